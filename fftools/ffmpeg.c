@@ -136,6 +136,8 @@ static int nb_frames_dup = 0;
 static unsigned dup_warning = 1000;
 static int nb_frames_drop = 0;
 static int64_t decode_error_stat[2];
+/* protects the counters above from the stage threads */
+static AVMutex stats_lock = AV_MUTEX_INITIALIZER;
 
 static int want_sdp = 1;
 
@@ -166,6 +168,12 @@ static int restore_tty;
 
 #if HAVE_THREADS
 static void free_input_threads(void);
+static void free_mux_threads(void);
+
+/* set while the stage threads run */
+static atomic_int stage_threads_running;
+/* time the main thread spent waiting on full decoder or filter queues */
+static int64_t main_stall;
 #endif
 
 /* sub2video hack:
@@ -484,6 +492,15 @@ static void ffmpeg_cleanup(int ret)
 {
     int i, j;
 
+#if HAVE_THREADS
+    /* a fatal error while the stage threads run: they may still use any of
+     * what follows, so only restore the terminal and let exit() do the rest */
+    if (atomic_load(&stage_threads_running)) {
+        term_exit();
+        return;
+    }
+#endif
+
     if (do_benchmark) {
         int maxrss = getmaxrss() / 1024;
         av_log(NULL, AV_LOG_INFO, "bench: maxrss=%ikB\n", maxrss);
@@ -523,6 +540,9 @@ static void ffmpeg_cleanup(int ret)
         }
         av_freep(&fg->outputs);
         av_freep(&fg->graph_desc);
+#if HAVE_THREADS
+        av_thread_message_queue_free(&fg->queue);
+#endif
 
         av_freep(&filtergraphs[i]);
     }
@@ -530,6 +550,10 @@ static void ffmpeg_cleanup(int ret)
 
     av_freep(&subtitle_out);
 
+#if HAVE_THREADS
+    free_mux_threads();
+#endif
+
     /* close files */
     for (i = 0; i < nb_output_files; i++) {
         OutputFile *of = output_files[i];
@@ -541,6 +565,7 @@ static void ffmpeg_cleanup(int ret)
             avio_closep(&s->pb);
         avformat_free_context(s);
         av_dict_free(&of->opts);
+        ff_mutex_destroy(&of->lock);
 
         av_freep(&output_files[i]);
     }
@@ -579,6 +604,9 @@ static void ffmpeg_cleanup(int ret)
             }
             av_fifo_freep(&ost->muxing_queue);
         }
+#if HAVE_THREADS
+        av_thread_message_queue_free(&ost->enc_queue);
+#endif
 
         av_freep(&output_streams[i]);
     }
@@ -600,6 +628,12 @@ static void ffmpeg_cleanup(int ret)
         av_freep(&ist->filters);
         av_freep(&ist->hwaccel_device);
         av_freep(&ist->dts_buffer);
+#if HAVE_THREADS
+        if (ist->dec_queue)
+            ff_mutex_destroy(&ist->dec_lock);
+        av_thread_message_queue_free(&ist->dec_queue);
+        av_thread_message_queue_free(&ist->dec_flushed);
+#endif
 
         avcodec_free_context(&ist->dec_ctx);
 
@@ -682,8 +716,222 @@ static void close_all_output_streams(OutputStream *ost, OSTFinished this_stream,
     int i;
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost2 = output_streams[i];
-        ost2->finished |= ost == ost2 ? this_stream : others;
+        atomic_fetch_or(&ost2->finished, ost == ost2 ? this_stream : others);
+    }
+}
+
+#if HAVE_THREADS
+typedef struct MuxMessage {
+    AVPacket pkt;
+    /* field order of the stream when the packet was queued */
+    enum AVFieldOrder field_order;
+} MuxMessage;
+
+/* messages of the stage threads, see -stage_threads */
+typedef struct DecoderMessage {
+    AVPacket pkt;
+    /* 1 to drain the decoder and send EOF to the filters,
+     * 2 to drain and flush it for -stream_loop */
+    int eof;
+} DecoderMessage;
+
+typedef struct FilterMessage {
+    AVFrame *frame;         /* NULL at EOF */
+    int64_t pts;            /* EOF timestamp */
+} FilterMessage;
+
+typedef struct EncoderMessage {
+    AVFrame *frame;         /* NULL to flush the video sync code, or at EOF */
+    double float_pts;
+    AVRational frame_rate;
+    int eof;
+} EncoderMessage;
+
+/* send a message to a thread, adding the time spent waiting for room in
+ * its queue to *stall */
+static int send_thread_message(AVThreadMessageQueue *queue, void *msg, int64_t *stall)
+{
+    int64_t t;
+    int ret;
+
+    ret = av_thread_message_queue_send(queue, msg, AV_THREAD_MESSAGE_NONBLOCK);
+    if (ret == AVERROR(EAGAIN)) {
+        t = av_gettime_relative();
+        ret = av_thread_message_queue_send(queue, msg, 0);
+        *stall += av_gettime_relative() - t;
+    }
+    return ret;
+}
+
+/* make the muxer state of the streams visible to the other threads */
+static void publish_mux_state(OutputFile *of)
+{
+    int i;
+
+    for (i = 0; i < of->ctx->nb_streams; i++) {
+        OutputStream *ost = output_streams[of->ost_index + i];
+        atomic_store(&ost->mux_cur_dts, ost->st->cur_dts);
+        atomic_store(&ost->mux_end_pts, av_stream_get_end_pts(ost->st));
+    }
+}
+
+static void *mux_thread(void *arg)
+{
+    OutputFile *of = arg;
+    int ret = 0;
+
+    while (1) {
+        MuxMessage msg;
+        AVStream *st;
+        int64_t t;
+
+        ret = av_thread_message_queue_recv(of->mux_queue, &msg, 0);
+        if (ret < 0)
+            break;
+
+        st = of->ctx->streams[msg.pkt.stream_index];
+        st->codecpar->field_order = msg.field_order;
+
+        t = av_gettime_relative();
+        ret = av_interleaved_write_frame(of->ctx, &msg.pkt);
+        of->mux_busy += av_gettime_relative() - t;
+        av_packet_unref(&msg.pkt);
+        publish_mux_state(of);
+        if (of->ctx->pb)
+            atomic_store(&of->mux_size, avio_tell(of->ctx->pb));
+        if (ret < 0) {
+            print_error("av_interleaved_write_frame()", ret);
+            of->mux_error = ret;
+            av_thread_message_queue_set_err_send(of->mux_queue, ret);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int init_mux_thread(OutputFile *of)
+{
+    int ret;
+
+    if (!of->thread_queue_size)
+        return 0;
+
+    ret = av_thread_message_queue_alloc(&of->mux_queue,
+                                        of->thread_queue_size, sizeof(MuxMessage));
+    if (ret < 0)
+        return ret;
+
+    publish_mux_state(of);
+    if ((ret = pthread_create(&of->mux_thread, NULL, mux_thread, of))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        av_thread_message_queue_free(&of->mux_queue);
+        return AVERROR(ret);
     }
+
+    return 0;
+}
+
+/* wait until all queued packets have been written and join the thread */
+static void free_mux_thread(OutputFile *of)
+{
+    MuxMessage msg;
+
+    if (!of || !of->mux_queue)
+        return;
+    av_thread_message_queue_set_err_recv(of->mux_queue, AVERROR_EOF);
+    pthread_join(of->mux_thread, NULL);
+    /* packets left behind by a failing muxer */
+    while (av_thread_message_queue_recv(of->mux_queue, &msg, 0) >= 0)
+        av_packet_unref(&msg.pkt);
+    av_thread_message_queue_free(&of->mux_queue);
+
+    if (of->mux_error < 0)
+        main_return_code = 1;
+}
+
+static void free_mux_threads(void)
+{
+    int i;
+
+    for (i = 0; i < nb_output_files; i++)
+        free_mux_thread(output_files[i]);
+}
+
+static int send_mux_packet(OutputFile *of, OutputStream *ost, AVPacket *pkt)
+{
+    MuxMessage msg;
+    int64_t stall = 0;
+    int ret;
+
+    ret = av_packet_make_refcounted(pkt);
+    if (ret < 0)
+        return ret;
+    av_packet_move_ref(&msg.pkt, pkt);
+    msg.field_order = ost->field_order;
+
+    ret = send_thread_message(of->mux_queue, &msg, &stall);
+    of->send_stall += stall;
+    ost->enc_stall += stall;
+    if (ret < 0)
+        av_packet_unref(&msg.pkt);
+    return ret;
+}
+#endif
+
+/* the AVStream belongs to the muxer thread if there is one, so use the
+ * values it published instead */
+static int64_t output_stream_cur_dts(OutputStream *ost)
+{
+#if HAVE_THREADS
+    if (output_files[ost->file_index]->thread_queue_size)
+        return atomic_load(&ost->mux_cur_dts);
+#endif
+    return ost->st->cur_dts;
+}
+
+static int64_t output_stream_end_pts(OutputStream *ost)
+{
+#if HAVE_THREADS
+    if (output_files[ost->file_index]->thread_queue_size)
+        return atomic_load(&ost->mux_end_pts);
+#endif
+    return av_stream_get_end_pts(ost->st);
+}
+
+/* whether the filtergraph and encoder of ost run on stage threads */
+static int output_stream_threaded(OutputStream *ost)
+{
+#if HAVE_THREADS
+    return !!ost->enc_queue;
+#else
+    return 0;
+#endif
+}
+
+/* the AVIOContext belongs to the muxer thread if there is one, so use the
+ * position it published instead of touching the context from here */
+static int64_t output_file_tell(OutputFile *of)
+{
+#if HAVE_THREADS
+    if (of->mux_queue)
+        return atomic_load(&of->mux_size);
+#endif
+    return avio_tell(of->ctx->pb);
+}
+
+static int64_t output_file_size(OutputFile *of)
+{
+    int64_t size;
+
+#if HAVE_THREADS
+    if (of->mux_queue)
+        return of->ctx->pb ? atomic_load(&of->mux_size) : AVERROR(EINVAL);
+#endif
+    size = avio_size(of->ctx->pb);
+    if (size <= 0) // FIXME improve avio_size() so it works with non seekable output too
+        size = avio_tell(of->ctx->pb);
+    return size;
 }
 
 static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int unqueue)
@@ -812,6 +1060,18 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
               );
     }
 
+#if HAVE_THREADS
+    if (of->mux_queue) {
+        /* write errors are reported by the muxer thread */
+        ret = send_mux_packet(of, ost, pkt);
+        if (ret < 0) {
+            main_return_code = 1;
+            close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
+        }
+        return;
+    }
+#endif
+
     ret = av_interleaved_write_frame(s, pkt);
     if (ret < 0) {
         print_error("av_interleaved_write_frame()", ret);
@@ -825,7 +1085,7 @@ static void close_output_stream(OutputStream *ost)
 {
     OutputFile *of = output_files[ost->file_index];
 
-    ost->finished |= ENCODER_FINISHED;
+    atomic_fetch_or(&ost->finished, ENCODER_FINISHED);
     if (of->shortest) {
         int64_t end = av_rescale_q(ost->sync_opts - ost->first_pts, ost->enc_ctx->time_base, AV_TIME_BASE_Q);
         of->recording_time = FFMIN(of->recording_time, end);
@@ -848,6 +1108,8 @@ static void output_packet(OutputFile *of, AVPacket *pkt,
 {
     int ret = 0;
 
+    ff_mutex_lock(&of->lock);
+
     /* apply the output bitstream filters, if any */
     if (ost->nb_bitstream_filters) {
         int idx;
@@ -886,6 +1148,7 @@ static void output_packet(OutputFile *of, AVPacket *pkt,
         write_packet(of, pkt, ost, 0);
 
 finish:
+    ff_mutex_unlock(&of->lock);
     if (ret < 0 && ret != AVERROR_EOF) {
         av_log(NULL, AV_LOG_ERROR, "Error applying bitstream filters to an output "
                "packet for stream #%d:%d.\n", ost->file_index, ost->index);
@@ -1053,24 +1316,22 @@ static void do_subtitle_out(OutputFile *of,
 static void do_video_out(OutputFile *of,
                          OutputStream *ost,
                          AVFrame *next_picture,
-                         double sync_ipts)
+                         double sync_ipts,
+                         AVRational frame_rate)
 {
     int ret, format_video_sync;
     AVPacket pkt;
     AVCodecContext *enc = ost->enc_ctx;
     AVCodecParameters *mux_par = ost->st->codecpar;
-    AVRational frame_rate;
     int nb_frames, nb0_frames, i;
     double delta, delta0;
     double duration = 0;
     int frame_size = 0;
     InputStream *ist = NULL;
-    AVFilterContext *filter = ost->filter->filter;
 
     if (ost->source_index >= 0)
         ist = input_streams[ost->source_index];
 
-    frame_rate = av_buffersink_get_frame_rate(filter);
     if (frame_rate.num > 0 && frame_rate.den > 0)
         duration = 1/(av_q2d(frame_rate) * av_q2d(enc->time_base));
 
@@ -1172,6 +1433,7 @@ static void do_video_out(OutputFile *of,
             sizeof(ost->last_nb0_frames[0]) * (FF_ARRAY_ELEMS(ost->last_nb0_frames) - 1));
     ost->last_nb0_frames[0] = nb0_frames;
 
+    ff_mutex_lock(&stats_lock);
     if (nb0_frames == 0 && ost->last_dropped) {
         nb_frames_drop++;
         av_log(NULL, AV_LOG_VERBOSE,
@@ -1182,6 +1444,7 @@ static void do_video_out(OutputFile *of,
         if (nb_frames > dts_error_threshold * 30) {
             av_log(NULL, AV_LOG_ERROR, "%d frame duplication too large, skipping\n", nb_frames - 1);
             nb_frames_drop++;
+            ff_mutex_unlock(&stats_lock);
             return;
         }
         nb_frames_dup += nb_frames - (nb0_frames && ost->last_dropped) - (nb_frames > nb0_frames);
@@ -1191,6 +1454,7 @@ static void do_video_out(OutputFile *of,
             dup_warning *= 10;
         }
     }
+    ff_mutex_unlock(&stats_lock);
     ost->last_dropped = nb_frames == nb0_frames && next_picture;
 
     /* duplicates frame if needed */
@@ -1221,11 +1485,18 @@ static void do_video_out(OutputFile *of,
 
         if (in_picture->interlaced_frame) {
             if (enc->codec->id == AV_CODEC_ID_MJPEG)
-                mux_par->field_order = in_picture->top_field_first ? AV_FIELD_TT:AV_FIELD_BB;
+                ost->field_order = in_picture->top_field_first ? AV_FIELD_TT:AV_FIELD_BB;
             else
-                mux_par->field_order = in_picture->top_field_first ? AV_FIELD_TB:AV_FIELD_BT;
+                ost->field_order = in_picture->top_field_first ? AV_FIELD_TB:AV_FIELD_BT;
         } else
-            mux_par->field_order = AV_FIELD_PROGRESSIVE;
+            ost->field_order = AV_FIELD_PROGRESSIVE;
+        /* a muxer thread gets it along with the packets */
+        ff_mutex_lock(&of->lock);
+#if HAVE_THREADS
+        if (!of->mux_queue)
+#endif
+            mux_par->field_order = ost->field_order;
+        ff_mutex_unlock(&of->lock);
 
         in_picture->quality = enc->global_quality;
         in_picture->pict_type = 0;
@@ -1330,7 +1601,9 @@ static void do_video_out(OutputFile *of,
          * But there may be reordering, so we can't throw away frames on encoder
          * flush, we need to limit them here, before they go into encoder.
          */
+        ff_mutex_lock(&of->lock);
         ost->frame_number++;
+        ff_mutex_unlock(&of->lock);
 
         if (vstats_filename && frame_size)
             do_video_stats(ost, frame_size);
@@ -1386,7 +1659,7 @@ static void do_video_stats(OutputStream *ost, int frame_size)
 
         fprintf(vstats_file,"f_size= %6d ", frame_size);
         /* compute pts value */
-        ti1 = av_stream_get_end_pts(ost->st) * av_q2d(ost->st->time_base);
+        ti1 = output_stream_end_pts(ost) * av_q2d(ost->st->time_base);
         if (ti1 < 0.01)
             ti1 = 0.01;
 
@@ -1399,125 +1672,203 @@ static void do_video_stats(OutputStream *ost, int frame_size)
 }
 
 static int init_output_stream(OutputStream *ost, char *error, int error_len);
+static InputStream *get_input_stream(OutputStream *ost);
+
+/* dec_ctx belongs to the decoder thread of the stream if it has one, the
+ * other threads only look at it with dec_lock held */
+static void lock_decoder(InputStream *ist)
+{
+#if HAVE_THREADS
+    if (ist && ist->dec_queue)
+        ff_mutex_lock(&ist->dec_lock);
+#endif
+}
+
+static void unlock_decoder(InputStream *ist)
+{
+#if HAVE_THREADS
+    if (ist && ist->dec_queue)
+        ff_mutex_unlock(&ist->dec_lock);
+#endif
+}
 
 static void finish_output_stream(OutputStream *ost)
 {
     OutputFile *of = output_files[ost->file_index];
     int i;
 
-    ost->finished = ENCODER_FINISHED | MUXER_FINISHED;
+    atomic_store(&ost->finished, ENCODER_FINISHED | MUXER_FINISHED);
 
     if (of->shortest) {
         for (i = 0; i < of->ctx->nb_streams; i++)
-            output_streams[of->ost_index + i]->finished = ENCODER_FINISHED | MUXER_FINISHED;
+            atomic_store(&output_streams[of->ost_index + i]->finished,
+                         ENCODER_FINISHED | MUXER_FINISHED);
+    }
+}
+
+static void encode_frame(OutputFile *of, OutputStream *ost, AVFrame *frame,
+                         double float_pts, AVRational frame_rate)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+
+    switch (enc->codec_type) {
+    case AVMEDIA_TYPE_VIDEO:
+        if (!ost->frame_aspect_ratio.num)
+            enc->sample_aspect_ratio = frame->sample_aspect_ratio;
+
+        if (debug_ts) {
+            av_log(NULL, AV_LOG_INFO, "filter -> pts:%s pts_time:%s exact:%f time_base:%d/%d\n",
+                    av_ts2str(frame->pts), av_ts2timestr(frame->pts, &enc->time_base),
+                    float_pts,
+                    enc->time_base.num, enc->time_base.den);
+        }
+
+        do_video_out(of, ost, frame, float_pts, frame_rate);
+        break;
+    case AVMEDIA_TYPE_AUDIO:
+        if (!(enc->codec->capabilities & AV_CODEC_CAP_PARAM_CHANGE) &&
+            enc->channels != frame->channels) {
+            av_log(NULL, AV_LOG_ERROR,
+                   "Audio filter graph output is not normalized and encoder does not support parameter changes\n");
+            break;
+        }
+        do_audio_out(of, ost, frame);
+        break;
+    default:
+        // TODO support subtitle filters
+        av_assert0(0);
+    }
+}
+
+/* encode a filtered frame, or with frame == NULL flush the video sync code,
+ * here or on the encoder thread of the stream */
+static void output_frame(OutputFile *of, OutputStream *ost, AVFrame *frame,
+                         double float_pts, AVRational frame_rate)
+{
+#if HAVE_THREADS
+    if (ost->enc_queue) {
+        EncoderMessage msg = { NULL, float_pts, frame_rate };
+
+        if (frame) {
+            if (!(msg.frame = av_frame_alloc()))
+                exit_program(1);
+            av_frame_move_ref(msg.frame, frame);
+        }
+        if (send_thread_message(ost->enc_queue, &msg, &ost->filter->graph->stall) < 0) {
+            av_frame_free(&msg.frame);
+            exit_program(1);
+        }
+        return;
     }
+#endif
+    if (frame) {
+        encode_frame(of, ost, frame, float_pts, frame_rate);
+        av_frame_unref(frame);
+    } else
+        do_video_out(of, ost, NULL, AV_NOPTS_VALUE, frame_rate);
 }
 
 /**
- * Get and encode new output from any of the filtergraphs, without causing
- * activity.
+ * Get and encode new output from the filtergraph of an output stream,
+ * without causing activity.
  *
  * @return  0 for success, <0 for severe errors
  */
-static int reap_filters(int flush)
+static int reap_filter(OutputStream *ost, int flush)
 {
-    AVFrame *filtered_frame = NULL;
-    int i;
+    OutputFile    *of = output_files[ost->file_index];
+    AVFilterContext *filter;
+    AVCodecContext *enc = ost->enc_ctx;
+    AVFrame *filtered_frame;
+    int ret = 0;
 
-    /* Reap all buffers present in the buffer sinks */
-    for (i = 0; i < nb_output_streams; i++) {
-        OutputStream *ost = output_streams[i];
-        OutputFile    *of = output_files[ost->file_index];
-        AVFilterContext *filter;
-        AVCodecContext *enc = ost->enc_ctx;
-        int ret = 0;
+    if (!ost->filter || !ost->filter->graph->graph)
+        return 0;
+    filter = ost->filter->filter;
+
+    if (!ost->initialized) {
+        InputStream *ist = get_input_stream(ost);
+        char error[1024] = "";
+        lock_decoder(ist);
+        ret = init_output_stream(ost, error, sizeof(error));
+        unlock_decoder(ist);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error initializing output stream %d:%d -- %s\n",
+                   ost->file_index, ost->index, error);
+            exit_program(1);
+        }
+    }
 
-        if (!ost->filter || !ost->filter->graph->graph)
-            continue;
-        filter = ost->filter->filter;
+    if (!ost->filtered_frame && !(ost->filtered_frame = av_frame_alloc())) {
+        return AVERROR(ENOMEM);
+    }
+    filtered_frame = ost->filtered_frame;
 
-        if (!ost->initialized) {
-            char error[1024] = "";
-            ret = init_output_stream(ost, error, sizeof(error));
-            if (ret < 0) {
-                av_log(NULL, AV_LOG_ERROR, "Error initializing output stream %d:%d -- %s\n",
-                       ost->file_index, ost->index, error);
-                exit_program(1);
+    while (1) {
+        double float_pts = AV_NOPTS_VALUE; // this is identical to filtered_frame.pts but with higher precision
+        ret = av_buffersink_get_frame_flags(filter, filtered_frame,
+                                           AV_BUFFERSINK_FLAG_NO_REQUEST);
+        if (ret < 0) {
+            if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+                av_log(NULL, AV_LOG_WARNING,
+                       "Error in av_buffersink_get_frame_flags(): %s\n", av_err2str(ret));
+            } else if (flush && ret == AVERROR_EOF) {
+                if (av_buffersink_get_type(filter) == AVMEDIA_TYPE_VIDEO)
+                    output_frame(of, ost, NULL, AV_NOPTS_VALUE,
+                                 av_buffersink_get_frame_rate(filter));
             }
+            break;
         }
+        if (atomic_load(&ost->finished)) {
+            av_frame_unref(filtered_frame);
+            continue;
+        }
+        if (filtered_frame->pts != AV_NOPTS_VALUE) {
+            int64_t start_time = (of->start_time == AV_NOPTS_VALUE) ? 0 : of->start_time;
+            AVRational filter_tb = av_buffersink_get_time_base(filter);
+            AVRational tb = enc->time_base;
+            int extra_bits = av_clip(29 - av_log2(tb.den), 0, 16);
 
-        if (!ost->filtered_frame && !(ost->filtered_frame = av_frame_alloc())) {
-            return AVERROR(ENOMEM);
+            tb.den <<= extra_bits;
+            float_pts =
+                av_rescale_q(filtered_frame->pts, filter_tb, tb) -
+                av_rescale_q(start_time, AV_TIME_BASE_Q, tb);
+            float_pts /= 1 << extra_bits;
+            // avoid exact midoints to reduce the chance of rounding differences, this can be removed in case the fps code is changed to work with integers
+            float_pts += FFSIGN(float_pts) * 1.0 / (1<<17);
+
+            filtered_frame->pts =
+                av_rescale_q(filtered_frame->pts, filter_tb, enc->time_base) -
+                av_rescale_q(start_time, AV_TIME_BASE_Q, enc->time_base);
         }
-        filtered_frame = ost->filtered_frame;
 
-        while (1) {
-            double float_pts = AV_NOPTS_VALUE; // this is identical to filtered_frame.pts but with higher precision
-            ret = av_buffersink_get_frame_flags(filter, filtered_frame,
-                                               AV_BUFFERSINK_FLAG_NO_REQUEST);
-            if (ret < 0) {
-                if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
-                    av_log(NULL, AV_LOG_WARNING,
-                           "Error in av_buffersink_get_frame_flags(): %s\n", av_err2str(ret));
-                } else if (flush && ret == AVERROR_EOF) {
-                    if (av_buffersink_get_type(filter) == AVMEDIA_TYPE_VIDEO)
-                        do_video_out(of, ost, NULL, AV_NOPTS_VALUE);
-                }
-                break;
-            }
-            if (ost->finished) {
-                av_frame_unref(filtered_frame);
-                continue;
-            }
-            if (filtered_frame->pts != AV_NOPTS_VALUE) {
-                int64_t start_time = (of->start_time == AV_NOPTS_VALUE) ? 0 : of->start_time;
-                AVRational filter_tb = av_buffersink_get_time_base(filter);
-                AVRational tb = enc->time_base;
-                int extra_bits = av_clip(29 - av_log2(tb.den), 0, 16);
-
-                tb.den <<= extra_bits;
-                float_pts =
-                    av_rescale_q(filtered_frame->pts, filter_tb, tb) -
-                    av_rescale_q(start_time, AV_TIME_BASE_Q, tb);
-                float_pts /= 1 << extra_bits;
-                // avoid exact midoints to reduce the chance of rounding differences, this can be removed in case the fps code is changed to work with integers
-                float_pts += FFSIGN(float_pts) * 1.0 / (1<<17);
-
-                filtered_frame->pts =
-                    av_rescale_q(filtered_frame->pts, filter_tb, enc->time_base) -
-                    av_rescale_q(start_time, AV_TIME_BASE_Q, enc->time_base);
-            }
+        output_frame(of, ost, filtered_frame, float_pts,
+                     av_buffersink_get_frame_rate(filter));
+    }
 
-            switch (av_buffersink_get_type(filter)) {
-            case AVMEDIA_TYPE_VIDEO:
-                if (!ost->frame_aspect_ratio.num)
-                    enc->sample_aspect_ratio = filtered_frame->sample_aspect_ratio;
+    return 0;
+}
 
-                if (debug_ts) {
-                    av_log(NULL, AV_LOG_INFO, "filter -> pts:%s pts_time:%s exact:%f time_base:%d/%d\n",
-                            av_ts2str(filtered_frame->pts), av_ts2timestr(filtered_frame->pts, &enc->time_base),
-                            float_pts,
-                            enc->time_base.num, enc->time_base.den);
-                }
+/**
+ * Get and encode new output from any of the filtergraphs, without causing
+ * activity.
+ *
+ * @return  0 for success, <0 for severe errors
+ */
+static int reap_filters(int flush)
+{
+    int i, ret;
 
-                do_video_out(of, ost, filtered_frame, float_pts);
-                break;
-            case AVMEDIA_TYPE_AUDIO:
-                if (!(enc->codec->capabilities & AV_CODEC_CAP_PARAM_CHANGE) &&
-                    enc->channels != filtered_frame->channels) {
-                    av_log(NULL, AV_LOG_ERROR,
-                           "Audio filter graph output is not normalized and encoder does not support parameter changes\n");
-                    break;
-                }
-                do_audio_out(of, ost, filtered_frame);
-                break;
-            default:
-                // TODO support subtitle filters
-                av_assert0(0);
-            }
+    /* Reap all buffers present in the buffer sinks */
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
 
-            av_frame_unref(filtered_frame);
-        }
+        /* reaped by the thread of its filtergraph */
+        if (output_stream_threaded(ost))
+            continue;
+        ret = reap_filter(ost, flush);
+        if (ret < 0)
+            return ret;
     }
 
     return 0;
@@ -1644,7 +1995,6 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
 {
     AVBPrint buf, buf_script;
     OutputStream *ost;
-    AVFormatContext *oc;
     int64_t total_size;
     AVCodecContext *enc;
     int frame_number, vid, i;
@@ -1674,19 +2024,19 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
     t = (cur_time-timer_start) / 1000000.0;
 
 
-    oc = output_files[0]->ctx;
-
-    total_size = avio_size(oc->pb);
-    if (total_size <= 0) // FIXME improve avio_size() so it works with non seekable output too
-        total_size = avio_tell(oc->pb);
+    total_size = output_file_size(output_files[0]);
 
     vid = 0;
     av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
     av_bprint_init(&buf_script, 0, AV_BPRINT_SIZE_AUTOMATIC);
     for (i = 0; i < nb_output_streams; i++) {
+        OutputFile *of;
         float q = -1;
         ost = output_streams[i];
+        of  = output_files[ost->file_index];
         enc = ost->enc_ctx;
+        /* the stats are updated by the threads encoding the file */
+        ff_mutex_lock(&of->lock);
         if (!ost->stream_copy)
             q = ost->quality / (float) FF_QP2LAMBDA;
 
@@ -1749,9 +2099,10 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
             vid = 1;
         }
         /* compute min output value */
-        if (av_stream_get_end_pts(ost->st) != AV_NOPTS_VALUE)
-            pts = FFMAX(pts, av_rescale_q(av_stream_get_end_pts(ost->st),
+        if (output_stream_end_pts(ost) != AV_NOPTS_VALUE)
+            pts = FFMAX(pts, av_rescale_q(output_stream_end_pts(ost),
                                           ost->st->time_base, AV_TIME_BASE_Q));
+        ff_mutex_unlock(&of->lock);
         if (is_last_report)
             nb_frames_drop += ost->last_dropped;
     }
@@ -1797,10 +2148,12 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
                    hours_sign, hours, mins, secs, us);
     }
 
+    ff_mutex_lock(&stats_lock);
     if (nb_frames_dup || nb_frames_drop)
         av_bprintf(&buf, " dup=%d drop=%d", nb_frames_dup, nb_frames_drop);
     av_bprintf(&buf_script, "dup_frames=%d\n", nb_frames_dup);
     av_bprintf(&buf_script, "drop_frames=%d\n", nb_frames_drop);
+    ff_mutex_unlock(&stats_lock);
 
     if (speed < 0) {
         av_bprintf(&buf, " speed=N/A");
@@ -1852,122 +2205,142 @@ static void ifilter_parameters_from_codecpar(InputFilter *ifilter, AVCodecParame
     ifilter->sample_aspect_ratio    = par->sample_aspect_ratio;
 }
 
-static void flush_encoders(void)
+/*
+ * Try to enable encoding with no input frames.
+ * Maybe we should just let encoding fail instead.
+ *
+ * Return 0 if the formats of the filtergraph inputs are still unknown.
+ */
+static int init_output_stream_without_frames(OutputStream *ost)
 {
-    int i, ret;
-
-    for (i = 0; i < nb_output_streams; i++) {
-        OutputStream   *ost = output_streams[i];
-        AVCodecContext *enc = ost->enc_ctx;
-        OutputFile      *of = output_files[ost->file_index];
-
-        if (!ost->encoding_needed)
-            continue;
+    FilterGraph *fg = ost->filter->graph;
+    char error[1024] = "";
+    int ret;
 
-        // Try to enable encoding with no input frames.
-        // Maybe we should just let encoding fail instead.
-        if (!ost->initialized) {
-            FilterGraph *fg = ost->filter->graph;
-            char error[1024] = "";
+    av_log(NULL, AV_LOG_WARNING,
+           "Finishing stream %d:%d without any data written to it.\n",
+           ost->file_index, ost->st->index);
 
-            av_log(NULL, AV_LOG_WARNING,
-                   "Finishing stream %d:%d without any data written to it.\n",
-                   ost->file_index, ost->st->index);
+    if (ost->filter && !fg->graph) {
+        int x;
+        for (x = 0; x < fg->nb_inputs; x++) {
+            InputFilter *ifilter = fg->inputs[x];
+            if (ifilter->format < 0)
+                ifilter_parameters_from_codecpar(ifilter, ifilter->ist->st->codecpar);
+        }
 
-            if (ost->filter && !fg->graph) {
-                int x;
-                for (x = 0; x < fg->nb_inputs; x++) {
-                    InputFilter *ifilter = fg->inputs[x];
-                    if (ifilter->format < 0)
-                        ifilter_parameters_from_codecpar(ifilter, ifilter->ist->st->codecpar);
-                }
+        if (!ifilter_has_all_input_formats(fg))
+            return 0;
 
-                if (!ifilter_has_all_input_formats(fg))
-                    continue;
-
-                ret = configure_filtergraph(fg);
-                if (ret < 0) {
-                    av_log(NULL, AV_LOG_ERROR, "Error configuring filter graph\n");
-                    exit_program(1);
-                }
+        ret = configure_filtergraph(fg);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error configuring filter graph\n");
+            exit_program(1);
+        }
 
-                finish_output_stream(ost);
-            }
+        finish_output_stream(ost);
+    }
 
-            ret = init_output_stream(ost, error, sizeof(error));
-            if (ret < 0) {
-                av_log(NULL, AV_LOG_ERROR, "Error initializing output stream %d:%d -- %s\n",
-                       ost->file_index, ost->index, error);
-                exit_program(1);
-            }
-        }
+    ret = init_output_stream(ost, error, sizeof(error));
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Error initializing output stream %d:%d -- %s\n",
+               ost->file_index, ost->index, error);
+        exit_program(1);
+    }
+    return 1;
+}
 
-        if (enc->codec_type == AVMEDIA_TYPE_AUDIO && enc->frame_size <= 1)
-            continue;
+static void flush_encoder(OutputStream *ost)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+    OutputFile      *of = output_files[ost->file_index];
+    int ret;
 
-        if (enc->codec_type != AVMEDIA_TYPE_VIDEO && enc->codec_type != AVMEDIA_TYPE_AUDIO)
-            continue;
+    if (enc->codec_type == AVMEDIA_TYPE_AUDIO && enc->frame_size <= 1)
+        return;
 
-        for (;;) {
-            const char *desc = NULL;
-            AVPacket pkt;
-            int pkt_size;
+    if (enc->codec_type != AVMEDIA_TYPE_VIDEO && enc->codec_type != AVMEDIA_TYPE_AUDIO)
+        return;
 
-            switch (enc->codec_type) {
-            case AVMEDIA_TYPE_AUDIO:
-                desc   = "audio";
-                break;
-            case AVMEDIA_TYPE_VIDEO:
-                desc   = "video";
-                break;
-            default:
-                av_assert0(0);
-            }
+    for (;;) {
+        const char *desc = NULL;
+        AVPacket pkt;
+        int pkt_size;
 
-            av_init_packet(&pkt);
-            pkt.data = NULL;
-            pkt.size = 0;
+        switch (enc->codec_type) {
+        case AVMEDIA_TYPE_AUDIO:
+            desc   = "audio";
+            break;
+        case AVMEDIA_TYPE_VIDEO:
+            desc   = "video";
+            break;
+        default:
+            av_assert0(0);
+        }
 
-            update_benchmark(NULL);
+        av_init_packet(&pkt);
+        pkt.data = NULL;
+        pkt.size = 0;
 
-            while ((ret = avcodec_receive_packet(enc, &pkt)) == AVERROR(EAGAIN)) {
-                ret = avcodec_send_frame(enc, NULL);
-                if (ret < 0) {
-                    av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
-                           desc,
-                           av_err2str(ret));
-                    exit_program(1);
-                }
-            }
+        update_benchmark(NULL);
 
-            update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
-            if (ret < 0 && ret != AVERROR_EOF) {
+        while ((ret = avcodec_receive_packet(enc, &pkt)) == AVERROR(EAGAIN)) {
+            ret = avcodec_send_frame(enc, NULL);
+            if (ret < 0) {
                 av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
                        desc,
                        av_err2str(ret));
                 exit_program(1);
             }
-            if (ost->logfile && enc->stats_out) {
-                fprintf(ost->logfile, "%s", enc->stats_out);
-            }
-            if (ret == AVERROR_EOF) {
-                output_packet(of, &pkt, ost, 1);
-                break;
-            }
-            if (ost->finished & MUXER_FINISHED) {
-                av_packet_unref(&pkt);
-                continue;
-            }
-            av_packet_rescale_ts(&pkt, enc->time_base, ost->mux_timebase);
-            pkt_size = pkt.size;
-            output_packet(of, &pkt, ost, 0);
-            if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
-                do_video_stats(ost, pkt_size);
-            }
+        }
+
+        update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
+        if (ret < 0 && ret != AVERROR_EOF) {
+            av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
+                   desc,
+                   av_err2str(ret));
+            exit_program(1);
+        }
+        if (ost->logfile && enc->stats_out) {
+            fprintf(ost->logfile, "%s", enc->stats_out);
+        }
+        if (ret == AVERROR_EOF) {
+            output_packet(of, &pkt, ost, 1);
+            break;
+        }
+        if (atomic_load(&ost->finished) & MUXER_FINISHED) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+        av_packet_rescale_ts(&pkt, enc->time_base, ost->mux_timebase);
+        pkt_size = pkt.size;
+        output_packet(of, &pkt, ost, 0);
+        if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
+            do_video_stats(ost, pkt_size);
         }
     }
 }
 
+static void flush_encoders(void)
+{
+    int i;
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream   *ost = output_streams[i];
+
+        if (!ost->encoding_needed)
+            continue;
+        /* flushed by its encoder thread */
+        if (output_stream_threaded(ost))
+            continue;
+
+        if (!ost->initialized && !init_output_stream_without_frames(ost))
+            continue;
+
+        flush_encoder(ost);
+    }
+}
+
 /*
  * Check whether a packet from ist should be written into ost at this time
  */
@@ -1979,7 +2352,7 @@ static int check_output_constraints(InputStream *ist, OutputStream *ost)
     if (ost->source_index != ist_index)
         return 0;
 
-    if (ost->finished)
+    if (atomic_load(&ost->finished))
         return 0;
 
     if (of->start_time != AV_NOPTS_VALUE && ist->pts < of->start_time)
@@ -2097,8 +2470,11 @@ int guess_input_channel_layout(InputStream *ist)
 
 static void check_decode_result(InputStream *ist, int *got_output, int ret)
 {
-    if (*got_output || ret<0)
+    if (*got_output || ret<0) {
+        ff_mutex_lock(&stats_lock);
         decode_error_stat[ret<0] ++;
+        ff_mutex_unlock(&stats_lock);
+    }
 
     if (ret < 0 && exit_on_error)
         exit_program(1);
@@ -2179,13 +2555,20 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
             }
         }
 
+#if HAVE_THREADS
+        if (fg->queue)
+            ret = reap_filter(fg->outputs[0]->ost, 1);
+        else
+#endif
         ret = reap_filters(1);
         if (ret < 0 && ret != AVERROR_EOF) {
             av_log(NULL, AV_LOG_ERROR, "Error while filtering: %s\n", av_err2str(ret));
             return ret;
         }
 
+        lock_decoder(ifilter->ist);
         ret = configure_filtergraph(fg);
+        unlock_decoder(ifilter->ist);
         if (ret < 0) {
             av_log(NULL, AV_LOG_ERROR, "Error reinitializing filters!\n");
             return ret;
@@ -2252,6 +2635,29 @@ static int decode(AVCodecContext *avctx, AVFrame *frame, int *got_frame, AVPacke
     return 0;
 }
 
+/* feed a frame to a filtergraph, or to its filter thread if it has one */
+static int send_frame_to_filter(InputStream *ist, InputFilter *ifilter, AVFrame *frame)
+{
+#if HAVE_THREADS
+    FilterGraph *fg = ifilter->graph;
+
+    if (fg->queue) {
+        FilterMessage msg = { NULL };
+        int ret;
+
+        if (!(msg.frame = av_frame_alloc()))
+            return AVERROR(ENOMEM);
+        av_frame_move_ref(msg.frame, frame);
+        ret = send_thread_message(fg->queue, &msg,
+                                  ist->dec_queue ? &ist->dec_stall : &main_stall);
+        if (ret < 0)
+            av_frame_free(&msg.frame);
+        return ret;
+    }
+#endif
+    return ifilter_send_frame(ifilter, frame);
+}
+
 static int send_frame_to_filters(InputStream *ist, AVFrame *decoded_frame)
 {
     int i, ret;
@@ -2266,7 +2672,7 @@ static int send_frame_to_filters(InputStream *ist, AVFrame *decoded_frame)
                 break;
         } else
             f = decoded_frame;
-        ret = ifilter_send_frame(ist->filters[i], f);
+        ret = send_frame_to_filter(ist, ist->filters[i], f);
         if (ret == AVERROR_EOF)
             ret = 0; /* ignore */
         if (ret < 0) {
@@ -2293,7 +2699,9 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output,
     decoded_frame = ist->decoded_frame;
 
     update_benchmark(NULL);
+    lock_decoder(ist);
     ret = decode(avctx, decoded_frame, got_output, pkt);
+    unlock_decoder(ist);
     update_benchmark("decode_audio %d.%d", ist->file_index, ist->st->index);
     if (ret < 0)
         *decode_failed = 1;
@@ -2378,6 +2786,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
     }
 
     update_benchmark(NULL);
+    lock_decoder(ist);
     ret = decode(ist->dec_ctx, decoded_frame, got_output, pkt ? &avpkt : NULL);
     update_benchmark("decode_video %d.%d", ist->file_index, ist->st->index);
     if (ret < 0)
@@ -2397,6 +2806,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
                    ist->dec_ctx->has_b_frames,
                    ist->st->codecpar->video_delay);
     }
+    unlock_decoder(ist);
 
     if (ret != AVERROR_EOF)
         check_decode_result(ist, got_output, ret);
@@ -2558,6 +2968,22 @@ static int send_filter_eof(InputStream *ist)
                                    AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
 
     for (i = 0; i < ist->nb_filters; i++) {
+#if HAVE_THREADS
+        FilterGraph *fg = ist->filters[i]->graph;
+
+        if (fg->queue) {
+            FilterMessage msg = { NULL, pts };
+
+            if (fg->eof_sent)
+                continue;
+            ret = send_thread_message(fg->queue, &msg,
+                                      ist->dec_queue ? &ist->dec_stall : &main_stall);
+            if (ret < 0)
+                return ret;
+            fg->eof_sent = 1;
+            continue;
+        }
+#endif
         ret = ifilter_send_eof(ist->filters[i], pts);
         if (ret < 0)
             return ret;
@@ -2966,6 +3392,19 @@ static int compare_int64(const void *a, const void *b)
     return FFDIFFSIGN(*(const int64_t *)a, *(const int64_t *)b);
 }
 
+/* whether an encoder thread of the file may be encoding right now */
+static int output_file_has_stage_threads(OutputFile *of)
+{
+#if HAVE_THREADS
+    int i;
+
+    for (i = 0; i < of->ctx->nb_streams; i++)
+        if (output_streams[of->ost_index + i]->enc_queue)
+            return 1;
+#endif
+    return 0;
+}
+
 /* open the muxer when all the streams are initialized */
 static int check_init_output_file(OutputFile *of, int file_index)
 {
@@ -2990,6 +3429,12 @@ static int check_init_output_file(OutputFile *of, int file_index)
     //assert_avoptions(of->opts);
     of->header_written = 1;
 
+#if HAVE_THREADS
+    ret = init_mux_thread(of);
+    if (ret < 0)
+        return ret;
+#endif
+
     av_dump_format(of->ctx, file_index, of->ctx->url, 1);
 
     if (sdp_filename || want_sdp)
@@ -2999,8 +3444,9 @@ static int check_init_output_file(OutputFile *of, int file_index)
     for (i = 0; i < of->ctx->nb_streams; i++) {
         OutputStream *ost = output_streams[of->ost_index + i];
 
-        /* try to improve muxing time_base (only possible if nothing has been written yet) */
-        if (!av_fifo_size(ost->muxing_queue))
+        /* try to improve muxing time_base (only possible if nothing has been
+         * written yet, and no other thread is encoding with the old one) */
+        if (!av_fifo_size(ost->muxing_queue) && !output_file_has_stage_threads(of))
             ost->mux_timebase = ost->st->time_base;
 
         while (av_fifo_size(ost->muxing_queue)) {
@@ -3635,11 +4081,12 @@ static int init_output_stream(OutputStream *ost, char *error, int error_len)
     if (ret < 0)
         return ret;
 
-    ost->initialized = 1;
+    ost->field_order = ost->st->codecpar->field_order;
 
+    ff_mutex_lock(&output_files[ost->file_index]->lock);
+    ost->initialized = 1;
     ret = check_init_output_file(output_files[ost->file_index], ost->file_index);
-    if (ret < 0)
-        return ret;
+    ff_mutex_unlock(&output_files[ost->file_index]->lock);
 
     return ret;
 }
@@ -3841,9 +4288,12 @@ static int need_output(void)
         OutputFile *of       = output_files[ost->file_index];
         AVFormatContext *os  = output_files[ost->file_index]->ctx;
 
-        if (ost->finished ||
-            (os->pb && avio_tell(os->pb) >= of->limit_filesize))
+        if (atomic_load(&ost->finished) ||
+            (os->pb && output_file_tell(of) >= of->limit_filesize))
             continue;
+        /* -frames is never set for it, and frame_number is not ours */
+        if (output_stream_threaded(ost))
+            return 1;
         if (ost->frame_number >= ost->max_frames) {
             int j;
             for (j = 0; j < of->ctx->nb_streams; j++)
@@ -3870,16 +4320,29 @@ static OutputStream *choose_output(void)
 
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost = output_streams[i];
-        int64_t opts = ost->st->cur_dts == AV_NOPTS_VALUE ? INT64_MIN :
-                       av_rescale_q(ost->st->cur_dts, ost->st->time_base,
+        int64_t cur_dts = output_stream_cur_dts(ost);
+        int64_t opts = cur_dts == AV_NOPTS_VALUE ? INT64_MIN :
+                       av_rescale_q(cur_dts, ost->st->time_base,
                                     AV_TIME_BASE_Q);
-        if (ost->st->cur_dts == AV_NOPTS_VALUE)
+        if (cur_dts == AV_NOPTS_VALUE)
             av_log(NULL, AV_LOG_DEBUG, "cur_dts is invalid (this is harmless if it occurs once at the start per stream)\n");
 
-        if (!ost->initialized && !ost->inputs_done)
+        if (output_stream_threaded(ost)) {
+            OutputFile *of = output_files[ost->file_index];
+            int initialized;
+
+            /* all that is left to do for it happens on its stage threads */
+            if (input_files[ost->filter->graph->inputs[0]->ist->file_index]->eof_reached)
+                continue;
+            ff_mutex_lock(&of->lock);
+            initialized = ost->initialized;
+            ff_mutex_unlock(&of->lock);
+            if (!initialized)
+                return ost;
+        } else if (!ost->initialized && !ost->inputs_done)
             return ost;
 
-        if (!ost->finished && opts < opts_min) {
+        if (!atomic_load(&ost->finished) && opts < opts_min) {
             opts_min = opts;
             ost_min  = ost->unavailable ? NULL : ost;
         }
@@ -4017,6 +4480,417 @@ static int check_keyboard_interaction(int64_t cur_time)
 }
 
 #if HAVE_THREADS
+/* stage threads, see -stage_threads: the decoder of an input stream, a simple
+ * filtergraph and the encoder behind it each get a thread, joined by bounded
+ * message queues so that a slow stage holds back the ones feeding it */
+
+#define STAGE_QUEUE_SIZE 8
+
+static void free_decoder_message(void *msg)
+{
+    av_packet_unref(&((DecoderMessage *)msg)->pkt);
+}
+
+static void free_filter_message(void *msg)
+{
+    av_frame_free(&((FilterMessage *)msg)->frame);
+}
+
+static void free_encoder_message(void *msg)
+{
+    av_frame_free(&((EncoderMessage *)msg)->frame);
+}
+
+/* make the timestamps of ist visible to the main thread */
+static void publish_decoder_state(InputStream *ist)
+{
+    ff_mutex_lock(&ist->dec_lock);
+    ist->shared_dts      = ist->dts;
+    ist->shared_next_dts = ist->next_dts;
+    ist->shared_pts      = ist->pts;
+    ist->shared_next_pts = ist->next_pts;
+    ff_mutex_unlock(&ist->dec_lock);
+}
+
+/* queue a packet for the decoder thread of ist, or with pkt == NULL make it
+ * drain the decoder: eof is 1 at the end of the stream, 2 to flush it for
+ * -stream_loop */
+static int send_decoder_message(InputStream *ist, AVPacket *pkt, int eof)
+{
+    DecoderMessage msg = { { 0 } };
+    int ret;
+
+    if (pkt) {
+        ret = av_packet_make_refcounted(pkt);
+        if (ret < 0)
+            return ret;
+        av_packet_move_ref(&msg.pkt, pkt);
+    }
+    msg.eof = eof;
+    if (eof == 1)
+        ist->eof_sent = 1;
+
+    ret = send_thread_message(ist->dec_queue, &msg, &main_stall);
+    if (ret < 0)
+        av_packet_unref(&msg.pkt);
+    return ret;
+}
+
+static void *decoder_thread(void *arg)
+{
+    InputStream *ist = arg;
+    DecoderMessage msg;
+    int64_t t, stall;
+    int flushed = 1;
+
+    while (av_thread_message_queue_recv(ist->dec_queue, &msg, 0) >= 0) {
+        t     = av_gettime_relative();
+        stall = ist->dec_stall;
+
+        if (!msg.eof) {
+            process_input_packet(ist, &msg.pkt, 0);
+            av_packet_unref(&msg.pkt);
+        } else {
+            while (process_input_packet(ist, NULL, msg.eof == 2) > 0)
+                ;
+        }
+        if (msg.eof == 2) {
+            ff_mutex_lock(&ist->dec_lock);
+            avcodec_flush_buffers(ist->dec_ctx);
+            ff_mutex_unlock(&ist->dec_lock);
+        }
+        publish_decoder_state(ist);
+        ist->dec_busy += av_gettime_relative() - t - (ist->dec_stall - stall);
+
+        if (msg.eof == 2)
+            av_thread_message_queue_send(ist->dec_flushed, &flushed, 0);
+        else if (msg.eof)
+            break;
+    }
+
+    return NULL;
+}
+
+/* encode what the filtergraph of ost outputs without further input,
+ * return 1 once it is finished */
+static int drain_filtergraph(OutputStream *ost)
+{
+    FilterGraph *fg = ost->filter->graph;
+    int ret;
+
+    if (reap_filter(ost, 0) < 0)
+        exit_program(1);
+
+    while (!atomic_load(&ost->finished)) {
+        ret = avfilter_graph_request_oldest(fg->graph);
+        if (ret == AVERROR(EAGAIN))
+            return 0;
+        if (ret < 0 && ret != AVERROR_EOF) {
+            av_log(NULL, AV_LOG_ERROR, "Error while filtering: %s\n", av_err2str(ret));
+            exit_program(1);
+        }
+        if (reap_filter(ost, ret == AVERROR_EOF) < 0)
+            exit_program(1);
+        if (ret == AVERROR_EOF)
+            return 1;
+    }
+    return 1;
+}
+
+static void *filter_thread(void *arg)
+{
+    FilterGraph     *fg = arg;
+    InputFilter *ifilter = fg->inputs[0];
+    OutputStream   *ost = fg->outputs[0]->ost;
+    EncoderMessage  eof = { NULL, 0, { 0, 1 }, 1 };
+    FilterMessage   msg;
+    int64_t t, stall;
+    int ret, done = 0, eof_reached = 0;
+
+    while (av_thread_message_queue_recv(fg->queue, &msg, 0) >= 0) {
+        t     = av_gettime_relative();
+        stall = fg->stall;
+
+        eof_reached = !msg.frame;
+        if (msg.frame) {
+            if (!done) {
+                ret = ifilter_send_frame(ifilter, msg.frame);
+                if (ret < 0 && ret != AVERROR_EOF) {
+                    av_log(NULL, AV_LOG_ERROR,
+                           "Failed to inject frame into filter network: %s\n", av_err2str(ret));
+                    exit_program(1);
+                }
+                if (fg->graph)
+                    done = drain_filtergraph(ost);
+            }
+            av_frame_free(&msg.frame);
+        } else {
+            ret = ifilter_send_eof(ifilter, msg.pts);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_FATAL, "Error marking filters as finished\n");
+                exit_program(1);
+            }
+            if (!done && !fg->graph && ifilter_has_all_input_formats(fg)) {
+                lock_decoder(ifilter->ist);
+                ret = configure_filtergraph(fg);
+                unlock_decoder(ifilter->ist);
+                if (ret < 0) {
+                    av_log(NULL, AV_LOG_ERROR, "Error reinitializing filters!\n");
+                    exit_program(1);
+                }
+            }
+            if (!done && fg->graph)
+                drain_filtergraph(ost);
+        }
+        fg->busy += av_gettime_relative() - t - (fg->stall - stall);
+
+        if (eof_reached)
+            break;
+    }
+
+    if (send_thread_message(ost->enc_queue, &eof, &fg->stall) < 0)
+        exit_program(1);
+    return NULL;
+}
+
+/* the muxing queue of ost may also be flushed into the muxer thread by
+ * another stage thread, so enc_stall is only touched under the file lock */
+static int64_t encoder_stall(OutputFile *of, OutputStream *ost)
+{
+    int64_t stall;
+
+    ff_mutex_lock(&of->lock);
+    stall = ost->enc_stall;
+    ff_mutex_unlock(&of->lock);
+    return stall;
+}
+
+static void *encoder_thread(void *arg)
+{
+    OutputStream *ost = arg;
+    OutputFile    *of = output_files[ost->file_index];
+    InputStream  *ist = ost->filter->graph->inputs[0]->ist;
+    EncoderMessage msg;
+    int64_t t, stall;
+    int ret;
+
+    while (av_thread_message_queue_recv(ost->enc_queue, &msg, 0) >= 0) {
+        t     = av_gettime_relative();
+        stall = encoder_stall(of, ost);
+
+        if (msg.eof) {
+            close_output_stream(ost);
+            lock_decoder(ist);
+            ret = ost->initialized || init_output_stream_without_frames(ost);
+            unlock_decoder(ist);
+            if (ret)
+                flush_encoder(ost);
+        } else if (msg.frame) {
+            if (!atomic_load(&ost->finished))
+                encode_frame(of, ost, msg.frame, msg.float_pts, msg.frame_rate);
+            av_frame_free(&msg.frame);
+        } else if (!atomic_load(&ost->finished)) {
+            do_video_out(of, ost, NULL, AV_NOPTS_VALUE, msg.frame_rate);
+        }
+
+        ost->enc_busy += av_gettime_relative() - t - (encoder_stall(of, ost) - stall);
+
+        if (msg.eof)
+            break;
+    }
+
+    return NULL;
+}
+
+/* whether the streams of of have to stop together, which needs them to be
+ * encoded in lockstep on the main thread */
+static int output_file_stops_together(OutputFile *of)
+{
+    int i;
+
+    if (of->shortest)
+        return 1;
+    for (i = 0; i < of->ctx->nb_streams; i++)
+        if (output_streams[of->ost_index + i]->max_frames < INT64_MAX)
+            return 1;
+    return 0;
+}
+
+/* whether ist can be decoded on its own thread: everything it feeds must
+ * be on stage threads too, and the main thread must not need its
+ * timestamps to be current */
+static int stage_decoder_possible(InputStream *ist)
+{
+    InputFile *f = input_files[ist->file_index];
+    int i;
+
+    if (!ist->decoding_needed || !ist->nb_filters ||
+        (ist->dec_ctx->codec_type != AVMEDIA_TYPE_VIDEO &&
+         ist->dec_ctx->codec_type != AVMEDIA_TYPE_AUDIO) ||
+        (f->ctx->iformat->flags & AVFMT_TS_DISCONT))
+        return 0;
+
+    for (i = 0; i < ist->nb_filters; i++)
+        if (!ist->filters[i]->graph->queue)
+            return 0;
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        if (ost->source_index == f->ist_index + ist->st->index && ost->stream_copy)
+            return 0;
+    }
+    return 1;
+}
+
+static int start_stage_thread(pthread_t *thread, void *(*func)(void *), void *arg)
+{
+    int ret;
+
+    if ((ret = pthread_create(thread, NULL, func, arg))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        return AVERROR(ret);
+    }
+    return 0;
+}
+
+static void abort_stage_threads(void)
+{
+    int i;
+
+    /* the threads started so far have nothing queued yet, so they return
+     * right away; the caller exits with them still around */
+    for (i = 0; i < nb_input_streams; i++)
+        if (input_streams[i]->dec_queue)
+            av_thread_message_queue_set_err_recv(input_streams[i]->dec_queue, AVERROR_EOF);
+    for (i = 0; i < nb_filtergraphs; i++)
+        if (filtergraphs[i]->queue)
+            av_thread_message_queue_set_err_recv(filtergraphs[i]->queue, AVERROR_EOF);
+    for (i = 0; i < nb_output_streams; i++)
+        if (output_streams[i]->enc_queue)
+            av_thread_message_queue_set_err_recv(output_streams[i]->enc_queue, AVERROR_EOF);
+}
+
+static int init_stage_threads(void)
+{
+    int i, ret;
+
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+        OutputStream *ost;
+        OutputFile *of;
+
+        if (!filtergraph_is_simple(fg) ||
+            (fg->inputs[0]->type != AVMEDIA_TYPE_VIDEO &&
+             fg->inputs[0]->type != AVMEDIA_TYPE_AUDIO))
+            continue;
+        ost = fg->outputs[0]->ost;
+        of  = output_files[ost->file_index];
+        /* -vstats and -benchmark_all share state between streams */
+        if (!ost->encoding_needed || output_file_stops_together(of) ||
+            vstats_filename || do_benchmark_all)
+            continue;
+
+        if ((ret = av_thread_message_queue_alloc(&fg->queue, STAGE_QUEUE_SIZE,
+                                                 sizeof(FilterMessage))) < 0 ||
+            (ret = av_thread_message_queue_alloc(&ost->enc_queue, STAGE_QUEUE_SIZE,
+                                                 sizeof(EncoderMessage))) < 0)
+            return ret;
+        av_thread_message_queue_set_free_func(fg->queue, free_filter_message);
+        av_thread_message_queue_set_free_func(ost->enc_queue, free_encoder_message);
+
+        /* the encoder threads must not mux on the main thread */
+        if (!of->thread_queue_size)
+            of->thread_queue_size = STAGE_QUEUE_SIZE;
+    }
+
+    for (i = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+
+        if (!stage_decoder_possible(ist))
+            continue;
+
+        if ((ret = ff_mutex_init(&ist->dec_lock, NULL)))
+            return AVERROR(ret);
+        ist->shared_dts      = ist->dts;
+        ist->shared_next_dts = ist->next_dts;
+        ist->shared_pts      = ist->pts;
+        ist->shared_next_pts = ist->next_pts;
+
+        if ((ret = av_thread_message_queue_alloc(&ist->dec_queue, STAGE_QUEUE_SIZE,
+                                                 sizeof(DecoderMessage))) < 0 ||
+            (ret = av_thread_message_queue_alloc(&ist->dec_flushed, 1, sizeof(int))) < 0)
+            return ret;
+        av_thread_message_queue_set_free_func(ist->dec_queue, free_decoder_message);
+    }
+
+    atomic_store(&stage_threads_running, 1);
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        if (ost->enc_queue &&
+            (ret = start_stage_thread(&ost->enc_thread, encoder_thread, ost)) < 0)
+            goto fail;
+    }
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+        if (fg->queue &&
+            (ret = start_stage_thread(&fg->thread, filter_thread, fg)) < 0)
+            goto fail;
+    }
+    for (i = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+        if (ist->dec_queue &&
+            (ret = start_stage_thread(&ist->dec_thread, decoder_thread, ist)) < 0)
+            goto fail;
+    }
+    return 0;
+fail:
+    abort_stage_threads();
+    return ret;
+}
+
+/* send EOF to the stage threads that did not get it yet and wait until they
+ * have passed everything on to the muxers */
+static void free_stage_threads(void)
+{
+    int i;
+
+    if (!atomic_load(&stage_threads_running))
+        return;
+
+    for (i = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+        if (!ist->dec_queue)
+            continue;
+        if (!ist->eof_sent)
+            send_decoder_message(ist, NULL, 1);
+        pthread_join(ist->dec_thread, NULL);
+    }
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+        InputStream *ist;
+        FilterMessage msg = { NULL };
+
+        if (!fg->queue)
+            continue;
+        if (!fg->eof_sent) {
+            ist = fg->inputs[0]->ist;
+            msg.pts = av_rescale_q_rnd(ist->pts, AV_TIME_BASE_Q, ist->st->time_base,
+                                       AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+            send_thread_message(fg->queue, &msg, &main_stall);
+            fg->eof_sent = 1;
+        }
+        pthread_join(fg->thread, NULL);
+    }
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        if (ost->enc_queue)
+            pthread_join(ost->enc_thread, NULL);
+    }
+
+    atomic_store(&stage_threads_running, 0);
+}
+
 static void *input_thread(void *arg)
 {
     InputFile *f = arg;
@@ -4035,14 +4909,19 @@ static void *input_thread(void *arg)
             av_thread_message_queue_set_err_recv(f->in_thread_queue, ret);
             break;
         }
-        ret = av_thread_message_queue_send(f->in_thread_queue, &pkt, flags);
-        if (flags && ret == AVERROR(EAGAIN)) {
-            flags = 0;
-            ret = av_thread_message_queue_send(f->in_thread_queue, &pkt, flags);
-            av_log(f->ctx, AV_LOG_WARNING,
-                   "Thread message queue blocking; consider raising the "
-                   "thread_queue_size option (current value: %d)\n",
-                   f->thread_queue_size);
+        ret = av_thread_message_queue_send(f->in_thread_queue, &pkt,
+                                           flags | AV_THREAD_MESSAGE_NONBLOCK);
+        if (ret == AVERROR(EAGAIN)) {
+            int64_t t = av_gettime_relative();
+            if (flags) {
+                flags = 0;
+                av_log(f->ctx, AV_LOG_WARNING,
+                       "Thread message queue blocking; consider raising the "
+                       "thread_queue_size option (current value: %d)\n",
+                       f->thread_queue_size);
+            }
+            ret = av_thread_message_queue_send(f->in_thread_queue, &pkt, 0);
+            f->send_stall += av_gettime_relative() - t;
         }
         if (ret < 0) {
             if (ret != AVERROR_EOF)
@@ -4119,6 +4998,56 @@ static int init_input_threads(void)
     return 0;
 }
 
+static void print_thread_stats(void)
+{
+    int i, stages = 0;
+
+    for (i = 0; i < nb_input_files; i++) {
+        InputFile *f = input_files[i];
+        if (f->joined)
+            av_log(NULL, AV_LOG_INFO, "bench: input #%d: demuxer stall=%0.3fs\n",
+                   i, f->send_stall / 1000000.0);
+    }
+    for (i = 0; i < nb_output_files; i++) {
+        OutputFile *of = output_files[i];
+        if (of->thread_queue_size && of->header_written)
+            av_log(NULL, AV_LOG_INFO, "bench: output #%d: muxer busy=%0.3fs "
+                   "encoder stall=%0.3fs\n",
+                   i, of->mux_busy / 1000000.0, of->send_stall / 1000000.0);
+    }
+
+    /* busy is the time spent working, stall the time spent waiting for room
+     * in the queue of the next stage */
+    for (i = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+        if (!ist->dec_queue)
+            continue;
+        av_log(NULL, AV_LOG_INFO, "bench: input #%d:%d: decoder busy=%0.3fs stall=%0.3fs\n",
+               ist->file_index, ist->st->index,
+               ist->dec_busy / 1000000.0, ist->dec_stall / 1000000.0);
+        stages = 1;
+    }
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+        if (!fg->queue)
+            continue;
+        av_log(NULL, AV_LOG_INFO, "bench: filtergraph #%d: busy=%0.3fs stall=%0.3fs\n",
+               i, fg->busy / 1000000.0, fg->stall / 1000000.0);
+        stages = 1;
+    }
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        if (!ost->enc_queue)
+            continue;
+        av_log(NULL, AV_LOG_INFO, "bench: output #%d:%d: encoder busy=%0.3fs stall=%0.3fs\n",
+               ost->file_index, ost->index,
+               ost->enc_busy / 1000000.0, ost->enc_stall / 1000000.0);
+    }
+    if (stages)
+        av_log(NULL, AV_LOG_INFO, "bench: main thread stall=%0.3fs\n",
+               main_stall / 1000000.0);
+}
+
 static int get_input_packet_mt(InputFile *f, AVPacket *pkt)
 {
     return av_thread_message_queue_recv(f->in_thread_queue, pkt,
@@ -4127,14 +5056,38 @@ static int get_input_packet_mt(InputFile *f, AVPacket *pkt)
 }
 #endif
 
+/* the timestamps of ist, as last published by its decoder thread if it has one */
+static void input_stream_timestamps(InputStream *ist, int64_t *dts, int64_t *next_dts,
+                                    int64_t *pts, int64_t *next_pts)
+{
+#if HAVE_THREADS
+    if (ist->dec_queue) {
+        ff_mutex_lock(&ist->dec_lock);
+        *dts      = ist->shared_dts;
+        *next_dts = ist->shared_next_dts;
+        *pts      = ist->shared_pts;
+        *next_pts = ist->shared_next_pts;
+        ff_mutex_unlock(&ist->dec_lock);
+        return;
+    }
+#endif
+    *dts      = ist->dts;
+    *next_dts = ist->next_dts;
+    *pts      = ist->pts;
+    *next_pts = ist->next_pts;
+}
+
 static int get_input_packet(InputFile *f, AVPacket *pkt)
 {
     if (f->rate_emu) {
         int i;
         for (i = 0; i < f->nb_streams; i++) {
             InputStream *ist = input_streams[f->ist_index + i];
-            int64_t pts = av_rescale(ist->dts, 1000000, AV_TIME_BASE);
-            int64_t now = av_gettime_relative() - ist->start;
+            int64_t dts, next_dts, pts, next_pts, now;
+
+            input_stream_timestamps(ist, &dts, &next_dts, &pts, &next_pts);
+            pts = av_rescale(dts, 1000000, AV_TIME_BASE);
+            now = av_gettime_relative() - ist->start;
             if (pts > now)
                 return AVERROR(EAGAIN);
         }
@@ -4259,6 +5212,7 @@ static int process_input(int file_index)
     int ret, thread_ret, i, j;
     int64_t duration;
     int64_t pkt_dts;
+    int64_t dts, next_dts, pts, next_pts;
 
     is  = ifile->ctx;
     ret = get_input_packet(ifile, &pkt);
@@ -4272,6 +5226,17 @@ static int process_input(int file_index)
         for (i = 0; i < ifile->nb_streams; i++) {
             ist = input_streams[ifile->ist_index + i];
             avctx = ist->dec_ctx;
+#if HAVE_THREADS
+            if (ist->dec_queue) {
+                int flushed;
+
+                /* wait for the decoder to be drained and flushed */
+                if (send_decoder_message(ist, NULL, 2) < 0 ||
+                    av_thread_message_queue_recv(ist->dec_flushed, &flushed, 0) < 0)
+                    exit_program(1);
+                continue;
+            }
+#endif
             if (ist->decoding_needed) {
                 ret = process_input_packet(ist, NULL, 1);
                 if (ret>0)
@@ -4306,6 +5271,12 @@ static int process_input(int file_index)
 
         for (i = 0; i < ifile->nb_streams; i++) {
             ist = input_streams[ifile->ist_index + i];
+#if HAVE_THREADS
+            if (ist->dec_queue) {
+                if (!ist->eof_sent && send_decoder_message(ist, NULL, 1) < 0)
+                    exit_program(1);
+            } else
+#endif
             if (ist->decoding_needed) {
                 ret = process_input_packet(ist, NULL, 0);
                 if (ret>0)
@@ -4340,6 +5311,7 @@ static int process_input(int file_index)
     }
 
     ist = input_streams[ifile->ist_index + pkt.stream_index];
+    input_stream_timestamps(ist, &dts, &next_dts, &pts, &next_pts);
 
     ist->data_size += pkt.size;
     ist->nb_packets++;
@@ -4358,8 +5330,8 @@ static int process_input(int file_index)
         av_log(NULL, AV_LOG_INFO, "demuxer -> ist_index:%d type:%s "
                "next_dts:%s next_dts_time:%s next_pts:%s next_pts_time:%s pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s off:%s off_time:%s\n",
                ifile->ist_index + pkt.stream_index, av_get_media_type_string(ist->dec_ctx->codec_type),
-               av_ts2str(ist->next_dts), av_ts2timestr(ist->next_dts, &AV_TIME_BASE_Q),
-               av_ts2str(ist->next_pts), av_ts2timestr(ist->next_pts, &AV_TIME_BASE_Q),
+               av_ts2str(next_dts), av_ts2timestr(next_dts, &AV_TIME_BASE_Q),
+               av_ts2str(next_pts), av_ts2timestr(next_pts, &AV_TIME_BASE_Q),
                av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &ist->st->time_base),
                av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &ist->st->time_base),
                av_ts2str(input_files[ist->file_index]->ts_offset),
@@ -4371,7 +5343,7 @@ static int process_input(int file_index)
         // Correcting starttime based on the enabled streams
         // FIXME this ideally should be done before the first use of starttime but we do not know which are the enabled streams at that point.
         //       so we instead do it here as part of discontinuity handling
-        if (   ist->next_dts == AV_NOPTS_VALUE
+        if (   next_dts == AV_NOPTS_VALUE
             && ifile->ts_offset == -is->start_time
             && (is->iformat->flags & AVFMT_TS_DISCONT)) {
             int64_t new_start_time = INT64_MAX;
@@ -4434,7 +5406,7 @@ static int process_input(int file_index)
     pkt_dts = av_rescale_q_rnd(pkt.dts, ist->st->time_base, AV_TIME_BASE_Q, AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
     if ((ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO ||
          ist->dec_ctx->codec_type == AVMEDIA_TYPE_AUDIO) &&
-        pkt_dts != AV_NOPTS_VALUE && ist->next_dts == AV_NOPTS_VALUE && !copy_ts
+        pkt_dts != AV_NOPTS_VALUE && next_dts == AV_NOPTS_VALUE && !copy_ts
         && (is->iformat->flags & AVFMT_TS_DISCONT) && ifile->last_ts != AV_NOPTS_VALUE) {
         int64_t delta   = pkt_dts - ifile->last_ts;
         if (delta < -1LL*dts_delta_threshold*AV_TIME_BASE ||
@@ -4462,13 +5434,13 @@ static int process_input(int file_index)
     pkt_dts = av_rescale_q_rnd(pkt.dts, ist->st->time_base, AV_TIME_BASE_Q, AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
     if ((ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO ||
          ist->dec_ctx->codec_type == AVMEDIA_TYPE_AUDIO) &&
-         pkt_dts != AV_NOPTS_VALUE && ist->next_dts != AV_NOPTS_VALUE &&
+         pkt_dts != AV_NOPTS_VALUE && next_dts != AV_NOPTS_VALUE &&
         !copy_ts) {
-        int64_t delta   = pkt_dts - ist->next_dts;
+        int64_t delta   = pkt_dts - next_dts;
         if (is->iformat->flags & AVFMT_TS_DISCONT) {
             if (delta < -1LL*dts_delta_threshold*AV_TIME_BASE ||
                 delta >  1LL*dts_delta_threshold*AV_TIME_BASE ||
-                pkt_dts + AV_TIME_BASE/10 < FFMAX(ist->pts, ist->dts)) {
+                pkt_dts + AV_TIME_BASE/10 < FFMAX(pts, dts)) {
                 ifile->ts_offset -= delta;
                 av_log(NULL, AV_LOG_DEBUG,
                        "timestamp discontinuity for stream #%d:%d "
@@ -4483,15 +5455,15 @@ static int process_input(int file_index)
         } else {
             if ( delta < -1LL*dts_error_threshold*AV_TIME_BASE ||
                  delta >  1LL*dts_error_threshold*AV_TIME_BASE) {
-                av_log(NULL, AV_LOG_WARNING, "DTS %"PRId64", next:%"PRId64" st:%d invalid dropping\n", pkt.dts, ist->next_dts, pkt.stream_index);
+                av_log(NULL, AV_LOG_WARNING, "DTS %"PRId64", next:%"PRId64" st:%d invalid dropping\n", pkt.dts, next_dts, pkt.stream_index);
                 pkt.dts = AV_NOPTS_VALUE;
             }
             if (pkt.pts != AV_NOPTS_VALUE){
                 int64_t pkt_pts = av_rescale_q(pkt.pts, ist->st->time_base, AV_TIME_BASE_Q);
-                delta   = pkt_pts - ist->next_dts;
+                delta   = pkt_pts - next_dts;
                 if ( delta < -1LL*dts_error_threshold*AV_TIME_BASE ||
                      delta >  1LL*dts_error_threshold*AV_TIME_BASE) {
-                    av_log(NULL, AV_LOG_WARNING, "PTS %"PRId64", next:%"PRId64" invalid dropping st:%d\n", pkt.pts, ist->next_dts, pkt.stream_index);
+                    av_log(NULL, AV_LOG_WARNING, "PTS %"PRId64", next:%"PRId64" invalid dropping st:%d\n", pkt.pts, next_dts, pkt.stream_index);
                     pkt.pts = AV_NOPTS_VALUE;
                 }
             }
@@ -4512,6 +5484,12 @@ static int process_input(int file_index)
 
     sub2video_heartbeat(ist, pkt.pts);
 
+#if HAVE_THREADS
+    if (ist->dec_queue) {
+        if (send_decoder_message(ist, &pkt, 0) < 0)
+            exit_program(1);
+    } else
+#endif
     process_input_packet(ist, &pkt, 0);
 
 discard_packet:
@@ -4590,7 +5568,7 @@ static int transcode_step(void)
         return AVERROR_EOF;
     }
 
-    if (ost->filter && !ost->filter->graph->graph) {
+    if (!output_stream_threaded(ost) && ost->filter && !ost->filter->graph->graph) {
         if (ifilter_has_all_input_formats(ost->filter->graph)) {
             ret = configure_filtergraph(ost->filter->graph);
             if (ret < 0) {
@@ -4600,7 +5578,10 @@ static int transcode_step(void)
         }
     }
 
-    if (ost->filter && ost->filter->graph->graph) {
+    if (output_stream_threaded(ost)) {
+        /* its filtergraph and encoder run on their own threads, just read */
+        ist = ost->filter->graph->inputs[0]->ist;
+    } else if (ost->filter && ost->filter->graph->graph) {
         if (!ost->initialized) {
             char error[1024] = {0};
             ret = init_output_stream(ost, error, sizeof(error));
@@ -4668,6 +5649,8 @@ static int transcode(void)
     timer_start = av_gettime_relative();
 
 #if HAVE_THREADS
+    if (stage_threads && (ret = init_stage_threads()) < 0)
+        goto fail;
     if ((ret = init_input_threads()) < 0)
         goto fail;
 #endif
@@ -4703,13 +5686,36 @@ static int transcode(void)
     for (i = 0; i < nb_input_streams; i++) {
         ist = input_streams[i];
         if (!input_files[ist->file_index]->eof_reached) {
+#if HAVE_THREADS
+            if (ist->dec_queue) {
+                if (!ist->eof_sent)
+                    send_decoder_message(ist, NULL, 1);
+                continue;
+            }
+#endif
             process_input_packet(ist, NULL, 0);
         }
     }
+#if HAVE_THREADS
+    free_stage_threads();
+#endif
     flush_encoders();
 
     term_exit();
 
+#if HAVE_THREADS
+    free_mux_threads();
+#endif
+
+    /* leave the field order of the last encoded frame, like muxing on the
+     * main thread does */
+    for (i = 0; i < nb_output_streams; i++) {
+        ost = output_streams[i];
+        if (ost->encoding_needed && ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO &&
+            ost->initialized)
+            ost->st->codecpar->field_order = ost->field_order;
+    }
+
     /* write the trailer if needed and close file */
     for (i = 0; i < nb_output_files; i++) {
         os = output_files[i]->ctx;
@@ -4730,6 +5736,11 @@ static int transcode(void)
     /* dump report by using the first video and audio streams */
     print_report(1, timer_start, av_gettime_relative());
 
+#if HAVE_THREADS
+    if (do_benchmark)
+        print_thread_stats();
+#endif
+
     /* close each encoder */
     for (i = 0; i < nb_output_streams; i++) {
         ost = output_streams[i];
@@ -21,6 +21,7 @@
 
 #include "config.h"
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <signal.h>
@@ -290,6 +291,15 @@ typedef struct FilterGraph {
     int          nb_inputs;
     OutputFilter **outputs;
     int         nb_outputs;
+
+#if HAVE_THREADS
+    /* simple graph running on its own thread, see -stage_threads */
+    AVThreadMessageQueue *queue;    /* decoded frames waiting to be filtered */
+    pthread_t thread;
+    int eof_sent;                   /* the EOF message has been queued */
+    int64_t busy;                   /* time spent filtering, in microseconds */
+    int64_t stall;                  /* time spent waiting on a full encoder queue */
+#endif
 } FilterGraph;
 
 typedef struct InputStream {
@@ -388,6 +398,21 @@ typedef struct InputStream {
     int nb_dts_buffer;
 
     int got_output;
+
+#if HAVE_THREADS
+    /* decoder running on its own thread, see -stage_threads */
+    AVThreadMessageQueue *dec_queue;    /* packets waiting to be decoded */
+    AVThreadMessageQueue *dec_flushed;  /* acknowledges the flushes for -stream_loop */
+    pthread_t dec_thread;
+    /* held by the thread while it changes dec_ctx or the timestamps below,
+     * the other threads take it to look at them */
+    AVMutex dec_lock;
+    /* dts, next_dts, pts and next_pts as of the last decoded packet */
+    int64_t shared_dts, shared_next_dts, shared_pts, shared_next_pts;
+    int eof_sent;                       /* the EOF message has been queued */
+    int64_t dec_busy;                   /* time spent decoding, in microseconds */
+    int64_t dec_stall;                  /* time spent waiting on full filter queues */
+#endif
 } InputStream;
 
 typedef struct InputFile {
@@ -418,6 +443,7 @@ typedef struct InputFile {
     int non_blocking;           /* reading packets from the thread should not block */
     int joined;                 /* the thread has been joined */
     int thread_queue_size;      /* maximum number of queued packets */
+    int64_t send_stall;         /* time the thread spent waiting on a full queue, in microseconds */
 #endif
 } InputFile;
 
@@ -509,7 +535,7 @@ typedef struct OutputStream {
     AVDictionary *swr_opts;
     AVDictionary *resample_opts;
     char *apad;
-    OSTFinished finished;        /* no more packets should be written for this stream */
+    atomic_int finished;         /* OSTFinished flags, no more packets should be written for this stream */
     int unavailable;                     /* true if the steram is unavailable (possibly temporarily) */
     int stream_copy;
 
@@ -549,6 +575,21 @@ typedef struct OutputStream {
 
     /* frame encode sum of squared error values */
     int64_t error[4];
+
+    /* field order of the last frame sent to the encoder, the codecpar is
+     * updated from it when the packets are muxed */
+    enum AVFieldOrder field_order;
+
+#if HAVE_THREADS
+    /* encoder running on its own thread, see -stage_threads */
+    AVThreadMessageQueue *enc_queue;    /* filtered frames waiting to be encoded */
+    pthread_t enc_thread;
+    int64_t enc_busy;                   /* time spent encoding, in microseconds */
+    int64_t enc_stall;                  /* time spent waiting on a full muxer queue */
+    /* cur_dts and end pts of the AVStream, published by the muxer thread */
+    atomic_int_least64_t mux_cur_dts;
+    atomic_int_least64_t mux_end_pts;
+#endif
 } OutputStream;
 
 typedef struct OutputFile {
@@ -562,6 +603,20 @@ typedef struct OutputFile {
     int shortest;
 
     int header_written;
+
+    /* serializes the muxing and the initialization of the file between the
+     * threads that encode its streams */
+    AVMutex lock;
+
+#if HAVE_THREADS
+    AVThreadMessageQueue *mux_queue;
+    pthread_t mux_thread;       /* thread writing packets to this file */
+    int thread_queue_size;      /* maximum number of queued packets, 0 to mux on the main thread */
+    int mux_error;              /* error returned by the muxer in the thread, if any */
+    atomic_int_least64_t mux_size; /* bytes written so far, updated by the thread */
+    int64_t send_stall;         /* time spent waiting on a full queue, in microseconds */
+    int64_t mux_busy;           /* time the thread spent in the muxer, in microseconds */
+#endif
 } OutputFile;
 
 extern InputStream **input_streams;
@@ -609,6 +664,7 @@ extern char *videotoolbox_pixfmt;
 
 extern int filter_nbthreads;
 extern int filter_complex_nbthreads;
+extern int stage_threads;
 extern int vstats_version;
 
 extern const AVIOInterruptCB int_cb;
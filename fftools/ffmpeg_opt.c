@@ -109,6 +109,7 @@ int frame_bits_per_raw_sample = 0;
 float max_error_rate  = 2.0/3;
 int filter_nbthreads = 0;
 int filter_complex_nbthreads = 0;
+int stage_threads = 0;
 int vstats_version = 2;
 
 
@@ -1561,6 +1562,10 @@ static OutputStream *new_output_stream(OptionsContext *o, AVFormatContext *oc, e
         input_streams[source_index]->st->discard = input_streams[source_index]->user_set_discard;
     }
     ost->last_mux_dts = AV_NOPTS_VALUE;
+#if HAVE_THREADS
+    atomic_init(&ost->mux_cur_dts, AV_NOPTS_VALUE);
+    atomic_init(&ost->mux_end_pts, AV_NOPTS_VALUE);
+#endif
 
     ost->muxing_queue = av_fifo_alloc(8 * sizeof(AVPacket));
     if (!ost->muxing_queue)
@@ -1954,7 +1959,7 @@ static OutputStream *new_attachment_stream(OptionsContext *o, AVFormatContext *o
 {
     OutputStream *ost = new_output_stream(o, oc, AVMEDIA_TYPE_ATTACHMENT, source_index);
     ost->stream_copy = 1;
-    ost->finished    = 1;
+    atomic_init(&ost->finished, ENCODER_FINISHED);
     return ost;
 }
 
@@ -2142,6 +2147,11 @@ static int open_output_file(OptionsContext *o, const char *filename)
     of->start_time     = o->start_time;
     of->limit_filesize = o->limit_filesize;
     of->shortest       = o->shortest;
+    if (ff_mutex_init(&of->lock, NULL))
+        exit_program(1);
+#if HAVE_THREADS
+    of->thread_queue_size = FFMAX(o->thread_queue_size, 0);
+#endif
     av_dict_copy(&of->opts, o->g->format_opts, 0);
 
     if (!strcmp(filename, "-"))
@@ -3503,6 +3513,10 @@ const OptionDef options[] = {
         "set stream filtergraph", "filter_graph" },
     { "filter_threads",  HAS_ARG | OPT_INT,                          { &filter_nbthreads },
         "number of non-complex filter threads" },
+#if HAVE_THREADS
+    { "stage_threads",  OPT_BOOL | OPT_EXPERT,                       { &stage_threads },
+        "run the decoders, simple filtergraphs and encoders on their own threads" },
+#endif
     { "filter_script",  HAS_ARG | OPT_STRING | OPT_SPEC | OPT_OUTPUT, { .off = OFFSET(filter_scripts) },
         "read stream filtergraph description from a file", "filename" },
     { "reinit_filter",  HAS_ARG | OPT_INT | OPT_SPEC | OPT_INPUT,    { .off = OFFSET(reinit_filters) },
@@ -3535,9 +3549,9 @@ const OptionDef options[] = {
     { "disposition",    OPT_STRING | HAS_ARG | OPT_SPEC |
                         OPT_OUTPUT,                                  { .off = OFFSET(disposition) },
         "disposition", "" },
-    { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT,
+    { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT | OPT_OUTPUT,
                                                                      { .off = OFFSET(thread_queue_size) },
-        "set the maximum number of queued packets from the demuxer" },
+        "set the maximum number of queued packets from the demuxer or to the muxer" },
     { "find_stream_info", OPT_BOOL | OPT_PERFILE | OPT_INPUT | OPT_EXPERT, { &find_stream_info },
         "read and decode the streams to fill missing information with heuristics" },
 
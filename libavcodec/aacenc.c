@@ -553,6 +553,38 @@ static void copy_input_samples(AACEncContext *s, const AVFrame *frame)
     }
 }
 
+/**
+ * Search scalefactors and TNS filters of one channel. Only touches the
+ * channel itself and the scratch areas of s, so channels can be searched
+ * concurrently with separate contexts.
+ */
+static void search_channel(AVCodecContext *avctx, AACEncContext *s,
+                           SingleChannelElement *sce)
+{
+    if (s->options.pns && s->coder->mark_pns)
+        s->coder->mark_pns(s, avctx, sce);
+    s->coder->search_for_quantizers(avctx, s, sce, s->lambda);
+    if (s->options.tns && s->coder->search_for_tns)
+        s->coder->search_for_tns(s, sce);
+    if (s->options.tns && s->coder->apply_tns_filt)
+        s->coder->apply_tns_filt(s, sce);
+}
+
+static int search_channels_job(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    AACEncContext *s   = avctx->priv_data;
+    AACEncContext *ctx = jobnr ? &s->slice_ctx[jobnr - 1] : s;
+    int ch;
+
+    for (ch = jobnr; ch < s->channels; ch += s->nb_slice_jobs) {
+        ctx->cur_channel      = ch;
+        ctx->cur_type         = s->slice_type[ch];
+        ctx->psy.bitres.alloc = s->slice_alloc[ch];
+        search_channel(avctx, ctx, s->slice_sce[ch]);
+    }
+    return 0;
+}
+
 static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
                             const AVFrame *frame, int *got_packet_ptr)
 {
@@ -565,6 +597,7 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
     int target_bits, rate_bits, too_many_bits, too_few_bits;
     int ms_mode = 0, is_mode = 0, tns_mode = 0, pred_mode = 0;
     int chan_el_counter[4];
+    int first_el, last_el, first_ch, parallel;
     FFPsyWindowInfo windows[AAC_MAX_CHANNELS];
 
     /* add current frame to queue */
@@ -680,6 +713,13 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
     }
     if ((ret = ff_alloc_packet2(avctx, avpkt, 8192 * s->channels, 0)) < 0)
         return ret;
+    /* Elements are normally analyzed, searched and written one at a time.
+     * The channels of all elements can be searched at once after psy analysis
+     * of the whole frame, except when psy of an element depends on the coding
+     * of the previous ones: the coder may adjust the psy cutoff the first
+     * time it runs, and common prediction looks at the psy bands of the next
+     * channel. */
+    parallel = s->nb_slice_jobs > 1 && s->lambda_count && !s->options.pred;
     frame_bits = its = 0;
     do {
         init_put_bits(&s->pb, avpkt->data, avpkt->size);
@@ -689,131 +729,149 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
         start_ch = 0;
         target_bits = 0;
         memset(chan_el_counter, 0, sizeof(chan_el_counter));
-        for (i = 0; i < s->chan_map[0]; i++) {
-            FFPsyWindowInfo* wi = windows + start_ch;
-            const float *coeffs[2];
-            tag      = s->chan_map[i+1];
-            chans    = tag == TYPE_CPE ? 2 : 1;
-            cpe      = &s->cpe[i];
-            cpe->common_window = 0;
-            memset(cpe->is_mask, 0, sizeof(cpe->is_mask));
-            memset(cpe->ms_mask, 0, sizeof(cpe->ms_mask));
-            put_bits(&s->pb, 3, tag);
-            put_bits(&s->pb, 4, chan_el_counter[tag]++);
-            for (ch = 0; ch < chans; ch++) {
-                sce = &cpe->ch[ch];
-                coeffs[ch] = sce->coeffs;
-                sce->ics.predictor_present = 0;
-                sce->ics.ltp.present = 0;
-                memset(sce->ics.ltp.used, 0, sizeof(sce->ics.ltp.used));
-                memset(sce->ics.prediction_used, 0, sizeof(sce->ics.prediction_used));
-                memset(&sce->tns, 0, sizeof(TemporalNoiseShaping));
-                for (w = 0; w < 128; w++)
-                    if (sce->band_type[w] > RESERVED_BT)
-                        sce->band_type[w] = 0;
-            }
-            s->psy.bitres.alloc = -1;
-            s->psy.bitres.bits = s->last_frame_pb_count / s->channels;
-            s->psy.model->analyze(&s->psy, start_ch, coeffs, wi);
-            if (s->psy.bitres.alloc > 0) {
-                /* Lambda unused here on purpose, we need to take psy's unscaled allocation */
-                target_bits += s->psy.bitres.alloc
-                    * (s->lambda / (avctx->global_quality ? avctx->global_quality : 120));
-                s->psy.bitres.alloc /= chans;
-            }
-            s->cur_type = tag;
-            for (ch = 0; ch < chans; ch++) {
-                s->cur_channel = start_ch + ch;
-                if (s->options.pns && s->coder->mark_pns)
-                    s->coder->mark_pns(s, avctx, &cpe->ch[ch]);
-                s->coder->search_for_quantizers(avctx, s, &cpe->ch[ch], s->lambda);
-            }
-            if (chans > 1
-                && wi[0].window_type[0] == wi[1].window_type[0]
-                && wi[0].window_shape   == wi[1].window_shape) {
-
-                cpe->common_window = 1;
-                for (w = 0; w < wi[0].num_windows; w++) {
-                    if (wi[0].grouping[w] != wi[1].grouping[w]) {
-                        cpe->common_window = 0;
-                        break;
-                    }
-                }
-            }
-            for (ch = 0; ch < chans; ch++) { /* TNS and PNS */
-                sce = &cpe->ch[ch];
-                s->cur_channel = start_ch + ch;
-                if (s->options.tns && s->coder->search_for_tns)
-                    s->coder->search_for_tns(s, sce);
-                if (s->options.tns && s->coder->apply_tns_filt)
-                    s->coder->apply_tns_filt(s, sce);
-                if (sce->tns.present)
-                    tns_mode = 1;
-                if (s->options.pns && s->coder->search_for_pns)
-                    s->coder->search_for_pns(s, avctx, sce);
-            }
-            s->cur_channel = start_ch;
-            if (s->options.intensity_stereo) { /* Intensity Stereo */
-                if (s->coder->search_for_is)
-                    s->coder->search_for_is(s, avctx, cpe);
-                if (cpe->is_mode) is_mode = 1;
-                apply_intensity_stereo(cpe);
-            }
-            if (s->options.pred) { /* Prediction */
+        for (first_el = 0; first_el < s->chan_map[0]; first_el = last_el) {
+            last_el  = parallel ? s->chan_map[0] : first_el + 1;
+            first_ch = start_ch;
+            for (i = first_el; i < last_el; i++) {
+                FFPsyWindowInfo* wi = windows + start_ch;
+                const float *coeffs[2];
+                tag      = s->chan_map[i+1];
+                chans    = tag == TYPE_CPE ? 2 : 1;
+                cpe      = &s->cpe[i];
+                cpe->common_window = 0;
+                memset(cpe->is_mask, 0, sizeof(cpe->is_mask));
+                memset(cpe->ms_mask, 0, sizeof(cpe->ms_mask));
                 for (ch = 0; ch < chans; ch++) {
                     sce = &cpe->ch[ch];
-                    s->cur_channel = start_ch + ch;
-                    if (s->options.pred && s->coder->search_for_pred)
-                        s->coder->search_for_pred(s, sce);
-                    if (cpe->ch[ch].ics.predictor_present) pred_mode = 1;
+                    coeffs[ch] = sce->coeffs;
+                    sce->ics.predictor_present = 0;
+                    sce->ics.ltp.present = 0;
+                    memset(sce->ics.ltp.used, 0, sizeof(sce->ics.ltp.used));
+                    memset(sce->ics.prediction_used, 0, sizeof(sce->ics.prediction_used));
+                    memset(&sce->tns, 0, sizeof(TemporalNoiseShaping));
+                    for (w = 0; w < 128; w++)
+                        if (sce->band_type[w] > RESERVED_BT)
+                            sce->band_type[w] = 0;
+                }
+                s->psy.bitres.alloc = -1;
+                s->psy.bitres.bits = s->last_frame_pb_count / s->channels;
+                s->psy.model->analyze(&s->psy, start_ch, coeffs, wi);
+                if (s->psy.bitres.alloc > 0) {
+                    /* Lambda unused here on purpose, we need to take psy's unscaled allocation */
+                    target_bits += s->psy.bitres.alloc
+                        * (s->lambda / (avctx->global_quality ? avctx->global_quality : 120));
+                    s->psy.bitres.alloc /= chans;
                 }
-                if (s->coder->adjust_common_pred)
-                    s->coder->adjust_common_pred(s, cpe);
+                s->cur_type = tag;
                 for (ch = 0; ch < chans; ch++) {
-                    sce = &cpe->ch[ch];
                     s->cur_channel = start_ch + ch;
-                    if (s->options.pred && s->coder->apply_main_pred)
-                        s->coder->apply_main_pred(s, sce);
+                    s->slice_sce[s->cur_channel]   = &cpe->ch[ch];
+                    s->slice_alloc[s->cur_channel] = s->psy.bitres.alloc;
+                    s->slice_type[s->cur_channel]  = tag;
+                    if (!parallel)
+                        search_channel(avctx, s, &cpe->ch[ch]);
                 }
-                s->cur_channel = start_ch;
+                start_ch += chans;
             }
-            if (s->options.mid_side) { /* Mid/Side stereo */
-                if (s->options.mid_side == -1 && s->coder->search_for_ms)
-                    s->coder->search_for_ms(s, cpe);
-                else if (cpe->common_window)
-                    memset(cpe->ms_mask, 1, sizeof(cpe->ms_mask));
-                apply_mid_side_stereo(cpe);
+
+            if (parallel) {
+                for (i = 0; i < s->nb_slice_jobs - 1; i++)
+                    s->slice_ctx[i].lambda = s->lambda;
+                avctx->execute2(avctx, search_channels_job, NULL, NULL, s->nb_slice_jobs);
             }
-            adjust_frame_information(cpe, chans);
-            if (s->options.ltp) { /* LTP */
-                for (ch = 0; ch < chans; ch++) {
+
+            start_ch = first_ch;
+            for (i = first_el; i < last_el; i++) {
+                FFPsyWindowInfo* wi = windows + start_ch;
+                tag      = s->chan_map[i+1];
+                chans    = tag == TYPE_CPE ? 2 : 1;
+                cpe      = &s->cpe[i];
+                s->cur_type = tag;
+                put_bits(&s->pb, 3, tag);
+                put_bits(&s->pb, 4, chan_el_counter[tag]++);
+                if (chans > 1
+                    && wi[0].window_type[0] == wi[1].window_type[0]
+                    && wi[0].window_shape   == wi[1].window_shape) {
+
+                    cpe->common_window = 1;
+                    for (w = 0; w < wi[0].num_windows; w++) {
+                        if (wi[0].grouping[w] != wi[1].grouping[w]) {
+                            cpe->common_window = 0;
+                            break;
+                        }
+                    }
+                }
+                for (ch = 0; ch < chans; ch++) { /* PNS */
                     sce = &cpe->ch[ch];
                     s->cur_channel = start_ch + ch;
-                    if (s->coder->search_for_ltp)
-                        s->coder->search_for_ltp(s, sce, cpe->common_window);
-                    if (sce->ics.ltp.present) pred_mode = 1;
+                    if (sce->tns.present)
+                        tns_mode = 1;
+                    if (s->options.pns && s->coder->search_for_pns)
+                        s->coder->search_for_pns(s, avctx, sce);
                 }
                 s->cur_channel = start_ch;
-                if (s->coder->adjust_common_ltp)
-                    s->coder->adjust_common_ltp(s, cpe);
-            }
-            if (chans == 2) {
-                put_bits(&s->pb, 1, cpe->common_window);
-                if (cpe->common_window) {
-                    put_ics_info(s, &cpe->ch[0].ics);
-                    if (s->coder->encode_main_pred)
-                        s->coder->encode_main_pred(s, &cpe->ch[0]);
-                    if (s->coder->encode_ltp_info)
-                        s->coder->encode_ltp_info(s, &cpe->ch[0], 1);
-                    encode_ms_info(&s->pb, cpe);
-                    if (cpe->ms_mode) ms_mode = 1;
+                if (s->options.intensity_stereo) { /* Intensity Stereo */
+                    if (s->coder->search_for_is)
+                        s->coder->search_for_is(s, avctx, cpe);
+                    if (cpe->is_mode) is_mode = 1;
+                    apply_intensity_stereo(cpe);
                 }
+                if (s->options.pred) { /* Prediction */
+                    for (ch = 0; ch < chans; ch++) {
+                        sce = &cpe->ch[ch];
+                        s->cur_channel = start_ch + ch;
+                        if (s->options.pred && s->coder->search_for_pred)
+                            s->coder->search_for_pred(s, sce);
+                        if (cpe->ch[ch].ics.predictor_present) pred_mode = 1;
+                    }
+                    if (s->coder->adjust_common_pred)
+                        s->coder->adjust_common_pred(s, cpe);
+                    for (ch = 0; ch < chans; ch++) {
+                        sce = &cpe->ch[ch];
+                        s->cur_channel = start_ch + ch;
+                        if (s->options.pred && s->coder->apply_main_pred)
+                            s->coder->apply_main_pred(s, sce);
+                    }
+                    s->cur_channel = start_ch;
+                }
+                if (s->options.mid_side) { /* Mid/Side stereo */
+                    if (s->options.mid_side == -1 && s->coder->search_for_ms)
+                        s->coder->search_for_ms(s, cpe);
+                    else if (cpe->common_window)
+                        memset(cpe->ms_mask, 1, sizeof(cpe->ms_mask));
+                    apply_mid_side_stereo(cpe);
+                }
+                adjust_frame_information(cpe, chans);
+                if (s->options.ltp) { /* LTP */
+                    for (ch = 0; ch < chans; ch++) {
+                        sce = &cpe->ch[ch];
+                        s->cur_channel = start_ch + ch;
+                        if (s->coder->search_for_ltp)
+                            s->coder->search_for_ltp(s, sce, cpe->common_window);
+                        if (sce->ics.ltp.present) pred_mode = 1;
+                    }
+                    s->cur_channel = start_ch;
+                    if (s->coder->adjust_common_ltp)
+                        s->coder->adjust_common_ltp(s, cpe);
+                }
+                if (chans == 2) {
+                    put_bits(&s->pb, 1, cpe->common_window);
+                    if (cpe->common_window) {
+                        put_ics_info(s, &cpe->ch[0].ics);
+                        if (s->coder->encode_main_pred)
+                            s->coder->encode_main_pred(s, &cpe->ch[0]);
+                        if (s->coder->encode_ltp_info)
+                            s->coder->encode_ltp_info(s, &cpe->ch[0], 1);
+                        encode_ms_info(&s->pb, cpe);
+                        if (cpe->ms_mode) ms_mode = 1;
+                    }
+                }
+                for (ch = 0; ch < chans; ch++) {
+                    s->cur_channel = start_ch + ch;
+                    encode_individual_channel(avctx, s, &cpe->ch[ch], cpe->common_window);
+                }
+                start_ch += chans;
             }
-            for (ch = 0; ch < chans; ch++) {
-                s->cur_channel = start_ch + ch;
-                encode_individual_channel(avctx, s, &cpe->ch[ch], cpe->common_window);
-            }
-            start_ch += chans;
         }
 
         if (avctx->flags & AV_CODEC_FLAG_QSCALE) {
@@ -899,6 +957,7 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
 static av_cold int aac_encode_end(AVCodecContext *avctx)
 {
     AACEncContext *s = avctx->priv_data;
+    int i;
 
     av_log(avctx, AV_LOG_INFO, "Qavg: %.3f\n", s->lambda_sum / s->lambda_count);
 
@@ -906,6 +965,9 @@ static av_cold int aac_encode_end(AVCodecContext *avctx)
     ff_mdct_end(&s->mdct128);
     ff_psy_end(&s->psy);
     ff_lpc_end(&s->lpc);
+    for (i = 0; i < s->nb_slice_jobs - 1; i++)
+        ff_lpc_end(&s->slice_ctx[i].lpc);
+    av_freep(&s->slice_ctx);
     if (s->psypp)
         ff_psy_preprocess_end(s->psypp);
     av_freep(&s->buffer.samples);
@@ -915,6 +977,34 @@ static av_cold int aac_encode_end(AVCodecContext *avctx)
     return 0;
 }
 
+static av_cold int alloc_slice_contexts(AVCodecContext *avctx, AACEncContext *s)
+{
+    int ret, nb_jobs = 1;
+
+    if (avctx->active_thread_type & FF_THREAD_SLICE)
+        nb_jobs = FFMIN(s->channels, avctx->thread_count);
+    s->nb_slice_jobs = 1;
+    if (nb_jobs <= 1)
+        return 0;
+
+    s->slice_ctx = av_malloc_array(nb_jobs - 1, sizeof(*s->slice_ctx));
+    if (!s->slice_ctx)
+        return AVERROR(ENOMEM);
+    while (s->nb_slice_jobs < nb_jobs) {
+        AACEncContext *ctx = &s->slice_ctx[s->nb_slice_jobs - 1];
+
+        /* The copies share everything but the scratch areas, the
+         * quantization cache and the LPC context used by TNS. */
+        memcpy(ctx, s, sizeof(*ctx));
+        ctx->slice_ctx = NULL;
+        if ((ret = ff_lpc_init(&ctx->lpc, 2*avctx->frame_size, TNS_MAX_ORDER,
+                               FF_LPC_TYPE_LEVINSON)) < 0)
+            return ret;
+        s->nb_slice_jobs++;
+    }
+    return 0;
+}
+
 static av_cold int dsp_init(AVCodecContext *avctx, AACEncContext *s)
 {
     int ret = 0;
@@ -1112,6 +1202,9 @@ static av_cold int aac_encode_init(AVCodecContext *avctx)
 
     ff_af_queue_init(avctx, &s->afq);
 
+    if ((ret = alloc_slice_contexts(avctx, s)) < 0)
+        goto fail;
+
     return 0;
 fail:
     aac_encode_end(avctx);
@@ -1158,7 +1251,8 @@ AVCodec ff_aac_encoder = {
     .defaults       = aac_encode_defaults,
     .supported_samplerates = mpeg4audio_sample_rates,
     .caps_internal  = FF_CODEC_CAP_INIT_THREADSAFE,
-    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY,
+    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY |
+                      AV_CODEC_CAP_SLICE_THREADS,
     .sample_fmts    = (const enum AVSampleFormat[]){ AV_SAMPLE_FMT_FLTP,
                                                      AV_SAMPLE_FMT_NONE },
     .priv_class     = &aacenc_class,
@@ -418,6 +418,12 @@ typedef struct AACEncContext {
     struct {
         float *samples;
     } buffer;
+
+    struct AACEncContext *slice_ctx;             ///< contexts of the channel search jobs other than the first
+    int nb_slice_jobs;                           ///< number of channel search jobs run in parallel
+    SingleChannelElement *slice_sce[MAX_CHANNELS]; ///< channels to search, in coding order
+    int slice_alloc[MAX_CHANNELS];               ///< psy bit allocation of each channel
+    enum RawDataBlockType slice_type[MAX_CHANNELS]; ///< channel group type of each channel
 } AACEncContext;
 
 void ff_aac_dsp_init_x86(AACEncContext *s);
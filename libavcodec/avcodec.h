@@ -3357,6 +3357,28 @@ typedef struct AVCodecContext {
      * - encoding: unused
      */
     int discard_damaged_percentage;
+
+    /**
+     * Maximum number of frames that frame threading may hold back.
+     * A frame is held back only while it is still being decoded and at
+     * most this many frames are pending; delay is set to this bound.
+     * 0 means a fixed delay of thread_count - 1 frames.
+     *
+     * - decoding: set by user
+     * - encoding: unused
+     */
+    int max_frame_delay;
+
+    /**
+     * If nonzero, run the slice threads on a worker pool shared with all
+     * the other codec contexts and filtergraphs of the process that set
+     * this option, with at most this many worker threads in total.
+     * thread_count then limits how many of them this context uses at once.
+     *
+     * - encoding: set by user
+     * - decoding: set by user
+     */
+    int shared_threads;
 } AVCodecContext;
 
 #if FF_API_CODEC_GET_SET
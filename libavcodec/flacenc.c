@@ -117,7 +117,8 @@ typedef struct FlacEncodeContext {
     FlacFrame frame;
     CompressionOptions options;
     AVCodecContext *avctx;
-    LPCContext lpc_ctx;
+    LPCContext lpc_ctx[FLAC_MAX_CHANNELS];        ///< one per channel when channels are encoded in parallel
+    int nb_lpc_ctx;
     struct AVMD5 *md5ctx;
     uint8_t *md5_buffer;
     unsigned int md5_buffer_size;
@@ -454,8 +455,10 @@ FF_ENABLE_DEPRECATION_WARNINGS
         }
     }
 
-    ret = ff_lpc_init(&s->lpc_ctx, avctx->frame_size,
-                      s->options.max_prediction_order, FF_LPC_TYPE_LEVINSON);
+    s->nb_lpc_ctx = avctx->active_thread_type & FF_THREAD_SLICE ? channels : 1;
+    for (i = 0, ret = 0; i < s->nb_lpc_ctx && ret >= 0; i++)
+        ret = ff_lpc_init(&s->lpc_ctx[i], avctx->frame_size,
+                          s->options.max_prediction_order, FF_LPC_TYPE_LEVINSON);
 
     ff_bswapdsp_init(&s->bdsp);
     ff_flacdsp_init(&s->flac_dsp, avctx->sample_fmt, channels,
@@ -828,6 +831,7 @@ static int encode_residual_ch(FlacEncodeContext *s, int ch)
     int32_t coefs[MAX_LPC_ORDER][MAX_LPC_ORDER];
     int shift[MAX_LPC_ORDER];
     int32_t *res, *smp;
+    LPCContext *lpc = &s->lpc_ctx[ch % s->nb_lpc_ctx];
 
     frame = &s->frame;
     sub   = &frame->subframes[ch];
@@ -882,7 +886,7 @@ static int encode_residual_ch(FlacEncodeContext *s, int ch)
 
     /* LPC */
     sub->type = FLAC_SUBFRAME_LPC;
-    opt_order = ff_lpc_calc_coefs(&s->lpc_ctx, smp, n, min_order, max_order,
+    opt_order = ff_lpc_calc_coefs(lpc, smp, n, min_order, max_order,
                                   s->options.lpc_coeff_precision, coefs, shift, s->options.lpc_type,
                                   s->options.lpc_passes, omethod,
                                   MIN_LPC_SHIFT, MAX_LPC_SHIFT, 0);
@@ -1054,15 +1058,26 @@ static int count_frame_header(FlacEncodeContext *s)
 }
 
 
+static int encode_residual_job(AVCodecContext *avctx, void *arg, int ch, int threadnr)
+{
+    FlacEncodeContext *s = avctx->priv_data;
+
+    return encode_residual_ch(s, ch);
+}
+
+
 static int encode_frame(FlacEncodeContext *s)
 {
-    int ch;
+    int ch, bits[FLAC_MAX_CHANNELS];
     uint64_t count;
 
     count = count_frame_header(s);
 
+    /* subframes are independent, each channel can be searched on its own
+     * thread with its own LPC context */
+    s->avctx->execute2(s->avctx, encode_residual_job, NULL, bits, s->channels);
     for (ch = 0; ch < s->channels; ch++)
-        count += encode_residual_ch(s, ch);
+        count += bits[ch];
 
     count += (8 - (count & 7)) & 7; // byte alignment
     count += 16;                    // CRC-16
@@ -1451,9 +1466,11 @@ static av_cold int flac_encode_close(AVCodecContext *avctx)
 {
     if (avctx->priv_data) {
         FlacEncodeContext *s = avctx->priv_data;
+        int i;
         av_freep(&s->md5ctx);
         av_freep(&s->md5_buffer);
-        ff_lpc_end(&s->lpc_ctx);
+        for (i = 0; i < s->nb_lpc_ctx; i++)
+            ff_lpc_end(&s->lpc_ctx[i]);
     }
     av_freep(&avctx->extradata);
     avctx->extradata_size = 0;
@@ -1508,7 +1525,8 @@ AVCodec ff_flac_encoder = {
     .init           = flac_encode_init,
     .encode2        = flac_encode_frame,
     .close          = flac_encode_close,
-    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY | AV_CODEC_CAP_LOSSLESS,
+    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY | AV_CODEC_CAP_LOSSLESS |
+                      AV_CODEC_CAP_SLICE_THREADS,
     .sample_fmts    = (const enum AVSampleFormat[]){ AV_SAMPLE_FMT_S16,
                                                      AV_SAMPLE_FMT_S32,
                                                      AV_SAMPLE_FMT_NONE },
@@ -3301,7 +3301,7 @@ static av_cold int hevc_decode_free(AVCodecContext *avctx)
     av_freep(&s->sh.offset);
     av_freep(&s->sh.size);
 
-    for (i = 1; i < s->threads_number; i++) {
+    for (i = 1; i < FF_ARRAY_ELEMS(s->HEVClcList); i++) {
         HEVCLocalContext *lc = s->HEVClcList[i];
         if (lc) {
             av_freep(&s->HEVClcList[i]);
@@ -3431,7 +3431,7 @@ static int hevc_update_thread_context(AVCodecContext *dst,
     s->is_nalff        = s0->is_nalff;
     s->nal_length_size = s0->nal_length_size;
 
-    s->threads_number      = s0->threads_number;
+    s->threads_number      = FFMIN(s->threads_number, s0->threads_number);
     s->threads_type        = s0->threads_type;
 
     if (s0->eos) {
@@ -3468,8 +3468,14 @@ static av_cold int hevc_decode_init(AVCodecContext *avctx)
 
     if(avctx->active_thread_type & FF_THREAD_SLICE)
         s->threads_number = avctx->thread_count;
-    else
-        s->threads_number = 1;
+    else {
+        ret = ff_slice_thread_init_hybrid(avctx, s->wpp_threads);
+        if (ret < 0) {
+            hevc_decode_free(avctx);
+            return ret;
+        }
+        s->threads_number = ret;
+    }
 
     if (avctx->extradata_size > 0 && avctx->extradata) {
         ret = hevc_decode_extradata(s, avctx->extradata, avctx->extradata_size, 1);
@@ -3491,6 +3497,7 @@ static av_cold int hevc_decode_init(AVCodecContext *avctx)
 static av_cold int hevc_init_thread_copy(AVCodecContext *avctx)
 {
     HEVCContext *s = avctx->priv_data;
+    int wpp_threads = s->wpp_threads;
     int ret;
 
     memset(s, 0, sizeof(*s));
@@ -3499,6 +3506,12 @@ static av_cold int hevc_init_thread_copy(AVCodecContext *avctx)
     if (ret < 0)
         return ret;
 
+    ret = ff_slice_thread_init_hybrid(avctx, wpp_threads);
+    if (ret < 0)
+        return ret;
+    s->wpp_threads    = wpp_threads;
+    s->threads_number = ret;
+
     return 0;
 }
 #endif
@@ -3519,6 +3532,8 @@ static const AVOption options[] = {
         AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, PAR },
     { "strict-displaywin", "stricly apply default display window size", OFFSET(apply_defdispwin),
         AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, PAR },
+    { "wpp_threads", "number of threads decoding WPP rows of each frame with frame threading", OFFSET(wpp_threads),
+        AV_OPT_TYPE_INT, {.i64 = 0}, 0, MAX_NB_THREADS, PAR },
     { NULL },
 };
 
@@ -162,6 +162,12 @@ typedef struct AVCodecInternal {
 
     void *thread_ctx;
 
+    /**
+     * Slice threading context of a frame thread, for decoders that split
+     * each frame into slices on top of frame threading.
+     */
+    void *slice_thread_ctx;
+
     DecodeSimpleContext ds;
     DecodeFilterContext filter;
 
@@ -102,6 +102,14 @@ typedef struct {
    Jpeg2000Component *comp;
 } Jpeg2000Tile;
 
+typedef struct {
+    Jpeg2000Component *comp;
+    Jpeg2000Band *band;
+    Jpeg2000Cblk *cblk;
+    int x0, x1, y0, y1; ///< code-block area in the DWT output of comp
+    int bandpos, lev;
+} Jpeg2000CblkJob;
+
 typedef struct {
     AVClass *class;
     AVCodecContext *avctx;
@@ -126,6 +134,9 @@ typedef struct {
     Jpeg2000QuantStyle  qntsty;
 
     Jpeg2000Tile *tile;
+    Jpeg2000CblkJob *cblk_job;
+    int nb_cblk_jobs;
+    int *job_ret; ///< return value of each DWT or code-block job
 
     int format;
     int pred;
@@ -396,6 +407,80 @@ static uint8_t *put_sot(Jpeg2000EncoderContext *s, int tileno)
     return psotptr;
 }
 
+/**
+ * list the code-blocks of all tile-components as tier-1 jobs
+ */
+static int init_cblk_jobs(Jpeg2000EncoderContext *s)
+{
+    int tileno, compno, reslevelno, bandno, pass;
+    Jpeg2000CodingStyle *codsty = &s->codsty;
+    Jpeg2000CblkJob *job = NULL;
+
+    for (pass = 0; pass < 2; pass++){
+        s->nb_cblk_jobs = 0;
+        for (tileno = 0; tileno < s->numXtiles * s->numYtiles; tileno++){
+            for (compno = 0; compno < s->ncomponents; compno++){
+                Jpeg2000Component *comp = s->tile[tileno].comp + compno;
+
+                for (reslevelno = 0; reslevelno < codsty->nreslevels; reslevelno++){
+                    Jpeg2000ResLevel *reslevel = comp->reslevel + reslevelno;
+
+                    for (bandno = 0; bandno < reslevel->nbands ; bandno++){
+                        Jpeg2000Band *band = reslevel->band + bandno;
+                        Jpeg2000Prec *prec = band->prec; // we support only 1 precinct per band ATM in the encoder
+                        int cblkx, cblky, cblkno=0, xx0, x0, xx1, y0, yy0, yy1;
+                        yy0 = bandno == 0 ? 0 : comp->reslevel[reslevelno-1].coord[1][1] - comp->reslevel[reslevelno-1].coord[1][0];
+                        y0 = yy0;
+                        yy1 = FFMIN(ff_jpeg2000_ceildivpow2(band->coord[1][0] + 1, band->log2_cblk_height) << band->log2_cblk_height,
+                                    band->coord[1][1]) - band->coord[1][0] + yy0;
+
+                        if (band->coord[0][0] == band->coord[0][1] || band->coord[1][0] == band->coord[1][1])
+                            continue;
+
+                        for (cblky = 0; cblky < prec->nb_codeblocks_height; cblky++){
+                            if (reslevelno == 0 || bandno == 1)
+                                xx0 = 0;
+                            else
+                                xx0 = comp->reslevel[reslevelno-1].coord[0][1] - comp->reslevel[reslevelno-1].coord[0][0];
+                            x0 = xx0;
+                            xx1 = FFMIN(ff_jpeg2000_ceildivpow2(band->coord[0][0] + 1, band->log2_cblk_width) << band->log2_cblk_width,
+                                        band->coord[0][1]) - band->coord[0][0] + xx0;
+
+                            for (cblkx = 0; cblkx < prec->nb_codeblocks_width; cblkx++, cblkno++){
+                                if (job){
+                                    job->comp    = comp;
+                                    job->band    = band;
+                                    job->cblk    = prec->cblk + cblkno;
+                                    job->x0      = xx0;
+                                    job->x1      = xx1;
+                                    job->y0      = yy0;
+                                    job->y1      = yy1;
+                                    job->bandpos = bandno + (reslevelno > 0);
+                                    job->lev     = codsty->nreslevels - reslevelno - 1;
+                                    job++;
+                                }
+                                s->nb_cblk_jobs++;
+                                xx0 = xx1;
+                                xx1 = FFMIN(xx1 + (1 << band->log2_cblk_width), band->coord[0][1] - band->coord[0][0] + x0);
+                            }
+                            yy0 = yy1;
+                            yy1 = FFMIN(yy1 + (1 << band->log2_cblk_height), band->coord[1][1] - band->coord[1][0] + y0);
+                        }
+                    }
+                }
+            }
+        }
+        if (!pass){
+            s->cblk_job = job = av_malloc_array(s->nb_cblk_jobs, sizeof(*s->cblk_job));
+            s->job_ret  = av_malloc_array(FFMAX(s->nb_cblk_jobs, s->numXtiles * s->numYtiles * s->ncomponents),
+                                          sizeof(*s->job_ret));
+            if (!s->cblk_job || !s->job_ret)
+                return AVERROR(ENOMEM);
+        }
+    }
+    return 0;
+}
+
 /**
  * compute the sizes of tiles, resolution levels, bands, etc.
  * allocate memory for them
@@ -410,7 +495,7 @@ static int init_tiles(Jpeg2000EncoderContext *s)
     s->numXtiles = ff_jpeg2000_ceildiv(s->width, s->tile_width);
     s->numYtiles = ff_jpeg2000_ceildiv(s->height, s->tile_height);
 
-    s->tile = av_malloc_array(s->numXtiles, s->numYtiles * sizeof(Jpeg2000Tile));
+    s->tile = av_mallocz_array(s->numXtiles, s->numYtiles * sizeof(Jpeg2000Tile));
     if (!s->tile)
         return AVERROR(ENOMEM);
     for (tileno = 0, tiley = 0; tiley < s->numYtiles; tiley++)
@@ -444,7 +529,7 @@ static int init_tiles(Jpeg2000EncoderContext *s)
                     return ret;
             }
         }
-    return 0;
+    return init_cblk_jobs(s);
 }
 
 static void copy_frame(Jpeg2000EncoderContext *s)
@@ -638,7 +723,7 @@ static void encode_clnpass(Jpeg2000T1Context *t1, int width, int height, int ban
         }
 }
 
-static void encode_cblk(Jpeg2000EncoderContext *s, Jpeg2000T1Context *t1, Jpeg2000Cblk *cblk, Jpeg2000Tile *tile,
+static void encode_cblk(Jpeg2000EncoderContext *s, Jpeg2000T1Context *t1, Jpeg2000Cblk *cblk,
                         int width, int height, int bandpos, int lev)
 {
     int pass_t = 2, passno, x, y, max=0, nmsedec, bpno;
@@ -851,119 +936,63 @@ static int getcut(Jpeg2000Cblk *cblk, int64_t lambda, int dwt_norm)
     return res;
 }
 
-static void truncpasses(Jpeg2000EncoderContext *s, Jpeg2000Tile *tile)
+/**
+ * DWT of one tile-component. The components do not share any data, so this
+ * runs on all of them concurrently.
+ */
+static int dwt_job(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
 {
-    int precno, compno, reslevelno, bandno, cblkno, lev;
-    Jpeg2000CodingStyle *codsty = &s->codsty;
-
-    for (compno = 0; compno < s->ncomponents; compno++){
-        Jpeg2000Component *comp = tile->comp + compno;
-
-        for (reslevelno = 0, lev = codsty->nreslevels-1; reslevelno < codsty->nreslevels; reslevelno++, lev--){
-            Jpeg2000ResLevel *reslevel = comp->reslevel + reslevelno;
-
-            for (precno = 0; precno < reslevel->num_precincts_x * reslevel->num_precincts_y; precno++){
-                for (bandno = 0; bandno < reslevel->nbands ; bandno++){
-                    int bandpos = bandno + (reslevelno > 0);
-                    Jpeg2000Band *band = reslevel->band + bandno;
-                    Jpeg2000Prec *prec = band->prec + precno;
-
-                    for (cblkno = 0; cblkno < prec->nb_codeblocks_height * prec->nb_codeblocks_width; cblkno++){
-                        Jpeg2000Cblk *cblk = prec->cblk + cblkno;
+    Jpeg2000EncoderContext *s = avctx->priv_data;
+    Jpeg2000Component *comp = s->tile[jobnr / s->ncomponents].comp + jobnr % s->ncomponents;
 
-                        cblk->ninclpasses = getcut(cblk, s->lambda,
-                                (int64_t)dwt_norms[codsty->transform == FF_DWT53][bandpos][lev] * (int64_t)band->i_stepsize >> 15);
-                    }
-                }
-            }
-        }
-    }
+    return ff_dwt_encode(&comp->dwt, comp->i_data);
 }
 
-static int encode_tile(Jpeg2000EncoderContext *s, Jpeg2000Tile *tile, int tileno)
+/**
+ * Tier-1 coding and pass truncation of one code-block, which only read the
+ * DWT output and write to the code-block itself.
+ */
+static int encode_cblk_job(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
 {
-    int compno, reslevelno, bandno, ret;
-    Jpeg2000T1Context t1;
+    Jpeg2000EncoderContext *s = avctx->priv_data;
+    Jpeg2000CblkJob *job = s->cblk_job + jobnr;
+    Jpeg2000Component *comp = job->comp;
+    Jpeg2000Band *band = job->band;
+    Jpeg2000Cblk *cblk = job->cblk;
     Jpeg2000CodingStyle *codsty = &s->codsty;
-    for (compno = 0; compno < s->ncomponents; compno++){
-        Jpeg2000Component *comp = s->tile[tileno].comp + compno;
-
-        t1.stride = (1<<codsty->log2_cblk_width) + 2;
-
-        av_log(s->avctx, AV_LOG_DEBUG,"dwt\n");
-        if ((ret = ff_dwt_encode(&comp->dwt, comp->i_data)) < 0)
-            return ret;
-        av_log(s->avctx, AV_LOG_DEBUG,"after dwt -> tier1\n");
+    Jpeg2000T1Context t1;
+    int y, x, w = comp->coord[0][1] - comp->coord[0][0];
 
-        for (reslevelno = 0; reslevelno < codsty->nreslevels; reslevelno++){
-            Jpeg2000ResLevel *reslevel = comp->reslevel + reslevelno;
-
-            for (bandno = 0; bandno < reslevel->nbands ; bandno++){
-                Jpeg2000Band *band = reslevel->band + bandno;
-                Jpeg2000Prec *prec = band->prec; // we support only 1 precinct per band ATM in the encoder
-                int cblkx, cblky, cblkno=0, xx0, x0, xx1, y0, yy0, yy1, bandpos;
-                yy0 = bandno == 0 ? 0 : comp->reslevel[reslevelno-1].coord[1][1] - comp->reslevel[reslevelno-1].coord[1][0];
-                y0 = yy0;
-                yy1 = FFMIN(ff_jpeg2000_ceildivpow2(band->coord[1][0] + 1, band->log2_cblk_height) << band->log2_cblk_height,
-                            band->coord[1][1]) - band->coord[1][0] + yy0;
-
-                if (band->coord[0][0] == band->coord[0][1] || band->coord[1][0] == band->coord[1][1])
-                    continue;
+    t1.stride = (1<<codsty->log2_cblk_width) + 2;
 
-                bandpos = bandno + (reslevelno > 0);
-
-                for (cblky = 0; cblky < prec->nb_codeblocks_height; cblky++){
-                    if (reslevelno == 0 || bandno == 1)
-                        xx0 = 0;
-                    else
-                        xx0 = comp->reslevel[reslevelno-1].coord[0][1] - comp->reslevel[reslevelno-1].coord[0][0];
-                    x0 = xx0;
-                    xx1 = FFMIN(ff_jpeg2000_ceildivpow2(band->coord[0][0] + 1, band->log2_cblk_width) << band->log2_cblk_width,
-                                band->coord[0][1]) - band->coord[0][0] + xx0;
-
-                    for (cblkx = 0; cblkx < prec->nb_codeblocks_width; cblkx++, cblkno++){
-                        int y, x;
-                        if (codsty->transform == FF_DWT53){
-                            for (y = yy0; y < yy1; y++){
-                                int *ptr = t1.data + (y-yy0)*t1.stride;
-                                for (x = xx0; x < xx1; x++){
-                                    *ptr++ = comp->i_data[(comp->coord[0][1] - comp->coord[0][0]) * y + x] << NMSEDEC_FRACBITS;
-                                }
-                            }
-                        } else{
-                            for (y = yy0; y < yy1; y++){
-                                int *ptr = t1.data + (y-yy0)*t1.stride;
-                                for (x = xx0; x < xx1; x++){
-                                    *ptr = (comp->i_data[(comp->coord[0][1] - comp->coord[0][0]) * y + x]);
-                                    *ptr = (int64_t)*ptr * (int64_t)(16384 * 65536 / band->i_stepsize) >> 15 - NMSEDEC_FRACBITS;
-                                    ptr++;
-                                }
-                            }
-                        }
-                        if (!prec->cblk[cblkno].data)
-                            prec->cblk[cblkno].data = av_malloc(1 + 8192);
-                        if (!prec->cblk[cblkno].passes)
-                            prec->cblk[cblkno].passes = av_malloc_array(JPEG2000_MAX_PASSES, sizeof (*prec->cblk[cblkno].passes));
-                        if (!prec->cblk[cblkno].data || !prec->cblk[cblkno].passes)
-                            return AVERROR(ENOMEM);
-                        encode_cblk(s, &t1, prec->cblk + cblkno, tile, xx1 - xx0, yy1 - yy0,
-                                    bandpos, codsty->nreslevels - reslevelno - 1);
-                        xx0 = xx1;
-                        xx1 = FFMIN(xx1 + (1 << band->log2_cblk_width), band->coord[0][1] - band->coord[0][0] + x0);
-                    }
-                    yy0 = yy1;
-                    yy1 = FFMIN(yy1 + (1 << band->log2_cblk_height), band->coord[1][1] - band->coord[1][0] + y0);
-                }
+    if (codsty->transform == FF_DWT53){
+        for (y = job->y0; y < job->y1; y++){
+            int *ptr = t1.data + (y-job->y0)*t1.stride;
+            for (x = job->x0; x < job->x1; x++){
+                *ptr++ = comp->i_data[w * y + x] << NMSEDEC_FRACBITS;
+            }
+        }
+    } else{
+        for (y = job->y0; y < job->y1; y++){
+            int *ptr = t1.data + (y-job->y0)*t1.stride;
+            for (x = job->x0; x < job->x1; x++){
+                *ptr = (comp->i_data[w * y + x]);
+                *ptr = (int64_t)*ptr * (int64_t)(16384 * 65536 / band->i_stepsize) >> 15 - NMSEDEC_FRACBITS;
+                ptr++;
             }
         }
-        av_log(s->avctx, AV_LOG_DEBUG, "after tier1\n");
     }
+    if (!cblk->data)
+        cblk->data = av_malloc(1 + 8192);
+    if (!cblk->passes)
+        cblk->passes = av_malloc_array(JPEG2000_MAX_PASSES, sizeof (*cblk->passes));
+    if (!cblk->data || !cblk->passes)
+        return AVERROR(ENOMEM);
+    encode_cblk(s, &t1, cblk, job->x1 - job->x0, job->y1 - job->y0,
+                job->bandpos, job->lev);
 
-    av_log(s->avctx, AV_LOG_DEBUG, "rate control\n");
-    truncpasses(s, tile);
-    if ((ret = encode_packets(s, tile, tileno)) < 0)
-        return ret;
-    av_log(s->avctx, AV_LOG_DEBUG, "after rate control\n");
+    cblk->ninclpasses = getcut(cblk, s->lambda,
+            (int64_t)dwt_norms[codsty->transform == FF_DWT53][job->bandpos][job->lev] * (int64_t)band->i_stepsize >> 15);
     return 0;
 }
 
@@ -972,14 +1001,16 @@ static void cleanup(Jpeg2000EncoderContext *s)
     int tileno, compno;
     Jpeg2000CodingStyle *codsty = &s->codsty;
 
-    for (tileno = 0; tileno < s->numXtiles * s->numYtiles; tileno++){
-        for (compno = 0; compno < s->ncomponents; compno++){
+    for (tileno = 0; s->tile && tileno < s->numXtiles * s->numYtiles; tileno++){
+        for (compno = 0; s->tile[tileno].comp && compno < s->ncomponents; compno++){
             Jpeg2000Component *comp = s->tile[tileno].comp + compno;
             ff_jpeg2000_cleanup(comp, codsty);
         }
         av_freep(&s->tile[tileno].comp);
     }
     av_freep(&s->tile);
+    av_freep(&s->cblk_job);
+    av_freep(&s->job_ret);
 }
 
 static void reinit(Jpeg2000EncoderContext *s)
@@ -1000,7 +1031,7 @@ static void update_size(uint8_t *size, const uint8_t *end)
 static int encode_frame(AVCodecContext *avctx, AVPacket *pkt,
                         const AVFrame *pict, int *got_packet)
 {
-    int tileno, ret;
+    int tileno, i, ret;
     Jpeg2000EncoderContext *s = avctx->priv_data;
     uint8_t *chunkstart, *jp2cstart, *jp2hstart;
 
@@ -1064,7 +1095,6 @@ static int encode_frame(AVCodecContext *avctx, AVPacket *pkt,
         }
         update_size(chunkstart, s->buf);
         if (avctx->pix_fmt == AV_PIX_FMT_PAL8) {
-            int i;
             uint8_t *palette = pict->data[1];
             chunkstart = s->buf;
             bytestream_put_be32(&s->buf, 0);
@@ -1106,6 +1136,19 @@ static int encode_frame(AVCodecContext *avctx, AVPacket *pkt,
     if ((ret = put_com(s, 0)) < 0)
         return ret;
 
+    av_log(s->avctx, AV_LOG_DEBUG, "dwt\n");
+    avctx->execute2(avctx, dwt_job, NULL, s->job_ret,
+                    s->numXtiles * s->numYtiles * s->ncomponents);
+    for (i = 0; i < s->numXtiles * s->numYtiles * s->ncomponents; i++)
+        if (s->job_ret[i] < 0)
+            return s->job_ret[i];
+
+    av_log(s->avctx, AV_LOG_DEBUG, "tier1 and rate control\n");
+    avctx->execute2(avctx, encode_cblk_job, NULL, s->job_ret, s->nb_cblk_jobs);
+    for (i = 0; i < s->nb_cblk_jobs; i++)
+        if (s->job_ret[i] < 0)
+            return s->job_ret[i];
+
     for (tileno = 0; tileno < s->numXtiles * s->numYtiles; tileno++){
         uint8_t *psotptr;
         if (!(psotptr = put_sot(s, tileno)))
@@ -1113,7 +1156,7 @@ static int encode_frame(AVCodecContext *avctx, AVPacket *pkt,
         if (s->buf_end - s->buf < 2)
             return -1;
         bytestream_put_be16(&s->buf, JPEG2000_SOD);
-        if ((ret = encode_tile(s, s->tile + tileno, tileno)) < 0)
+        if ((ret = encode_packets(s, s->tile + tileno, tileno)) < 0)
             return ret;
         bytestream_put_be32(&psotptr, s->buf - psotptr + 6);
     }
@@ -1250,6 +1293,8 @@ AVCodec ff_jpeg2000_encoder = {
     .init           = j2kenc_init,
     .encode2        = encode_frame,
     .close          = j2kenc_destroy,
+    .capabilities   = AV_CODEC_CAP_SLICE_THREADS,
+    .caps_internal  = FF_CODEC_CAP_INIT_CLEANUP,
     .pix_fmts       = (const enum AVPixelFormat[]) {
         AV_PIX_FMT_RGB24, AV_PIX_FMT_YUV444P, AV_PIX_FMT_GRAY8,
         AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV422P,
@@ -45,6 +45,7 @@
 #include "jpeglsdec.h"
 #include "profiles.h"
 #include "put_bits.h"
+#include "thread.h"
 #include "tiff.h"
 #include "exif.h"
 #include "bytestream.h"
@@ -116,6 +117,35 @@ static int init_default_huffman_tables(MJpegDecodeContext *s)
     return 0;
 }
 
+/* rebuild the VLCs of table class/index from the raw DHT contents */
+static int init_huffman_table_from_raw(MJpegDecodeContext *s, int class, int index)
+{
+    uint8_t bits_table[17] = { 0 };
+    const uint8_t *val_table = s->raw_huffman_values[class][index];
+    int i, n = 0, code_max = 0, ret;
+
+    for (i = 1; i <= 16; i++) {
+        bits_table[i] = s->raw_huffman_lengths[class][index][i - 1];
+        n += bits_table[i];
+    }
+    ff_free_vlc(&s->vlcs[class][index]);
+    if (class > 0)
+        ff_free_vlc(&s->vlcs[2][index]);
+    if (!n || n > 256)
+        return 0;
+
+    for (i = 0; i < n; i++)
+        code_max = FFMAX(code_max, val_table[i]);
+
+    if ((ret = build_vlc(&s->vlcs[class][index], bits_table, val_table,
+                         code_max + 1, 0, class > 0)) < 0)
+        return ret;
+    if (class > 0)
+        return build_vlc(&s->vlcs[2][index], bits_table, val_table,
+                         code_max + 1, 0, 0);
+    return 0;
+}
+
 static void parse_avid(MJpegDecodeContext *s, uint8_t *buf, int len)
 {
     s->buggy_avid = 1;
@@ -192,9 +222,143 @@ av_cold int ff_mjpeg_decode_init(AVCodecContext *avctx)
     if (avctx->codec->id == AV_CODEC_ID_AMV)
         s->flipped = 1;
 
+    if (avctx->active_thread_type & FF_THREAD_SLICE) {
+        s->slice_blocks = av_malloc_array(avctx->thread_count, sizeof(*s->slice_blocks));
+        s->slice_ret    = av_malloc_array(avctx->thread_count, sizeof(*s->slice_ret));
+        if (!s->slice_blocks || !s->slice_ret)
+            return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
+#if HAVE_THREADS
+static int mjpeg_decode_init_thread_copy(AVCodecContext *avctx)
+{
+    MJpegDecodeContext *s = avctx->priv_data;
+    int i, j, ret;
+
+    s->avctx          = avctx;
+    s->picture        = av_frame_alloc();
+    s->picture_ptr    = s->picture;
+    s->buffer         = NULL;
+    s->buffer_size    = 0;
+    s->ljpeg_buffer   = NULL;
+    s->ljpeg_buffer_size = 0;
+    s->restart_offsets   = NULL;
+    s->restart_offsets_size = 0;
+    s->nb_restart_offsets   = 0;
+    s->slice_blocks   = NULL;
+    s->slice_ret      = NULL;
+    s->exif_metadata  = NULL;
+    s->stereo3d       = NULL;
+    s->iccdata        = NULL;
+    s->iccdatalens    = NULL;
+    s->iccnum         = 0;
+    s->hwaccel_picture_private = NULL;
+    memset(s->blocks,   0, sizeof(s->blocks));
+    memset(s->last_nnz, 0, sizeof(s->last_nnz));
+    memset(s->vlcs,     0, sizeof(s->vlcs));
+    if (!s->picture)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < 2; i++)
+        for (j = 0; j < 4; j++)
+            if ((ret = init_huffman_table_from_raw(s, i, j)) < 0)
+                return ret;
+
     return 0;
 }
 
+static int mjpeg_update_thread_context(AVCodecContext *dst, const AVCodecContext *src)
+{
+    MJpegDecodeContext *s = dst->priv_data, *s1 = src->priv_data;
+    int i, j, ret;
+
+    if (dst == src)
+        return 0;
+
+    /* state a packet leaves behind for the following ones; everything else
+     * is set up again by the markers of each packet */
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 4; j++) {
+            if (!memcmp(s->raw_huffman_lengths[i][j], s1->raw_huffman_lengths[i][j], 16) &&
+                !memcmp(s->raw_huffman_values[i][j],  s1->raw_huffman_values[i][j],  256))
+                continue;
+            memcpy(s->raw_huffman_lengths[i][j], s1->raw_huffman_lengths[i][j], 16);
+            memcpy(s->raw_huffman_values[i][j],  s1->raw_huffman_values[i][j],  256);
+            if ((ret = init_huffman_table_from_raw(s, i, j)) < 0)
+                return ret;
+        }
+    }
+    memcpy(s->quant_matrixes, s1->quant_matrixes, sizeof(s->quant_matrixes));
+    memcpy(s->qscale,         s1->qscale,         sizeof(s->qscale));
+
+    s->org_height         = s1->org_height;
+    s->first_picture      = s1->first_picture;
+    s->interlaced         = s1->interlaced;
+    s->bottom_field       = s1->bottom_field;
+    s->lossless           = s1->lossless;
+    s->ls                 = s1->ls;
+    s->progressive        = s1->progressive;
+    s->rgb                = s1->rgb;
+    s->rct                = s1->rct;
+    s->pegasus_rct        = s1->pegasus_rct;
+    s->bits               = s1->bits;
+    s->colr               = s1->colr;
+    s->xfrm               = s1->xfrm;
+    s->maxval             = s1->maxval;
+    s->near               = s1->near;
+    s->t1                 = s1->t1;
+    s->t2                 = s1->t2;
+    s->t3                 = s1->t3;
+    s->reset              = s1->reset;
+    s->palette_index      = s1->palette_index;
+    s->width              = s1->width;
+    s->height             = s1->height;
+    s->nb_components      = s1->nb_components;
+    s->h_max              = s1->h_max;
+    s->v_max              = s1->v_max;
+    memcpy(s->component_id, s1->component_id, sizeof(s->component_id));
+    memcpy(s->h_count,      s1->h_count,      sizeof(s->h_count));
+    memcpy(s->v_count,      s1->v_count,      sizeof(s->v_count));
+    memcpy(s->quant_index,  s1->quant_index,  sizeof(s->quant_index));
+    memcpy(s->linesize,     s1->linesize,     sizeof(s->linesize));
+    s->restart_interval   = s1->restart_interval;
+    s->buggy_avid         = s1->buggy_avid;
+    s->cs_itu601          = s1->cs_itu601;
+    s->interlace_polarity = s1->interlace_polarity;
+    s->multiscope         = s1->multiscope;
+    s->mjpb_skiptosod     = s1->mjpb_skiptosod;
+    s->flipped            = s1->flipped;
+    s->pix_desc           = s1->pix_desc;
+    s->hwaccel_sw_pix_fmt = s1->hwaccel_sw_pix_fmt;
+    s->hwaccel_pix_fmt    = s1->hwaccel_pix_fmt;
+
+    /* intra-only codecs do not get the frame parameters copied */
+    if ((ret = ff_set_dimensions(dst, src->coded_width, src->coded_height)) < 0)
+        return ret;
+    dst->pix_fmt             = src->pix_fmt;
+    dst->sample_aspect_ratio = src->sample_aspect_ratio;
+
+    /* interlaced packets finish setup only once they have been decoded
+     * completely, a single field is continued by the next packet */
+    av_frame_unref(s->picture_ptr);
+    if (s1->interlaced && s1->got_picture) {
+        if ((ret = av_frame_ref(s->picture_ptr, s1->picture_ptr)) < 0)
+            return ret;
+        s->got_picture = 1;
+        s->cur_scan    = s1->cur_scan;
+    } else {
+        s->got_picture = 0;
+        s->cur_scan    = 0;
+    }
+
+    return 0;
+}
+#endif
+
+
 
 /* quantize tables */
 int ff_mjpeg_decode_dqt(MJpegDecodeContext *s)
@@ -306,6 +470,7 @@ int ff_mjpeg_decode_sof(MJpegDecodeContext *s)
 {
     int len, nb_components, i, width, height, bits, ret, size_change;
     unsigned pix_fmt_id;
+    ThreadFrame tframe = { 0 };
     int h_count[MAX_COMPONENTS] = { 0 };
     int v_count[MAX_COMPONENTS] = { 0 };
 
@@ -703,7 +868,8 @@ unk_pixfmt:
     }
 
     av_frame_unref(s->picture_ptr);
-    if (ff_get_buffer(s->avctx, s->picture_ptr, AV_GET_BUFFER_FLAG_REF) < 0)
+    tframe.f = s->picture_ptr;
+    if (ff_thread_get_buffer(s->avctx, &tframe, AV_GET_BUFFER_FLAG_REF) < 0)
         return -1;
     s->picture_ptr->pict_type = AV_PICTURE_TYPE_I;
     s->picture_ptr->key_frame = 1;
@@ -756,10 +922,11 @@ unk_pixfmt:
     return 0;
 }
 
-static inline int mjpeg_decode_dc(MJpegDecodeContext *s, int dc_index)
+static inline int mjpeg_decode_dc(MJpegDecodeContext *s, GetBitContext *gb,
+                                  int dc_index)
 {
     int code;
-    code = get_vlc2(&s->gb, s->vlcs[0][dc_index].table, 9, 2);
+    code = get_vlc2(gb, s->vlcs[0][dc_index].table, 9, 2);
     if (code < 0 || code > 16) {
         av_log(s->avctx, AV_LOG_WARNING,
                "mjpeg_decode_dc: bad vlc: %d:%d (%p)\n",
@@ -768,47 +935,48 @@ static inline int mjpeg_decode_dc(MJpegDecodeContext *s, int dc_index)
     }
 
     if (code)
-        return get_xbits(&s->gb, code);
+        return get_xbits(gb, code);
     else
         return 0;
 }
 
 /* decode block and dequantize */
-static int decode_block(MJpegDecodeContext *s, int16_t *block, int component,
+static int decode_block(MJpegDecodeContext *s, GetBitContext *gb,
+                        int *last_dc, int16_t *block, int component,
                         int dc_index, int ac_index, uint16_t *quant_matrix)
 {
     int code, i, j, level, val;
 
     /* DC coef */
-    val = mjpeg_decode_dc(s, dc_index);
+    val = mjpeg_decode_dc(s, gb, dc_index);
     if (val == 0xfffff) {
         av_log(s->avctx, AV_LOG_ERROR, "error dc\n");
         return AVERROR_INVALIDDATA;
     }
-    val = val * (unsigned)quant_matrix[0] + s->last_dc[component];
+    val = val * (unsigned)quant_matrix[0] + last_dc[component];
     val = av_clip_int16(val);
-    s->last_dc[component] = val;
+    last_dc[component] = val;
     block[0] = val;
     /* AC coefs */
     i = 0;
-    {OPEN_READER(re, &s->gb);
+    {OPEN_READER(re, gb);
     do {
-        UPDATE_CACHE(re, &s->gb);
-        GET_VLC(code, re, &s->gb, s->vlcs[1][ac_index].table, 9, 2);
+        UPDATE_CACHE(re, gb);
+        GET_VLC(code, re, gb, s->vlcs[1][ac_index].table, 9, 2);
 
         i += ((unsigned)code) >> 4;
             code &= 0xf;
         if (code) {
             if (code > MIN_CACHE_BITS - 16)
-                UPDATE_CACHE(re, &s->gb);
+                UPDATE_CACHE(re, gb);
 
             {
-                int cache = GET_CACHE(re, &s->gb);
+                int cache = GET_CACHE(re, gb);
                 int sign  = (~cache) >> 31;
                 level     = (NEG_USR32(sign ^ cache,code) ^ sign) - sign;
             }
 
-            LAST_SKIP_BITS(re, &s->gb, code);
+            LAST_SKIP_BITS(re, gb, code);
 
             if (i > 63) {
                 av_log(s->avctx, AV_LOG_ERROR, "error count: %d\n", i);
@@ -818,24 +986,25 @@ static int decode_block(MJpegDecodeContext *s, int16_t *block, int component,
             block[j] = level * quant_matrix[i];
         }
     } while (i < 63);
-    CLOSE_READER(re, &s->gb);}
+    CLOSE_READER(re, gb);}
 
     return 0;
 }
 
-static int decode_dc_progressive(MJpegDecodeContext *s, int16_t *block,
+static int decode_dc_progressive(MJpegDecodeContext *s, GetBitContext *gb,
+                                 int *last_dc, int16_t *block,
                                  int component, int dc_index,
                                  uint16_t *quant_matrix, int Al)
 {
     unsigned val;
     s->bdsp.clear_block(block);
-    val = mjpeg_decode_dc(s, dc_index);
+    val = mjpeg_decode_dc(s, gb, dc_index);
     if (val == 0xfffff) {
         av_log(s->avctx, AV_LOG_ERROR, "error dc\n");
         return AVERROR_INVALIDDATA;
     }
-    val = (val * (quant_matrix[0] << Al)) + s->last_dc[component];
-    s->last_dc[component] = val;
+    val = (val * (quant_matrix[0] << Al)) + last_dc[component];
+    last_dc[component] = val;
     block[0] = val;
     return 0;
 }
@@ -1005,34 +1174,35 @@ static int decode_block_refinement(MJpegDecodeContext *s, int16_t *block,
 #undef REFINE_BIT
 #undef ZERO_RUN
 
-static int handle_rstn(MJpegDecodeContext *s, int nb_components)
+static int handle_rstn(MJpegDecodeContext *s, GetBitContext *gb, int *last_dc,
+                       int *restart_count, int nb_components)
 {
     int i;
     int reset = 0;
 
     if (s->restart_interval) {
-        s->restart_count--;
-        if(s->restart_count == 0 && s->avctx->codec_id == AV_CODEC_ID_THP){
-            align_get_bits(&s->gb);
+        (*restart_count)--;
+        if(*restart_count == 0 && s->avctx->codec_id == AV_CODEC_ID_THP){
+            align_get_bits(gb);
             for (i = 0; i < nb_components; i++) /* reset dc */
-                s->last_dc[i] = (4 << s->bits);
+                last_dc[i] = (4 << s->bits);
         }
 
-        i = 8 + ((-get_bits_count(&s->gb)) & 7);
+        i = 8 + ((-get_bits_count(gb)) & 7);
         /* skip RSTn */
-        if (s->restart_count == 0) {
-            if(   show_bits(&s->gb, i) == (1 << i) - 1
-               || show_bits(&s->gb, i) == 0xFF) {
-                int pos = get_bits_count(&s->gb);
-                align_get_bits(&s->gb);
-                while (get_bits_left(&s->gb) >= 8 && show_bits(&s->gb, 8) == 0xFF)
-                    skip_bits(&s->gb, 8);
-                if (get_bits_left(&s->gb) >= 8 && (get_bits(&s->gb, 8) & 0xF8) == 0xD0) {
+        if (*restart_count == 0) {
+            if(   show_bits(gb, i) == (1 << i) - 1
+               || show_bits(gb, i) == 0xFF) {
+                int pos = get_bits_count(gb);
+                align_get_bits(gb);
+                while (get_bits_left(gb) >= 8 && show_bits(gb, 8) == 0xFF)
+                    skip_bits(gb, 8);
+                if (get_bits_left(gb) >= 8 && (get_bits(gb, 8) & 0xF8) == 0xD0) {
                     for (i = 0; i < nb_components; i++) /* reset dc */
-                        s->last_dc[i] = (4 << s->bits);
+                        last_dc[i] = (4 << s->bits);
                     reset = 1;
                 } else
-                    skip_bits_long(&s->gb, pos - get_bits_count(&s->gb));
+                    skip_bits_long(gb, pos - get_bits_count(gb));
             }
         }
     }
@@ -1102,7 +1272,7 @@ static int ljpeg_decode_rgb_scan(MJpegDecodeContext *s, int nb_components, int p
 
                 PREDICT(pred, topleft[i], top[i], left[i], modified_predictor);
 
-                dc = mjpeg_decode_dc(s, s->dc_index[i]);
+                dc = mjpeg_decode_dc(s, &s->gb, s->dc_index[i]);
                 if(dc == 0xFFFFF)
                     return -1;
 
@@ -1214,7 +1384,7 @@ static int ljpeg_decode_yuv_scan(MJpegDecodeContext *s, int predictor,
                     for(j=0; j<n; j++) {
                         int pred, dc;
 
-                        dc = mjpeg_decode_dc(s, s->dc_index[i]);
+                        dc = mjpeg_decode_dc(s, &s->gb, s->dc_index[i]);
                         if(dc == 0xFFFFF)
                             return -1;
                         if (   h * mb_x + x >= s->width
@@ -1285,7 +1455,7 @@ static int ljpeg_decode_yuv_scan(MJpegDecodeContext *s, int predictor,
                     for (j = 0; j < n; j++) {
                         int pred;
 
-                        dc = mjpeg_decode_dc(s, s->dc_index[i]);
+                        dc = mjpeg_decode_dc(s, &s->gb, s->dc_index[i]);
                         if(dc == 0xFFFFF)
                             return -1;
                         if (   h * mb_x + x >= s->width
@@ -1354,27 +1524,21 @@ static void shift_output(MJpegDecodeContext *s, uint8_t *ptr, int linesize)
     }
 }
 
-static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
-                             int Al, const uint8_t *mb_bitmask,
-                             int mb_bitmask_size,
-                             const AVFrame *reference)
+/* decode the MCUs mb_start to mb_end - 1 of a sequential or progressive DC
+ * scan; mb_start must be the first MCU of a restart interval */
+static int mjpeg_decode_scan_mcus(MJpegDecodeContext *s, GetBitContext *gb,
+                                  int *last_dc, int16_t *cur_block,
+                                  int mb_start, int mb_end,
+                                  int nb_components, int Ah, int Al,
+                                  GetBitContext *mb_bitmask_gb,
+                                  const AVFrame *reference)
 {
-    int i, mb_x, mb_y, chroma_h_shift, chroma_v_shift, chroma_width, chroma_height;
+    int i, mb, chroma_h_shift, chroma_v_shift, chroma_width, chroma_height;
     uint8_t *data[MAX_COMPONENTS];
     const uint8_t *reference_data[MAX_COMPONENTS];
     int linesize[MAX_COMPONENTS];
-    GetBitContext mb_bitmask_gb = {0}; // initialize to silence gcc warning
     int bytes_per_pixel = 1 + (s->bits > 8);
-
-    if (mb_bitmask) {
-        if (mb_bitmask_size != (s->mb_width * s->mb_height + 7)>>3) {
-            av_log(s->avctx, AV_LOG_ERROR, "mb_bitmask_size mismatches\n");
-            return AVERROR_INVALIDDATA;
-        }
-        init_get_bits(&mb_bitmask_gb, mb_bitmask, s->mb_width * s->mb_height);
-    }
-
-    s->restart_count = 0;
+    int restart_count = 0;
 
     av_pix_fmt_get_chroma_sub_sample(s->avctx->pix_fmt, &chroma_h_shift,
                                      &chroma_v_shift);
@@ -1386,95 +1550,197 @@ static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
         data[c] = s->picture_ptr->data[c];
         reference_data[c] = reference ? reference->data[c] : NULL;
         linesize[c] = s->linesize[c];
-        s->coefs_finished[c] |= 1;
     }
 
-    for (mb_y = 0; mb_y < s->mb_height; mb_y++) {
-        for (mb_x = 0; mb_x < s->mb_width; mb_x++) {
-            const int copy_mb = mb_bitmask && !get_bits1(&mb_bitmask_gb);
+    for (mb = mb_start; mb < mb_end; mb++) {
+        const int mb_x    = mb % s->mb_width;
+        const int mb_y    = mb / s->mb_width;
+        const int copy_mb = mb_bitmask_gb && !get_bits1(mb_bitmask_gb);
 
-            if (s->restart_interval && !s->restart_count)
-                s->restart_count = s->restart_interval;
+        if (s->restart_interval && !restart_count)
+            restart_count = s->restart_interval;
+
+        if (get_bits_left(gb) < 0) {
+            av_log(s->avctx, AV_LOG_ERROR, "overread %d\n",
+                   -get_bits_left(gb));
+            return AVERROR_INVALIDDATA;
+        }
+        for (i = 0; i < nb_components; i++) {
+            uint8_t *ptr;
+            int n, h, v, x, y, c, j;
+            int block_offset;
+            n = s->nb_blocks[i];
+            c = s->comp_index[i];
+            h = s->h_scount[i];
+            v = s->v_scount[i];
+            x = 0;
+            y = 0;
+            for (j = 0; j < n; j++) {
+                block_offset = (((linesize[c] * (v * mb_y + y) * 8) +
+                                 (h * mb_x + x) * 8 * bytes_per_pixel) >> s->avctx->lowres);
+
+                if (s->interlaced && s->bottom_field)
+                    block_offset += linesize[c] >> 1;
+                if (   8*(h * mb_x + x) < ((c == 1) || (c == 2) ? chroma_width  : s->width)
+                    && 8*(v * mb_y + y) < ((c == 1) || (c == 2) ? chroma_height : s->height)) {
+                    ptr = data[c] + block_offset;
+                } else
+                    ptr = NULL;
+                if (!s->progressive) {
+                    if (copy_mb) {
+                        if (ptr)
+                            mjpeg_copy_block(s, ptr, reference_data[c] + block_offset,
+                                            linesize[c], s->avctx->lowres);
 
-            if (get_bits_left(&s->gb) < 0) {
-                av_log(s->avctx, AV_LOG_ERROR, "overread %d\n",
-                       -get_bits_left(&s->gb));
-                return AVERROR_INVALIDDATA;
-            }
-            for (i = 0; i < nb_components; i++) {
-                uint8_t *ptr;
-                int n, h, v, x, y, c, j;
-                int block_offset;
-                n = s->nb_blocks[i];
-                c = s->comp_index[i];
-                h = s->h_scount[i];
-                v = s->v_scount[i];
-                x = 0;
-                y = 0;
-                for (j = 0; j < n; j++) {
-                    block_offset = (((linesize[c] * (v * mb_y + y) * 8) +
-                                     (h * mb_x + x) * 8 * bytes_per_pixel) >> s->avctx->lowres);
-
-                    if (s->interlaced && s->bottom_field)
-                        block_offset += linesize[c] >> 1;
-                    if (   8*(h * mb_x + x) < ((c == 1) || (c == 2) ? chroma_width  : s->width)
-                        && 8*(v * mb_y + y) < ((c == 1) || (c == 2) ? chroma_height : s->height)) {
-                        ptr = data[c] + block_offset;
-                    } else
-                        ptr = NULL;
-                    if (!s->progressive) {
-                        if (copy_mb) {
-                            if (ptr)
-                                mjpeg_copy_block(s, ptr, reference_data[c] + block_offset,
-                                                linesize[c], s->avctx->lowres);
-
-                        } else {
-                            s->bdsp.clear_block(s->block);
-                            if (decode_block(s, s->block, i,
-                                             s->dc_index[i], s->ac_index[i],
-                                             s->quant_matrixes[s->quant_sindex[i]]) < 0) {
-                                av_log(s->avctx, AV_LOG_ERROR,
-                                       "error y=%d x=%d\n", mb_y, mb_x);
-                                return AVERROR_INVALIDDATA;
-                            }
-                            if (ptr) {
-                                s->idsp.idct_put(ptr, linesize[c], s->block);
-                                if (s->bits & 7)
-                                    shift_output(s, ptr, linesize[c]);
-                            }
-                        }
                     } else {
-                        int block_idx  = s->block_stride[c] * (v * mb_y + y) +
-                                         (h * mb_x + x);
-                        int16_t *block = s->blocks[c][block_idx];
-                        if (Ah)
-                            block[0] += get_bits1(&s->gb) *
-                                        s->quant_matrixes[s->quant_sindex[i]][0] << Al;
-                        else if (decode_dc_progressive(s, block, i, s->dc_index[i],
-                                                       s->quant_matrixes[s->quant_sindex[i]],
-                                                       Al) < 0) {
+                        s->bdsp.clear_block(cur_block);
+                        if (decode_block(s, gb, last_dc, cur_block, i,
+                                         s->dc_index[i], s->ac_index[i],
+                                         s->quant_matrixes[s->quant_sindex[i]]) < 0) {
                             av_log(s->avctx, AV_LOG_ERROR,
                                    "error y=%d x=%d\n", mb_y, mb_x);
                             return AVERROR_INVALIDDATA;
                         }
+                        if (ptr) {
+                            s->idsp.idct_put(ptr, linesize[c], cur_block);
+                            if (s->bits & 7)
+                                shift_output(s, ptr, linesize[c]);
+                        }
                     }
-                    ff_dlog(s->avctx, "mb: %d %d processed\n", mb_y, mb_x);
-                    ff_dlog(s->avctx, "%d %d %d %d %d %d %d %d \n",
-                            mb_x, mb_y, x, y, c, s->bottom_field,
-                            (v * mb_y + y) * 8, (h * mb_x + x) * 8);
-                    if (++x == h) {
-                        x = 0;
-                        y++;
+                } else {
+                    int block_idx  = s->block_stride[c] * (v * mb_y + y) +
+                                     (h * mb_x + x);
+                    int16_t *block = s->blocks[c][block_idx];
+                    if (Ah)
+                        block[0] += get_bits1(gb) *
+                                    s->quant_matrixes[s->quant_sindex[i]][0] << Al;
+                    else if (decode_dc_progressive(s, gb, last_dc, block, i, s->dc_index[i],
+                                                   s->quant_matrixes[s->quant_sindex[i]],
+                                                   Al) < 0) {
+                        av_log(s->avctx, AV_LOG_ERROR,
+                               "error y=%d x=%d\n", mb_y, mb_x);
+                        return AVERROR_INVALIDDATA;
                     }
                 }
+                ff_dlog(s->avctx, "mb: %d %d processed\n", mb_y, mb_x);
+                ff_dlog(s->avctx, "%d %d %d %d %d %d %d %d \n",
+                        mb_x, mb_y, x, y, c, s->bottom_field,
+                        (v * mb_y + y) * 8, (h * mb_x + x) * 8);
+                if (++x == h) {
+                    x = 0;
+                    y++;
+                }
             }
-
-            handle_rstn(s, nb_components);
         }
+
+        handle_rstn(s, gb, last_dc, &restart_count, nb_components);
     }
     return 0;
 }
 
+typedef struct MJpegScanSlices {
+    int nb_components;
+    int nb_jobs;
+    int nb_intervals;
+    int data_start;         ///< offset of the first interval in the scan buffer
+} MJpegScanSlices;
+
+static int mjpeg_decode_scan_slice(AVCodecContext *avctx, void *arg,
+                                   int jobnr, int threadnr)
+{
+    MJpegDecodeContext *s   = avctx->priv_data;
+    MJpegScanSlices *slices = arg;
+    const uint8_t *buf      = s->gb.buffer;
+    int first = slices->nb_intervals *  jobnr      / slices->nb_jobs;
+    int last  = slices->nb_intervals * (jobnr + 1) / slices->nb_jobs;
+    int start = first ? s->restart_offsets[first - 1] : slices->data_start;
+    int end   = last < slices->nb_intervals ? s->restart_offsets[last - 1]
+                                            : s->gb.size_in_bits >> 3;
+    int last_dc[MAX_COMPONENTS];
+    GetBitContext gb;
+    int i, ret;
+
+    if ((ret = init_get_bits8(&gb, buf + start, end - start)) < 0)
+        return ret;
+
+    for (i = 0; i < slices->nb_components; i++)
+        last_dc[i] = 4 << s->bits;
+
+    return mjpeg_decode_scan_mcus(s, &gb, last_dc, s->slice_blocks[jobnr],
+                                  first * s->restart_interval,
+                                  FFMIN(last * s->restart_interval,
+                                        s->mb_width * s->mb_height),
+                                  slices->nb_components, 0, 0, NULL, NULL);
+}
+
+/* Split a sequential scan into its restart intervals and decode them in
+ * parallel. Returns AVERROR(EAGAIN) if the scan has to be decoded serially. */
+static int mjpeg_decode_scan_threaded(MJpegDecodeContext *s, int nb_components)
+{
+    MJpegScanSlices slices;
+    int nb_mcus = s->mb_width * s->mb_height;
+    int i, ret = 0;
+
+    if (!s->slice_blocks || !s->restart_interval || s->progressive)
+        return AVERROR(EAGAIN);
+
+    slices.nb_intervals = (nb_mcus + s->restart_interval - 1) / s->restart_interval;
+    /* a missing or extra RSTn would shift all later intervals; leave such
+     * scans to the serial decoder, which resynchronizes on the markers */
+    if (slices.nb_intervals < 2 ||
+        (s->nb_restart_offsets != slices.nb_intervals - 1 &&
+         s->nb_restart_offsets != slices.nb_intervals))
+        return AVERROR(EAGAIN);
+
+    slices.nb_components = nb_components;
+    slices.nb_jobs       = FFMIN(slices.nb_intervals, s->avctx->thread_count);
+    slices.data_start    = get_bits_count(&s->gb) >> 3;
+    for (i = 0; i < slices.nb_intervals - 1; i++)
+        if (s->restart_offsets[i] <= slices.data_start)
+            return AVERROR(EAGAIN);
+
+    s->avctx->execute2(s->avctx, mjpeg_decode_scan_slice, &slices,
+                       s->slice_ret, slices.nb_jobs);
+
+    for (i = 0; i < slices.nb_jobs; i++)
+        if (s->slice_ret[i] < 0 && !ret)
+            ret = s->slice_ret[i];
+
+    skip_bits_long(&s->gb, get_bits_left(&s->gb));
+    return ret;
+}
+
+static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
+                             int Al, const uint8_t *mb_bitmask,
+                             int mb_bitmask_size,
+                             const AVFrame *reference)
+{
+    int i, ret;
+    GetBitContext mb_bitmask_gb = {0}; // initialize to silence gcc warning
+
+    if (mb_bitmask) {
+        if (mb_bitmask_size != (s->mb_width * s->mb_height + 7)>>3) {
+            av_log(s->avctx, AV_LOG_ERROR, "mb_bitmask_size mismatches\n");
+            return AVERROR_INVALIDDATA;
+        }
+        init_get_bits(&mb_bitmask_gb, mb_bitmask, s->mb_width * s->mb_height);
+    }
+
+    for (i = 0; i < nb_components; i++)
+        s->coefs_finished[s->comp_index[i]] |= 1;
+
+    if (!mb_bitmask) {
+        ret = mjpeg_decode_scan_threaded(s, nb_components);
+        if (ret != AVERROR(EAGAIN))
+            return ret;
+    }
+
+    return mjpeg_decode_scan_mcus(s, &s->gb, s->last_dc, s->block,
+                                  0, s->mb_width * s->mb_height,
+                                  nb_components, Ah, Al,
+                                  mb_bitmask ? &mb_bitmask_gb : NULL, reference);
+}
+
 static int mjpeg_decode_scan_progressive_ac(MJpegDecodeContext *s, int ss,
                                             int se, int Ah, int Al)
 {
@@ -1520,7 +1786,7 @@ static int mjpeg_decode_scan_progressive_ac(MJpegDecodeContext *s, int ss,
                     return AVERROR_INVALIDDATA;
                 }
 
-            if (handle_rstn(s, 0))
+            if (handle_rstn(s, &s->gb, s->last_dc, &s->restart_count, 0))
                 EOBRUN = 0;
         }
     }
@@ -2139,11 +2405,14 @@ int ff_mjpeg_find_marker(MJpegDecodeContext *s,
     if (!s->buffer)
         return AVERROR(ENOMEM);
 
+    s->nb_restart_offsets = 0;
+
     /* unescape buffer of SOS, use special treatment for JPEG-LS */
     if (start_code == SOS && !s->ls) {
         const uint8_t *src = *buf_ptr;
         const uint8_t *ptr = src;
         uint8_t *dst = s->buffer;
+        int record_restarts = s->slice_blocks && s->restart_interval;
 
         #define copy_data_segment(skip) do {       \
             ptrdiff_t length = (ptr - src) - (skip);  \
@@ -2182,6 +2451,14 @@ int ff_mjpeg_find_marker(MJpegDecodeContext *s,
                         copy_data_segment(1);
                         if (x)
                             break;
+                    } else if (record_restarts) {
+                        int *offsets = av_fast_realloc(s->restart_offsets,
+                                                       &s->restart_offsets_size,
+                                                       (s->nb_restart_offsets + 1) * sizeof(*offsets));
+                        if (!offsets)
+                            return AVERROR(ENOMEM);
+                        s->restart_offsets = offsets;
+                        offsets[s->nb_restart_offsets++] = (dst - s->buffer) + (ptr - src);
                     }
                 }
             }
@@ -2261,6 +2538,27 @@ static void reset_icc_profile(MJpegDecodeContext *s)
     s->iccnum  = 0;
 }
 
+/* Let the next frame thread start unless the rest of the packet may still
+ * change state that later packets depend on. */
+static void mjpeg_thread_finish_setup(MJpegDecodeContext *s,
+                                      const uint8_t *buf_ptr,
+                                      const uint8_t *buf_end)
+{
+    int start_code;
+
+    if (!(s->avctx->active_thread_type & FF_THREAD_FRAME) ||
+        s->setup_finished || s->interlaced || s->ls || s->avctx->hwaccel)
+        return;
+
+    while ((start_code = find_marker(&buf_ptr, buf_end)) >= 0 &&
+           start_code != EOI)
+        if (start_code != SOS && (start_code < RST0 || start_code > RST7))
+            return;
+
+    ff_thread_finish_setup(s->avctx);
+    s->setup_finished = 1;
+}
+
 int ff_mjpeg_decode_frame(AVCodecContext *avctx, void *data, int *got_frame,
                           AVPacket *avpkt)
 {
@@ -2277,7 +2575,8 @@ int ff_mjpeg_decode_frame(AVCodecContext *avctx, void *data, int *got_frame,
     int ret = 0;
     int is16bit;
 
-    s->buf_size = buf_size;
+    s->buf_size       = buf_size;
+    s->setup_finished = 0;
 
     av_dict_free(&s->exif_metadata);
     av_freep(&s->stereo3d);
@@ -2476,6 +2775,8 @@ eoi_parser:
                 break;
             }
 
+            mjpeg_thread_finish_setup(s, buf_ptr, buf_end);
+
             if ((ret = ff_mjpeg_decode_sos(s, NULL, 0, NULL)) < 0 &&
                 (avctx->err_recognition & AV_EF_EXPLODE))
                 goto fail;
@@ -2759,6 +3060,10 @@ av_cold int ff_mjpeg_decode_end(AVCodecContext *avctx)
     av_freep(&s->stereo3d);
     av_freep(&s->ljpeg_buffer);
     s->ljpeg_buffer_size = 0;
+    av_freep(&s->restart_offsets);
+    s->restart_offsets_size = 0;
+    av_freep(&s->slice_blocks);
+    av_freep(&s->slice_ret);
 
     for (i = 0; i < 3; i++) {
         for (j = 0; j < 4; j++)
@@ -2809,7 +3114,10 @@ AVCodec ff_mjpeg_decoder = {
     .close          = ff_mjpeg_decode_end,
     .decode         = ff_mjpeg_decode_frame,
     .flush          = decode_flush,
-    .capabilities   = AV_CODEC_CAP_DR1,
+    .init_thread_copy      = ONLY_IF_THREADS_ENABLED(mjpeg_decode_init_thread_copy),
+    .update_thread_context = ONLY_IF_THREADS_ENABLED(mjpeg_update_thread_context),
+    .capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_FRAME_THREADS |
+                      AV_CODEC_CAP_SLICE_THREADS,
     .max_lowres     = 3,
     .priv_class     = &mjpegdec_class,
     .profiles       = NULL_IF_CONFIG_SMALL(ff_mjpeg_profiles),
@@ -113,6 +113,12 @@ typedef struct MJpegDecodeContext {
 
     int restart_interval;
     int restart_count;
+    int *restart_offsets;           ///< offsets in buffer of the data following each RSTn of the current scan
+    unsigned int restart_offsets_size;
+    int nb_restart_offsets;
+    int16_t (*slice_blocks)[64];    ///< per-job blocks for slice threaded scans
+    int *slice_ret;
+    int setup_finished;             ///< ff_thread_finish_setup() was called for the current packet
 
     int buggy_avid;
     int cs_itu601;
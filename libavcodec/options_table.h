@@ -480,6 +480,8 @@ static const AVOption avcodec_options[] = {
 {"allow_profile_mismatch", "attempt to decode anyway if HW accelerated decoder's supported profiles do not exactly match the stream", 0, AV_OPT_TYPE_CONST, {.i64 = AV_HWACCEL_FLAG_ALLOW_PROFILE_MISMATCH }, INT_MIN, INT_MAX, V | D, "hwaccel_flags"},
 {"extra_hw_frames", "Number of extra hardware frames to allocate for the user", OFFSET(extra_hw_frames), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, INT_MAX, V|D },
 {"discard_damaged_percentage", "Percentage of damaged samples to discard a frame", OFFSET(discard_damaged_percentage), AV_OPT_TYPE_INT, {.i64 = 95 }, 0, 100, V|D },
+{"max_frame_delay", "Maximum number of frames held back by frame threading", OFFSET(max_frame_delay), AV_OPT_TYPE_INT, {.i64 = 0 }, 0, INT_MAX, V|D },
+{"shared_threads", "Run slice threads on the process-wide shared pool with at most this many workers", OFFSET(shared_threads), AV_OPT_TYPE_INT, {.i64 = 0 }, 0, INT_MAX, V|A|E|D },
 {NULL},
 };
 
@@ -299,7 +299,9 @@ static int update_context_from_thread(AVCodecContext *dst, AVCodecContext *src,
     }
 
     if (for_user) {
-        dst->delay       = src->thread_count - 1;
+        dst->delay       = src->max_frame_delay > 0 ?
+                           FFMIN(src->max_frame_delay, src->thread_count - 1) :
+                           src->thread_count - 1;
 #if FF_API_CODED_FRAME
 FF_DISABLE_DEPRECATION_WARNINGS
         dst->coded_frame = src->coded_frame;
@@ -498,6 +500,23 @@ int ff_thread_decode_frame(AVCodecContext *avctx,
     if (fctx->next_decoding > (avctx->thread_count-1-(avctx->codec_id == AV_CODEC_ID_FFV1)))
         fctx->delaying = 0;
 
+    /*
+     * With a bounded delay, decide for every packet: return the oldest frame
+     * if it is finished or if the maximum number of frames is pending, hold
+     * it back otherwise. The delay thus grows only while frames take longer
+     * to decode than to submit.
+     */
+    if (avctx->max_frame_delay > 0 && avpkt->size) {
+        int max_delay = FFMIN(avctx->max_frame_delay,
+                              avctx->thread_count - 1 - (avctx->codec_id == AV_CODEC_ID_FFV1));
+        int pending   = fctx->next_decoding - fctx->next_finished;
+        if (pending <= 0)
+            pending += avctx->thread_count;
+
+        fctx->delaying = pending <= max_delay &&
+                         atomic_load(&fctx->threads[fctx->next_finished].state) != STATE_INPUT_READY;
+    }
+
     if (fctx->delaying) {
         *got_picture_ptr=0;
         if (avpkt->size) {
@@ -678,6 +697,8 @@ void ff_frame_thread_free(AVCodecContext *avctx, int thread_count)
 
         if (codec->close && p->avctx)
             codec->close(p->avctx);
+        if (p->avctx && p->avctx->internal)
+            ff_slice_thread_free(p->avctx);
 
         release_delayed_buffers(p);
         av_frame_free(&p->frame);
@@ -799,6 +820,9 @@ int ff_frame_thread_init(AVCodecContext *avctx)
         }
         *copy->internal = *src->internal;
         copy->internal->thread_ctx = p;
+        copy->internal->slice_thread_ctx = NULL;
+        copy->execute  = avctx->execute;
+        copy->execute2 = avctx->execute2;
         copy->internal->last_pkt_props = &p->avpkt;
 
         if (!i) {
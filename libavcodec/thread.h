@@ -136,6 +136,20 @@ int ff_slice_thread_execute_with_mainfunc(AVCodecContext *avctx,
         int (*action_func2)(AVCodecContext *c, void *arg, int jobnr, int threadnr),
         int (*main_func)(AVCodecContext *c), void *arg, int *ret, int job_count);
 void ff_thread_free(AVCodecContext *s);
+
+/**
+ * Create slice threads for a frame thread context, so that a frame
+ * threaded decoder can also split each frame into slices with execute(),
+ * execute2() and the progress2 functions below.
+ * To be called from the init() and init_thread_copy() callbacks, the
+ * threads are freed along with the frame thread.
+ *
+ * @param thread_count number of slice threads to create for this frame thread
+ * @return the number of slice threads available (1 if none were created),
+ *         or a negative error code
+ */
+int ff_slice_thread_init_hybrid(AVCodecContext *avctx, int thread_count);
+
 int ff_alloc_entries(AVCodecContext *avctx, int count);
 void ff_reset_entries(AVCodecContext *avctx);
 void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, int n);
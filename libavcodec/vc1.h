@@ -256,13 +256,10 @@ typedef struct VC1Context{
     //@}
     int ttfrm;               ///< Transform type info present at frame level
     uint8_t ttmbf;           ///< Transform type flag
-    int *ttblk_base, *ttblk; ///< Transform type at the block level
     int codingset;           ///< index of current table set from 11.8 to use for luma block decoding
     int codingset2;          ///< index of current table set from 11.8 to use for chroma block decoding
     int pqindex;             ///< raw pqindex used in coding set selection
     int a_avail, c_avail;
-    uint8_t *mb_type_base, *mb_type[3];
-
 
     /** Luma compensation parameters */
     //@{
@@ -283,9 +280,6 @@ typedef struct VC1Context{
     uint8_t pquantizer;             ///< Uniform (over sequence) quantizer in use
     VLC *cbpcy_vlc;                 ///< CBPCY VLC table
     int tt_index;                   ///< Index for Transform Type tables (to decode TTMB)
-    uint8_t* mv_type_mb_plane;      ///< bitplane for mv_type == (4MV)
-    uint8_t* direct_mb_plane;       ///< bitplane for "direct" MBs
-    uint8_t* forward_mb_plane;      ///< bitplane for "forward" MBs
     int mv_type_is_raw;             ///< mv type mb plane is not coded
     int dmb_is_raw;                 ///< direct mb plane is raw
     int fmb_is_raw;                 ///< forward mb plane is raw
@@ -319,9 +313,7 @@ typedef struct VC1Context{
     int hrd_num_leaky_buckets;
     uint8_t bit_rate_exponent;
     uint8_t buffer_size_exponent;
-    uint8_t* acpred_plane;       ///< AC prediction flags bitplane
     int acpred_is_raw;
-    uint8_t* over_flags_plane;   ///< Overflags bitplane
     int overflg_is_raw;
     uint8_t condover;
     uint16_t *hrd_rate, *hrd_buffer;
@@ -344,12 +336,8 @@ typedef struct VC1Context{
     VLC* fourmvbp_vlc;
     uint8_t twomvbp;
     uint8_t fourmvbp;
-    uint8_t* fieldtx_plane;
     int fieldtx_is_raw;
     uint8_t zzi_8x8[64];
-    uint8_t *blk_mv_type_base, *blk_mv_type;    ///< 0: frame MV, 1: field MV (interlaced frame)
-    uint8_t *mv_f_base, *mv_f[2];               ///< 0: MV obtained from same field, 1: opposite field
-    uint8_t *mv_f_next_base, *mv_f_next[2];
     int field_mode;         ///< 1 for interlaced field pictures
     int fptype;
     int second_field;
@@ -378,20 +366,13 @@ typedef struct VC1Context{
     //@{
     int new_sprite;
     int two_sprites;
-    AVFrame *sprite_output_frame;
     int output_width, output_height, sprite_width, sprite_height;
-    uint8_t* sr_rows[2][2];      ///< Sprite resizer line cache
     //@}
 
     int p_frame_skipped;
     int bi_type;
     int x8_type;
 
-    int16_t (*block)[6][64];
-    int n_allocated_blks, cur_blk_idx, left_blk_idx, topleft_blk_idx, top_blk_idx;
-    uint32_t *cbp_base, *cbp;
-    uint8_t *is_intra_base, *is_intra;
-    int16_t (*luma_mv_base)[2], (*luma_mv)[2];
     uint8_t bfraction_lut_index; ///< Index for BFRACTION value (see Table 40, reproduced into ff_vc1_bfraction_lut[])
     uint8_t broken_link;         ///< Broken link flag (BROKEN_LINK syntax element)
     uint8_t closed_entry;        ///< Closed entry point flag (CLOSED_ENTRY syntax element)
@@ -400,6 +381,37 @@ typedef struct VC1Context{
 
     int parse_only;              ///< Context is used within parser
     int resync_marker;           ///< could this stream contain resync markers
+
+    /** Picture-sized tables, shared with the slice contexts
+     * This and the following members are not copied between frame threads.
+     */
+    //@{
+    uint8_t* mv_type_mb_plane;      ///< bitplane for mv_type == (4MV)
+    uint8_t* direct_mb_plane;       ///< bitplane for "direct" MBs
+    uint8_t* forward_mb_plane;      ///< bitplane for "forward" MBs
+    uint8_t* acpred_plane;          ///< AC prediction flags bitplane
+    uint8_t* over_flags_plane;      ///< Overflags bitplane
+    uint8_t* fieldtx_plane;
+    uint8_t *mb_type_base, *mb_type[3];
+    uint8_t *blk_mv_type_base, *blk_mv_type;    ///< 0: frame MV, 1: field MV (interlaced frame)
+    uint8_t *mv_f_base, *mv_f[2];               ///< 0: MV obtained from same field, 1: opposite field
+    uint8_t *mv_f_next_base, *mv_f_next[2];
+    AVFrame *sprite_output_frame;
+    uint8_t* sr_rows[2][2];         ///< Sprite resizer line cache
+    //@}
+
+    /** Macroblock row buffers, private to each slice context */
+    //@{
+    int16_t (*block)[6][64];
+    int n_allocated_blks, cur_blk_idx, left_blk_idx, topleft_blk_idx, top_blk_idx;
+    uint32_t *cbp_base, *cbp;
+    int *ttblk_base, *ttblk;        ///< Transform type at the block level
+    uint8_t *is_intra_base, *is_intra;
+    int16_t (*luma_mv_base)[2], (*luma_mv)[2];
+    //@}
+
+    struct VC1Context *slice_ctx;   ///< contexts for slice threaded decoding
+    int nb_slice_ctx;
 } VC1Context;
 
 /**
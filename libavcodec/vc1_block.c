@@ -30,6 +30,7 @@
 #include "mpegutils.h"
 #include "mpegvideo.h"
 #include "msmpeg4data.h"
+#include "thread.h"
 #include "unary.h"
 #include "vc1.h"
 #include "vc1_pred.h"
@@ -475,17 +476,20 @@ static inline int ff_vc1_pred_dc(MpegEncContext *s, int overlap, int pq, int n,
 static inline int vc1_coded_block_pred(MpegEncContext * s, int n,
                                        uint8_t **coded_block_ptr)
 {
-    int xy, wrap, pred, a, b, c;
+    int xy, wrap, pred, a, b = 0, c = 0;
 
     xy   = s->block_index[n];
     wrap = s->b8_stride;
 
     /* B C
      * A X
+     * B and C are not coded above the first row of a slice
      */
     a = s->coded_block[xy - 1       ];
-    b = s->coded_block[xy - 1 - wrap];
-    c = s->coded_block[xy     - wrap];
+    if (!s->first_slice_line || n >= 2) {
+        b = s->coded_block[xy - 1 - wrap];
+        c = s->coded_block[xy     - wrap];
+    }
 
     if (b == c) {
         pred = a;
@@ -2497,6 +2501,43 @@ static int vc1_decode_b_mb_intfr(VC1Context *v)
     return 0;
 }
 
+/**
+ * Report the rows of a progressive reference picture that are final to
+ * other frame threads.
+ * @param mb_y last macroblock row that will not be modified anymore
+ */
+static inline void vc1_report_decode_progress(VC1Context *v, int mb_y)
+{
+    MpegEncContext *s = &v->s;
+
+    if (v->fcm == PROGRESSIVE && s->pict_type != AV_PICTURE_TYPE_B &&
+        !s->er.error_occurred)
+        ff_thread_report_progress(&s->current_picture_ptr->tf, mb_y, 0);
+}
+
+/**
+ * Wait for the rows of the reference pictures that the motion vectors of
+ * the current macroblock row of a progressive picture can point to.
+ */
+static inline void vc1_await_reference_rows(VC1Context *v)
+{
+    MpegEncContext *s = &v->s;
+    /* direct mode MVs are scaled from the anchor, whose range may be larger */
+    int range_y = s->pict_type == AV_PICTURE_TYPE_B && v->extended_mv ? 1 << 10
+                                                                     : v->range_y;
+    /* range_y is in quarter pels, 31 covers the block itself and the taps of
+     * the interpolation filters */
+    int mb_y = FFMIN(s->mb_y + ((range_y >> 2) + 31 >> 4), s->mb_height - 1);
+
+    if (v->fcm != PROGRESSIVE)
+        return;
+
+    if (s->last_picture_ptr)
+        ff_thread_await_progress(&s->last_picture_ptr->tf, mb_y, 0);
+    if (s->pict_type == AV_PICTURE_TYPE_B && s->next_picture_ptr)
+        ff_thread_await_progress(&s->next_picture_ptr->tf, mb_y, 0);
+}
+
 /** Decode blocks of I-frame
  */
 static void vc1_decode_i_blocks(VC1Context *v)
@@ -2612,10 +2653,13 @@ static void vc1_decode_i_blocks(VC1Context *v)
         else if (s->mb_y)
             ff_mpeg_draw_horiz_band(s, (s->mb_y - 1) * 16, 16);
 
+        /* overlap smoothing and the loop filter trail by up to two rows */
+        vc1_report_decode_progress(v, s->mb_y - 2);
         s->first_slice_line = 0;
     }
     if (v->s.loop_filter)
         ff_mpeg_draw_horiz_band(s, (s->end_mb_y - 1) * 16, 16);
+    vc1_report_decode_progress(v, s->end_mb_y - 1);
 
     /* This is intentionally mb_height and not end_mb_y - unlike in advanced
      * profile, these only differ are when decoding MSS2 rectangles. */
@@ -2664,14 +2708,7 @@ static void vc1_decode_i_blocks_adv(VC1Context *v)
     s->mb_x             = s->mb_y = 0;
     s->mb_intra         = 1;
     s->first_slice_line = 1;
-    s->mb_y             = s->start_mb_y;
-    if (s->start_mb_y) {
-        s->mb_x = 0;
-        init_block_index(v);
-        memset(&s->coded_block[s->block_index[0] - s->b8_stride], 0,
-               (1 + s->b8_stride) * sizeof(*s->coded_block));
-    }
-    for (; s->mb_y < s->end_mb_y; s->mb_y++) {
+    for (s->mb_y = s->start_mb_y; s->mb_y < s->end_mb_y; s->mb_y++) {
         s->mb_x = 0;
         init_block_index(v);
         for (;s->mb_x < s->mb_width; s->mb_x++) {
@@ -2749,11 +2786,13 @@ static void vc1_decode_i_blocks_adv(VC1Context *v)
             ff_mpeg_draw_horiz_band(s, s->mb_y * 16, 16);
         else if (s->mb_y)
             ff_mpeg_draw_horiz_band(s, (s->mb_y-1) * 16, 16);
+        vc1_report_decode_progress(v, s->mb_y - 2);
         s->first_slice_line = 0;
     }
 
     if (v->s.loop_filter)
         ff_mpeg_draw_horiz_band(s, (s->end_mb_y - 1) * 16, 16);
+    vc1_report_decode_progress(v, s->end_mb_y - 1);
     ff_er_add_slice(&s->er, 0, s->start_mb_y << v->field_mode, s->mb_width - 1,
                     (s->end_mb_y << v->field_mode) - 1, ER_MB_END);
 }
@@ -2794,6 +2833,7 @@ static void vc1_decode_p_blocks(VC1Context *v)
     for (s->mb_y = s->start_mb_y; s->mb_y < s->end_mb_y; s->mb_y++) {
         s->mb_x = 0;
         init_block_index(v);
+        vc1_await_reference_rows(v);
         for (; s->mb_x < s->mb_width; s->mb_x++) {
             ff_update_block_index(s);
 
@@ -2836,10 +2876,12 @@ static void vc1_decode_p_blocks(VC1Context *v)
                 sizeof(v->luma_mv_base[0]) * 2 * s->mb_stride);
         if (s->mb_y != s->start_mb_y)
             ff_mpeg_draw_horiz_band(s, (s->mb_y - 1) * 16, 16);
+        vc1_report_decode_progress(v, s->mb_y - 2);
         s->first_slice_line = 0;
     }
     if (s->end_mb_y >= s->start_mb_y)
         ff_mpeg_draw_horiz_band(s, (s->end_mb_y - 1) * 16, 16);
+    vc1_report_decode_progress(v, s->end_mb_y - 1);
     ff_er_add_slice(&s->er, 0, s->start_mb_y << v->field_mode, s->mb_width - 1,
                     (s->end_mb_y << v->field_mode) - 1, ER_MB_END);
 }
@@ -2877,6 +2919,7 @@ static void vc1_decode_b_blocks(VC1Context *v)
     for (s->mb_y = s->start_mb_y; s->mb_y < s->end_mb_y; s->mb_y++) {
         s->mb_x = 0;
         init_block_index(v);
+        vc1_await_reference_rows(v);
         for (; s->mb_x < s->mb_width; s->mb_x++) {
             ff_update_block_index(s);
 
@@ -2935,10 +2978,12 @@ static void vc1_decode_skip_blocks(VC1Context *v)
         s->mb_x = 0;
         init_block_index(v);
         ff_update_block_index(s);
+        ff_thread_await_progress(&s->last_picture_ptr->tf, s->mb_y, 0);
         memcpy(s->dest[0], s->last_picture.f->data[0] + s->mb_y * 16 * s->linesize,   s->linesize   * 16);
         memcpy(s->dest[1], s->last_picture.f->data[1] + s->mb_y *  8 * s->uvlinesize, s->uvlinesize *  8);
         memcpy(s->dest[2], s->last_picture.f->data[2] + s->mb_y *  8 * s->uvlinesize, s->uvlinesize *  8);
         ff_mpeg_draw_horiz_band(s, s->mb_y * 16, 16);
+        vc1_report_decode_progress(v, s->mb_y);
         s->first_slice_line = 0;
     }
     s->pict_type = AV_PICTURE_TYPE_P;
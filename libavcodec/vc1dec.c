@@ -36,6 +36,7 @@
 #include "msmpeg4.h"
 #include "msmpeg4data.h"
 #include "profiles.h"
+#include "thread.h"
 #include "vc1.h"
 #include "vc1data.h"
 #include "libavutil/avassert.h"
@@ -321,6 +322,41 @@ static void vc1_sprite_flush(AVCodecContext *avctx)
 
 #endif
 
+static av_cold int vc1_alloc_row_buffers(VC1Context *v)
+{
+    MpegEncContext *s = &v->s;
+
+    v->n_allocated_blks = s->mb_width + 2;
+    v->block            = av_malloc(sizeof(*v->block) * v->n_allocated_blks);
+    v->cbp_base         = av_malloc(sizeof(v->cbp_base[0]) * 3 * s->mb_stride);
+    if (!v->block || !v->cbp_base)
+        return AVERROR(ENOMEM);
+    v->cbp              = v->cbp_base + 2 * s->mb_stride;
+    v->ttblk_base       = av_malloc(sizeof(v->ttblk_base[0]) * 3 * s->mb_stride);
+    if (!v->ttblk_base)
+        return AVERROR(ENOMEM);
+    v->ttblk            = v->ttblk_base + 2 * s->mb_stride;
+    v->is_intra_base    = av_mallocz(sizeof(v->is_intra_base[0]) * 3 * s->mb_stride);
+    if (!v->is_intra_base)
+        return AVERROR(ENOMEM);
+    v->is_intra         = v->is_intra_base + 2 * s->mb_stride;
+    v->luma_mv_base     = av_mallocz(sizeof(v->luma_mv_base[0]) * 3 * s->mb_stride);
+    if (!v->luma_mv_base)
+        return AVERROR(ENOMEM);
+    v->luma_mv          = v->luma_mv_base + 2 * s->mb_stride;
+
+    return 0;
+}
+
+static av_cold void vc1_free_row_buffers(VC1Context *v)
+{
+    av_freep(&v->block);
+    av_freep(&v->cbp_base);
+    av_freep(&v->ttblk_base);
+    av_freep(&v->is_intra_base); // FIXME use v->mb_type[]
+    av_freep(&v->luma_mv_base);
+}
+
 av_cold int ff_vc1_decode_init_alloc_tables(VC1Context *v)
 {
     MpegEncContext *s = &v->s;
@@ -338,24 +374,9 @@ av_cold int ff_vc1_decode_init_alloc_tables(VC1Context *v)
         !v->fieldtx_plane || !v->acpred_plane || !v->over_flags_plane)
         goto error;
 
-    v->n_allocated_blks = s->mb_width + 2;
-    v->block            = av_malloc(sizeof(*v->block) * v->n_allocated_blks);
-    v->cbp_base         = av_malloc(sizeof(v->cbp_base[0]) * 3 * s->mb_stride);
-    if (!v->block || !v->cbp_base)
-        goto error;
-    v->cbp              = v->cbp_base + 2 * s->mb_stride;
-    v->ttblk_base       = av_malloc(sizeof(v->ttblk_base[0]) * 3 * s->mb_stride);
-    if (!v->ttblk_base)
-        goto error;
-    v->ttblk            = v->ttblk_base + 2 * s->mb_stride;
-    v->is_intra_base    = av_mallocz(sizeof(v->is_intra_base[0]) * 3 * s->mb_stride);
-    if (!v->is_intra_base)
+    if ((ret = vc1_alloc_row_buffers(v)) < 0)
         goto error;
-    v->is_intra         = v->is_intra_base + 2 * s->mb_stride;
-    v->luma_mv_base     = av_mallocz(sizeof(v->luma_mv_base[0]) * 3 * s->mb_stride);
-    if (!v->luma_mv_base)
-        goto error;
-    v->luma_mv          = v->luma_mv_base + 2 * s->mb_stride;
+    ret = AVERROR(ENOMEM);
 
     /* allocate block type info in that way so it could be used with s->block_index[] */
     v->mb_type_base = av_malloc(s->b8_stride * (mb_height * 2 + 1) + s->mb_stride * (mb_height + 1) * 2);
@@ -387,6 +408,14 @@ av_cold int ff_vc1_decode_init_alloc_tables(VC1Context *v)
                 return AVERROR(ENOMEM);
     }
 
+    /* the row buffers of the slice contexts are allocated on first use */
+    if (s->slice_context_count > 1) {
+        v->slice_ctx = av_mallocz_array(s->slice_context_count, sizeof(*v->slice_ctx));
+        if (!v->slice_ctx)
+            goto error;
+        v->nb_slice_ctx = s->slice_context_count;
+    }
+
     ret = ff_intrax8_common_init(s->avctx, &v->x8, &s->idsp,
                                  s->block, s->block_last_index,
                                  s->mb_width, s->mb_height);
@@ -541,6 +570,7 @@ static av_cold int vc1_decode_init(AVCodecContext *avctx)
         return AVERROR(ENOMEM);
 
     avctx->has_b_frames = !!avctx->max_b_frames;
+    avctx->internal->allocate_progress = 1;
 
     if (v->color_prim == 1 || v->color_prim == 5 || v->color_prim == 6)
         avctx->color_primaries = v->color_prim;
@@ -606,15 +636,141 @@ av_cold int ff_vc1_decode_end(AVCodecContext *avctx)
     av_freep(&v->blk_mv_type_base);
     av_freep(&v->mv_f_base);
     av_freep(&v->mv_f_next_base);
-    av_freep(&v->block);
-    av_freep(&v->cbp_base);
-    av_freep(&v->ttblk_base);
-    av_freep(&v->is_intra_base); // FIXME use v->mb_type[]
-    av_freep(&v->luma_mv_base);
+    vc1_free_row_buffers(v);
+    for (i = 0; i < v->nb_slice_ctx; i++)
+        vc1_free_row_buffers(&v->slice_ctx[i]);
+    av_freep(&v->slice_ctx);
+    v->nb_slice_ctx = 0;
     ff_intrax8_common_end(&v->x8);
     return 0;
 }
 
+#if HAVE_THREADS
+static av_cold int vc1_decode_init_thread_copy(AVCodecContext *avctx)
+{
+    VC1Context *v = avctx->priv_data;
+
+    v->sprite_output_frame = av_frame_alloc();
+    if (!v->sprite_output_frame)
+        return AVERROR(ENOMEM);
+
+    return 0;
+}
+
+static int vc1_update_thread_context(AVCodecContext *dst,
+                                     const AVCodecContext *src)
+{
+    VC1Context *v = dst->priv_data;
+    const VC1Context *v1 = src->priv_data;
+    MpegEncContext *s = &v->s;
+    const MpegEncContext *s1 = &v1->s;
+    int init = s->context_initialized;
+    int ret;
+
+    if (dst == src)
+        return 0;
+
+    if (init && (s->width != s1->width || s->height != s1->height)) {
+        ff_vc1_decode_end(dst);
+        init = 0;
+    }
+
+    if ((ret = ff_mpeg_update_thread_context(dst, src)) < 0)
+        return ret;
+
+    if (!init && s->context_initialized &&
+        (ret = ff_vc1_decode_init_alloc_tables(v)) < 0)
+        return ret;
+
+    /* sequence, entry point and picture header state, including the
+     * intensity compensation LUTs of the reference pictures */
+    memcpy(&v->bits, &v1->bits,
+           offsetof(VC1Context, mv_type_mb_plane) - offsetof(VC1Context, bits));
+    if (v1->curr_luty) {
+        v->curr_luty   = v1->curr_luty   == v1->aux_luty     ? v->aux_luty     :
+                         v1->curr_luty   == v1->next_luty    ? v->next_luty    : v->last_luty;
+        v->curr_lutuv  = v1->curr_lutuv  == v1->aux_lutuv    ? v->aux_lutuv    :
+                         v1->curr_lutuv  == v1->next_lutuv   ? v->next_lutuv   : v->last_lutuv;
+        v->curr_use_ic = v1->curr_use_ic == &v1->aux_use_ic  ? &v->aux_use_ic  :
+                         v1->curr_use_ic == &v1->next_use_ic ? &v->next_use_ic : &v->last_use_ic;
+    }
+
+    s->loop_filter = s1->loop_filter;
+    s->h_edge_pos  = s1->h_edge_pos;
+    s->v_edge_pos  = s1->v_edge_pos;
+
+    /* field MV predictors of the next anchor picture; field P pictures
+     * swap mv_f_next[] with mv_f[], so they may live in either buffer */
+    if (v1->interlace && v->mv_f_next_base && v1->mv_f_next_base) {
+        int mb_height = FFALIGN(s->mb_height, 2);
+        memcpy(v->mv_f_next[0] - (s->b8_stride + 1), v1->mv_f_next[0] - (s1->b8_stride + 1),
+               2 * (s->b8_stride * (mb_height * 2 + 1) + s->mb_stride * (mb_height + 1) * 2));
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * Set up slice context n to decode the macroblock rows start_mb_y to
+ * end_mb_y - 1 of the current picture from gb.
+ */
+static int vc1_init_slice_context(VC1Context *v, int n, const GetBitContext *gb,
+                                  int start_mb_y, int end_mb_y)
+{
+    MpegEncContext *s = &v->s;
+    VC1Context *sv = &v->slice_ctx[n];
+    int ret;
+
+    if (n && (ret = ff_update_duplicate_context(s->thread_context[n], s)) < 0)
+        return ret;
+
+    memcpy(&sv->x8, &v->x8, offsetof(VC1Context, block) - offsetof(VC1Context, x8));
+    sv->s = *s->thread_context[n];
+    if (!sv->block && (ret = vc1_alloc_row_buffers(sv)) < 0)
+        return ret;
+
+    sv->s.gb         = *gb;
+    sv->s.start_mb_y = start_mb_y;
+    sv->s.end_mb_y   = end_mb_y;
+    atomic_init(&sv->s.er.error_count, 0);
+    sv->s.er.error_occurred = 0;
+
+    return 0;
+}
+
+static int vc1_decode_slice_thread(AVCodecContext *avctx, void *arg)
+{
+    VC1Context *v = arg;
+
+    ff_vc1_decode_blocks(v);
+    return 0;
+}
+
+/**
+ * Decode the first nb_jobs slice contexts in parallel and merge their error
+ * resilience state back into v.
+ */
+static void vc1_execute_slice_contexts(VC1Context *v, int nb_jobs)
+{
+    MpegEncContext *s = &v->s;
+    int i;
+
+    s->avctx->execute(s->avctx, vc1_decode_slice_thread, v->slice_ctx, NULL,
+                      nb_jobs, sizeof(*v->slice_ctx));
+
+    for (i = 0; i < nb_jobs; i++) {
+        ERContext *er = &v->slice_ctx[i].s.er;
+        int error_count = atomic_load(&er->error_count);
+
+        if (error_count > 0 || atomic_load(&s->er.error_count) == INT_MAX)
+            atomic_store(&s->er.error_count, INT_MAX);
+        else
+            atomic_fetch_add(&s->er.error_count, error_count);
+        s->er.error_occurred |= er->error_occurred;
+    }
+}
+
 
 /** Decode a VC1/WMV3 frame
  * @todo TODO: Handle VC-1 IDUs (Transport level?)
@@ -629,7 +785,7 @@ static int vc1_decode_frame(AVCodecContext *avctx, void *data,
     AVFrame *pict = data;
     uint8_t *buf2 = NULL;
     const uint8_t *buf_start = buf, *buf_start_second_field = NULL;
-    int mb_height, n_slices1=-1;
+    int mb_height, n_slices1=-1, slice_headers = 0, frame_started = 0;
     struct {
         uint8_t *buf;
         GetBitContext gb;
@@ -874,6 +1030,7 @@ static int vc1_decode_frame(AVCodecContext *avctx, void *data,
     if ((ret = ff_mpv_frame_start(s, avctx)) < 0) {
         goto err;
     }
+    frame_started = 1;
 
     v->s.current_picture_ptr->field_picture = v->field_mode;
     v->s.current_picture_ptr->f->interlaced_frame = (v->fcm != PROGRESSIVE);
@@ -891,6 +1048,16 @@ static int vc1_decode_frame(AVCodecContext *avctx, void *data,
         s->current_picture_ptr->f->repeat_pict = v->rptfrm * 2;
     }
 
+    for (i = 0; i < n_slices; i++)
+        slice_headers |= show_bits1(&slices[i].gb);
+
+    /* Progressive pictures report their progress row by row, so the next
+     * frame can start decoding once the picture header is parsed. Headers
+     * repeated in slices and field pictures update the decoder state later
+     * on, so the next frame has to wait until this one is finished. */
+    if (!v->field_mode && v->fcm == PROGRESSIVE && !slice_headers)
+        ff_thread_finish_setup(avctx);
+
     s->me.qpel_put = s->qdsp.put_qpel_pixels_tab;
     s->me.qpel_avg = s->qdsp.avg_qpel_pixels_tab;
 
@@ -1034,69 +1201,119 @@ static int vc1_decode_frame(AVCodecContext *avctx, void *data,
 
         av_assert0 (mb_height > 0);
 
-        for (i = 0; i <= n_slices; i++) {
-            if (i > 0 &&  slices[i - 1].mby_start >= mb_height) {
-                if (v->field_mode <= 0) {
-                    av_log(v->s.avctx, AV_LOG_ERROR, "Slice %d starts beyond "
-                           "picture boundary (%d >= %d)\n", i,
-                           slices[i - 1].mby_start, mb_height);
-                    continue;
-                }
-                v->second_field = 1;
-                av_assert0((s->mb_height & 1) == 0);
-                v->blocks_off   = s->b8_stride * (s->mb_height&~1);
-                v->mb_off       = s->mb_stride * s->mb_height >> 1;
+        /* only progressive pictures wait for their references row by row */
+        if (v->fcm != PROGRESSIVE) {
+            if (s->last_picture_ptr)
+                ff_thread_await_progress(&s->last_picture_ptr->tf, INT_MAX, 0);
+            if (s->pict_type == AV_PICTURE_TYPE_B && s->next_picture_ptr)
+                ff_thread_await_progress(&s->next_picture_ptr->tf, INT_MAX, 0);
+        }
+
+        if (v->nb_slice_ctx > 1 && n_slices && !v->field_mode &&
+            v->fcm == PROGRESSIVE && !slice_headers) {
+            int nb_jobs = 0;
+
+            v->second_field = 0;
+            v->blocks_off   = 0;
+            v->mb_off       = 0;
+            if (((s->pict_type == AV_PICTURE_TYPE_P && !v->p_frame_skipped) ||
+                 (s->pict_type == AV_PICTURE_TYPE_B && !v->bi_type)) &&
+                !v->cbpcy_vlc) {
+                av_log(v->s.avctx, AV_LOG_ERROR, "missing cbpcy_vlc\n");
             } else {
-                v->second_field = 0;
-                v->blocks_off   = 0;
-                v->mb_off       = 0;
-            }
-            if (i) {
-                v->pic_header_flag = 0;
-                if (v->field_mode && i == n_slices1 + 2) {
-                    if ((header_ret = ff_vc1_parse_frame_header_adv(v, &s->gb)) < 0) {
-                        av_log(v->s.avctx, AV_LOG_ERROR, "Field header damaged\n");
-                        ret = AVERROR_INVALIDDATA;
-                        if (avctx->err_recognition & AV_EF_EXPLODE)
-                            goto err;
+                for (i = 0; i <= n_slices; i++) {
+                    GetBitContext *gb = i ? &slices[i - 1].gb : &s->gb;
+                    int start_mb_y    = i ? slices[i - 1].mby_start : 0;
+                    int end_mb_y      = i == n_slices ? mb_height :
+                                        FFMIN(mb_height, slices[i].mby_start % mb_height);
+
+                    if (start_mb_y >= mb_height) {
+                        av_log(v->s.avctx, AV_LOG_ERROR, "Slice %d starts beyond "
+                               "picture boundary (%d >= %d)\n", i,
+                               start_mb_y, mb_height);
                         continue;
                     }
-                } else if (get_bits1(&s->gb)) {
-                    v->pic_header_flag = 1;
-                    if ((header_ret = ff_vc1_parse_frame_header_adv(v, &s->gb)) < 0) {
-                        av_log(v->s.avctx, AV_LOG_ERROR, "Slice header damaged\n");
-                        ret = AVERROR_INVALIDDATA;
-                        if (avctx->err_recognition & AV_EF_EXPLODE)
-                            goto err;
+                    if (end_mb_y <= start_mb_y) {
+                        av_log(v->s.avctx, AV_LOG_ERROR, "end mb y %d %d invalid\n", end_mb_y, start_mb_y);
                         continue;
                     }
+                    if (i)
+                        skip_bits1(gb); // pic_header_flag
+                    if ((ret = vc1_init_slice_context(v, nb_jobs, gb, start_mb_y, end_mb_y)) < 0)
+                        goto err;
+                    if (++nb_jobs == v->nb_slice_ctx) {
+                        vc1_execute_slice_contexts(v, nb_jobs);
+                        nb_jobs = 0;
+                    }
                 }
+                if (nb_jobs)
+                    vc1_execute_slice_contexts(v, nb_jobs);
             }
-            if (header_ret < 0)
-                continue;
-            s->start_mb_y = (i == 0) ? 0 : FFMAX(0, slices[i-1].mby_start % mb_height);
-            if (!v->field_mode || v->second_field)
-                s->end_mb_y = (i == n_slices     ) ? mb_height : FFMIN(mb_height, slices[i].mby_start % mb_height);
-            else {
-                if (i >= n_slices) {
-                    av_log(v->s.avctx, AV_LOG_ERROR, "first field slice count too large\n");
+        } else {
+            for (i = 0; i <= n_slices; i++) {
+                if (i > 0 &&  slices[i - 1].mby_start >= mb_height) {
+                    if (v->field_mode <= 0) {
+                        av_log(v->s.avctx, AV_LOG_ERROR, "Slice %d starts beyond "
+                               "picture boundary (%d >= %d)\n", i,
+                               slices[i - 1].mby_start, mb_height);
+                        continue;
+                    }
+                    v->second_field = 1;
+                    av_assert0((s->mb_height & 1) == 0);
+                    v->blocks_off   = s->b8_stride * (s->mb_height&~1);
+                    v->mb_off       = s->mb_stride * s->mb_height >> 1;
+                } else {
+                    v->second_field = 0;
+                    v->blocks_off   = 0;
+                    v->mb_off       = 0;
+                }
+                if (i) {
+                    v->pic_header_flag = 0;
+                    if (v->field_mode && i == n_slices1 + 2) {
+                        if ((header_ret = ff_vc1_parse_frame_header_adv(v, &s->gb)) < 0) {
+                            av_log(v->s.avctx, AV_LOG_ERROR, "Field header damaged\n");
+                            ret = AVERROR_INVALIDDATA;
+                            if (avctx->err_recognition & AV_EF_EXPLODE)
+                                goto err;
+                            continue;
+                        }
+                    } else if (get_bits1(&s->gb)) {
+                        v->pic_header_flag = 1;
+                        if ((header_ret = ff_vc1_parse_frame_header_adv(v, &s->gb)) < 0) {
+                            av_log(v->s.avctx, AV_LOG_ERROR, "Slice header damaged\n");
+                            ret = AVERROR_INVALIDDATA;
+                            if (avctx->err_recognition & AV_EF_EXPLODE)
+                                goto err;
+                            continue;
+                        }
+                    }
+                }
+                if (header_ret < 0)
                     continue;
+                s->start_mb_y = (i == 0) ? 0 : FFMAX(0, slices[i-1].mby_start % mb_height);
+                if (!v->field_mode || v->second_field)
+                    s->end_mb_y = (i == n_slices     ) ? mb_height : FFMIN(mb_height, slices[i].mby_start % mb_height);
+                else {
+                    if (i >= n_slices) {
+                        av_log(v->s.avctx, AV_LOG_ERROR, "first field slice count too large\n");
+                        continue;
+                    }
+                    s->end_mb_y = (i == n_slices1 + 1) ? mb_height : FFMIN(mb_height, slices[i].mby_start % mb_height);
                 }
-                s->end_mb_y = (i == n_slices1 + 1) ? mb_height : FFMIN(mb_height, slices[i].mby_start % mb_height);
-            }
-            if (s->end_mb_y <= s->start_mb_y) {
-                av_log(v->s.avctx, AV_LOG_ERROR, "end mb y %d %d invalid\n", s->end_mb_y, s->start_mb_y);
-                continue;
-            }
-            if (((s->pict_type == AV_PICTURE_TYPE_P && !v->p_frame_skipped) ||
-                 (s->pict_type == AV_PICTURE_TYPE_B && !v->bi_type)) &&
-                !v->cbpcy_vlc) {
-                av_log(v->s.avctx, AV_LOG_ERROR, "missing cbpcy_vlc\n");
-                continue;
+                if (s->end_mb_y <= s->start_mb_y) {
+                    av_log(v->s.avctx, AV_LOG_ERROR, "end mb y %d %d invalid\n", s->end_mb_y, s->start_mb_y);
+                    continue;
+                }
+                if (((s->pict_type == AV_PICTURE_TYPE_P && !v->p_frame_skipped) ||
+                     (s->pict_type == AV_PICTURE_TYPE_B && !v->bi_type)) &&
+                    !v->cbpcy_vlc) {
+                    av_log(v->s.avctx, AV_LOG_ERROR, "missing cbpcy_vlc\n");
+                    continue;
+                }
+                ff_vc1_decode_blocks(v);
+                if (i != n_slices)
+                    s->gb = slices[i].gb;
             }
-            ff_vc1_decode_blocks(v);
-            if (i != n_slices)
-                s->gb = slices[i].gb;
         }
         if (v->field_mode) {
             v->second_field = 0;
@@ -1159,6 +1376,8 @@ end:
     return buf_size;
 
 err:
+    if (frame_started)
+        ff_thread_report_progress(&s->current_picture_ptr->tf, INT_MAX, 0);
     av_free(buf2);
     for (i = 0; i < n_slices; i++)
         av_free(slices[i].buf);
@@ -1198,7 +1417,10 @@ AVCodec ff_vc1_decoder = {
     .close          = ff_vc1_decode_end,
     .decode         = vc1_decode_frame,
     .flush          = ff_mpeg_flush,
-    .capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_DELAY,
+    .capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_DELAY |
+                      AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_SLICE_THREADS,
+    .init_thread_copy      = ONLY_IF_THREADS_ENABLED(vc1_decode_init_thread_copy),
+    .update_thread_context = ONLY_IF_THREADS_ENABLED(vc1_update_thread_context),
     .pix_fmts       = vc1_hwaccel_pixfmt_list_420,
     .hw_configs     = (const AVCodecHWConfigInternal*[]) {
 #if CONFIG_VC1_DXVA2_HWACCEL
@@ -1235,7 +1457,10 @@ AVCodec ff_wmv3_decoder = {
     .close          = ff_vc1_decode_end,
     .decode         = vc1_decode_frame,
     .flush          = ff_mpeg_flush,
-    .capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_DELAY,
+    .capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_DELAY |
+                      AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_SLICE_THREADS,
+    .init_thread_copy      = ONLY_IF_THREADS_ENABLED(vc1_decode_init_thread_copy),
+    .update_thread_context = ONLY_IF_THREADS_ENABLED(vc1_update_thread_context),
     .pix_fmts       = vc1_hwaccel_pixfmt_list_420,
     .hw_configs     = (const AVCodecHWConfigInternal*[]) {
 #if CONFIG_WMV3_DXVA2_HWACCEL
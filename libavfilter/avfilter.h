@@ -896,6 +896,16 @@ typedef struct AVFilterGraph {
 
     char *aresample_swr_opts; ///< swr options to use for the auto-inserted aresample filters, Access ONLY through AVOptions
 
+    /**
+     * If nonzero, run the filter threads on a worker pool shared with all
+     * the other filtergraphs and codec contexts of the process that set
+     * this option, with at most this many worker threads in total.
+     * nb_threads then limits how many of them this graph uses at once.
+     *
+     * May be set by the caller before adding any filters to the filtergraph.
+     */
+    int shared_threads;
+
     /**
      * Private fields
      *
@@ -46,6 +46,7 @@ typedef struct PSNRContext {
     int stats_version;
     int stats_header_written;
     int stats_add_max;
+    int summary_only;
     int max[4], average_max;
     int is_rgb;
     uint8_t rgba_map[4];
@@ -54,6 +55,8 @@ typedef struct PSNRContext {
     int planewidth[4];
     int planeheight[4];
     double planeweight[4];
+    uint64_t (*score)[4];
+    int nb_threads;
     PSNRDSPContext dsp;
 } PSNRContext;
 
@@ -65,6 +68,7 @@ static const AVOption psnr_options[] = {
     {"f",          "Set file where to store per-frame difference information", OFFSET(stats_file_str), AV_OPT_TYPE_STRING, {.str=NULL}, 0, 0, FLAGS },
     {"stats_version", "Set the format version for the stats file.",               OFFSET(stats_version),  AV_OPT_TYPE_INT,    {.i64=1},    1, 2, FLAGS },
     {"output_max",  "Add raw stats (max values) to the output log.",            OFFSET(stats_add_max), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS},
+    {"summary_only", "Only compute the averages, no per-frame metadata or stats", OFFSET(summary_only), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS},
     { NULL }
 };
 
@@ -104,28 +108,55 @@ static uint64_t sse_line_16bit(const uint8_t *_main_line, const uint8_t *_ref_li
     return m2;
 }
 
-static inline
-void compute_images_mse(PSNRContext *s,
-                        const uint8_t *main_data[4], const int main_linesizes[4],
-                        const uint8_t *ref_data[4], const int ref_linesizes[4],
-                        int w, int h, double mse[4])
+typedef struct ThreadData {
+    const AVFrame *main, *ref;
+} ThreadData;
+
+static int compute_images_sse(AVFilterContext *ctx, void *arg,
+                              int jobnr, int nb_jobs)
 {
+    PSNRContext *s = ctx->priv;
+    ThreadData *td = arg;
     int i, c;
 
     for (c = 0; c < s->nb_components; c++) {
         const int outw = s->planewidth[c];
         const int outh = s->planeheight[c];
-        const uint8_t *main_line = main_data[c];
-        const uint8_t *ref_line = ref_data[c];
-        const int ref_linesize = ref_linesizes[c];
-        const int main_linesize = main_linesizes[c];
+        const int slice_start = (outh *  jobnr     ) / nb_jobs;
+        const int slice_end   = (outh * (jobnr + 1)) / nb_jobs;
+        const int ref_linesize = td->ref->linesize[c];
+        const int main_linesize = td->main->linesize[c];
+        const uint8_t *main_line = td->main->data[c] + main_linesize * slice_start;
+        const uint8_t *ref_line = td->ref->data[c] + ref_linesize * slice_start;
         uint64_t m = 0;
-        for (i = 0; i < outh; i++) {
+        for (i = slice_start; i < slice_end; i++) {
             m += s->dsp.sse_line(main_line, ref_line, outw);
             ref_line += ref_linesize;
             main_line += main_linesize;
         }
-        mse[c] = m / (double)(outw * outh);
+        s->score[jobnr][c] = m;
+    }
+
+    return 0;
+}
+
+static void compute_images_mse(AVFilterContext *ctx,
+                               const AVFrame *main, const AVFrame *ref,
+                               double mse[4])
+{
+    PSNRContext *s = ctx->priv;
+    ThreadData td = { .main = main, .ref = ref };
+    int nb_jobs = FFMIN(s->planeheight[1], s->nb_threads);
+    int j, c;
+
+    ctx->internal->execute(ctx, compute_images_sse, &td, NULL, nb_jobs);
+
+    /* the sums are exact, so the result does not depend on the slicing */
+    for (c = 0; c < s->nb_components; c++) {
+        uint64_t m = 0;
+        for (j = 0; j < nb_jobs; j++)
+            m += s->score[j][c];
+        mse[c] = m / (double)(s->planewidth[c] * s->planeheight[c]);
     }
 }
 
@@ -158,9 +189,7 @@ static int do_psnr(FFFrameSync *fs)
         return ff_filter_frame(ctx->outputs[0], master);
     metadata = &master->metadata;
 
-    compute_images_mse(s, (const uint8_t **)master->data, master->linesize,
-                          (const uint8_t **)ref->data, ref->linesize,
-                          master->width, master->height, comp_mse);
+    compute_images_mse(ctx, master, ref, comp_mse);
 
     for (j = 0; j < s->nb_components; j++)
         mse += comp_mse[j] * s->planeweight[j];
@@ -173,6 +202,9 @@ static int do_psnr(FFFrameSync *fs)
         s->mse_comp[j] += comp_mse[j];
     s->nb_frames++;
 
+    if (s->summary_only)
+        return ff_filter_frame(ctx->outputs[0], master);
+
     for (j = 0; j < s->nb_components; j++) {
         c = s->is_rgb ? s->rgba_map[j] : j;
         set_meta(metadata, "lavfi.psnr.mse.", s->comps[j], comp_mse[c]);
@@ -329,6 +361,12 @@ static int config_input_ref(AVFilterLink *inlink)
     if (ARCH_X86)
         ff_psnr_init_x86(&s->dsp, desc->comp[0].depth);
 
+    s->nb_threads = ff_filter_get_nb_threads(ctx);
+    av_freep(&s->score);
+    s->score = av_calloc(s->nb_threads, sizeof(*s->score));
+    if (!s->score)
+        return AVERROR(ENOMEM);
+
     return 0;
 }
 
@@ -378,9 +416,16 @@ static av_cold void uninit(AVFilterContext *ctx)
                get_psnr(s->mse, s->nb_frames, s->average_max),
                get_psnr(s->max_mse, 1, s->average_max),
                get_psnr(s->min_mse, 1, s->average_max));
+        if (s->stats_file && s->summary_only)
+            fprintf(s->stats_file, "n:%"PRId64"%s average:%f min:%f max:%f\n",
+                    s->nb_frames, buf,
+                    get_psnr(s->mse, s->nb_frames, s->average_max),
+                    get_psnr(s->max_mse, 1, s->average_max),
+                    get_psnr(s->min_mse, 1, s->average_max));
     }
 
     ff_framesync_uninit(&s->fs);
+    av_freep(&s->score);
 
     if (s->stats_file && s->stats_file != stdout)
         fclose(s->stats_file);
@@ -419,4 +464,5 @@ AVFilter ff_vf_psnr = {
     .priv_class    = &psnr_class,
     .inputs        = psnr_inputs,
     .outputs       = psnr_outputs,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
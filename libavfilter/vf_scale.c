@@ -51,6 +51,9 @@ typedef struct ScaleContext {
     const AVClass *class;
     struct SwsContext *sws;     ///< software scaler context
     struct SwsContext *isws[2]; ///< software scaler context for interlaced material
+    struct SwsContext **slice_sws; ///< additional scaler contexts for slice threading
+    int nb_slice_sws;
+    int *slice_ret;             ///< return values of the slice jobs
     AVDictionary *opts;
 
     /**
@@ -145,6 +148,17 @@ static av_cold int init_dict(AVFilterContext *ctx, AVDictionary **opts)
     return 0;
 }
 
+static void free_slice_contexts(ScaleContext *scale)
+{
+    int i;
+
+    for (i = 0; i < scale->nb_slice_sws; i++)
+        sws_freeContext(scale->slice_sws[i]);
+    av_freep(&scale->slice_sws);
+    av_freep(&scale->slice_ret);
+    scale->nb_slice_sws = 0;
+}
+
 static av_cold void uninit(AVFilterContext *ctx)
 {
     ScaleContext *scale = ctx->priv;
@@ -152,6 +166,7 @@ static av_cold void uninit(AVFilterContext *ctx)
     sws_freeContext(scale->isws[0]);
     sws_freeContext(scale->isws[1]);
     scale->sws = NULL;
+    free_slice_contexts(scale);
     av_dict_free(&scale->opts);
 }
 
@@ -217,6 +232,63 @@ static const int *parse_yuv_type(const char *s, enum AVColorSpace colorspace)
     return sws_getCoefficients(colorspace);
 }
 
+/**
+ * Allocate and initialize a scaler context for the whole frame (field 0)
+ * or for the top (field 1) or bottom (field 2) field of interlaced material.
+ */
+static int init_sws_context(ScaleContext *scale, struct SwsContext **s,
+                            AVFilterLink *inlink0, AVFilterLink *outlink,
+                            enum AVPixelFormat outfmt, int field)
+{
+    int in_v_chr_pos = scale->in_v_chr_pos, out_v_chr_pos = scale->out_v_chr_pos;
+    int ret;
+
+    *s = sws_alloc_context();
+    if (!*s)
+        return AVERROR(ENOMEM);
+
+    av_opt_set_int(*s, "srcw", inlink0 ->w, 0);
+    av_opt_set_int(*s, "srch", inlink0 ->h >> !!field, 0);
+    av_opt_set_int(*s, "src_format", inlink0->format, 0);
+    av_opt_set_int(*s, "dstw", outlink->w, 0);
+    av_opt_set_int(*s, "dsth", outlink->h >> !!field, 0);
+    av_opt_set_int(*s, "dst_format", outfmt, 0);
+    av_opt_set_int(*s, "sws_flags", scale->flags, 0);
+    av_opt_set_int(*s, "param0", scale->param[0], 0);
+    av_opt_set_int(*s, "param1", scale->param[1], 0);
+    if (scale->in_range != AVCOL_RANGE_UNSPECIFIED)
+        av_opt_set_int(*s, "src_range",
+                       scale->in_range == AVCOL_RANGE_JPEG, 0);
+    if (scale->out_range != AVCOL_RANGE_UNSPECIFIED)
+        av_opt_set_int(*s, "dst_range",
+                       scale->out_range == AVCOL_RANGE_JPEG, 0);
+
+    if (scale->opts) {
+        AVDictionaryEntry *e = NULL;
+        while ((e = av_dict_get(scale->opts, "", e, AV_DICT_IGNORE_SUFFIX))) {
+            if ((ret = av_opt_set(*s, e->key, e->value, 0)) < 0)
+                return ret;
+        }
+    }
+    /* Override YUV420P default settings to have the correct (MPEG-2) chroma positions
+     * MPEG-2 chroma positions are used by convention
+     * XXX: support other 4:2:0 pixel formats */
+    if (inlink0->format == AV_PIX_FMT_YUV420P && scale->in_v_chr_pos == -513) {
+        in_v_chr_pos = (field == 0) ? 128 : (field == 1) ? 64 : 192;
+    }
+
+    if (outlink->format == AV_PIX_FMT_YUV420P && scale->out_v_chr_pos == -513) {
+        out_v_chr_pos = (field == 0) ? 128 : (field == 1) ? 64 : 192;
+    }
+
+    av_opt_set_int(*s, "src_h_chr_pos", scale->in_h_chr_pos, 0);
+    av_opt_set_int(*s, "src_v_chr_pos", in_v_chr_pos, 0);
+    av_opt_set_int(*s, "dst_h_chr_pos", scale->out_h_chr_pos, 0);
+    av_opt_set_int(*s, "dst_v_chr_pos", out_v_chr_pos, 0);
+
+    return sws_init_context(*s, NULL, NULL);
+}
+
 static int config_props(AVFilterLink *outlink)
 {
     AVFilterContext *ctx = outlink->src;
@@ -273,6 +345,7 @@ static int config_props(AVFilterLink *outlink)
     if (scale->isws[1])
         sws_freeContext(scale->isws[1]);
     scale->isws[0] = scale->isws[1] = scale->sws = NULL;
+    free_slice_contexts(scale);
     if (inlink0->w == outlink->w &&
         inlink0->h == outlink->h &&
         !scale->out_color_matrix &&
@@ -281,59 +354,29 @@ static int config_props(AVFilterLink *outlink)
         ;
     else {
         struct SwsContext **swscs[3] = {&scale->sws, &scale->isws[0], &scale->isws[1]};
-        int i;
+        int i, nb_threads;
 
         for (i = 0; i < 3; i++) {
-            int in_v_chr_pos = scale->in_v_chr_pos, out_v_chr_pos = scale->out_v_chr_pos;
-            struct SwsContext **s = swscs[i];
-            *s = sws_alloc_context();
-            if (!*s)
-                return AVERROR(ENOMEM);
-
-            av_opt_set_int(*s, "srcw", inlink0 ->w, 0);
-            av_opt_set_int(*s, "srch", inlink0 ->h >> !!i, 0);
-            av_opt_set_int(*s, "src_format", inlink0->format, 0);
-            av_opt_set_int(*s, "dstw", outlink->w, 0);
-            av_opt_set_int(*s, "dsth", outlink->h >> !!i, 0);
-            av_opt_set_int(*s, "dst_format", outfmt, 0);
-            av_opt_set_int(*s, "sws_flags", scale->flags, 0);
-            av_opt_set_int(*s, "param0", scale->param[0], 0);
-            av_opt_set_int(*s, "param1", scale->param[1], 0);
-            if (scale->in_range != AVCOL_RANGE_UNSPECIFIED)
-                av_opt_set_int(*s, "src_range",
-                               scale->in_range == AVCOL_RANGE_JPEG, 0);
-            if (scale->out_range != AVCOL_RANGE_UNSPECIFIED)
-                av_opt_set_int(*s, "dst_range",
-                               scale->out_range == AVCOL_RANGE_JPEG, 0);
-
-            if (scale->opts) {
-                AVDictionaryEntry *e = NULL;
-                while ((e = av_dict_get(scale->opts, "", e, AV_DICT_IGNORE_SUFFIX))) {
-                    if ((ret = av_opt_set(*s, e->key, e->value, 0)) < 0)
-                        return ret;
-                }
-            }
-            /* Override YUV420P default settings to have the correct (MPEG-2) chroma positions
-             * MPEG-2 chroma positions are used by convention
-             * XXX: support other 4:2:0 pixel formats */
-            if (inlink0->format == AV_PIX_FMT_YUV420P && scale->in_v_chr_pos == -513) {
-                in_v_chr_pos = (i == 0) ? 128 : (i == 1) ? 64 : 192;
-            }
-
-            if (outlink->format == AV_PIX_FMT_YUV420P && scale->out_v_chr_pos == -513) {
-                out_v_chr_pos = (i == 0) ? 128 : (i == 1) ? 64 : 192;
-            }
-
-            av_opt_set_int(*s, "src_h_chr_pos", scale->in_h_chr_pos, 0);
-            av_opt_set_int(*s, "src_v_chr_pos", in_v_chr_pos, 0);
-            av_opt_set_int(*s, "dst_h_chr_pos", scale->out_h_chr_pos, 0);
-            av_opt_set_int(*s, "dst_v_chr_pos", out_v_chr_pos, 0);
-
-            if ((ret = sws_init_context(*s, NULL, NULL)) < 0)
+            if ((ret = init_sws_context(scale, swscs[i], inlink0, outlink, outfmt, i)) < 0)
                 return ret;
             if (!scale->interlaced)
                 break;
         }
+
+        /* the nb_slices option feeds the scaler with input slices,
+         * which does not combine with output slices */
+        nb_threads = FFMIN(ff_filter_get_nb_threads(ctx),
+                           outlink->h >> av_pix_fmt_desc_get(outfmt)->log2_chroma_h);
+        if (nb_threads > 1 && !scale->nb_slices) {
+            scale->slice_sws = av_mallocz_array(nb_threads - 1, sizeof(*scale->slice_sws));
+            scale->slice_ret = av_mallocz_array(nb_threads, sizeof(*scale->slice_ret));
+            if (!scale->slice_sws || !scale->slice_ret)
+                return AVERROR(ENOMEM);
+            scale->nb_slice_sws = nb_threads - 1;
+            for (i = 0; i < scale->nb_slice_sws; i++)
+                if ((ret = init_sws_context(scale, &scale->slice_sws[i], inlink0, outlink, outfmt, 0)) < 0)
+                    return ret;
+        }
     }
 
     if (inlink0->sample_aspect_ratio.num){
@@ -400,6 +443,54 @@ static int scale_slice(AVFilterLink *link, AVFrame *out_buf, AVFrame *cur_pic, s
                          out,out_stride);
 }
 
+typedef struct ThreadData {
+    AVFrame *in, *out;
+} ThreadData;
+
+static int scale_dst_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ScaleContext *scale = ctx->priv;
+    ThreadData *td = arg;
+    AVFrame *out = td->out;
+    struct SwsContext *sws = jobnr ? scale->slice_sws[jobnr - 1] : scale->sws;
+    const int vsub = av_pix_fmt_desc_get(out->format)->log2_chroma_h;
+    const int nb_rows = AV_CEIL_RSHIFT(out->height, vsub);
+    const int slice_start = (nb_rows *  jobnr     ) / nb_jobs << vsub;
+    const int slice_end   = jobnr == nb_jobs - 1 ? out->height :
+                            (nb_rows * (jobnr + 1)) / nb_jobs << vsub;
+
+    return sws_scale_dst_slice(sws, (const uint8_t * const *)td->in->data,
+                               td->in->linesize, out->data, out->linesize,
+                               slice_start, slice_end - slice_start);
+}
+
+/**
+ * Scale the whole frame with one scaler context per output slice.
+ * Return AVERROR(ENOSYS) if the conversion cannot be split, in which case
+ * the additional contexts are dropped, or the first error returned for a
+ * slice.
+ */
+static int scale_frame_threaded(AVFilterContext *ctx, AVFrame *out, AVFrame *in)
+{
+    ScaleContext *scale = ctx->priv;
+    ThreadData td = { .in = in, .out = out };
+    int i;
+
+    ctx->internal->execute(ctx, scale_dst_slice, &td, scale->slice_ret,
+                           scale->nb_slice_sws + 1);
+
+    if (scale->slice_ret[0] == AVERROR(ENOSYS)) {
+        av_log(ctx, AV_LOG_VERBOSE, "Conversion cannot be split into slices, "
+               "disabling slice threading\n");
+        free_slice_contexts(scale);
+        return AVERROR(ENOSYS);
+    }
+    for (i = 0; i <= scale->nb_slice_sws; i++)
+        if (scale->slice_ret[i] < 0)
+            return scale->slice_ret[i];
+    return 0;
+}
+
 static int filter_frame(AVFilterLink *link, AVFrame *in)
 {
     ScaleContext *scale = link->dst->priv;
@@ -463,7 +554,7 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
         || scale-> in_range != AVCOL_RANGE_UNSPECIFIED
         || in_range != AVCOL_RANGE_UNSPECIFIED
         || scale->out_range != AVCOL_RANGE_UNSPECIFIED) {
-        int in_full, out_full, brightness, contrast, saturation;
+        int in_full, out_full, brightness, contrast, saturation, i;
         const int *inv_table, *table;
 
         sws_getColorspaceDetails(scale->sws, (int **)&inv_table, &in_full,
@@ -495,6 +586,10 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
             sws_setColorspaceDetails(scale->isws[1], inv_table, in_full,
                                      table, out_full,
                                      brightness, contrast, saturation);
+        for (i = 0; i < scale->nb_slice_sws; i++)
+            sws_setColorspaceDetails(scale->slice_sws[i], inv_table, in_full,
+                                     table, out_full,
+                                     brightness, contrast, saturation);
 
         out->color_range = out_full ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
     }
@@ -517,7 +612,16 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
             scale_slice(link, out, in, scale->sws, slice_start, slice_h, 1, 0);
         }
     }else{
-        scale_slice(link, out, in, scale->sws, 0, link->h, 1, 0);
+        int ret = AVERROR(ENOSYS);
+        if (scale->nb_slice_sws)
+            ret = scale_frame_threaded(link->dst, out, in);
+        if (ret == AVERROR(ENOSYS)) {
+            scale_slice(link, out, in, scale->sws, 0, link->h, 1, 0);
+        } else if (ret < 0) {
+            av_frame_free(&in);
+            av_frame_free(&out);
+            return ret;
+        }
     }
 
     av_frame_free(&in);
@@ -639,6 +743,7 @@ AVFilter ff_vf_scale = {
     .inputs          = avfilter_vf_scale_inputs,
     .outputs         = avfilter_vf_scale_outputs,
     .process_command = process_command,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
 
 static const AVClass scale2ref_class = {
@@ -691,4 +796,5 @@ AVFilter ff_vf_scale2ref = {
     .inputs          = avfilter_vf_scale2ref_inputs,
     .outputs         = avfilter_vf_scale2ref_outputs,
     .process_command = process_command,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
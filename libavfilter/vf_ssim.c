@@ -59,13 +59,16 @@ typedef struct SSIMContext {
     uint8_t rgba_map[4];
     int planewidth[4];
     int planeheight[4];
-    int *temp;
+    int summary_only;
+    int nb_threads;
+    void **temp;
+    float *row_ssim[4];
     int is_rgb;
-    float (*ssim_plane)(SSIMDSPContext *dsp,
-                        uint8_t *main, int main_stride,
-                        uint8_t *ref, int ref_stride,
-                        int width, int height, void *temp,
-                        int max);
+    void (*ssim_plane)(SSIMDSPContext *dsp,
+                       uint8_t *main, int main_stride,
+                       uint8_t *ref, int ref_stride,
+                       int width, int height, void *temp,
+                       int max, int jobnr, int nb_jobs, float *row_ssim);
     SSIMDSPContext dsp;
 } SSIMContext;
 
@@ -75,6 +78,7 @@ typedef struct SSIMContext {
 static const AVOption ssim_options[] = {
     {"stats_file", "Set file where to store per-frame difference information", OFFSET(stats_file_str), AV_OPT_TYPE_STRING, {.str=NULL}, 0, 0, FLAGS },
     {"f",          "Set file where to store per-frame difference information", OFFSET(stats_file_str), AV_OPT_TYPE_STRING, {.str=NULL}, 0, 0, FLAGS },
+    {"summary_only", "Only compute the averages, no per-frame metadata or stats", OFFSET(summary_only), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
     { NULL }
 };
 
@@ -221,21 +225,26 @@ static float ssim_endn_8bit(const int (*sum0)[4], const int (*sum1)[4], int widt
 
 #define SUM_LEN(w) (((w) >> 2) + 3)
 
-static float ssim_plane_16bit(SSIMDSPContext *dsp,
-                              uint8_t *main, int main_stride,
-                              uint8_t *ref, int ref_stride,
-                              int width, int height, void *temp,
-                              int max)
+/* the first and the last row of 4x4 blocks computed by a slice job */
+#define SLICE_START(h, jobnr, nb_jobs) (1 + (((h) - 1) *  (jobnr)     ) / (nb_jobs))
+#define SLICE_END(h, jobnr, nb_jobs)   (1 + (((h) - 1) * ((jobnr) + 1)) / (nb_jobs))
+
+static void ssim_plane_16bit(SSIMDSPContext *dsp,
+                             uint8_t *main, int main_stride,
+                             uint8_t *ref, int ref_stride,
+                             int width, int height, void *temp,
+                             int max, int jobnr, int nb_jobs, float *row_ssim)
 {
-    int z = 0, y;
-    float ssim = 0.0;
+    int z, y, slice_start, slice_end;
     int64_t (*sum0)[4] = temp;
     int64_t (*sum1)[4] = sum0 + SUM_LEN(width);
 
     width >>= 2;
     height >>= 2;
+    slice_start = SLICE_START(height, jobnr, nb_jobs);
+    slice_end   = SLICE_END(height, jobnr, nb_jobs);
 
-    for (y = 1; y < height; y++) {
+    for (z = slice_start - 1, y = slice_start; y < slice_end; y++) {
         for (; z <= y; z++) {
             FFSWAP(void*, sum0, sum1);
             ssim_4x4xn_16bit(&main[4 * z * main_stride], main_stride,
@@ -243,27 +252,26 @@ static float ssim_plane_16bit(SSIMDSPContext *dsp,
                              sum0, width);
         }
 
-        ssim += ssim_endn_16bit((const int64_t (*)[4])sum0, (const int64_t (*)[4])sum1, width - 1, max);
+        row_ssim[y] = ssim_endn_16bit((const int64_t (*)[4])sum0, (const int64_t (*)[4])sum1, width - 1, max);
     }
-
-    return ssim / ((height - 1) * (width - 1));
 }
 
-static float ssim_plane(SSIMDSPContext *dsp,
-                        uint8_t *main, int main_stride,
-                        uint8_t *ref, int ref_stride,
-                        int width, int height, void *temp,
-                        int max)
+static void ssim_plane(SSIMDSPContext *dsp,
+                       uint8_t *main, int main_stride,
+                       uint8_t *ref, int ref_stride,
+                       int width, int height, void *temp,
+                       int max, int jobnr, int nb_jobs, float *row_ssim)
 {
-    int z = 0, y;
-    float ssim = 0.0;
+    int z, y, slice_start, slice_end;
     int (*sum0)[4] = temp;
     int (*sum1)[4] = sum0 + SUM_LEN(width);
 
     width >>= 2;
     height >>= 2;
+    slice_start = SLICE_START(height, jobnr, nb_jobs);
+    slice_end   = SLICE_END(height, jobnr, nb_jobs);
 
-    for (y = 1; y < height; y++) {
+    for (z = slice_start - 1, y = slice_start; y < slice_end; y++) {
         for (; z <= y; z++) {
             FFSWAP(void*, sum0, sum1);
             dsp->ssim_4x4_line(&main[4 * z * main_stride], main_stride,
@@ -271,8 +279,42 @@ static float ssim_plane(SSIMDSPContext *dsp,
                                sum0, width);
         }
 
-        ssim += dsp->ssim_end_line((const int (*)[4])sum0, (const int (*)[4])sum1, width - 1);
+        row_ssim[y] = dsp->ssim_end_line((const int (*)[4])sum0, (const int (*)[4])sum1, width - 1);
     }
+}
+
+typedef struct ThreadData {
+    AVFrame *main, *ref;
+} ThreadData;
+
+static int ssim_plane_slices(AVFilterContext *ctx, void *arg,
+                             int jobnr, int nb_jobs)
+{
+    SSIMContext *s = ctx->priv;
+    ThreadData *td = arg;
+    int i;
+
+    for (i = 0; i < s->nb_components; i++)
+        s->ssim_plane(&s->dsp, td->main->data[i], td->main->linesize[i],
+                      td->ref->data[i], td->ref->linesize[i],
+                      s->planewidth[i], s->planeheight[i], s->temp[jobnr],
+                      s->max, jobnr, nb_jobs, s->row_ssim[i]);
+
+    return 0;
+}
+
+/* sum up the rows in order, so that the result does not depend on the
+ * number of slices */
+static float ssim_plane_reduce(const float *row_ssim, int width, int height)
+{
+    float ssim = 0.0;
+    int y;
+
+    width >>= 2;
+    height >>= 2;
+
+    for (y = 1; y < height; y++)
+        ssim += row_ssim[y];
 
     return ssim / ((height - 1) * (width - 1));
 }
@@ -288,8 +330,9 @@ static int do_ssim(FFFrameSync *fs)
     SSIMContext *s = ctx->priv;
     AVFrame *master, *ref;
     AVDictionary **metadata;
+    ThreadData td;
     float c[4], ssimv = 0.0;
-    int ret, i;
+    int ret, i, nb_jobs;
 
     ret = ff_framesync_dualinput_get(fs, &master, &ref);
     if (ret < 0)
@@ -300,19 +343,25 @@ static int do_ssim(FFFrameSync *fs)
 
     s->nb_frames++;
 
+    td.main = master;
+    td.ref  = ref;
+    nb_jobs = av_clip(s->planeheight[1] / 4 - 1, 1, s->nb_threads);
+    ctx->internal->execute(ctx, ssim_plane_slices, &td, NULL, nb_jobs);
+
     for (i = 0; i < s->nb_components; i++) {
-        c[i] = s->ssim_plane(&s->dsp, master->data[i], master->linesize[i],
-                             ref->data[i], ref->linesize[i],
-                             s->planewidth[i], s->planeheight[i], s->temp,
-                             s->max);
+        c[i] = ssim_plane_reduce(s->row_ssim[i], s->planewidth[i], s->planeheight[i]);
         ssimv += s->coefs[i] * c[i];
         s->ssim[i] += c[i];
     }
+    s->ssim_total += ssimv;
+
+    if (s->summary_only)
+        return ff_filter_frame(ctx->outputs[0], master);
+
     for (i = 0; i < s->nb_components; i++) {
         int cidx = s->is_rgb ? s->rgba_map[i] : i;
         set_meta(metadata, "lavfi.ssim.", s->comps[i], c[cidx]);
     }
-    s->ssim_total += ssimv;
 
     set_meta(metadata, "lavfi.ssim.All", 0, ssimv);
     set_meta(metadata, "lavfi.ssim.dB", 0, ssim_db(ssimv, 1.0));
@@ -410,9 +459,20 @@ static int config_input_ref(AVFilterLink *inlink)
     for (i = 0; i < s->nb_components; i++)
         s->coefs[i] = (double) s->planeheight[i] * s->planewidth[i] / sum;
 
-    s->temp = av_mallocz_array(2 * SUM_LEN(inlink->w), (desc->comp[0].depth > 8) ? sizeof(int64_t[4]) : sizeof(int[4]));
+    s->nb_threads = ff_filter_get_nb_threads(ctx);
+    s->temp = av_mallocz_array(s->nb_threads, sizeof(*s->temp));
     if (!s->temp)
         return AVERROR(ENOMEM);
+    for (i = 0; i < s->nb_threads; i++) {
+        s->temp[i] = av_mallocz_array(2 * SUM_LEN(inlink->w), (desc->comp[0].depth > 8) ? sizeof(int64_t[4]) : sizeof(int[4]));
+        if (!s->temp[i])
+            return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < s->nb_components; i++) {
+        s->row_ssim[i] = av_mallocz_array(s->planeheight[i] / 4 + 1, sizeof(*s->row_ssim[i]));
+        if (!s->row_ssim[i])
+            return AVERROR(ENOMEM);
+    }
     s->max = (1 << desc->comp[0].depth) - 1;
 
     s->ssim_plane = desc->comp[0].depth > 8 ? ssim_plane_16bit : ssim_plane;
@@ -455,10 +515,10 @@ static int activate(AVFilterContext *ctx)
 static av_cold void uninit(AVFilterContext *ctx)
 {
     SSIMContext *s = ctx->priv;
+    int i;
 
     if (s->nb_frames > 0) {
         char buf[256];
-        int i;
         buf[0] = 0;
         for (i = 0; i < s->nb_components; i++) {
             int c = s->is_rgb ? s->rgba_map[i] : i;
@@ -467,6 +527,9 @@ static av_cold void uninit(AVFilterContext *ctx)
         }
         av_log(ctx, AV_LOG_INFO, "SSIM%s All:%f (%f)\n", buf,
                s->ssim_total / s->nb_frames, ssim_db(s->ssim_total, s->nb_frames));
+        if (s->stats_file && s->summary_only)
+            fprintf(s->stats_file, "n:%"PRId64"%s All:%f (%f)\n", s->nb_frames, buf,
+                    s->ssim_total / s->nb_frames, ssim_db(s->ssim_total, s->nb_frames));
     }
 
     ff_framesync_uninit(&s->fs);
@@ -474,7 +537,12 @@ static av_cold void uninit(AVFilterContext *ctx)
     if (s->stats_file && s->stats_file != stdout)
         fclose(s->stats_file);
 
+    if (s->temp)
+        for (i = 0; i < s->nb_threads; i++)
+            av_freep(&s->temp[i]);
     av_freep(&s->temp);
+    for (i = 0; i < 4; i++)
+        av_freep(&s->row_ssim[i]);
 }
 
 static const AVFilterPad ssim_inputs[] = {
@@ -510,4 +578,5 @@ AVFilter ff_vf_ssim = {
     .priv_class    = &ssim_class,
     .inputs        = ssim_inputs,
     .outputs       = ssim_outputs,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
@@ -1084,7 +1084,7 @@ typedef struct AVStream {
     struct AVCodecParserContext *parser;
 
     /**
-     * last packet in packet_buffer for this stream when muxing.
+     * last packet in the interleaving queue of this stream when muxing.
      */
     struct AVPacketList *last_in_packet_buffer;
     AVProbeData probe_data;
@@ -1915,6 +1915,10 @@ typedef struct AVFormatContext {
      * additional internal format contexts. Thus the AVFormatContext pointer
      * passed to this callback may be different from the one facing the caller.
      * It will, however, have the same 'opaque' field.
+     *
+     * @note Some demuxers may call this callback and io_close from several
+     * threads at once if requested by their options, e.g. the hls demuxer
+     * with the prefetch option.
      */
     int (*io_open)(struct AVFormatContext *s, AVIOContext **pb, const char *url,
                    int flags, AVDictionary **options);
@@ -1944,6 +1948,41 @@ typedef struct AVFormatContext {
      * - decoding: set by user
      */
     int skip_estimate_duration_from_pts;
+
+    /**
+     * Maximum number of streams whose probe frames are decoded on worker
+     * threads in avformat_find_stream_info(), while the calling thread keeps
+     * demuxing. 0 decodes all probe frames on the calling thread.
+     * - encoding: unused
+     * - decoding: set by user
+     */
+    int probe_threads;
+
+    /**
+     * Directory in which avformat_find_stream_info() caches the stream
+     * parameters and the index of local files, so that later opens of an
+     * unchanged file skip probing.
+     * - encoding: unused
+     * - decoding: set by user
+     */
+    char *probe_cache;
+
+    /**
+     * Maximum number of bytes buffered by av_interleaved_write_frame() while
+     * waiting for packets of all the streams. Above it, packets are output
+     * regardless, as with max_interleave_delta. 0 means no limit.
+     *
+     * Muxing only, set by the caller before avformat_write_header().
+     */
+    int64_t max_interleave_size;
+
+    /**
+     * Largest number of bytes buffered by av_interleaved_write_frame() so
+     * far.
+     *
+     * Muxing only, set by libavformat.
+     */
+    int64_t interleave_peak_size;
 } AVFormatContext;
 
 #if FF_API_FORMAT_GET_SET
@@ -57,6 +57,7 @@ static const AVOption options[] = {
     {"protocol_whitelist", "List of protocols that are allowed to be used", OFFSET(protocol_whitelist), AV_OPT_TYPE_STRING, { .str = NULL },  CHAR_MIN, CHAR_MAX, D },
     {"protocol_blacklist", "List of protocols that are not allowed to be used", OFFSET(protocol_blacklist), AV_OPT_TYPE_STRING, { .str = NULL },  CHAR_MIN, CHAR_MAX, D },
     {"rw_timeout", "Timeout for IO operations (in microseconds)", offsetof(URLContext, rw_timeout), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_DECODING_PARAM },
+    {"readahead", "Maximum size of the asynchronous read-ahead buffer, 0 to disable", offsetof(URLContext, readahead), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, AV_OPT_FLAG_DECODING_PARAM },
     { NULL }
 };
 
@@ -342,6 +343,10 @@ int ffurl_open_whitelist(URLContext **puc, const char *filename, int flags,
     if ((ret = av_opt_set_dict(*puc, options)) < 0)
         goto fail;
 
+    /* read-ahead must be able to interrupt the nested contexts too */
+    if ((*puc)->readahead && !(flags & AVIO_FLAG_WRITE))
+        ffurl_intercept_interrupt(*puc);
+
     ret = ffurl_connect(*puc, options);
 
     if (!ret)
@@ -352,6 +357,22 @@ fail:
     return ret;
 }
 
+static int url_check_interrupt(void *opaque)
+{
+    URLContext *h = opaque;
+
+    return atomic_load(&h->cancel) || ff_check_interrupt(&h->orig_interrupt_callback);
+}
+
+void ffurl_intercept_interrupt(URLContext *h)
+{
+    if (h->interrupt_callback.callback == url_check_interrupt)
+        return;
+    atomic_init(&h->cancel, 0);
+    h->orig_interrupt_callback = h->interrupt_callback;
+    h->interrupt_callback      = (AVIOInterruptCB){ url_check_interrupt, h };
+}
+
 int ffurl_open(URLContext **puc, const char *filename, int flags,
                const AVIOInterruptCB *int_cb, AVDictionary **options)
 {
@@ -140,6 +140,17 @@ int ffio_fdopen(AVIOContext **s, URLContext *h);
  */
 URLContext *ffio_geturlcontext(AVIOContext *s);
 
+/**
+ * Read size bytes as a reference to the data of the underlying protocol,
+ * without copying them, if it supports that (see URLProtocol.url_read_ref).
+ * The referenced data must not be modified. It is followed by zeroed
+ * padding like packet data.
+ *
+ * @return size on success, AVERROR(ENOSYS) if the data cannot be referenced,
+ *         in which case nothing was read, or another negative error code
+ */
+int ffio_read_ref(AVIOContext *s, int size, AVBufferRef **buf);
+
 /**
  * Open a write-only fake memory stream. The written data is not stored
  * anywhere - this is only used for measuring the amount of data
@@ -22,16 +22,20 @@
 #include "libavutil/bprint.h"
 #include "libavutil/crc.h"
 #include "libavutil/dict.h"
+#include "libavutil/fifo.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/log.h"
 #include "libavutil/opt.h"
 #include "libavutil/avassert.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
 #include "avformat.h"
 #include "avio.h"
 #include "avio_internal.h"
 #include "internal.h"
 #include "url.h"
 #include <stdarg.h>
+#include <stdatomic.h>
 
 #define IO_BUFFER_SIZE 32768
 
@@ -42,8 +46,16 @@
  */
 #define SHORT_SEEK_THRESHOLD 4096
 
+/**
+ * Initial amount of data kept buffered ahead in read-ahead mode, see below.
+ */
+#define READAHEAD_MIN_SIZE (4 * IO_BUFFER_SIZE)
+
+typedef struct ReadAhead ReadAhead;
+
 typedef struct AVIOInternal {
     URLContext *h;
+    ReadAhead *ra;
 } AVIOInternal;
 
 static void *ff_avio_child_next(void *obj, void *prev)
@@ -938,9 +950,305 @@ uint64_t ffio_read_varlen(AVIOContext *bc){
     return val;
 }
 
+#if HAVE_THREADS
+/**
+ * Asynchronous read-ahead, enabled with the readahead URLContext option.
+ *
+ * A worker thread reads from the URLContext into a ring buffer, keeping
+ * up to target bytes buffered. The target starts small and grows up to
+ * max_size to cover half a second of the observed throughput, and doubles
+ * whenever the reader finds the ring empty.
+ * Whenever the reader needs the URLContext itself (seeking), it holds the
+ * worker, which interrupts the read in progress if the buffered data is
+ * to be discarded. The interruption goes through URLContext.cancel, so that
+ * it also reaches the nested contexts of h, e.g. the tcp context of http.
+ */
+struct ReadAhead {
+    URLContext      *h;
+
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+
+    AVFifoBuffer    *fifo;
+    int64_t         pos;        ///< position of the first buffered byte
+    int             error;      ///< error or EOF returned by the last read
+    int             target;
+    int             max_size;
+
+    int             hold;       ///< the worker must not use h
+    int             busy;       ///< the worker is inside ffurl_read()
+    int             abort;
+    int             discard;    ///< drop the data of the read in progress
+
+    int64_t         stat_bytes;
+    int64_t         stat_time;
+};
+
+/* mutex held */
+static void ra_set_target(ReadAhead *ra, int64_t target)
+{
+    target = av_clip64(target, READAHEAD_MIN_SIZE, ra->max_size);
+    if (target <= ra->target)
+        return;
+    if (av_fifo_grow(ra->fifo, target - av_fifo_size(ra->fifo)) < 0)
+        return;
+    av_log(ra->h, AV_LOG_DEBUG, "read-ahead size %d -> %"PRId64"\n",
+           ra->target, target);
+    ra->target = target;
+}
+
+/* mutex held */
+static void ra_update_stats(ReadAhead *ra, int len, int64_t elapsed)
+{
+    ra->stat_bytes += len;
+    ra->stat_time  += elapsed;
+    if (ra->stat_time < 100000)
+        return;
+
+    ra_set_target(ra, ra->stat_bytes * 1000000 / ra->stat_time / 2);
+    ra->stat_bytes = ra->stat_time = 0;
+}
+
+static void *ra_worker(void *arg)
+{
+    ReadAhead *ra = arg;
+    uint8_t *buf = NULL;
+    unsigned buf_size = 0;
+
+    pthread_mutex_lock(&ra->mutex);
+    for (;;) {
+        int64_t start, elapsed;
+        int len, ret;
+
+        while (!ra->abort &&
+               (ra->hold || ra->error || av_fifo_size(ra->fifo) >= ra->target))
+            pthread_cond_wait(&ra->cond, &ra->mutex);
+        if (ra->abort)
+            break;
+
+        /* read in chunks large enough to keep the number of reads low,
+         * but small enough to make the data available early */
+        len = FFMIN3(ra->target - av_fifo_size(ra->fifo), av_fifo_space(ra->fifo),
+                     FFMAX(ra->target / 4, IO_BUFFER_SIZE));
+        av_fast_malloc(&buf, &buf_size, len);
+        if (!buf) {
+            ra->error = AVERROR(ENOMEM);
+            pthread_cond_broadcast(&ra->cond);
+            continue;
+        }
+
+        ra->busy = 1;
+        pthread_mutex_unlock(&ra->mutex);
+        start   = av_gettime_relative();
+        ret     = ffurl_read(ra->h, buf, len);
+        elapsed = av_gettime_relative() - start;
+        pthread_mutex_lock(&ra->mutex);
+        ra->busy = 0;
+
+        if (ra->discard) {
+            /* the data is discarded by the reader anyway */
+        } else if (ret > 0) {
+            av_fifo_generic_write(ra->fifo, buf, ret, NULL);
+            ra_update_stats(ra, ret, elapsed);
+        } else if (ret < 0) {
+            ra->error = ret;
+        }
+        pthread_cond_broadcast(&ra->cond);
+    }
+    pthread_mutex_unlock(&ra->mutex);
+
+    av_free(buf);
+    return NULL;
+}
+
+static int ra_read(ReadAhead *ra, uint8_t *buf, int size)
+{
+    int ret;
+
+    pthread_mutex_lock(&ra->mutex);
+    if (!av_fifo_size(ra->fifo) && !ra->error) {
+        /* the worker does not keep up */
+        ra_set_target(ra, 2LL * ra->target);
+        do {
+            pthread_cond_wait(&ra->cond, &ra->mutex);
+        } while (!av_fifo_size(ra->fifo) && !ra->error);
+    }
+
+    if (av_fifo_size(ra->fifo)) {
+        ret = FFMIN(size, av_fifo_size(ra->fifo));
+        av_fifo_generic_read(ra->fifo, buf, ret, NULL);
+        ra->pos += ret;
+    } else {
+        /* report the error once, then let the worker try again */
+        ret = ra->error;
+        ra->error = 0;
+    }
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->mutex);
+
+    return ret;
+}
+
+/**
+ * Wait until the worker does not use the URLContext anymore. If flush is
+ * set, the read in progress is interrupted and the buffered data will be
+ * discarded by ra_release().
+ * The interruption is lifted again before returning, so that the caller
+ * can use the URLContext normally, e.g. for a seek that reconnects.
+ */
+static void ra_hold(ReadAhead *ra, int flush)
+{
+    pthread_mutex_lock(&ra->mutex);
+    ra->hold = 1;
+    if (flush) {
+        ra->discard = 1;
+        atomic_store(&ra->h->cancel, 1);
+    }
+    while (ra->busy)
+        pthread_cond_wait(&ra->cond, &ra->mutex);
+    if (flush)
+        atomic_store(&ra->h->cancel, 0);
+    pthread_mutex_unlock(&ra->mutex);
+}
+
+static void ra_release(ReadAhead *ra, int flush, int64_t pos)
+{
+    pthread_mutex_lock(&ra->mutex);
+    if (flush) {
+        av_fifo_reset(ra->fifo);
+        ra->pos     = pos;
+        ra->error   = 0;
+        ra->discard = 0;
+    }
+    ra->hold = 0;
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->mutex);
+}
+
+static int64_t ra_seek(ReadAhead *ra, int64_t offset, int whence)
+{
+    int64_t ret;
+
+    if (whence == AVSEEK_SIZE) {
+        ra_hold(ra, 0);
+        ret = ffurl_seek(ra->h, offset, whence);
+        ra_release(ra, 0, 0);
+        return ret;
+    }
+    if (!ra->h->prot->url_seek)
+        return AVERROR(ENOSYS);
+
+    pthread_mutex_lock(&ra->mutex);
+    if (whence == SEEK_CUR) {
+        offset += ra->pos;
+        whence  = SEEK_SET;
+    }
+    /* skip forward inside the buffered data */
+    if (whence == SEEK_SET && offset >= ra->pos &&
+        offset - ra->pos <= av_fifo_size(ra->fifo)) {
+        av_fifo_drain(ra->fifo, offset - ra->pos);
+        ra->pos = offset;
+        pthread_cond_broadcast(&ra->cond);
+        pthread_mutex_unlock(&ra->mutex);
+        return offset;
+    }
+    pthread_mutex_unlock(&ra->mutex);
+
+    ra_hold(ra, 1);
+    ret = ffurl_seek(ra->h, offset, whence);
+    if (ret < 0) {
+        /* the worker may have read past ra->pos already */
+        int64_t ret2 = ffurl_seek(ra->h, ra->pos, SEEK_SET);
+        ra_release(ra, 1, ra->pos);
+        if (ret2 < 0) {
+            pthread_mutex_lock(&ra->mutex);
+            ra->error = ret2;
+            pthread_mutex_unlock(&ra->mutex);
+        }
+        return ret;
+    }
+    ra_release(ra, 1, ret);
+    return ret;
+}
+
+static int64_t ra_read_seek(ReadAhead *ra, int stream_index, int64_t timestamp, int flags)
+{
+    int64_t ret, pos;
+
+    ra_hold(ra, 1);
+    ret = ra->h->prot->url_read_seek(ra->h, stream_index, timestamp, flags);
+    pos = ffurl_seek(ra->h, 0, SEEK_CUR);
+    ra_release(ra, 1, FFMAX(pos, 0));
+    return ret;
+}
+
+static void ra_free(ReadAhead **pra)
+{
+    ReadAhead *ra = *pra;
+
+    if (!ra)
+        return;
+
+    pthread_mutex_lock(&ra->mutex);
+    ra->abort = 1;
+    atomic_store(&ra->h->cancel, 1);
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->mutex);
+    pthread_join(ra->thread, NULL);
+
+    /* h is still used to close the connection */
+    atomic_store(&ra->h->cancel, 0);
+    pthread_cond_destroy(&ra->cond);
+    pthread_mutex_destroy(&ra->mutex);
+    av_fifo_freep(&ra->fifo);
+    av_freep(pra);
+}
+
+static int ra_init(ReadAhead **pra, URLContext *h)
+{
+    ReadAhead *ra;
+    int ret;
+
+    ra = av_mallocz(sizeof(*ra));
+    if (!ra)
+        return AVERROR(ENOMEM);
+
+    ra->max_size = FFMAX(h->readahead, READAHEAD_MIN_SIZE);
+    ra->target   = FFMIN(READAHEAD_MIN_SIZE, ra->max_size);
+    ra->fifo     = av_fifo_alloc(ra->target);
+    if (!ra->fifo) {
+        av_free(ra);
+        return AVERROR(ENOMEM);
+    }
+    ra->h = h;
+    pthread_mutex_init(&ra->mutex, NULL);
+    pthread_cond_init(&ra->cond, NULL);
+
+    /* usually done by ffurl_open_whitelist() already */
+    ffurl_intercept_interrupt(h);
+
+    ret = pthread_create(&ra->thread, NULL, ra_worker, ra);
+    if (ret) {
+        pthread_cond_destroy(&ra->cond);
+        pthread_mutex_destroy(&ra->mutex);
+        av_fifo_freep(&ra->fifo);
+        av_free(ra);
+        return AVERROR(ret);
+    }
+
+    *pra = ra;
+    return 0;
+}
+#endif
+
 static int io_read_packet(void *opaque, uint8_t *buf, int buf_size)
 {
     AVIOInternal *internal = opaque;
+#if HAVE_THREADS
+    if (internal->ra)
+        return ra_read(internal->ra, buf, buf_size);
+#endif
     return ffurl_read(internal->h, buf, buf_size);
 }
 
@@ -953,12 +1261,26 @@ static int io_write_packet(void *opaque, uint8_t *buf, int buf_size)
 static int64_t io_seek(void *opaque, int64_t offset, int whence)
 {
     AVIOInternal *internal = opaque;
+#if HAVE_THREADS
+    if (internal->ra)
+        return ra_seek(internal->ra, offset, whence);
+#endif
     return ffurl_seek(internal->h, offset, whence);
 }
 
 static int io_short_seek(void *opaque)
 {
     AVIOInternal *internal = opaque;
+#if HAVE_THREADS
+    /* skipping over the data buffered ahead is cheap */
+    if (internal->ra) {
+        int ret;
+        pthread_mutex_lock(&internal->ra->mutex);
+        ret = internal->ra->target;
+        pthread_mutex_unlock(&internal->ra->mutex);
+        return ret;
+    }
+#endif
     return ffurl_get_short_seek(internal->h);
 }
 
@@ -967,6 +1289,15 @@ static int io_read_pause(void *opaque, int pause)
     AVIOInternal *internal = opaque;
     if (!internal->h->prot->url_read_pause)
         return AVERROR(ENOSYS);
+#if HAVE_THREADS
+    if (internal->ra) {
+        int ret;
+        ra_hold(internal->ra, 0);
+        ret = internal->h->prot->url_read_pause(internal->h, pause);
+        ra_release(internal->ra, 0, 0);
+        return ret;
+    }
+#endif
     return internal->h->prot->url_read_pause(internal->h, pause);
 }
 
@@ -975,6 +1306,10 @@ static int64_t io_read_seek(void *opaque, int stream_index, int64_t timestamp, i
     AVIOInternal *internal = opaque;
     if (!internal->h->prot->url_read_seek)
         return AVERROR(ENOSYS);
+#if HAVE_THREADS
+    if (internal->ra)
+        return ra_read_seek(internal->ra, stream_index, timestamp, flags);
+#endif
     return internal->h->prot->url_read_seek(internal->h, stream_index, timestamp, flags);
 }
 
@@ -1029,6 +1364,13 @@ int ffio_fdopen(AVIOContext **s, URLContext *h)
     }
     (*s)->short_seek_get = io_short_seek;
     (*s)->av_class = &ff_avio_class;
+
+#if HAVE_THREADS
+    /* packetized protocols need a read per packet */
+    if (h->readahead && !(h->flags & AVIO_FLAG_WRITE) && !max_packet_size &&
+        ra_init(&internal->ra, h) < 0)
+        av_log(h, AV_LOG_WARNING, "Cannot start read-ahead, reading synchronously\n");
+#endif
     return 0;
 fail:
     av_freep(&internal);
@@ -1049,6 +1391,39 @@ URLContext* ffio_geturlcontext(AVIOContext *s)
         return NULL;
 }
 
+int ffio_read_ref(AVIOContext *s, int size, AVBufferRef **buf)
+{
+    URLContext *h = ffio_geturlcontext(s);
+    int64_t pos, ret;
+
+    if (!h || !h->prot->url_read_ref || !s->seek || s->write_flag || s->update_checksum)
+        return AVERROR(ENOSYS);
+
+    pos = avio_tell(s);
+    if (pos < 0)
+        return pos;
+    ret = h->prot->url_read_ref(h, pos, size, buf);
+    if (ret < 0)
+        return ret;
+
+    /* avio_skip() would read short skips through the buffer */
+    if (size <= s->buf_end - s->buf_ptr) {
+        s->buf_ptr += size;
+    } else {
+        if ((ret = s->seek(s->opaque, pos + size, SEEK_SET)) < 0) {
+            av_buffer_unref(buf);
+            return ret;
+        }
+        s->seek_count++;
+        s->buf_end     =
+        s->buf_ptr     =
+        s->buf_ptr_max = s->buffer;
+        s->pos         = pos + size;
+        s->eof_reached = 0;
+    }
+    return size;
+}
+
 int ffio_ensure_seekback(AVIOContext *s, int64_t buf_size)
 {
     uint8_t *buffer;
@@ -1199,6 +1574,9 @@ int avio_close(AVIOContext *s)
     internal = s->opaque;
     h        = internal->h;
 
+#if HAVE_THREADS
+    ra_free(&internal->ra);
+#endif
     av_freep(&s->opaque);
     av_freep(&s->buffer);
     if (s->write_flag)
@@ -20,6 +20,7 @@
  */
 
 #include "libavutil/avstring.h"
+#include "libavutil/buffer.h"
 #include "libavutil/internal.h"
 #include "libavutil/opt.h"
 #include "avformat.h"
@@ -33,6 +34,9 @@
 #if HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include <sys/stat.h>
 #include <stdlib.h>
 #include "os_support.h"
@@ -73,6 +77,11 @@ typedef struct FileContext {
     int trunc;
     int blocksize;
     int follow;
+    int mmap;
+    AVBufferRef *map_buf;   ///< whole file mapping, NULL if not mapped
+    int64_t map_size;
+    int64_t map_end;        ///< end of the last mapped page, zero past map_size
+    int64_t map_pos;
 #if HAVE_DIRENT_H
     DIR *dir;
 #endif
@@ -82,6 +91,10 @@ static const AVOption file_options[] = {
     { "truncate", "truncate existing files on write", offsetof(FileContext, trunc), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM },
     { "blocksize", "set I/O operation maximum block size", offsetof(FileContext, blocksize), AV_OPT_TYPE_INT, { .i64 = INT_MAX }, 1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "follow", "Follow a file as it is being written", offsetof(FileContext, follow), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "mmap", "read the file through a memory mapping", offsetof(FileContext, mmap), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 2, AV_OPT_FLAG_DECODING_PARAM, "mmap" },
+        { "off",      "use read()",                                   0, AV_OPT_TYPE_CONST, { .i64 = 0 }, 0, 0, AV_OPT_FLAG_DECODING_PARAM, "mmap" },
+        { "read",     "copy from the mapping",                        0, AV_OPT_TYPE_CONST, { .i64 = 1 }, 0, 0, AV_OPT_FLAG_DECODING_PARAM, "mmap" },
+        { "zerocopy", "also return packets referencing the mapping",  0, AV_OPT_TYPE_CONST, { .i64 = 2 }, 0, 0, AV_OPT_FLAG_DECODING_PARAM, "mmap" },
     { NULL }
 };
 
@@ -109,6 +122,14 @@ static int file_read(URLContext *h, unsigned char *buf, int size)
     FileContext *c = h->priv_data;
     int ret;
     size = FFMIN(size, c->blocksize);
+    if (c->map_buf) {
+        if (c->map_pos >= c->map_size)
+            return AVERROR_EOF;
+        size = FFMIN(size, c->map_size - c->map_pos);
+        memcpy(buf, c->map_buf->data + c->map_pos, size);
+        c->map_pos += size;
+        return size;
+    }
     ret = read(c->fd, buf, size);
     if (ret == 0 && c->follow)
         return AVERROR(EAGAIN);
@@ -203,6 +224,69 @@ static int file_move(URLContext *h_src, URLContext *h_dst)
 
 #if CONFIG_FILE_PROTOCOL
 
+#if HAVE_MMAP
+static void file_unmap(void *opaque, uint8_t *data)
+{
+    munmap(data, (size_t)(uintptr_t)opaque);
+}
+
+static void file_map(URLContext *h, const struct stat *st)
+{
+    FileContext *c = h->priv_data;
+    void *map;
+
+    if (!S_ISREG(st->st_mode) || st->st_size <= 0 || st->st_size > SIZE_MAX ||
+        c->follow)
+        return;
+
+    map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, c->fd, 0);
+    if (map == MAP_FAILED) {
+        av_log(h, AV_LOG_VERBOSE, "Cannot map file, using read(): %s\n",
+               av_err2str(AVERROR(errno)));
+        return;
+    }
+
+    /* the mapping is not resized; size only limits what av_buffer_ref()
+     * users see, the real length is passed to file_unmap() */
+    c->map_buf = av_buffer_create(map, FFMIN(st->st_size, INT_MAX), file_unmap,
+                                  (void *)(uintptr_t)st->st_size,
+                                  AV_BUFFER_FLAG_READONLY);
+    if (!c->map_buf) {
+        munmap(map, st->st_size);
+        return;
+    }
+    c->map_size = st->st_size;
+    c->map_end  = FFALIGN(st->st_size, sysconf(_SC_PAGESIZE));
+    c->map_pos  = 0;
+}
+
+static int file_read_ref(URLContext *h, int64_t pos, int size, AVBufferRef **pbuf)
+{
+    FileContext *c = h->priv_data;
+    AVBufferRef *buf;
+    int64_t end = pos + size;
+    int i;
+
+    /* the padding has to be mapped and zero, as packets require; the
+     * kernel zeroes the mapped page past the end of the file */
+    if (!c->map_buf || c->mmap < 2 || pos < 0 || size <= 0 ||
+        end > c->map_end - AV_INPUT_BUFFER_PADDING_SIZE)
+        return AVERROR(ENOSYS);
+    for (i = 0; i < AV_INPUT_BUFFER_PADDING_SIZE && end + i < c->map_size; i++)
+        if (c->map_buf->data[end + i])
+            return AVERROR(ENOSYS);
+
+    buf = av_buffer_ref(c->map_buf);
+    if (!buf)
+        return AVERROR(ENOMEM);
+    buf->data += pos;
+    buf->size  = size;
+    *pbuf = buf;
+
+    return size;
+}
+#endif
+
 static int file_open(URLContext *h, const char *filename, int flags)
 {
     FileContext *c = h->priv_data;
@@ -233,6 +317,11 @@ static int file_open(URLContext *h, const char *filename, int flags)
 
     h->is_streamed = !fstat(fd, &st) && S_ISFIFO(st.st_mode);
 
+#if HAVE_MMAP
+    if (c->mmap && !(flags & AVIO_FLAG_WRITE) && !h->is_streamed)
+        file_map(h, &st);
+#endif
+
     /* Buffer writes more than the default 32k to improve throughput especially
      * with networked file systems */
     if (!h->is_streamed && flags & AVIO_FLAG_WRITE)
@@ -247,6 +336,19 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
     FileContext *c = h->priv_data;
     int64_t ret;
 
+    if (c->map_buf) {
+        switch (whence) {
+        case AVSEEK_SIZE: return c->map_size;
+        case SEEK_SET:    break;
+        case SEEK_CUR:    pos += c->map_pos;  break;
+        case SEEK_END:    pos += c->map_size; break;
+        default:          return AVERROR(EINVAL);
+        }
+        if (pos < 0)
+            return AVERROR(EINVAL);
+        return c->map_pos = pos;
+    }
+
     if (whence == AVSEEK_SIZE) {
         struct stat st;
         ret = fstat(c->fd, &st);
@@ -261,6 +363,7 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
 static int file_close(URLContext *h)
 {
     FileContext *c = h->priv_data;
+    av_buffer_unref(&c->map_buf);
     return close(c->fd);
 }
 
@@ -359,6 +462,9 @@ const URLProtocol ff_file_protocol = {
     .url_check           = file_check,
     .url_delete          = file_delete,
     .url_move            = file_move,
+#if HAVE_MMAP
+    .url_read_ref        = file_read_ref,
+#endif
     .priv_data_size      = sizeof(FileContext),
     .priv_data_class     = &file_class,
     .url_open_dir        = file_open_dir,
@@ -792,6 +792,7 @@ static void clear_index_entries(AVFormatContext *s, int64_t pos)
     for (i = 0; i < s->nb_streams; i++) {
         AVStream *st = s->streams[i];
         /* Remove all index entries that point to >= pos */
+        ff_index_flush(st);
         out = 0;
         for (j = 0; j < st->nb_index_entries; j++)
             if (st->index_entries[j].pos < pos)
@@ -1094,7 +1095,7 @@ skip:
         if ((s->pb->seekable & AVIO_SEEKABLE_NORMAL) &&
             ((flags & FLV_VIDEO_FRAMETYPE_MASK) == FLV_FRAME_KEY ||
               stream_type == FLV_STREAM_TYPE_AUDIO))
-            av_add_index_entry(st, pos, dts, size, 0, AVINDEX_KEYFRAME);
+            ff_add_index_entry_deferred(st, pos, dts, size, 0, AVINDEX_KEYFRAME);
 
         if (  (st->discard >= AVDISCARD_NONKEY && !((flags & FLV_VIDEO_FRAMETYPE_MASK) == FLV_FRAME_KEY || (stream_type == FLV_STREAM_TYPE_AUDIO)))
             ||(st->discard >= AVDISCARD_BIDIR  &&  ((flags & FLV_VIDEO_FRAMETYPE_MASK) == FLV_FRAME_DISP_INTER && (stream_type == FLV_STREAM_TYPE_VIDEO)))
@@ -34,6 +34,7 @@
 #include "libavutil/opt.h"
 #include "libavutil/dict.h"
 #include "libavutil/time.h"
+#include "libavutil/thread.h"
 #include "avformat.h"
 #include "internal.h"
 #include "avio_internal.h"
@@ -41,6 +42,8 @@
 
 #define INITIAL_BUFFER_SIZE 32768
 
+#define PREFETCH_CHUNK_SIZE 32768
+
 #define MAX_FIELD_LEN 64
 #define MAX_CHARACTERISTICS_LEN 512
 
@@ -78,6 +81,7 @@ struct segment {
 };
 
 struct rendition;
+struct prefetch;
 
 enum PlaylistType {
     PLS_TYPE_UNSPECIFIED,
@@ -157,6 +161,12 @@ struct playlist {
      * playlist, if any. */
     int n_init_sections;
     struct segment **init_sections;
+
+    /* Upcoming segments being downloaded in the background, and the
+     * prefetched segment currently read through input, if any. */
+    int n_prefetch;
+    struct prefetch **prefetch;
+    struct prefetch *input_prefetch;
 };
 
 /*
@@ -209,8 +219,20 @@ typedef struct HLSContext {
     int http_persistent;
     int http_multiple;
     AVIOContext *playlist_pb;
+
+    int prefetch;
+    int64_t prefetch_max_size;
+    int64_t prefetch_bytes; /* buffered but not yet consumed, all playlists */
+#if HAVE_THREADS
+    pthread_mutex_t prefetch_lock;
+    pthread_cond_t prefetch_cond;
+    int prefetch_lock_init;
+#endif
 } HLSContext;
 
+static void close_segment_input(struct playlist *pls);
+static void prefetch_flush(struct playlist *pls);
+
 static void free_segment_dynarray(struct segment **segments, int n_segments)
 {
     int i;
@@ -254,12 +276,12 @@ static void free_playlist_list(HLSContext *c)
         av_freep(&pls->init_sec_buf);
         av_packet_unref(&pls->pkt);
         av_freep(&pls->pb.buffer);
-        if (pls->input)
-            ff_format_io_close(c->ctx, &pls->input);
+        close_segment_input(pls);
         pls->input_read_done = 0;
         if (pls->input_next)
             ff_format_io_close(c->ctx, &pls->input_next);
         pls->input_next_requested = 0;
+        prefetch_flush(pls);
         if (pls->ctx) {
             pls->ctx->pb = NULL;
             avformat_close_input(&pls->ctx);
@@ -607,8 +629,42 @@ static int open_url_keepalive(AVFormatContext *s, AVIOContext **pb,
 #endif
 }
 
+/* avio_opts is shared with the prefetch threads, which update the cookies */
+static void lock_avio_opts(HLSContext *c)
+{
+#if HAVE_THREADS
+    if (c->prefetch_lock_init)
+        pthread_mutex_lock(&c->prefetch_lock);
+#endif
+}
+
+static void unlock_avio_opts(HLSContext *c)
+{
+#if HAVE_THREADS
+    if (c->prefetch_lock_init)
+        pthread_mutex_unlock(&c->prefetch_lock);
+#endif
+}
+
+static int open_url_io(AVFormatContext *s, AVIOContext **pb, const char *url,
+                       AVDictionary **opts, const AVIOInterruptCB *int_cb)
+{
+    /* the default callbacks always use the interrupt callback of s */
+    if (int_cb && ff_format_io_is_default(s))
+        return ffio_open_whitelist(pb, url, AVIO_FLAG_READ, int_cb, opts,
+                                   s->protocol_whitelist, s->protocol_blacklist);
+    return s->io_open(s, pb, url, AVIO_FLAG_READ, opts);
+}
+
+/**
+ * Open url with the AVIO options of the demuxer and opts2.
+ *
+ * @param int_cb interrupt callback to use instead of the one of s, if the
+ *               IO callbacks of s are the default ones; may be NULL
+ */
 static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
-                    AVDictionary *opts, AVDictionary *opts2, int *is_http_out)
+                    AVDictionary *opts2, int *is_http_out,
+                    const AVIOInterruptCB *int_cb)
 {
     HLSContext *c = s->priv_data;
     AVDictionary *tmp = NULL;
@@ -616,7 +672,9 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
     int ret;
     int is_http = 0;
 
-    av_dict_copy(&tmp, opts, 0);
+    lock_avio_opts(c);
+    av_dict_copy(&tmp, c->avio_opts, 0);
+    unlock_avio_opts(c);
     av_dict_copy(&tmp, opts2, 0);
 
     if (av_strstart(url, "crypto", NULL)) {
@@ -660,10 +718,10 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
                 av_log(s, AV_LOG_WARNING,
                     "keepalive request failed for '%s', retrying with new connection: %s\n",
                     url, av_err2str(ret));
-            ret = s->io_open(s, pb, url, AVIO_FLAG_READ, &tmp);
+            ret = open_url_io(s, pb, url, &tmp, int_cb);
         }
     } else {
-        ret = s->io_open(s, pb, url, AVIO_FLAG_READ, &tmp);
+        ret = open_url_io(s, pb, url, &tmp, int_cb);
     }
     if (ret >= 0) {
         // update cookies on http response with setcookies.
@@ -672,8 +730,11 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
         if (!(s->flags & AVFMT_FLAG_CUSTOM_IO))
             av_opt_get(*pb, "cookies", AV_OPT_SEARCH_CHILDREN, (uint8_t**)&new_cookies);
 
-        if (new_cookies)
-            av_dict_set(&opts, "cookies", new_cookies, AV_DICT_DONT_STRDUP_VAL);
+        if (new_cookies) {
+            lock_avio_opts(c);
+            av_dict_set(&c->avio_opts, "cookies", new_cookies, AV_DICT_DONT_STRDUP_VAL);
+            unlock_avio_opts(c);
+        }
     }
 
     av_dict_free(&tmp);
@@ -723,7 +784,9 @@ static int parse_playlist(HLSContext *c, const char *url,
 
     if (!in) {
         AVDictionary *opts = NULL;
+        lock_avio_opts(c);
         av_dict_copy(&opts, c->avio_opts, 0);
+        unlock_avio_opts(c);
 
         if (c->http_persistent)
             av_dict_set(&opts, "multiple_requests", "1", 0);
@@ -1195,12 +1258,12 @@ static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg,
            seg->url, seg->url_offset, pls->index);
 
     if (seg->key_type == KEY_NONE) {
-        ret = open_url(pls->parent, in, seg->url, c->avio_opts, opts, &is_http);
+        ret = open_url(pls->parent, in, seg->url, opts, &is_http, NULL);
     } else if (seg->key_type == KEY_AES_128) {
         char iv[33], key[33], url[MAX_URL_SIZE];
         if (strcmp(seg->key, pls->key_url)) {
             AVIOContext *pb = NULL;
-            if (open_url(pls->parent, &pb, seg->key, c->avio_opts, opts, NULL) == 0) {
+            if (open_url(pls->parent, &pb, seg->key, opts, NULL, NULL) == 0) {
                 ret = avio_read(pb, pls->key, sizeof(pls->key));
                 if (ret != sizeof(pls->key)) {
                     av_log(NULL, AV_LOG_ERROR, "Unable to read key file %s\n",
@@ -1224,7 +1287,7 @@ static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg,
         av_dict_set(&opts, "key", key, 0);
         av_dict_set(&opts, "iv", iv, 0);
 
-        ret = open_url(pls->parent, in, url, c->avio_opts, opts, &is_http);
+        ret = open_url(pls->parent, in, url, opts, &is_http, NULL);
         if (ret < 0) {
             goto cleanup;
         }
@@ -1262,6 +1325,347 @@ cleanup:
     return ret;
 }
 
+#if HAVE_THREADS
+/*
+ * A segment downloaded into memory by a background thread. Once it becomes
+ * the current segment of its playlist, it is read through an AVIOContext
+ * that blocks until the thread has delivered enough data.
+ */
+struct prefetch {
+    struct playlist *pls;
+    int seq_no;
+    char *url;
+    int64_t url_offset;
+    int64_t size;
+
+    pthread_t thread;
+    AVIOInterruptCB interrupt_callback;
+    uint8_t *buf;
+    unsigned int buf_size;
+    unsigned int len;   /* bytes downloaded into buf */
+    unsigned int rpos;  /* bytes consumed from buf */
+    int done;
+    int err;
+    int abort;
+};
+
+/* Must be called with prefetch_lock held. The head of a playlist is the
+ * segment that is read next; it is downloaded regardless of the memory
+ * budget, so that the consumer never waits for a segment that waits for
+ * the consumer. */
+static int prefetch_is_head(struct prefetch *p)
+{
+    struct playlist *pls = p->pls;
+    int i;
+
+    if (pls->input_prefetch)
+        return p == pls->input_prefetch;
+    for (i = 0; i < pls->n_prefetch; i++)
+        if (pls->prefetch[i]->seq_no < p->seq_no)
+            return 0;
+    return 1;
+}
+
+static int prefetch_check_interrupt(void *opaque)
+{
+    struct prefetch *p = opaque;
+    HLSContext *c = p->pls->parent->priv_data;
+    int abort;
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    abort = p->abort;
+    pthread_mutex_unlock(&c->prefetch_lock);
+    return abort || ff_check_interrupt(c->interrupt_callback);
+}
+
+static void *prefetch_thread(void *arg)
+{
+    struct prefetch *p = arg;
+    struct playlist *pls = p->pls;
+    HLSContext *c = pls->parent->priv_data;
+    AVDictionary *opts = NULL;
+    AVIOContext *in = NULL;
+    uint8_t chunk[PREFETCH_CHUNK_SIZE];
+    int64_t left = p->size;
+    int is_http = 0, stop = 0;
+    int ret;
+
+    if (p->size >= 0) {
+        av_dict_set_int(&opts, "offset", p->url_offset, 0);
+        av_dict_set_int(&opts, "end_offset", p->url_offset + p->size, 0);
+    }
+    ret = open_url(pls->parent, &in, p->url, opts, &is_http, &p->interrupt_callback);
+    av_dict_free(&opts);
+    if (ret >= 0 && !is_http && p->url_offset) {
+        int64_t seekret = avio_seek(in, p->url_offset, SEEK_SET);
+        if (seekret < 0)
+            ret = seekret;
+    }
+    if (ret < 0)
+        av_log(pls->parent, AV_LOG_WARNING, "Failed to prefetch segment %d of playlist %d\n",
+               p->seq_no, pls->index);
+
+    while (ret >= 0 && left) {
+        uint8_t *buf;
+        int size = sizeof(chunk);
+        if (left > 0)
+            size = FFMIN(size, left);
+
+        pthread_mutex_lock(&c->prefetch_lock);
+        while (!p->abort && c->prefetch_bytes >= c->prefetch_max_size &&
+               !prefetch_is_head(p))
+            pthread_cond_wait(&c->prefetch_cond, &c->prefetch_lock);
+        stop = p->abort;
+        pthread_mutex_unlock(&c->prefetch_lock);
+        if (stop)
+            break;
+
+        ret = avio_read(in, chunk, size);
+        if (ret == AVERROR_EOF) {
+            ret = 0;
+            break;
+        } else if (ret <= 0) {
+            break;
+        }
+
+        pthread_mutex_lock(&c->prefetch_lock);
+        buf = av_fast_realloc(p->buf, &p->buf_size, p->len + ret);
+        if (buf) {
+            p->buf = buf;
+            memcpy(p->buf + p->len, chunk, ret);
+            p->len += ret;
+            c->prefetch_bytes += ret;
+            if (left > 0)
+                left -= ret;
+            ret = 0;
+        } else {
+            ret = AVERROR(ENOMEM);
+        }
+        pthread_cond_broadcast(&c->prefetch_cond);
+        pthread_mutex_unlock(&c->prefetch_lock);
+    }
+
+    ff_format_io_close(pls->parent, &in);
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    p->err  = FFMIN(ret, 0);
+    p->done = 1;
+    pthread_cond_broadcast(&c->prefetch_cond);
+    pthread_mutex_unlock(&c->prefetch_lock);
+
+    return NULL;
+}
+
+static int prefetch_read(void *opaque, uint8_t *buf, int buf_size)
+{
+    struct prefetch *p = opaque;
+    HLSContext *c = p->pls->parent->priv_data;
+    int ret;
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    while (p->rpos == p->len && !p->done)
+        pthread_cond_wait(&c->prefetch_cond, &c->prefetch_lock);
+    if (p->rpos < p->len) {
+        ret = FFMIN(buf_size, p->len - p->rpos);
+        memcpy(buf, p->buf + p->rpos, ret);
+        p->rpos += ret;
+        c->prefetch_bytes -= ret;
+        /* give the consumed part of the buffer back to the thread */
+        if (p->rpos >= p->len / 2) {
+            memmove(p->buf, p->buf + p->rpos, p->len - p->rpos);
+            p->len -= p->rpos;
+            p->rpos = 0;
+        }
+        pthread_cond_broadcast(&c->prefetch_cond);
+    } else {
+        ret = p->err ? p->err : AVERROR_EOF;
+    }
+    pthread_mutex_unlock(&c->prefetch_lock);
+
+    return ret;
+}
+
+static int prefetch_start(HLSContext *c, struct playlist *pls,
+                          struct segment *seg, int seq_no)
+{
+    struct prefetch *p = av_mallocz(sizeof(*p));
+    int ret;
+
+    if (!p)
+        return AVERROR(ENOMEM);
+    p->pls        = pls;
+    p->seq_no     = seq_no;
+    p->interrupt_callback = (AVIOInterruptCB){ prefetch_check_interrupt, p };
+    p->url_offset = seg->url_offset;
+    p->size       = seg->size;
+    p->url        = av_strdup(seg->url);
+    if (!p->url) {
+        av_free(p);
+        return AVERROR(ENOMEM);
+    }
+
+    av_log(pls->parent, AV_LOG_VERBOSE, "HLS prefetch for url '%s', offset %"PRId64", playlist %d\n",
+           seg->url, seg->url_offset, pls->index);
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    ret = av_dynarray_add_nofree(&pls->prefetch, &pls->n_prefetch, p);
+    if (ret >= 0) {
+        ret = AVERROR(pthread_create(&p->thread, NULL, prefetch_thread, p));
+        if (ret < 0)
+            pls->n_prefetch--;
+    }
+    pthread_mutex_unlock(&c->prefetch_lock);
+
+    if (ret < 0) {
+        av_free(p->url);
+        av_free(p);
+    }
+    return ret;
+}
+
+/* The prefetch must not be listed in the playlist anymore. */
+static void prefetch_free(HLSContext *c, struct prefetch *p)
+{
+    pthread_mutex_lock(&c->prefetch_lock);
+    p->abort = 1;
+    pthread_cond_broadcast(&c->prefetch_cond);
+    pthread_mutex_unlock(&c->prefetch_lock);
+
+    pthread_join(p->thread, NULL);
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    c->prefetch_bytes -= p->len - p->rpos;
+    pthread_cond_broadcast(&c->prefetch_cond);
+    pthread_mutex_unlock(&c->prefetch_lock);
+
+    av_free(p->buf);
+    av_free(p->url);
+    av_free(p);
+}
+
+/* Drop the prefetches outside the window of segments following the current
+ * one, then start the missing ones. */
+static void prefetch_update(HLSContext *c, struct playlist *pls)
+{
+    int seq_no, i;
+
+    for (;;) {
+        struct prefetch *p = NULL;
+
+        pthread_mutex_lock(&c->prefetch_lock);
+        for (i = 0; i < pls->n_prefetch; i++) {
+            if (pls->prefetch[i]->seq_no <  pls->cur_seq_no ||
+                pls->prefetch[i]->seq_no >= pls->cur_seq_no + c->prefetch) {
+                p = pls->prefetch[i];
+                pls->prefetch[i] = pls->prefetch[--pls->n_prefetch];
+                break;
+            }
+        }
+        pthread_mutex_unlock(&c->prefetch_lock);
+        if (!p)
+            break;
+        prefetch_free(c, p);
+    }
+
+    for (seq_no = pls->cur_seq_no;
+         seq_no < pls->cur_seq_no + c->prefetch &&
+         seq_no < pls->start_seq_no + pls->n_segments; seq_no++) {
+        struct segment *seg = pls->segments[seq_no - pls->start_seq_no];
+
+        /* encrypted segments need the key state of open_input() */
+        if (seg->key_type != KEY_NONE)
+            continue;
+        for (i = 0; i < pls->n_prefetch; i++)
+            if (pls->prefetch[i]->seq_no == seq_no)
+                break;
+        if (i < pls->n_prefetch)
+            continue;
+        if (prefetch_start(c, pls, seg, seq_no) < 0)
+            break;
+    }
+}
+
+/* Use the prefetched current segment as input; returns AVERROR(EAGAIN) if
+ * the segment has to be opened directly. */
+static int prefetch_open_input(HLSContext *c, struct playlist *pls)
+{
+    struct prefetch *p = NULL;
+    uint8_t *buf;
+    int i;
+
+    prefetch_update(c, pls);
+
+    pthread_mutex_lock(&c->prefetch_lock);
+    for (i = 0; i < pls->n_prefetch; i++) {
+        if (pls->prefetch[i]->seq_no == pls->cur_seq_no) {
+            p = pls->prefetch[i];
+            pls->prefetch[i] = pls->prefetch[--pls->n_prefetch];
+            break;
+        }
+    }
+    pls->input_prefetch = p;
+    pthread_cond_broadcast(&c->prefetch_cond);
+    pthread_mutex_unlock(&c->prefetch_lock);
+    if (!p)
+        return AVERROR(EAGAIN);
+
+    buf = av_malloc(INITIAL_BUFFER_SIZE);
+    if (buf)
+        pls->input = avio_alloc_context(buf, INITIAL_BUFFER_SIZE, 0, p,
+                                        prefetch_read, NULL, NULL);
+    if (!pls->input) {
+        av_free(buf);
+        pls->input_prefetch = NULL;
+        prefetch_free(c, p);
+        return AVERROR(ENOMEM);
+    }
+    pls->cur_seg_offset = 0;
+    return 0;
+}
+#else
+static int prefetch_open_input(HLSContext *c, struct playlist *pls)
+{
+    return AVERROR(EAGAIN);
+}
+#endif
+
+static void close_segment_input(struct playlist *pls)
+{
+#if HAVE_THREADS
+    if (pls->input_prefetch) {
+        HLSContext *c = pls->parent->priv_data;
+        struct prefetch *p = pls->input_prefetch;
+
+        av_freep(&pls->input->buffer);
+        avio_context_free(&pls->input);
+        pthread_mutex_lock(&c->prefetch_lock);
+        pls->input_prefetch = NULL;
+        pthread_mutex_unlock(&c->prefetch_lock);
+        prefetch_free(c, p);
+        return;
+    }
+#endif
+    if (pls->input)
+        ff_format_io_close(pls->parent, &pls->input);
+}
+
+/* Abort and free all the prefetched segments of the playlist. */
+static void prefetch_flush(struct playlist *pls)
+{
+#if HAVE_THREADS
+    HLSContext *c = pls->parent->priv_data;
+
+    while (pls->n_prefetch) {
+        struct prefetch *p;
+        pthread_mutex_lock(&c->prefetch_lock);
+        p = pls->prefetch[--pls->n_prefetch];
+        pthread_mutex_unlock(&c->prefetch_lock);
+        prefetch_free(c, p);
+    }
+    av_freep(&pls->prefetch);
+#endif
+}
+
 static int update_init_section(struct playlist *pls, struct segment *seg)
 {
     static const int max_init_section_size = 1024*1024;
@@ -1449,7 +1853,8 @@ reload:
             FFSWAP(AVIOContext *, v->input, v->input_next);
             v->input_next_requested = 0;
             ret = 0;
-        } else {
+        } else if (c->prefetch <= 0 ||
+                   (ret = prefetch_open_input(c, v)) == AVERROR(EAGAIN)) {
             ret = open_input(c, v, seg, &v->input);
         }
         if (ret < 0) {
@@ -1507,11 +1912,11 @@ reload:
 
         return ret;
     }
-    if (c->http_persistent &&
+    if (c->http_persistent && !v->input_prefetch &&
         seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         v->input_read_done = 1;
     } else {
-        ff_format_io_close(v->parent, &v->input);
+        close_segment_input(v);
     }
     v->cur_seq_no++;
 
@@ -1775,6 +2180,14 @@ static int hls_close(AVFormatContext *s)
     av_dict_free(&c->avio_opts);
     ff_format_io_close(c->ctx, &c->playlist_pb);
 
+#if HAVE_THREADS
+    if (c->prefetch_lock_init) {
+        pthread_cond_destroy(&c->prefetch_cond);
+        pthread_mutex_destroy(&c->prefetch_lock);
+        c->prefetch_lock_init = 0;
+    }
+#endif
+
     return 0;
 }
 
@@ -1792,6 +2205,22 @@ static int hls_read_header(AVFormatContext *s)
     c->first_timestamp = AV_NOPTS_VALUE;
     c->cur_timestamp = AV_NOPTS_VALUE;
 
+#if HAVE_THREADS
+    if (c->prefetch > 0) {
+        if ((ret = AVERROR(pthread_mutex_init(&c->prefetch_lock, NULL))) < 0)
+            goto fail;
+        if ((ret = AVERROR(pthread_cond_init(&c->prefetch_cond, NULL))) < 0) {
+            pthread_mutex_destroy(&c->prefetch_lock);
+            goto fail;
+        }
+        c->prefetch_lock_init = 1;
+        /* the prefetch threads take care of the next segments */
+        c->http_multiple = 0;
+    }
+#else
+    c->prefetch = 0;
+#endif
+
     if ((ret = save_avio_options(s)) < 0)
         goto fail;
 
@@ -2002,12 +2431,12 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
             }
             av_log(s, AV_LOG_INFO, "Now receiving playlist %d, segment %d\n", i, pls->cur_seq_no);
         } else if (first && !cur_needed && pls->needed) {
-            if (pls->input)
-                ff_format_io_close(pls->parent, &pls->input);
+            close_segment_input(pls);
             pls->input_read_done = 0;
             if (pls->input_next)
                 ff_format_io_close(pls->parent, &pls->input_next);
             pls->input_next_requested = 0;
+            prefetch_flush(pls);
             pls->needed = 0;
             changed = 1;
             av_log(s, AV_LOG_INFO, "No longer receiving playlist %d\n", i);
@@ -2250,8 +2679,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
     for (i = 0; i < c->n_playlists; i++) {
         /* Reset reading */
         struct playlist *pls = c->playlists[i];
-        if (pls->input)
-            ff_format_io_close(pls->parent, &pls->input);
+        close_segment_input(pls);
         pls->input_read_done = 0;
         if (pls->input_next)
             ff_format_io_close(pls->parent, &pls->input_next);
@@ -2314,6 +2742,10 @@ static const AVOption hls_options[] = {
         OFFSET(http_persistent), AV_OPT_TYPE_BOOL, {.i64 = 1}, 0, 1, FLAGS },
     {"http_multiple", "Use multiple HTTP connections for fetching segments",
         OFFSET(http_multiple), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, FLAGS},
+    {"prefetch", "Number of upcoming segments to download in the background",
+        OFFSET(prefetch), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 64, FLAGS},
+    {"prefetch_max_size", "Maximum amount of memory used for prefetched segments",
+        OFFSET(prefetch_max_size), AV_OPT_TYPE_INT64, {.i64 = 64 << 20}, 0, INT64_MAX, FLAGS},
     {NULL}
 };
 
@@ -144,6 +144,32 @@ struct AVFormatInternal {
      * Prefer the codec framerate for avg_frame_rate computation.
      */
     int prefer_codec_framerate;
+
+    /**
+     * Key and stream parameters of the probe cache entry of this input,
+     * see probecache.c, and the number of index entries last written to or
+     * read from it.
+     */
+    uint8_t *probe_cache_entry;
+    int probe_cache_entry_size;
+    int64_t probe_cache_nb_index;
+
+    /**
+     * Muxing: streams with packets in their interleaving queue, as a binary
+     * heap ordered by the first packet of each queue with
+     * interleave_compare().
+     */
+    int *interleave_heap;
+    int nb_interleave_heap;
+    unsigned int interleave_heap_allocated_size;
+    int (*interleave_compare)(AVFormatContext *, AVPacket *, AVPacket *);
+
+    /**
+     * Muxing: bytes in the interleaving queues, and whether output was
+     * last forced because they exceeded max_interleave_size.
+     */
+    int64_t interleave_size;
+    int interleave_stalled;
 };
 
 struct AVStreamInternal {
@@ -192,6 +218,27 @@ struct AVStreamInternal {
     int need_context_update;
 
     FFFrac *priv_pts;
+
+    /**
+     * Index entries added with ff_add_index_entry_deferred() which belong
+     * before the last entry of the index, sorted by timestamp. They are
+     * merged into index_entries by ff_index_flush().
+     */
+    AVIndexEntry *index_pending;
+    int nb_index_pending;
+    unsigned int index_pending_allocated_size;
+
+    /**
+     * Worker decoding probe frames for this stream in
+     * avformat_find_stream_info(), if AVFormatContext.probe_threads is set.
+     */
+    struct ProbeThread *probe_thread;
+
+    /**
+     * Muxing: first packet in the interleaving queue of this stream. The
+     * last one is AVStream.last_in_packet_buffer.
+     */
+    struct AVPacketList *interleave_queue;
 };
 
 #ifdef __GNUC__
@@ -232,13 +279,32 @@ char *ff_data_to_hex(char *buf, const uint8_t *src, int size, int lowercase);
 int ff_hex_to_data(uint8_t *data, const char *p);
 
 /**
- * Add packet to AVFormatContext->packet_buffer list, determining its
- * interleaved position using compare() function argument.
+ * Add packet to the interleaving queue of its stream. The queues are
+ * merged in the order given by compare(s, next, pkt), which returns 1 if
+ * pkt has to be output before next. The packet is moved into the queue.
  * @return 0, or < 0 on error
  */
 int ff_interleave_add_packet(AVFormatContext *s, AVPacket *pkt,
                              int (*compare)(AVFormatContext *, AVPacket *, AVPacket *));
 
+/**
+ * Return the first packet in interleaving order, or NULL if the
+ * interleaving queues are empty. The packet stays in its queue.
+ */
+const AVPacket *ff_interleave_peek_first(AVFormatContext *s);
+
+/**
+ * Remove the first packet in interleaving order from the interleaving
+ * queues and move it to pkt.
+ * @return 0, or AVERROR(EAGAIN) if the queues are empty
+ */
+int ff_interleave_get_first(AVFormatContext *s, AVPacket *pkt);
+
+/**
+ * Free all packets in the interleaving queues.
+ */
+void ff_interleave_free(AVFormatContext *s);
+
 void ff_read_frame_flush(AVFormatContext *s);
 
 #define NTP_OFFSET 2208988800ULL
@@ -420,6 +486,24 @@ AVChapter *avpriv_new_chapter(AVFormatContext *s, int id, AVRational time_base,
  */
 void ff_reduce_index(AVFormatContext *s, int stream_index);
 
+/**
+ * Add an index entry like av_add_index_entry(), but defer the insertion
+ * of entries which do not go at the end of the index, so that building
+ * the index of an earlier part of the file after a seek does not move
+ * the whole index for each entry.
+ *
+ * Deferred entries are merged by ff_index_flush(), which the seeking and
+ * index functions call. Code reading index_entries directly after adding
+ * entries with this function must call ff_index_flush() first.
+ */
+void ff_add_index_entry_deferred(AVStream *st, int64_t pos, int64_t timestamp,
+                                 int size, int distance, int flags);
+
+/**
+ * Merge the entries deferred by ff_add_index_entry_deferred() into the index.
+ */
+void ff_index_flush(AVStream *st);
+
 enum AVCodecID ff_guess_image2_codec(const char *filename);
 
 /**
@@ -496,6 +580,14 @@ int ff_framehash_write_header(AVFormatContext *s);
  */
 int ff_read_packet(AVFormatContext *s, AVPacket *pkt);
 
+/**
+ * Like av_get_packet(), but if the protocol supports it, return a packet
+ * referencing the input data directly instead of a copy (see
+ * ffio_read_ref()). Only for demuxers which do not modify the packet data
+ * in place, as the packet buffer may be read-only.
+ */
+int ff_get_packet_ref(AVIOContext *s, AVPacket *pkt, int size);
+
 /**
  * Interleave a packet per dts in an output media file.
  *
@@ -675,6 +767,13 @@ int ff_format_output_open(AVFormatContext *s, const char *url, AVDictionary **op
  */
 void ff_format_io_close(AVFormatContext *s, AVIOContext **pb);
 
+/**
+ * Check whether s uses the default io_open and io_close callbacks, i.e.
+ * whether its IO contexts are opened by ffio_open_whitelist() with the
+ * interrupt callback of s and closed by avio_close().
+ */
+int ff_format_io_is_default(AVFormatContext *s);
+
 /**
  * Utility function to check if the file uses http or https protocol
  *
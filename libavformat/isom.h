@@ -238,6 +238,12 @@ typedef struct MOVStreamContext {
         AVEncryptionInfo *default_encrypted_sample;
         MOVEncryptionIndex *encryption_index;
     } cenc;
+
+    int64_t heap_key;     ///< dts (or pos if unseekable) of the current sample in the sample heap
+    int heap_index;       ///< position in MOVContext.sample_heap, -1 if not in it
+    int dropped;          ///< removed from the sample heap because discarded
+
+    struct MOVIndexBuilder *index_builder; ///< sample table expansion state, NULL once the index is complete
 } MOVStreamContext;
 
 typedef struct MOVContext {
@@ -264,6 +270,7 @@ typedef struct MOVContext {
     int use_absolute_path;
     int ignore_editlist;
     int advanced_editlist;
+    int lazy_index;
     int ignore_chapters;
     int seek_individually;
     int64_t next_root_atom; ///< offset of the next root atom
@@ -288,6 +295,18 @@ typedef struct MOVContext {
     int decryption_key_len;
     int enable_drefs;
     int32_t movie_display_matrix[3][3]; ///< display matrix from mvhd
+
+    /**
+     * Binary min-heap of the indexes of the streams with samples left to
+     * read, ordered by the dts of their current sample.
+     */
+    int *sample_heap;
+    int nb_sample_heap;
+    int sample_heap_dirty;  ///< the heap must be rebuilt before use
+    int sample_heap_all;    ///< also keep discarded streams in the heap
+    int nb_dropped;         ///< number of discarded streams left out
+    int dropped_check;      ///< next stream to check for being enabled again
+    int64_t last_dts;       ///< dts of the last sample returned, in AV_TIME_BASE
 } MOVContext;
 
 int ff_mp4_read_descr_len(AVIOContext *pb);
@@ -3368,8 +3368,8 @@ static int matroska_parse_block(MatroskaDemuxContext *matroska, AVBufferRef *buf
             is_keyframe = 0;  /* overlapping subtitles are not key frame */
         if (is_keyframe) {
             ff_reduce_index(matroska->ctx, st->index);
-            av_add_index_entry(st, cluster_pos, timecode, 0, 0,
-                               AVINDEX_KEYFRAME);
+            ff_add_index_entry_deferred(st, cluster_pos, timecode, 0, 0,
+                                        AVINDEX_KEYFRAME);
         }
     }
 
@@ -3718,6 +3718,7 @@ static int webm_clusters_start_with_keyframe(AVFormatContext *s)
             break;
         }
     }
+    ff_index_flush(s->streams[0]);
     avio_seek(s->pb, before_pos, SEEK_SET);
     return rv;
 }
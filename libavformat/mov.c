@@ -3717,20 +3717,289 @@ static void mov_fix_index(MOVContext *mov, AVStream *st)
     msc->current_index = msc->index_ranges[0].start;
 }
 
+#define MOV_INDEX_BATCH 4096
+
+/**
+ * Position of the sample table expansion of a stream, kept between calls
+ * when the index is built lazily.
+ */
+typedef struct MOVIndexBuilder {
+    int64_t current_offset;
+    int64_t current_dts;
+    int64_t last_dts;
+    int64_t dts_correction;
+    uint64_t stream_size;
+    unsigned int chunk;
+    unsigned int chunk_sample;  ///< sample in the current chunk, 0 before its first sample
+    unsigned int current_sample;
+    unsigned int stts_index;
+    unsigned int stts_sample;
+    unsigned int stsc_index;
+    unsigned int stss_index;
+    unsigned int stps_index;
+    unsigned int distance;
+    unsigned int rap_group_index;
+    unsigned int rap_group_sample;
+    int key_off;
+    int done;                   ///< all samples added, or the tables were found invalid
+} MOVIndexBuilder;
+
+/**
+ * Expand ctts entries such that we have a 1-1 mapping with samples.
+ */
+static int mov_expand_ctts(MOVStreamContext *sc)
+{
+    MOVStts *ctts_data_old = sc->ctts_data;
+    unsigned int ctts_count_old = sc->ctts_count;
+    unsigned int i, j;
+
+    if (sc->sample_count >= UINT_MAX / sizeof(*sc->ctts_data))
+        return AVERROR_INVALIDDATA;
+    sc->ctts_count = 0;
+    sc->ctts_allocated_size = 0;
+    sc->ctts_data = av_fast_realloc(NULL, &sc->ctts_allocated_size,
+                            sc->sample_count * sizeof(*sc->ctts_data));
+    if (!sc->ctts_data) {
+        av_free(ctts_data_old);
+        return AVERROR(ENOMEM);
+    }
+
+    memset((uint8_t*)(sc->ctts_data), 0, sc->ctts_allocated_size);
+
+    for (i = 0; i < ctts_count_old &&
+                sc->ctts_count < sc->sample_count; i++)
+        for (j = 0; j < ctts_data_old[i].count &&
+                    sc->ctts_count < sc->sample_count; j++)
+            add_ctts_entry(&sc->ctts_data, &sc->ctts_count,
+                           &sc->ctts_allocated_size, 1,
+                           ctts_data_old[i].duration);
+    av_free(ctts_data_old);
+    return 0;
+}
+
+/**
+ * Add the index entries of up to nb_samples more samples of the sample
+ * table. Room for them must already be allocated in st->index_entries.
+ *
+ * @return 0 on success, a negative AVERROR code if the tables are invalid
+ */
+static int mov_build_index_entries(MOVContext *mov, AVStream *st,
+                                   MOVIndexBuilder *b, unsigned int nb_samples)
+{
+    MOVStreamContext *sc = st->priv_data;
+    unsigned int sample_size;
+    int rap_group_present = sc->rap_group_count && sc->rap_group;
+
+    while (nb_samples && b->chunk < sc->chunk_count) {
+        int keyframe = 0;
+
+        if (!b->chunk_sample) {
+            int64_t next_offset = b->chunk + 1 < sc->chunk_count ? sc->chunk_offsets[b->chunk + 1] : INT64_MAX;
+            b->current_offset = sc->chunk_offsets[b->chunk];
+            while (mov_stsc_index_valid(b->stsc_index, sc->stsc_count) &&
+                b->chunk + 1 == sc->stsc_data[b->stsc_index + 1].first)
+                b->stsc_index++;
+
+            if (next_offset > b->current_offset && sc->sample_size>0 && sc->sample_size < sc->stsz_sample_size &&
+                sc->stsc_data[b->stsc_index].count * (int64_t)sc->stsz_sample_size > next_offset - b->current_offset) {
+                av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too large), ignoring\n", sc->stsz_sample_size);
+                sc->stsz_sample_size = sc->sample_size;
+            }
+            if (sc->stsz_sample_size>0 && sc->stsz_sample_size < sc->sample_size) {
+                av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too small), ignoring\n", sc->stsz_sample_size);
+                sc->stsz_sample_size = sc->sample_size;
+            }
+        }
+        if (b->chunk_sample >= sc->stsc_data[b->stsc_index].count) {
+            b->chunk++;
+            b->chunk_sample = 0;
+            continue;
+        }
+
+        if (b->current_sample >= sc->sample_count) {
+            av_log(mov->fc, AV_LOG_ERROR, "wrong sample count\n");
+            return AVERROR_INVALIDDATA;
+        }
+
+        if (!sc->keyframe_absent && (!sc->keyframe_count || b->current_sample+b->key_off == sc->keyframes[b->stss_index])) {
+            keyframe = 1;
+            if (b->stss_index + 1 < sc->keyframe_count)
+                b->stss_index++;
+        } else if (sc->stps_count && b->current_sample+b->key_off == sc->stps_data[b->stps_index]) {
+            keyframe = 1;
+            if (b->stps_index + 1 < sc->stps_count)
+                b->stps_index++;
+        }
+        if (rap_group_present && b->rap_group_index < sc->rap_group_count) {
+            if (sc->rap_group[b->rap_group_index].index > 0)
+                keyframe = 1;
+            if (++b->rap_group_sample == sc->rap_group[b->rap_group_index].count) {
+                b->rap_group_sample = 0;
+                b->rap_group_index++;
+            }
+        }
+        if (sc->keyframe_absent
+            && !sc->stps_count
+            && !rap_group_present
+            && (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO || (b->chunk==0 && b->chunk_sample==0)))
+             keyframe = 1;
+        if (keyframe)
+            b->distance = 0;
+        sample_size = sc->stsz_sample_size > 0 ? sc->stsz_sample_size : sc->sample_sizes[b->current_sample];
+        if (sc->pseudo_stream_id == -1 ||
+           sc->stsc_data[b->stsc_index].id - 1 == sc->pseudo_stream_id) {
+            AVIndexEntry *e;
+            if (sample_size > 0x3FFFFFFF) {
+                av_log(mov->fc, AV_LOG_ERROR, "Sample size %u is too large\n", sample_size);
+                return AVERROR_INVALIDDATA;
+            }
+            e = &st->index_entries[st->nb_index_entries++];
+            e->pos = b->current_offset;
+            e->timestamp = b->current_dts;
+            e->size = sample_size;
+            e->min_distance = b->distance;
+            e->flags = keyframe ? AVINDEX_KEYFRAME : 0;
+            av_log(mov->fc, AV_LOG_TRACE, "AVIndex stream %d, sample %u, offset %"PRIx64", dts %"PRId64", "
+                    "size %u, distance %u, keyframe %d\n", st->index, b->current_sample,
+                    b->current_offset, b->current_dts, sample_size, b->distance, keyframe);
+            if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && st->nb_index_entries < 100)
+                ff_rfps_add_frame(mov->fc, st, b->current_dts);
+        }
+
+        b->current_offset += sample_size;
+        b->stream_size += sample_size;
+
+        /* A negative sample duration is invalid based on the spec,
+         * but some samples need it to correct the DTS. */
+        if (sc->stts_data[b->stts_index].duration < 0) {
+            av_log(mov->fc, AV_LOG_WARNING,
+                   "Invalid SampleDelta %d in STTS, at %d st:%d\n",
+                   sc->stts_data[b->stts_index].duration, b->stts_index,
+                   st->index);
+            b->dts_correction += sc->stts_data[b->stts_index].duration - 1;
+            sc->stts_data[b->stts_index].duration = 1;
+        }
+        b->current_dts += sc->stts_data[b->stts_index].duration;
+        if (!b->dts_correction || b->current_dts + b->dts_correction > b->last_dts) {
+            b->current_dts += b->dts_correction;
+            b->dts_correction = 0;
+        } else {
+            /* Avoid creating non-monotonous DTS */
+            b->dts_correction += b->current_dts - b->last_dts - 1;
+            b->current_dts = b->last_dts + 1;
+        }
+        b->last_dts = b->current_dts;
+        b->distance++;
+        b->stts_sample++;
+        b->current_sample++;
+        b->chunk_sample++;
+        nb_samples--;
+        if (b->stts_index + 1 < sc->stts_count && b->stts_sample == sc->stts_data[b->stts_index].count) {
+            b->stts_sample = 0;
+            b->stts_index++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Grow a lazily built index until it holds at least nb_entries entries,
+ * or the whole sample table.
+ */
+static int mov_index_expand(MOVContext *mov, AVStream *st, int64_t nb_entries)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVIndexBuilder *b = sc->index_builder;
+    int ret = 0;
+
+    while (b && !b->done && st->nb_index_entries < nb_entries) {
+        unsigned int count = FFMAX(MOV_INDEX_BATCH, st->nb_index_entries / 2);
+        AVIndexEntry *entries;
+
+        count = FFMIN(count, sc->sample_count - b->current_sample);
+        entries = av_fast_realloc(st->index_entries,
+                                  &st->index_entries_allocated_size,
+                                  (st->nb_index_entries + (size_t)count) * sizeof(*st->index_entries));
+        if (!entries) {
+            ret = AVERROR(ENOMEM);
+            b->done = 1;
+        } else {
+            st->index_entries = entries;
+            ret = mov_build_index_entries(mov, st, b, count);
+            if (ret < 0 || b->chunk >= sc->chunk_count ||
+                b->current_sample >= sc->sample_count)
+                b->done = 1;
+        }
+        /* the end of the trak still uses them when parsing the moov */
+        if (b->done && mov->found_moov) {
+            /* Do not need those anymore. */
+            av_freep(&sc->chunk_offsets);
+            av_freep(&sc->sample_sizes);
+            av_freep(&sc->keyframes);
+            av_freep(&sc->stts_data);
+            av_freep(&sc->stps_data);
+            av_freep(&sc->rap_group);
+        }
+    }
+    return ret;
+}
+
+/**
+ * Grow a lazily built index until it covers the given dts, so that
+ * av_index_search_timestamp() gives the same result as on a full index.
+ */
+static int mov_index_expand_to(MOVContext *mov, AVStream *st, int64_t timestamp, int flags)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int ret;
+
+    while (sc->index_builder && !sc->index_builder->done &&
+           (!st->nb_index_entries ||
+            st->index_entries[st->nb_index_entries - 1].timestamp <= timestamp ||
+            av_index_search_timestamp(st, timestamp, flags) < 0)) {
+        if ((ret = mov_index_expand(mov, st, st->nb_index_entries + 1)) < 0)
+            return ret;
+    }
+    return 0;
+}
+
+/**
+ * Complete a lazily built index, including the 1-1 ctts mapping, for code
+ * that needs all of it at once.
+ */
+static int mov_index_finish(MOVContext *mov, AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int ret;
+
+    if (!sc->index_builder)
+        return 0;
+    ret = mov_index_expand(mov, st, INT64_MAX);
+    if (ret >= 0 && sc->ctts_data) {
+        ret = mov_expand_ctts(sc);
+        sc->ctts_index  = sc->current_sample;
+        sc->ctts_sample = 0;
+    }
+    av_freep(&sc->index_builder);
+    return ret;
+}
+
 static void mov_build_index(MOVContext *mov, AVStream *st)
 {
     MOVStreamContext *sc = st->priv_data;
     int64_t current_offset;
     int64_t current_dts = 0;
-    unsigned int stts_index = 0;
     unsigned int stsc_index = 0;
-    unsigned int stss_index = 0;
-    unsigned int stps_index = 0;
-    unsigned int i, j;
+    unsigned int i;
     uint64_t stream_size = 0;
-    MOVStts *ctts_data_old = sc->ctts_data;
-    unsigned int ctts_count_old = sc->ctts_count;
-
+    /* only plain audio and video tracks without edits to apply to the
+     * index itself can have it built while reading */
+    int lazy = mov->lazy_index &&
+               (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ||
+                st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO);
+    int advanced_editlist;
+
+    advanced_editlist = mov->advanced_editlist && !lazy;
     if (sc->elst_count) {
         int i, edit_start_index = 0, multiple_edits = 0;
         int64_t empty_duration = 0; // empty duration of the first edit list entry
@@ -3754,6 +4023,10 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
             av_log(mov->fc, AV_LOG_WARNING, "multiple edit list entries, "
                    "Use -advanced_editlist to correctly decode otherwise "
                    "a/v desync might occur\n");
+        if (multiple_edits) {
+            lazy = 0;
+            advanced_editlist = mov->advanced_editlist;
+        }
 
         /* adjust first dts according to edit list */
         if ((empty_duration || start_time) && mov->time_scale > 0) {
@@ -3761,11 +4034,11 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
                 empty_duration = av_rescale(empty_duration, sc->time_scale, mov->time_scale);
             sc->time_offset = start_time - empty_duration;
             sc->min_corrected_pts = start_time;
-            if (!mov->advanced_editlist)
+            if (!advanced_editlist)
                 current_dts = -sc->time_offset;
         }
 
-        if (!multiple_edits && !mov->advanced_editlist &&
+        if (!multiple_edits && !advanced_editlist &&
             st->codecpar->codec_id == AV_CODEC_ID_AAC && start_time > 0)
             sc->start_pad = start_time;
     }
@@ -3773,157 +4046,51 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
     /* only use old uncompressed audio chunk demuxing when stts specifies it */
     if (!(st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
           sc->stts_count == 1 && sc->stts_data[0].duration == 1)) {
-        unsigned int current_sample = 0;
-        unsigned int stts_sample = 0;
-        unsigned int sample_size;
-        unsigned int distance = 0;
-        unsigned int rap_group_index = 0;
-        unsigned int rap_group_sample = 0;
-        int64_t last_dts = 0;
-        int64_t dts_correction = 0;
-        int rap_group_present = sc->rap_group_count && sc->rap_group;
-        int key_off = (sc->keyframe_count && sc->keyframes[0] > 0) || (sc->stps_count && sc->stps_data[0] > 0);
+        MOVIndexBuilder *b;
+        int ret;
 
         current_dts -= sc->dts_shift;
-        last_dts     = current_dts;
 
         if (!sc->sample_count || st->nb_index_entries)
             return;
         if (sc->sample_count >= UINT_MAX / sizeof(*st->index_entries) - st->nb_index_entries)
             return;
-        if (av_reallocp_array(&st->index_entries,
-                              st->nb_index_entries + sc->sample_count,
-                              sizeof(*st->index_entries)) < 0) {
-            st->nb_index_entries = 0;
-            return;
-        }
-        st->index_entries_allocated_size = (st->nb_index_entries + sc->sample_count) * sizeof(*st->index_entries);
 
-        if (ctts_data_old) {
-            // Expand ctts entries such that we have a 1-1 mapping with samples
-            if (sc->sample_count >= UINT_MAX / sizeof(*sc->ctts_data))
+        b = av_mallocz(sizeof(*b));
+        if (!b)
+            return;
+        b->current_dts = current_dts;
+        b->last_dts    = current_dts;
+        b->key_off     = (sc->keyframe_count && sc->keyframes[0] > 0) || (sc->stps_count && sc->stps_data[0] > 0);
+
+        if (lazy) {
+            /* ctts is kept run-length coded, the packet reading and
+             * seeking code handles both forms */
+            sc->index_builder = b;
+            if (mov_index_expand(mov, st, MOV_INDEX_BATCH) < 0)
                 return;
-            sc->ctts_count = 0;
-            sc->ctts_allocated_size = 0;
-            sc->ctts_data = av_fast_realloc(NULL, &sc->ctts_allocated_size,
-                                    sc->sample_count * sizeof(*sc->ctts_data));
-            if (!sc->ctts_data) {
-                av_free(ctts_data_old);
+            stream_size = sc->stsz_sample_size > 0 ?
+                          (uint64_t)sc->stsz_sample_size * sc->sample_count : sc->data_size;
+        } else {
+            if (av_reallocp_array(&st->index_entries,
+                                  st->nb_index_entries + sc->sample_count,
+                                  sizeof(*st->index_entries)) < 0) {
+                st->nb_index_entries = 0;
+                av_free(b);
                 return;
             }
+            st->index_entries_allocated_size = (st->nb_index_entries + sc->sample_count) * sizeof(*st->index_entries);
 
-            memset((uint8_t*)(sc->ctts_data), 0, sc->ctts_allocated_size);
-
-            for (i = 0; i < ctts_count_old &&
-                        sc->ctts_count < sc->sample_count; i++)
-                for (j = 0; j < ctts_data_old[i].count &&
-                            sc->ctts_count < sc->sample_count; j++)
-                    add_ctts_entry(&sc->ctts_data, &sc->ctts_count,
-                                   &sc->ctts_allocated_size, 1,
-                                   ctts_data_old[i].duration);
-            av_free(ctts_data_old);
-        }
-
-        for (i = 0; i < sc->chunk_count; i++) {
-            int64_t next_offset = i+1 < sc->chunk_count ? sc->chunk_offsets[i+1] : INT64_MAX;
-            current_offset = sc->chunk_offsets[i];
-            while (mov_stsc_index_valid(stsc_index, sc->stsc_count) &&
-                i + 1 == sc->stsc_data[stsc_index + 1].first)
-                stsc_index++;
-
-            if (next_offset > current_offset && sc->sample_size>0 && sc->sample_size < sc->stsz_sample_size &&
-                sc->stsc_data[stsc_index].count * (int64_t)sc->stsz_sample_size > next_offset - current_offset) {
-                av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too large), ignoring\n", sc->stsz_sample_size);
-                sc->stsz_sample_size = sc->sample_size;
-            }
-            if (sc->stsz_sample_size>0 && sc->stsz_sample_size < sc->sample_size) {
-                av_log(mov->fc, AV_LOG_WARNING, "STSZ sample size %d invalid (too small), ignoring\n", sc->stsz_sample_size);
-                sc->stsz_sample_size = sc->sample_size;
+            if (sc->ctts_data && mov_expand_ctts(sc) < 0) {
+                av_free(b);
+                return;
             }
 
-            for (j = 0; j < sc->stsc_data[stsc_index].count; j++) {
-                int keyframe = 0;
-                if (current_sample >= sc->sample_count) {
-                    av_log(mov->fc, AV_LOG_ERROR, "wrong sample count\n");
-                    return;
-                }
-
-                if (!sc->keyframe_absent && (!sc->keyframe_count || current_sample+key_off == sc->keyframes[stss_index])) {
-                    keyframe = 1;
-                    if (stss_index + 1 < sc->keyframe_count)
-                        stss_index++;
-                } else if (sc->stps_count && current_sample+key_off == sc->stps_data[stps_index]) {
-                    keyframe = 1;
-                    if (stps_index + 1 < sc->stps_count)
-                        stps_index++;
-                }
-                if (rap_group_present && rap_group_index < sc->rap_group_count) {
-                    if (sc->rap_group[rap_group_index].index > 0)
-                        keyframe = 1;
-                    if (++rap_group_sample == sc->rap_group[rap_group_index].count) {
-                        rap_group_sample = 0;
-                        rap_group_index++;
-                    }
-                }
-                if (sc->keyframe_absent
-                    && !sc->stps_count
-                    && !rap_group_present
-                    && (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO || (i==0 && j==0)))
-                     keyframe = 1;
-                if (keyframe)
-                    distance = 0;
-                sample_size = sc->stsz_sample_size > 0 ? sc->stsz_sample_size : sc->sample_sizes[current_sample];
-                if (sc->pseudo_stream_id == -1 ||
-                   sc->stsc_data[stsc_index].id - 1 == sc->pseudo_stream_id) {
-                    AVIndexEntry *e;
-                    if (sample_size > 0x3FFFFFFF) {
-                        av_log(mov->fc, AV_LOG_ERROR, "Sample size %u is too large\n", sample_size);
-                        return;
-                    }
-                    e = &st->index_entries[st->nb_index_entries++];
-                    e->pos = current_offset;
-                    e->timestamp = current_dts;
-                    e->size = sample_size;
-                    e->min_distance = distance;
-                    e->flags = keyframe ? AVINDEX_KEYFRAME : 0;
-                    av_log(mov->fc, AV_LOG_TRACE, "AVIndex stream %d, sample %u, offset %"PRIx64", dts %"PRId64", "
-                            "size %u, distance %u, keyframe %d\n", st->index, current_sample,
-                            current_offset, current_dts, sample_size, distance, keyframe);
-                    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && st->nb_index_entries < 100)
-                        ff_rfps_add_frame(mov->fc, st, current_dts);
-                }
-
-                current_offset += sample_size;
-                stream_size += sample_size;
-
-                /* A negative sample duration is invalid based on the spec,
-                 * but some samples need it to correct the DTS. */
-                if (sc->stts_data[stts_index].duration < 0) {
-                    av_log(mov->fc, AV_LOG_WARNING,
-                           "Invalid SampleDelta %d in STTS, at %d st:%d\n",
-                           sc->stts_data[stts_index].duration, stts_index,
-                           st->index);
-                    dts_correction += sc->stts_data[stts_index].duration - 1;
-                    sc->stts_data[stts_index].duration = 1;
-                }
-                current_dts += sc->stts_data[stts_index].duration;
-                if (!dts_correction || current_dts + dts_correction > last_dts) {
-                    current_dts += dts_correction;
-                    dts_correction = 0;
-                } else {
-                    /* Avoid creating non-monotonous DTS */
-                    dts_correction += current_dts - last_dts - 1;
-                    current_dts = last_dts + 1;
-                }
-                last_dts = current_dts;
-                distance++;
-                stts_sample++;
-                current_sample++;
-                if (stts_index + 1 < sc->stts_count && stts_sample == sc->stts_data[stts_index].count) {
-                    stts_sample = 0;
-                    stts_index++;
-                }
-            }
+            ret = mov_build_index_entries(mov, st, b, UINT_MAX);
+            stream_size = b->stream_size;
+            av_free(b);
+            if (ret < 0)
+                return;
         }
         if (st->duration > 0)
             st->codecpar->bit_rate = stream_size*8*sc->time_scale/st->duration;
@@ -4029,7 +4196,7 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
         }
     }
 
-    if (!mov->ignore_editlist && mov->advanced_editlist) {
+    if (!mov->ignore_editlist && advanced_editlist) {
         // Fix index according to edit lists.
         mov_fix_index(mov, st);
     }
@@ -4273,14 +4440,16 @@ static int mov_read_trak(MOVContext *c, AVIOContext *pb, MOVAtom atom)
         && sc->time_scale == st->codecpar->sample_rate) {
             st->need_parsing = AVSTREAM_PARSE_FULL;
     }
-    /* Do not need those anymore. */
-    av_freep(&sc->chunk_offsets);
-    av_freep(&sc->sample_sizes);
-    av_freep(&sc->keyframes);
-    av_freep(&sc->stts_data);
-    av_freep(&sc->stps_data);
+    /* Do not need those anymore, unless the index is still being built. */
+    if (!sc->index_builder || sc->index_builder->done) {
+        av_freep(&sc->chunk_offsets);
+        av_freep(&sc->sample_sizes);
+        av_freep(&sc->keyframes);
+        av_freep(&sc->stts_data);
+        av_freep(&sc->stps_data);
+        av_freep(&sc->rap_group);
+    }
     av_freep(&sc->elst_data);
-    av_freep(&sc->rap_group);
 
     return 0;
 }
@@ -4691,7 +4860,7 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     int64_t dts, pts = AV_NOPTS_VALUE;
     int data_offset = 0;
     unsigned entries, first_sample_flags = frag->flags;
-    int flags, distance, i;
+    int flags, distance, i, ret;
     int64_t prev_dts = AV_NOPTS_VALUE;
     int next_frag_index = -1, index_entry_pos;
     size_t requested_size;
@@ -4718,6 +4887,10 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     if (sc->pseudo_stream_id+1 != frag->stsd_id && sc->pseudo_stream_id != -1)
         return 0;
 
+    // Fragments are inserted into the complete index.
+    if ((ret = mov_index_finish(c, st)) < 0)
+        return ret;
+
     // Find the next frag_index index that has a valid index_entry for
     // the current track_id.
     //
@@ -4823,6 +4996,7 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 
     st->nb_index_entries += entries;
     sc->ctts_count = st->nb_index_entries;
+    c->sample_heap_dirty = 1;
 
     // Record the index_entry position in frag_index of this fragment
     if (frag_stream_info)
@@ -7200,6 +7374,7 @@ static int mov_read_close(AVFormatContext *s)
         av_freep(&sc->rap_group);
         av_freep(&sc->display_matrix);
         av_freep(&sc->index_ranges);
+        av_freep(&sc->index_builder);
 
         if (sc->extradata)
             for (j = 0; j < sc->stsd_count; j++)
@@ -7243,6 +7418,7 @@ static int mov_read_close(AVFormatContext *s)
 
     av_freep(&mov->aes_decrypt);
     av_freep(&mov->chapter_tracks);
+    av_freep(&mov->sample_heap);
 
     return 0;
 }
@@ -7588,33 +7764,210 @@ static int mov_read_header(AVFormatContext *s)
         if (mov->frag_index.item[i].moof_offset <= mov->fragment.moof_offset)
             mov->frag_index.item[i].headers_read = 1;
 
+    mov->sample_heap_dirty = 1;
+
     return 0;
 }
 
-static AVIndexEntry *mov_find_next_sample(AVFormatContext *s, AVStream **st)
+static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp, int flags);
+
+static int mov_sample_heap_less(AVFormatContext *s, int a, int b)
+{
+    MOVStreamContext *sca = s->streams[a]->priv_data;
+    MOVStreamContext *scb = s->streams[b]->priv_data;
+
+    return sca->heap_key < scb->heap_key ||
+           (sca->heap_key == scb->heap_key && a < b);
+}
+
+static void mov_sample_heap_swap(AVFormatContext *s, int i, int j)
+{
+    MOVContext *mov = s->priv_data;
+    int tmp = mov->sample_heap[i];
+
+    mov->sample_heap[i] = mov->sample_heap[j];
+    mov->sample_heap[j] = tmp;
+    ((MOVStreamContext *)s->streams[mov->sample_heap[i]]->priv_data)->heap_index = i;
+    ((MOVStreamContext *)s->streams[mov->sample_heap[j]]->priv_data)->heap_index = j;
+}
+
+static void mov_sample_heap_sift(AVFormatContext *s, int i)
 {
-    AVIndexEntry *sample = NULL;
-    int64_t best_dts = INT64_MAX;
+    MOVContext *mov = s->priv_data;
+    int *heap = mov->sample_heap;
+
+    while (i > 0 && mov_sample_heap_less(s, heap[i], heap[(i - 1) / 2])) {
+        mov_sample_heap_swap(s, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= mov->nb_sample_heap)
+            break;
+        if (child + 1 < mov->nb_sample_heap &&
+            mov_sample_heap_less(s, heap[child + 1], heap[child]))
+            child++;
+        if (!mov_sample_heap_less(s, heap[child], heap[i]))
+            break;
+        mov_sample_heap_swap(s, i, child);
+        i = child;
+    }
+}
+
+/**
+ * Move a stream in the sample heap after its current sample changed,
+ * removing it if it has no samples left or is discarded.
+ */
+static void mov_sample_heap_update(AVFormatContext *s, AVStream *st)
+{
+    MOVContext *mov = s->priv_data;
+    MOVStreamContext *sc = st->priv_data;
+    int i = sc->heap_index;
+
+    if (mov->sample_heap_dirty)
+        return;
+
+    if (sc->current_sample >= 0 &&
+        (st->discard != AVDISCARD_ALL || mov->sample_heap_all))
+        mov_index_expand(mov, st, sc->current_sample + 1LL);
+
+    if (!sc->pb || sc->current_sample < 0 ||
+        sc->current_sample >= st->nb_index_entries ||
+        (st->discard == AVDISCARD_ALL && !mov->sample_heap_all)) {
+        if (i >= 0) {
+            mov_sample_heap_swap(s, i, --mov->nb_sample_heap);
+            sc->heap_index = -1;
+            if (i < mov->nb_sample_heap)
+                mov_sample_heap_sift(s, i);
+        }
+        if (st->discard == AVDISCARD_ALL && !mov->sample_heap_all && !sc->dropped) {
+            sc->dropped = 1;
+            mov->nb_dropped++;
+        }
+        return;
+    }
+
+    if (s->pb->seekable & AVIO_SEEKABLE_NORMAL)
+        sc->heap_key = av_rescale(st->index_entries[sc->current_sample].timestamp,
+                                  AV_TIME_BASE, sc->time_scale);
+    else
+        sc->heap_key = st->index_entries[sc->current_sample].pos;
+
+    if (i < 0) {
+        i = sc->heap_index = mov->nb_sample_heap++;
+        mov->sample_heap[i] = st->index;
+    }
+    mov_sample_heap_sift(s, i);
+}
+
+static int mov_sample_heap_build(AVFormatContext *s)
+{
+    MOVContext *mov = s->priv_data;
     int i;
+
+    if (av_reallocp_array(&mov->sample_heap, s->nb_streams, sizeof(*mov->sample_heap)) < 0) {
+        mov->nb_sample_heap = 0;
+        return AVERROR(ENOMEM);
+    }
+    mov->nb_sample_heap    = 0;
+    mov->nb_dropped        = 0;
+    mov->sample_heap_dirty = 0;
     for (i = 0; i < s->nb_streams; i++) {
-        AVStream *avst = s->streams[i];
-        MOVStreamContext *msc = avst->priv_data;
-        if (msc->pb && msc->current_sample < avst->nb_index_entries) {
-            AVIndexEntry *current_sample = &avst->index_entries[msc->current_sample];
-            int64_t dts = av_rescale(current_sample->timestamp, AV_TIME_BASE, msc->time_scale);
-            av_log(s, AV_LOG_TRACE, "stream %d, sample %d, dts %"PRId64"\n", i, msc->current_sample, dts);
-            if (!sample || (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL) && current_sample->pos < sample->pos) ||
-                ((s->pb->seekable & AVIO_SEEKABLE_NORMAL) &&
-                 ((msc->pb != s->pb && dts < best_dts) || (msc->pb == s->pb &&
-                 ((FFABS(best_dts - dts) <= AV_TIME_BASE && current_sample->pos < sample->pos) ||
-                  (FFABS(best_dts - dts) > AV_TIME_BASE && dts < best_dts)))))) {
-                sample = current_sample;
-                best_dts = dts;
-                *st = avst;
-            }
+        MOVStreamContext *sc = s->streams[i]->priv_data;
+        sc->heap_index = -1;
+        sc->dropped    = 0;
+        mov_sample_heap_update(s, s->streams[i]);
+    }
+    return 0;
+}
+
+/* Return the stream to read first among the streams of the main file whose
+ * next sample is within one second of the earliest one, that is the one
+ * stored first, to avoid seeking back and forth. */
+static void mov_sample_heap_window(AVFormatContext *s, int i, int64_t limit, AVStream **best)
+{
+    MOVContext *mov = s->priv_data;
+    AVStream *st;
+    MOVStreamContext *sc;
+
+    if (i >= mov->nb_sample_heap)
+        return;
+    st = s->streams[mov->sample_heap[i]];
+    sc = st->priv_data;
+    if (sc->heap_key > limit)
+        return;
+
+    if (sc->pb == s->pb && (st->discard != AVDISCARD_ALL || mov->sample_heap_all)) {
+        int64_t pos = st->index_entries[sc->current_sample].pos;
+        if (!*best)
+            *best = st;
+        else {
+            MOVStreamContext *best_sc = (*best)->priv_data;
+            int64_t best_pos = (*best)->index_entries[best_sc->current_sample].pos;
+            if (pos < best_pos || (pos == best_pos && st->index < (*best)->index))
+                *best = st;
         }
     }
-    return sample;
+    mov_sample_heap_window(s, 2 * i + 1, limit, best);
+    mov_sample_heap_window(s, 2 * i + 2, limit, best);
+}
+
+static AVIndexEntry *mov_find_next_sample(AVFormatContext *s, AVStream **st)
+{
+    MOVContext *mov = s->priv_data;
+    AVStream *best = NULL, *top;
+    MOVStreamContext *sc;
+
+    if (mov->sample_heap_dirty && mov_sample_heap_build(s) < 0)
+        return NULL;
+
+    /* Streams enabled again continue from the current position. Only one
+     * stream is checked per call, so that the cost does not grow with the
+     * number of streams; rebuilding the heap on seek checks all of them. */
+    if (mov->nb_dropped && !mov->sample_heap_all) {
+        AVStream *avst;
+
+        if (mov->dropped_check >= s->nb_streams)
+            mov->dropped_check = 0;
+        avst = s->streams[mov->dropped_check++];
+        sc   = avst->priv_data;
+        if (sc->dropped && avst->discard != AVDISCARD_ALL) {
+            sc->dropped = 0;
+            mov->nb_dropped--;
+            mov_seek_stream(s, avst, av_rescale_q(mov->last_dts, AV_TIME_BASE_Q,
+                                                  avst->time_base), 0);
+            if (mov->sample_heap_dirty && mov_sample_heap_build(s) < 0)
+                return NULL;
+            mov_sample_heap_update(s, avst);
+        }
+    }
+
+    for (;;) {
+        if (!mov->nb_sample_heap)
+            return NULL;
+        top = s->streams[mov->sample_heap[0]];
+        if (top->discard != AVDISCARD_ALL || mov->sample_heap_all)
+            break;
+        mov_sample_heap_update(s, top);
+    }
+    sc = top->priv_data;
+
+    if (s->pb->seekable & AVIO_SEEKABLE_NORMAL) {
+        mov_sample_heap_window(s, 0, sc->heap_key + AV_TIME_BASE, &best);
+        if (best && (sc->pb == s->pb ||
+                     ((MOVStreamContext *)best->priv_data)->heap_key <= sc->heap_key))
+            top = best;
+        sc = top->priv_data;
+        mov->last_dts = sc->heap_key;
+    } else {
+        mov->last_dts = av_rescale(top->index_entries[sc->current_sample].timestamp,
+                                   AV_TIME_BASE, sc->time_scale);
+    }
+
+    av_log(s, AV_LOG_TRACE, "stream %d, sample %d, dts %"PRId64"\n",
+           top->index, sc->current_sample, mov->last_dts);
+    *st = top;
+    return &top->index_entries[sc->current_sample];
 }
 
 static int should_retry(AVIOContext *pb, int error_code) {
@@ -7688,7 +8041,7 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
     MOVStreamContext *sc;
     AVIndexEntry *sample;
     AVStream *st = NULL;
-    int64_t current_index;
+    int64_t current_index, sample_index;
     int ret;
     mov->fc = s;
  retry:
@@ -7703,7 +8056,11 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
     sc = st->priv_data;
     /* must be done just before reading, to avoid infinite loop on sample */
     current_index = sc->current_index;
+    sample_index  = sample - st->index_entries;
     mov_current_sample_inc(sc);
+    mov_sample_heap_update(s, st);
+    /* a lazily built index may have been reallocated */
+    sample = &st->index_entries[sample_index];
 
     if (mov->next_root_atom) {
         sample->pos = FFMIN(sample->pos, mov->next_root_atom);
@@ -7717,6 +8074,7 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
                    sc->ffindex, sample->pos);
             if (should_retry(sc->pb, ret64)) {
                 mov_current_sample_dec(sc);
+                mov_sample_heap_update(s, st);
             }
             return AVERROR_INVALIDDATA;
         }
@@ -7726,10 +8084,16 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
             goto retry;
         }
 
-        ret = av_get_packet(sc->pb, pkt, sample->size);
+        /* decryption and the DV demuxer work on the packet data in place */
+        if (mov->aax_mode || mov->decryption_key ||
+            (mov->dv_demux && sc->dv_audio_container))
+            ret = av_get_packet(sc->pb, pkt, sample->size);
+        else
+            ret = ff_get_packet_ref(sc->pb, pkt, sample->size);
         if (ret < 0) {
             if (should_retry(sc->pb, ret)) {
                 mov_current_sample_dec(sc);
+                mov_sample_heap_update(s, st);
             }
             return ret;
         }
@@ -7849,6 +8213,10 @@ static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp,
     if (ret < 0)
         return ret;
 
+    ret = mov_index_expand_to(s->priv_data, st, timestamp, flags);
+    if (ret < 0)
+        return ret;
+
     sample = av_index_search_timestamp(st, timestamp, flags);
     av_log(s, AV_LOG_TRACE, "stream %d, timestamp %"PRId64", sample %d\n", st->index, timestamp, sample);
     if (sample < 0 && st->nb_index_entries && timestamp < st->index_entries[0].timestamp)
@@ -7925,17 +8293,26 @@ static int mov_read_seek(AVFormatContext *s, int stream_index, int64_t sample_ti
             sc = st->priv_data;
             mov_current_sample_set(sc, 0);
         }
+        /* the target stream may be discarded */
+        mc->sample_heap_all   = 1;
+        mc->sample_heap_dirty = 1;
         while (1) {
             MOVStreamContext *sc;
             AVIndexEntry *entry = mov_find_next_sample(s, &st);
-            if (!entry)
+            if (!entry) {
+                mc->sample_heap_all   = 0;
+                mc->sample_heap_dirty = 1;
                 return AVERROR_INVALIDDATA;
+            }
             sc = st->priv_data;
             if (sc->ffindex == stream_index && sc->current_sample == sample)
                 break;
             mov_current_sample_inc(sc);
+            mov_sample_heap_update(s, st);
         }
+        mc->sample_heap_all = 0;
     }
+    mc->sample_heap_dirty = 1;
     return 0;
 }
 
@@ -7952,6 +8329,13 @@ static const AVOption mov_options[] = {
         0, 1, FLAGS},
     {"ignore_editlist", "Ignore the edit list atom.", OFFSET(ignore_editlist), AV_OPT_TYPE_BOOL, {.i64 = 0},
         0, 1, FLAGS},
+    {"lazy_index",
+        "Build the index of audio and video tracks while reading instead of when opening. "
+        "Only speeds up opening: the index grows back to its full size as the file is read, "
+        "and a seek expands it up to the target at once. Only a single edit list entry is honored, "
+        "as with advanced_editlist disabled.",
+        OFFSET(lazy_index), AV_OPT_TYPE_BOOL, {.i64 = 0},
+        0, 1, FLAGS},
     {"advanced_editlist",
         "Modify the AVIndex according to the editlists. Use this option to decode in the order specified by the edits.",
         OFFSET(advanced_editlist), AV_OPT_TYPE_BOOL, {.i64 = 1},
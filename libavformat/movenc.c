@@ -60,7 +60,8 @@
 static const AVOption options[] = {
     { "movflags", "MOV muxer flags", offsetof(MOVMuxContext, flags), AV_OPT_TYPE_FLAGS, {.i64 = 0}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "rtphint", "Add RTP hint tracks", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_RTP_HINT}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
-    { "moov_size", "maximum moov size so it can be placed at the begin", offsetof(MOVMuxContext, reserved_moov_size), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, 0 },
+    { "moov_size", "maximum moov size so it can be placed at the begin", offsetof(MOVMuxContext, reserved_moov_size), AV_OPT_TYPE_INT, {.i64 = 0}, MOV_RESERVED_MOOV_AUTO, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "moov_size" },
+    { "auto", "estimate from the stream durations, moving the data if too small", 0, AV_OPT_TYPE_CONST, {.i64 = MOV_RESERVED_MOOV_AUTO}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "moov_size" },
     { "empty_moov", "Make the initial moov atom empty", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_EMPTY_MOOV}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "frag_keyframe", "Fragment at video keyframes", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_FRAG_KEYFRAME}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "frag_every_frame", "Fragment at every frame", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_FRAG_EVERY_FRAME}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
@@ -6047,6 +6048,42 @@ static int mov_create_dvd_sub_decoder_specific_info(MOVTrack *track,
     return 0;
 }
 
+/**
+ * Estimate the size of the moov atom from the stream durations, for
+ * reserving space for it at the beginning of the file.
+ * Return 0 if the length of some stream is unknown.
+ */
+static int64_t estimate_moov_size(AVFormatContext *s)
+{
+    int64_t size = 8192;
+    int i;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        int64_t nb_samples = st->nb_frames;
+        double duration;
+
+        if (nb_samples <= 0) {
+            if (st->duration <= 0)
+                return 0;
+            duration = st->duration * av_q2d(st->time_base);
+            if (par->codec_type == AVMEDIA_TYPE_VIDEO)
+                nb_samples = duration * (st->avg_frame_rate.num > 0 ?
+                                         av_q2d(st->avg_frame_rate) : 60);
+            else if (par->codec_type == AVMEDIA_TYPE_AUDIO && par->sample_rate > 0)
+                nb_samples = duration * par->sample_rate /
+                             (par->frame_size > 0 ? par->frame_size : 1024);
+            else
+                nb_samples = duration;
+        }
+        /* stsz, co64 and ctts entries for every sample, the other tables are
+         * usually much smaller */
+        size += 1024 + par->extradata_size + 20 * nb_samples;
+    }
+    return size;
+}
+
 static int mov_init(AVFormatContext *s)
 {
     MOVMuxContext *mov = s->priv_data;
@@ -6088,6 +6125,30 @@ static int mov_init(AVFormatContext *s)
         mov->flags |= FF_MOV_FLAG_FRAGMENT | FF_MOV_FLAG_EMPTY_MOOV |
                       FF_MOV_FLAG_DEFAULT_BASE_MOOF;
 
+    if (mov->reserved_moov_size < 0 &&
+        mov->reserved_moov_size != MOV_RESERVED_MOOV_AUTO) {
+        av_log(s, AV_LOG_ERROR, "Invalid moov_size %d, must be 'auto' or a "
+               "non-negative size\n", mov->reserved_moov_size);
+        return AVERROR(EINVAL);
+    }
+
+    if (mov->reserved_moov_size == MOV_RESERVED_MOOV_AUTO) {
+        int64_t size = 0;
+
+        mov->reserved_moov_size = 0;
+        if (!(mov->flags & FF_MOV_FLAG_FRAGMENT) &&
+            s->pb && s->pb->seekable & AVIO_SEEKABLE_NORMAL)
+            size = estimate_moov_size(s);
+        if (size > 0 && size <= INT_MAX) {
+            av_log(s, AV_LOG_VERBOSE, "Reserving %"PRId64" bytes for the moov atom\n", size);
+            mov->reserved_moov_size = size;
+            mov->moov_size_auto     = 1;
+            mov->flags &= ~FF_MOV_FLAG_FASTSTART;
+        } else {
+            mov->flags |= FF_MOV_FLAG_FASTSTART;
+        }
+    }
+
     if (mov->flags & FF_MOV_FLAG_EMPTY_MOOV && s->flags & AVFMT_FLAG_AUTO_BSF) {
         av_log(s, AV_LOG_VERBOSE, "Empty MOOV enabled; disabling automatic bitstream filtering\n");
         s->flags &= ~AVFMT_FLAG_AUTO_BSF;
@@ -6705,6 +6766,22 @@ static int mov_write_trailer(AVFormatContext *s)
         }
         avio_seek(pb, mov->reserved_moov_size > 0 ? mov->reserved_header_pos : moov_pos, SEEK_SET);
 
+        if (mov->moov_size_auto) {
+            int moov_size = get_moov_size(s);
+            if (moov_size < 0)
+                return moov_size;
+            if (moov_size > mov->reserved_moov_size - 8) {
+                av_log(s, AV_LOG_INFO, "Reserved %d bytes for the moov atom, "
+                       "needed %d\n", mov->reserved_moov_size, moov_size);
+                /* keep the reserved space as a free atom and fall back to
+                 * moving the data */
+                avio_wb32(pb, mov->reserved_moov_size);
+                ffio_wfourcc(pb, "free");
+                avio_seek(pb, moov_pos, SEEK_SET);
+                mov->flags |= FF_MOV_FLAG_FASTSTART;
+            }
+        }
+
         if (mov->flags & FF_MOV_FLAG_FASTSTART) {
             av_log(s, AV_LOG_INFO, "Starting second pass: moving the moov atom to the beginning of the file\n");
             res = shift_data(s);
@@ -30,6 +30,7 @@
 #define MOV_FRAG_INFO_ALLOC_INCREMENT 64
 #define MOV_INDEX_CLUSTER_SIZE 1024
 #define MOV_TIMESCALE 1000
+#define MOV_RESERVED_MOOV_AUTO -2 ///< moov_size option value for an estimated size
 
 #define RTP_MAX_PACKET_SIZE 1450
 
@@ -208,6 +209,7 @@ typedef struct MOVMuxContext {
 
     int reserved_moov_size; ///< 0 for disabled, -1 for automatic, size otherwise
     int64_t reserved_header_pos;
+    int moov_size_auto;     ///< reserved_moov_size is an estimate
 
     char *major_brand;
 
@@ -95,6 +95,7 @@ struct MpegTSFilter {
     int last_cc; /* last cc code (-1 if first packet) */
     int64_t last_pcr;
     int discard;
+    int discard_gen; /* value of MpegTSContext.discard_gen when discard was set */
     enum MpegTSFilterType type;
     union {
         MpegTSPESFilter pes_filter;
@@ -161,6 +162,13 @@ struct MpegTSContext {
     unsigned int nb_prg;
     struct Program *prg;
 
+    /** changed whenever the result of discard_pid() may have changed */
+    int discard_gen;
+    /** AVProgram.discard values at the last check, to detect changes */
+    enum AVDiscard *prg_discard;
+    unsigned int prg_discard_size;
+    int nb_prg_discard;
+
     int8_t crc_validity[NB_PID_MAX];
     /** filters for various streams specified by PMT + for the PAT and PMT */
     MpegTSFilter *pids[NB_PID_MAX];
@@ -292,12 +300,14 @@ static void clear_program(MpegTSContext *ts, unsigned int programid)
             ts->prg[i].nb_pids = 0;
             ts->prg[i].pmt_found = 0;
         }
+    ts->discard_gen++;
 }
 
 static void clear_programs(MpegTSContext *ts)
 {
     av_freep(&ts->prg);
     ts->nb_prg = 0;
+    ts->discard_gen++;
 }
 
 static void add_pat_entry(MpegTSContext *ts, unsigned int programid)
@@ -312,6 +322,7 @@ static void add_pat_entry(MpegTSContext *ts, unsigned int programid)
     p->nb_pids = 0;
     p->pmt_found = 0;
     ts->nb_prg++;
+    ts->discard_gen++;
 }
 
 static void add_pid_to_pmt(MpegTSContext *ts, unsigned int programid,
@@ -330,6 +341,7 @@ static void add_pid_to_pmt(MpegTSContext *ts, unsigned int programid,
             return;
 
     p->pids[p->nb_pids++] = pid;
+    ts->discard_gen++;
 }
 
 static void set_pmt_found(MpegTSContext *ts, unsigned int programid)
@@ -405,6 +417,36 @@ static int discard_pid(MpegTSContext *ts, unsigned int pid)
     return !used && discarded;
 }
 
+/**
+ * Invalidate the cached discard_pid() results of the filters if the
+ * discard flags of the programs have changed since the last call.
+ */
+static void check_program_discard(MpegTSContext *ts)
+{
+    AVFormatContext *s = ts->stream;
+    int i, changed = ts->nb_prg_discard != s->nb_programs;
+
+    if (changed && s->nb_programs) {
+        enum AVDiscard *prg_discard = av_fast_realloc(ts->prg_discard, &ts->prg_discard_size,
+                                                      s->nb_programs * sizeof(*prg_discard));
+        if (!prg_discard) {
+            ts->nb_prg_discard = -1;
+            ts->discard_gen++;
+            return;
+        }
+        ts->prg_discard = prg_discard;
+    }
+    for (i = 0; i < s->nb_programs; i++) {
+        if (changed || ts->prg_discard[i] != s->programs[i]->discard) {
+            ts->prg_discard[i] = s->programs[i]->discard;
+            changed = 1;
+        }
+    }
+    ts->nb_prg_discard = s->nb_programs;
+    if (changed)
+        ts->discard_gen++;
+}
+
 /**
  *  Assemble PES packets out of TS packets, and then call the "section_cb"
  *  function when they are complete.
@@ -495,6 +537,7 @@ static MpegTSFilter *mpegts_open_filter(MpegTSContext *ts, unsigned int pid,
     filter->es_id   = -1;
     filter->last_cc = -1;
     filter->last_pcr= -1;
+    filter->discard_gen = ts->discard_gen - 1;
 
     return filter;
 }
@@ -2575,8 +2618,10 @@ static int handle_packet(MpegTSContext *ts, const uint8_t *packet)
     }
     if (!tss)
         return 0;
-    if (is_start)
-        tss->discard = discard_pid(ts, pid);
+    if (is_start && tss->discard_gen != ts->discard_gen) {
+        tss->discard     = discard_pid(ts, pid);
+        tss->discard_gen = ts->discard_gen;
+    }
     if (tss->discard)
         return 0;
     ts->current_pid = pid;
@@ -2798,6 +2843,75 @@ static void finished_reading_packet(AVFormatContext *s, int raw_packet_size)
         avio_skip(pb, skip);
 }
 
+/* Check whether the PES filter would drop the packet in its current state:
+ * the stream is skipped until the next PES start, and so is the next PES if
+ * its streams are discarded. The packet must be in sequence so that only
+ * last_cc and last_pcr need to be updated. */
+static int pes_packet_unused(MpegTSFilter *tss, const uint8_t *packet, int is_start)
+{
+    PESContext *pes = tss->u.pes_filter.opaque;
+
+    if (pes->state != MPEGTS_SKIP || !(packet[3] & 0x10) || packet[1] & 0x80)
+        return 0;
+    if (tss->last_cc < 0 || (packet[3] & 0xf) != ((tss->last_cc + 1) & 0xf))
+        return 0;
+    if (is_start &&
+        (!pes->st || pes->st->discard != AVDISCARD_ALL ||
+         (pes->sub_st && pes->sub_st->discard != AVDISCARD_ALL)))
+        return 0;
+    return 1;
+}
+
+/**
+ * Skip the packets buffered in the input that handle_packet() would drop
+ * without any side effect, directly in the AVIOContext buffer.
+ * These are the packets of PIDs without filter or discarded, and the
+ * packets of PES streams which are being skipped.
+ *
+ * @return the number of skipped packets, at most max_packets
+ */
+static int64_t skip_unused_packets(MpegTSContext *ts, int64_t max_packets)
+{
+    AVIOContext *pb = ts->stream->pb;
+    const int raw_packet_size = ts->raw_packet_size;
+    const uint8_t *p = pb->buf_ptr;
+    const uint8_t *last_pes = NULL;
+    int64_t n = 0;
+
+    while (n < max_packets && pb->buf_end - p >= raw_packet_size) {
+        int pid, is_start;
+        MpegTSFilter *tss;
+
+        if (p[0] != 0x47)
+            break;
+        pid      = AV_RB16(p + 1) & 0x1fff;
+        is_start = p[1] & 0x40;
+        tss      = ts->pids[pid];
+        if (!tss) {
+            if (ts->auto_guess && is_start)
+                break;
+        } else if (is_start && tss->discard_gen != ts->discard_gen) {
+            break;
+        } else if (!tss->discard) {
+            int64_t pcr_h;
+            int pcr_l;
+            if (tss->type != MPEGTS_PES || !pes_packet_unused(tss, p, is_start))
+                break;
+            tss->last_cc = p[3] & 0xf;
+            if (p[3] & 0x20 && parse_pcr(&pcr_h, &pcr_l, p) == 0)
+                tss->last_pcr = pcr_h * 300 + pcr_l;
+            last_pes     = p;
+        }
+        p += raw_packet_size;
+        n++;
+    }
+
+    if (last_pes)
+        ts->pos47_full = avio_tell(pb) + (last_pes - pb->buf_ptr);
+    pb->buf_ptr = (uint8_t *)p;
+    return n;
+}
+
 static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
 {
     AVFormatContext *s = ts->stream;
@@ -2826,6 +2940,8 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         }
     }
 
+    check_program_discard(ts);
+
     ts->stop_parse = 0;
     packet_num = 0;
     memset(packet + TS_PACKET_SIZE, 0, AV_INPUT_BUFFER_PADDING_SIZE);
@@ -2839,6 +2955,9 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         if (ts->stop_parse > 0)
             break;
 
+        packet_num += skip_unused_packets(ts, nb_packets ? nb_packets - 1 - packet_num
+                                                         : INT64_MAX);
+
         ret = read_packet(s, packet, ts->raw_packet_size, &data);
         if (ret != 0)
             break;
@@ -3121,6 +3240,7 @@ static void mpegts_free(MpegTSContext *ts)
     int i;
 
     clear_programs(ts);
+    av_freep(&ts->prg_discard);
 
     for (i = 0; i < NB_PID_MAX; i++)
         if (ts->pids[i])
@@ -3231,6 +3351,7 @@ int avpriv_mpegts_parse_packet(MpegTSContext *ts, AVPacket *pkt,
 
     len1 = len;
     ts->pkt = pkt;
+    check_program_discard(ts);
     for (;;) {
         ts->stop_parse = 0;
         if (len < TS_PACKET_SIZE)
@@ -916,14 +916,71 @@ int av_write_frame(AVFormatContext *s, AVPacket *pkt)
 
 #define CHUNK_START 0x1000
 
+/* returns 1 if the queue of stream a has to be output before that of b */
+static int interleave_before(AVFormatContext *s, int a, int b)
+{
+    AVPacket *pa = &s->streams[a]->internal->interleave_queue->pkt;
+    AVPacket *pb = &s->streams[b]->internal->interleave_queue->pkt;
+
+    /* the rest of a chunk follows its start right away */
+    if (s->max_chunk_size || s->max_chunk_duration) {
+        int start_a = pa->flags & CHUNK_START;
+        int start_b = pb->flags & CHUNK_START;
+        if (start_a != start_b)
+            return !start_a;
+    }
+    return s->internal->interleave_compare(s, pb, pa);
+}
+
+static void interleave_heap_up(AVFormatContext *s, int i)
+{
+    int *heap = s->internal->interleave_heap;
+
+    while (i > 0) {
+        int parent = (i - 1) >> 1;
+        if (!interleave_before(s, heap[i], heap[parent]))
+            break;
+        FFSWAP(int, heap[i], heap[parent]);
+        i = parent;
+    }
+}
+
+static void interleave_heap_down(AVFormatContext *s, int i)
+{
+    int *heap = s->internal->interleave_heap;
+    int n     = s->internal->nb_interleave_heap;
+
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && interleave_before(s, heap[child + 1], heap[child]))
+            child++;
+        if (!interleave_before(s, heap[child], heap[i]))
+            break;
+        FFSWAP(int, heap[i], heap[child]);
+        i = child;
+    }
+}
+
 int ff_interleave_add_packet(AVFormatContext *s, AVPacket *pkt,
                              int (*compare)(AVFormatContext *, AVPacket *, AVPacket *))
 {
     int ret;
-    AVPacketList **next_point, *this_pktl;
+    AVFormatInternal *internal = s->internal;
+    AVPacketList *this_pktl;
     AVStream *st   = s->streams[pkt->stream_index];
     int chunked    = s->max_chunk_size || s->max_chunk_duration;
 
+    if (!st->internal->interleave_queue) {
+        int *heap = av_fast_realloc(internal->interleave_heap,
+                                    &internal->interleave_heap_allocated_size,
+                                    s->nb_streams * sizeof(*heap));
+        if (!heap)
+            return AVERROR(ENOMEM);
+        internal->interleave_heap = heap;
+    }
+
     this_pktl      = av_mallocz(sizeof(AVPacketList));
     if (!this_pktl)
         return AVERROR(ENOMEM);
@@ -935,65 +992,93 @@ int ff_interleave_add_packet(AVFormatContext *s, AVPacket *pkt,
         pkt->side_data = NULL;
         pkt->side_data_elems = 0;
     } else {
-        if ((ret = av_packet_ref(&this_pktl->pkt, pkt)) < 0) {
+        if ((ret = av_packet_make_refcounted(pkt)) < 0) {
             av_free(this_pktl);
             return ret;
         }
-    }
-
-    if (s->streams[pkt->stream_index]->last_in_packet_buffer) {
-        next_point = &(st->last_in_packet_buffer->next);
-    } else {
-        next_point = &s->internal->packet_buffer;
+        av_packet_move_ref(&this_pktl->pkt, pkt);
     }
 
     if (chunked) {
         uint64_t max= av_rescale_q_rnd(s->max_chunk_duration, AV_TIME_BASE_Q, st->time_base, AV_ROUND_UP);
-        st->interleaver_chunk_size     += pkt->size;
-        st->interleaver_chunk_duration += pkt->duration;
+        st->interleaver_chunk_size     += this_pktl->pkt.size;
+        st->interleaver_chunk_duration += this_pktl->pkt.duration;
         if (   (s->max_chunk_size && st->interleaver_chunk_size > s->max_chunk_size)
             || (max && st->interleaver_chunk_duration           > max)) {
             st->interleaver_chunk_size      = 0;
             this_pktl->pkt.flags |= CHUNK_START;
             if (max && st->interleaver_chunk_duration > max) {
                 int64_t syncoffset = (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)*max/2;
-                int64_t syncto = av_rescale(pkt->dts + syncoffset, 1, max)*max - syncoffset;
+                int64_t syncto = av_rescale(this_pktl->pkt.dts + syncoffset, 1, max)*max - syncoffset;
 
-                st->interleaver_chunk_duration += (pkt->dts - syncto)/8 - max;
+                st->interleaver_chunk_duration += (this_pktl->pkt.dts - syncto)/8 - max;
             } else
                 st->interleaver_chunk_duration = 0;
         }
     }
-    if (*next_point) {
-        if (chunked && !(this_pktl->pkt.flags & CHUNK_START))
-            goto next_non_null;
-
-        if (compare(s, &s->internal->packet_buffer_end->pkt, pkt)) {
-            while (   *next_point
-                   && ((chunked && !((*next_point)->pkt.flags&CHUNK_START))
-                       || !compare(s, &(*next_point)->pkt, pkt)))
-                next_point = &(*next_point)->next;
-            if (*next_point)
-                goto next_non_null;
-        } else {
-            next_point = &(s->internal->packet_buffer_end->next);
-        }
+
+    internal->interleave_compare = compare;
+    if (st->internal->interleave_queue) {
+        st->last_in_packet_buffer->next = this_pktl;
+    } else {
+        st->internal->interleave_queue = this_pktl;
+        internal->interleave_heap[internal->nb_interleave_heap++] = st->index;
+        interleave_heap_up(s, internal->nb_interleave_heap - 1);
     }
-    av_assert1(!*next_point);
+    st->last_in_packet_buffer = this_pktl;
+
+    internal->interleave_size += this_pktl->pkt.size;
+    s->interleave_peak_size = FFMAX(s->interleave_peak_size,
+                                    internal->interleave_size);
+
+    return 0;
+}
 
-    s->internal->packet_buffer_end = this_pktl;
-next_non_null:
+const AVPacket *ff_interleave_peek_first(AVFormatContext *s)
+{
+    if (!s->internal->nb_interleave_heap)
+        return NULL;
+    return &s->streams[s->internal->interleave_heap[0]]->internal->interleave_queue->pkt;
+}
 
-    this_pktl->next = *next_point;
+int ff_interleave_get_first(AVFormatContext *s, AVPacket *pkt)
+{
+    AVFormatInternal *internal = s->internal;
+    AVStream *st;
+    AVPacketList *pktl;
 
-    s->streams[pkt->stream_index]->last_in_packet_buffer =
-        *next_point                                      = this_pktl;
+    if (!internal->nb_interleave_heap)
+        return AVERROR(EAGAIN);
 
-    av_packet_unref(pkt);
+    st   = s->streams[internal->interleave_heap[0]];
+    pktl = st->internal->interleave_queue;
+    st->internal->interleave_queue = pktl->next;
+    if (!pktl->next) {
+        st->last_in_packet_buffer = NULL;
+        internal->interleave_heap[0] =
+            internal->interleave_heap[--internal->nb_interleave_heap];
+    }
+    interleave_heap_down(s, 0);
 
+    internal->interleave_size -= pktl->pkt.size;
+    *pkt = pktl->pkt;
+    av_freep(&pktl);
     return 0;
 }
 
+void ff_interleave_free(AVFormatContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        ff_packet_list_free(&st->internal->interleave_queue,
+                            &st->last_in_packet_buffer);
+    }
+    s->internal->nb_interleave_heap = 0;
+    s->internal->interleave_size    = 0;
+}
+
 static int interleave_compare_dts(AVFormatContext *s, AVPacket *next,
                                   AVPacket *pkt)
 {
@@ -1020,7 +1105,7 @@ static int interleave_compare_dts(AVFormatContext *s, AVPacket *next,
 int ff_interleave_packet_per_dts(AVFormatContext *s, AVPacket *out,
                                  AVPacket *pkt, int flush)
 {
-    AVPacketList *pktl;
+    const AVPacket *top_pkt;
     int stream_count = 0;
     int noninterleaved_count = 0;
     int i, ret;
@@ -1041,15 +1126,18 @@ int ff_interleave_packet_per_dts(AVFormatContext *s, AVPacket *out,
         }
     }
 
-    if (s->internal->nb_interleaved_streams == stream_count)
+    if (s->internal->nb_interleaved_streams == stream_count) {
         flush = 1;
+        s->internal->interleave_stalled = 0;
+    }
+
+    top_pkt = ff_interleave_peek_first(s);
 
     if (s->max_interleave_delta > 0 &&
-        s->internal->packet_buffer &&
+        top_pkt &&
         !flush &&
         s->internal->nb_interleaved_streams == stream_count+noninterleaved_count
     ) {
-        AVPacket *top_pkt = &s->internal->packet_buffer->pkt;
         int64_t delta_dts = INT64_MIN;
         int64_t top_dts = av_rescale_q(top_pkt->dts,
                                        s->streams[top_pkt->stream_index]->time_base,
@@ -1077,21 +1165,41 @@ int ff_interleave_packet_per_dts(AVFormatContext *s, AVPacket *out,
         }
     }
 
-    if (s->internal->packet_buffer &&
+    if (s->max_interleave_size > 0 &&
+        top_pkt &&
+        !flush &&
+        s->internal->interleave_size > s->max_interleave_size) {
+        if (!s->internal->interleave_stalled) {
+            av_log(s, AV_LOG_WARNING,
+                   "Muxing queue holds %"PRId64" bytes > %"PRId64", forcing "
+                   "output; waiting for packets on stream(s):",
+                   s->internal->interleave_size, s->max_interleave_size);
+            for (i = 0; i < s->nb_streams; i++) {
+                AVStream *st = s->streams[i];
+                if (st->last_in_packet_buffer ||
+                    st->codecpar->codec_type == AVMEDIA_TYPE_ATTACHMENT)
+                    continue;
+                av_log(s, AV_LOG_WARNING, " %d (last dts %s)",
+                       i, av_ts2timestr(st->cur_dts, &st->time_base));
+            }
+            av_log(s, AV_LOG_WARNING, "\n");
+            s->internal->interleave_stalled = 1;
+        }
+        flush = 1;
+    }
+
+    if (top_pkt &&
         eof &&
         (s->flags & AVFMT_FLAG_SHORTEST) &&
         s->internal->shortest_end == AV_NOPTS_VALUE) {
-        AVPacket *top_pkt = &s->internal->packet_buffer->pkt;
-
         s->internal->shortest_end = av_rescale_q(top_pkt->dts,
                                        s->streams[top_pkt->stream_index]->time_base,
                                        AV_TIME_BASE_Q);
     }
 
     if (s->internal->shortest_end != AV_NOPTS_VALUE) {
-        while (s->internal->packet_buffer) {
-            AVPacket *top_pkt = &s->internal->packet_buffer->pkt;
-            AVStream *st;
+        while ((top_pkt = ff_interleave_peek_first(s))) {
+            AVPacket drop;
             int64_t top_dts = av_rescale_q(top_pkt->dts,
                                         s->streams[top_pkt->stream_index]->time_base,
                                         AV_TIME_BASE_Q);
@@ -1099,36 +1207,17 @@ int ff_interleave_packet_per_dts(AVFormatContext *s, AVPacket *out,
             if (s->internal->shortest_end + 1 >= top_dts)
                 break;
 
-            pktl = s->internal->packet_buffer;
-            st   = s->streams[pktl->pkt.stream_index];
-
-            s->internal->packet_buffer = pktl->next;
-            if (!s->internal->packet_buffer)
-                s->internal->packet_buffer_end = NULL;
-
-            if (st->last_in_packet_buffer == pktl)
-                st->last_in_packet_buffer = NULL;
-
-            av_packet_unref(&pktl->pkt);
-            av_freep(&pktl);
+            ff_interleave_get_first(s, &drop);
+            av_packet_unref(&drop);
             flush = 0;
         }
     }
 
     if (stream_count && flush) {
-        AVStream *st;
-        pktl = s->internal->packet_buffer;
-        *out = pktl->pkt;
-        st   = s->streams[out->stream_index];
-
-        s->internal->packet_buffer = pktl->next;
-        if (!s->internal->packet_buffer)
-            s->internal->packet_buffer_end = NULL;
-
-        if (st->last_in_packet_buffer == pktl)
-            st->last_in_packet_buffer = NULL;
-        av_freep(&pktl);
-
+        if (ff_interleave_get_first(s, out) < 0) {
+            av_init_packet(out);
+            return 0;
+        }
         return 1;
     } else {
         av_init_packet(out);
@@ -1139,27 +1228,25 @@ int ff_interleave_packet_per_dts(AVFormatContext *s, AVPacket *out,
 int ff_interleaved_peek(AVFormatContext *s, int stream,
                         AVPacket *pkt, int add_offset)
 {
-    AVPacketList *pktl = s->internal->packet_buffer;
-    while (pktl) {
-        if (pktl->pkt.stream_index == stream) {
-            *pkt = pktl->pkt;
-            if (add_offset) {
-                AVStream *st = s->streams[pkt->stream_index];
-                int64_t offset = st->mux_ts_offset;
-
-                if (s->output_ts_offset)
-                    offset += av_rescale_q(s->output_ts_offset, AV_TIME_BASE_Q, st->time_base);
-
-                if (pkt->dts != AV_NOPTS_VALUE)
-                    pkt->dts += offset;
-                if (pkt->pts != AV_NOPTS_VALUE)
-                    pkt->pts += offset;
-            }
-            return 0;
-        }
-        pktl = pktl->next;
+    AVPacketList *pktl = s->streams[stream]->internal->interleave_queue;
+
+    if (!pktl)
+        return AVERROR(ENOENT);
+
+    *pkt = pktl->pkt;
+    if (add_offset) {
+        AVStream *st = s->streams[pkt->stream_index];
+        int64_t offset = st->mux_ts_offset;
+
+        if (s->output_ts_offset)
+            offset += av_rescale_q(s->output_ts_offset, AV_TIME_BASE_Q, st->time_base);
+
+        if (pkt->dts != AV_NOPTS_VALUE)
+            pkt->dts += offset;
+        if (pkt->pts != AV_NOPTS_VALUE)
+            pkt->pts += offset;
     }
-    return AVERROR(ENOENT);
+    return 0;
 }
 
 /**
@@ -1269,6 +1356,10 @@ int av_write_trailer(AVFormatContext *s)
     }
 
 fail:
+    if (s->interleave_peak_size > 0)
+        av_log(s, AV_LOG_VERBOSE, "Peak muxing queue size: %"PRId64" bytes\n",
+               s->interleave_peak_size);
+
     if (s->oformat->write_trailer) {
         if (!(s->oformat->flags & AVFMT_NOFILE) && s->pb)
             avio_write_marker(s->pb, AV_NOPTS_VALUE, AVIO_DATA_MARKER_TRAILER);
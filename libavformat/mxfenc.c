@@ -2971,6 +2971,15 @@ end:
     return err < 0 ? err : 0;
 }
 
+static int mxf_compare_timestamps(AVFormatContext *s, AVPacket *next, AVPacket *pkt)
+{
+    MXFStreamContext *sc  = s->streams[pkt ->stream_index]->priv_data;
+    MXFStreamContext *sc2 = s->streams[next->stream_index]->priv_data;
+
+    return next->dts > pkt->dts ||
+        (next->dts == pkt->dts && sc->order < sc2->order);
+}
+
 static int mxf_interleave_get_packet(AVFormatContext *s, AVPacket *out, AVPacket *pkt, int flush)
 {
     int i, stream_count = 0;
@@ -2979,45 +2988,39 @@ static int mxf_interleave_get_packet(AVFormatContext *s, AVPacket *out, AVPacket
         stream_count += !!s->streams[i]->last_in_packet_buffer;
 
     if (stream_count && (s->nb_streams == stream_count || flush)) {
-        AVPacketList *pktl = s->internal->packet_buffer;
         if (s->nb_streams != stream_count) {
-            AVPacketList *last = NULL;
+            AVPacketList *keep = NULL, *keep_end = NULL;
+            const AVPacket *first;
+            int ret;
             // find last packet in edit unit
-            while (pktl) {
-                if (!stream_count || pktl->pkt.stream_index == 0)
-                    break;
-                // update last packet in packet buffer
-                if (s->streams[pktl->pkt.stream_index]->last_in_packet_buffer != pktl)
-                    s->streams[pktl->pkt.stream_index]->last_in_packet_buffer = pktl;
-                last = pktl;
-                pktl = pktl->next;
+            while (stream_count && (first = ff_interleave_peek_first(s)) &&
+                   first->stream_index != 0) {
+                AVPacket tmp;
+                ff_interleave_get_first(s, &tmp);
+                if ((ret = ff_packet_list_put(&keep, &keep_end, &tmp, 0)) < 0) {
+                    av_packet_unref(&tmp);
+                    ff_packet_list_free(&keep, &keep_end);
+                    return ret;
+                }
                 stream_count--;
             }
             // purge packet queue
-            while (pktl) {
-                AVPacketList *next = pktl->next;
-                av_packet_unref(&pktl->pkt);
-                av_freep(&pktl);
-                pktl = next;
-            }
-            if (last)
-                last->next = NULL;
-            else {
-                s->internal->packet_buffer = NULL;
-                s->internal->packet_buffer_end= NULL;
+            ff_interleave_free(s);
+            if (!keep)
                 goto out;
+            while (keep) {
+                AVPacket tmp;
+                ff_packet_list_get(&keep, &keep_end, &tmp);
+                if ((ret = ff_interleave_add_packet(s, &tmp, mxf_compare_timestamps)) < 0) {
+                    av_packet_unref(&tmp);
+                    ff_packet_list_free(&keep, &keep_end);
+                    return ret;
+                }
             }
-            pktl = s->internal->packet_buffer;
         }
 
-        *out = pktl->pkt;
+        ff_interleave_get_first(s, out);
         av_log(s, AV_LOG_TRACE, "out st:%d dts:%"PRId64"\n", (*out).stream_index, (*out).dts);
-        s->internal->packet_buffer = pktl->next;
-        if(s->streams[pktl->pkt.stream_index]->last_in_packet_buffer == pktl)
-            s->streams[pktl->pkt.stream_index]->last_in_packet_buffer= NULL;
-        if(!s->internal->packet_buffer)
-            s->internal->packet_buffer_end= NULL;
-        av_freep(&pktl);
         return 1;
     } else {
     out:
@@ -3026,15 +3029,6 @@ static int mxf_interleave_get_packet(AVFormatContext *s, AVPacket *out, AVPacket
     }
 }
 
-static int mxf_compare_timestamps(AVFormatContext *s, AVPacket *next, AVPacket *pkt)
-{
-    MXFStreamContext *sc  = s->streams[pkt ->stream_index]->priv_data;
-    MXFStreamContext *sc2 = s->streams[next->stream_index]->priv_data;
-
-    return next->dts > pkt->dts ||
-        (next->dts == pkt->dts && sc->order < sc2->order);
-}
-
 static int mxf_interleave(AVFormatContext *s, AVPacket *out, AVPacket *pkt, int flush)
 {
     return ff_audio_rechunk_interleave(s, out, pkt, flush,
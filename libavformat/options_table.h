@@ -111,6 +111,10 @@ static const AVOption avformat_options[] = {
 {"protocol_blacklist", "List of protocols that are not allowed to be used", OFFSET(protocol_blacklist), AV_OPT_TYPE_STRING, { .str = NULL },  CHAR_MIN, CHAR_MAX, D },
 {"max_streams", "maximum number of streams", OFFSET(max_streams), AV_OPT_TYPE_INT, { .i64 = 1000 }, 0, INT_MAX, D },
 {"skip_estimate_duration_from_pts", "skip duration calculation in estimate_timings_from_pts", OFFSET(skip_estimate_duration_from_pts), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, D},
+{"probe_threads", "number of streams to decode probe frames for on worker threads", OFFSET(probe_threads), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, D},
+{"probe_cache", "directory to cache stream parameters and indexes of local files in", OFFSET(probe_cache), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, D},
+{"max_interleave_size", "maximum bytes buffered for interleaving", OFFSET(max_interleave_size), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, E},
+{"interleave_peak_size", "largest number of bytes buffered for interleaving", OFFSET(interleave_peak_size), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, E|AV_OPT_FLAG_EXPORT|AV_OPT_FLAG_READONLY},
 {NULL},
 };
 
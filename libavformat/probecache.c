@@ -0,0 +1,551 @@
+/*
+ * Persistent cache of stream parameters and indexes
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * A cache entry is one file in the cache directory, named after the MD5 of
+ * the input URL. It holds, with all numbers little-endian:
+ *
+ * key:     'FFPC', entry version, LIBAVFORMAT_VERSION_INT, URL, demuxer
+ *          name, file size and modification time of the input
+ * streams: size of this section, the format timings and, per stream, the
+ *          parameters found by avformat_find_stream_info()
+ * index:   per stream, the number of index entries and the entries
+ *
+ * An entry whose key differs from that of the input is ignored and replaced.
+ * Entries are written to a temporary file first and renamed into place.
+ */
+
+#include <sys/stat.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/md5.h"
+#include "libavutil/random_seed.h"
+
+#include "libavcodec/internal.h"
+
+#include "avformat.h"
+#include "avio_internal.h"
+#include "internal.h"
+#include "os_support.h"
+#include "probecache.h"
+#include "version.h"
+
+#define PROBE_CACHE_VERSION 1
+#define MAX_STREAMS_SIZE    (64 << 20)
+
+typedef struct StreamRecord {
+    int id;
+    AVRational time_base;
+    int64_t start_time;
+    int64_t duration;
+    int64_t nb_frames;
+    int disposition;
+    AVRational sample_aspect_ratio;
+    AVRational avg_frame_rate;
+    AVRational r_frame_rate;
+    AVRational codec_time_base;
+    int ticks_per_frame;
+    int codec_info_nb_frames;
+    int nb_decoded_frames;
+    AVCodecParameters *par;
+} StreamRecord;
+
+/* mov keeps its per-track sample position in step with its own index */
+static int index_cacheable(AVFormatContext *s)
+{
+    return strcmp(s->iformat->name, "mov,mp4,m4a,3gp,3g2,mj2");
+}
+
+/* returns 1 and the key of s if it can be cached, 0 if it cannot */
+static int get_key(AVFormatContext *s, uint8_t **key, int *key_size)
+{
+    const char *proto = avio_find_protocol_name(s->url);
+    const char *path  = s->url;
+    struct stat st;
+    AVIOContext *pb;
+    int ret;
+
+    if (!s->probe_cache || !s->iformat || !proto || strcmp(proto, "file"))
+        return 0;
+    av_strstart(path, "file:", &path);
+    if (stat(path, &st) < 0)
+        return 0;
+
+    if ((ret = avio_open_dyn_buf(&pb)) < 0)
+        return ret;
+    avio_wl32(pb, MKTAG('F','F','P','C'));
+    avio_wl32(pb, PROBE_CACHE_VERSION);
+    avio_wl32(pb, LIBAVFORMAT_VERSION_INT);
+    avio_put_str(pb, s->url);
+    avio_put_str(pb, s->iformat->name);
+    avio_wl64(pb, st.st_size);
+    avio_wl64(pb, st.st_mtime);
+    *key_size = avio_close_dyn_buf(pb, key);
+    return *key ? 1 : AVERROR(ENOMEM);
+}
+
+static void get_path(AVFormatContext *s, char *buf, int size)
+{
+    uint8_t md5[16];
+    char hex[2 * sizeof(md5) + 1];
+
+    av_md5_sum(md5, s->url, strlen(s->url));
+    ff_data_to_hex(hex, md5, sizeof(md5), 1);
+    hex[2 * sizeof(md5)] = 0;
+    snprintf(buf, size, "%s/%s.ffpc", s->probe_cache, hex);
+}
+
+static void write_rational(AVIOContext *pb, AVRational q)
+{
+    avio_wl32(pb, q.num);
+    avio_wl32(pb, q.den);
+}
+
+static AVRational read_rational(AVIOContext *pb)
+{
+    AVRational q;
+    q.num = avio_rl32(pb);
+    q.den = avio_rl32(pb);
+    return q;
+}
+
+static void write_streams(AVFormatContext *s, AVIOContext *pb)
+{
+    int i;
+
+    avio_wl64(pb, s->start_time);
+    avio_wl64(pb, s->duration);
+    avio_wl64(pb, s->bit_rate);
+    avio_wl32(pb, s->duration_estimation_method);
+    avio_wl32(pb, s->nb_streams);
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        AVCodecParameters *par = st->codecpar;
+
+        avio_wl32(pb, st->id);
+        write_rational(pb, st->time_base);
+        avio_wl64(pb, st->start_time);
+        avio_wl64(pb, st->duration);
+        avio_wl64(pb, st->nb_frames);
+        avio_wl32(pb, st->disposition);
+        write_rational(pb, st->sample_aspect_ratio);
+        write_rational(pb, st->avg_frame_rate);
+        write_rational(pb, st->r_frame_rate);
+        write_rational(pb, st->internal->avctx->time_base);
+        avio_wl32(pb, st->internal->avctx->ticks_per_frame);
+        avio_wl32(pb, st->codec_info_nb_frames);
+        avio_wl32(pb, st->nb_decoded_frames);
+
+        avio_wl32(pb, par->codec_type);
+        avio_wl32(pb, par->codec_id);
+        avio_wl32(pb, par->codec_tag);
+        avio_wl32(pb, par->format);
+        avio_wl64(pb, par->bit_rate);
+        avio_wl32(pb, par->bits_per_coded_sample);
+        avio_wl32(pb, par->bits_per_raw_sample);
+        avio_wl32(pb, par->profile);
+        avio_wl32(pb, par->level);
+        avio_wl32(pb, par->width);
+        avio_wl32(pb, par->height);
+        write_rational(pb, par->sample_aspect_ratio);
+        avio_wl32(pb, par->field_order);
+        avio_wl32(pb, par->color_range);
+        avio_wl32(pb, par->color_primaries);
+        avio_wl32(pb, par->color_trc);
+        avio_wl32(pb, par->color_space);
+        avio_wl32(pb, par->chroma_location);
+        avio_wl32(pb, par->video_delay);
+        avio_wl64(pb, par->channel_layout);
+        avio_wl32(pb, par->channels);
+        avio_wl32(pb, par->sample_rate);
+        avio_wl32(pb, par->block_align);
+        avio_wl32(pb, par->frame_size);
+        avio_wl32(pb, par->initial_padding);
+        avio_wl32(pb, par->trailing_padding);
+        avio_wl32(pb, par->seek_preroll);
+        avio_wl32(pb, par->extradata_size);
+        avio_write(pb, par->extradata, par->extradata_size);
+    }
+}
+
+static int read_stream(AVIOContext *pb, StreamRecord *rec)
+{
+    AVCodecParameters *par = rec->par;
+
+    rec->id                   = avio_rl32(pb);
+    rec->time_base            = read_rational(pb);
+    rec->start_time           = avio_rl64(pb);
+    rec->duration             = avio_rl64(pb);
+    rec->nb_frames            = avio_rl64(pb);
+    rec->disposition          = avio_rl32(pb);
+    rec->sample_aspect_ratio  = read_rational(pb);
+    rec->avg_frame_rate       = read_rational(pb);
+    rec->r_frame_rate         = read_rational(pb);
+    rec->codec_time_base      = read_rational(pb);
+    rec->ticks_per_frame      = avio_rl32(pb);
+    rec->codec_info_nb_frames = avio_rl32(pb);
+    rec->nb_decoded_frames    = avio_rl32(pb);
+
+    par->codec_type            = (int)avio_rl32(pb);
+    par->codec_id              = avio_rl32(pb);
+    par->codec_tag             = avio_rl32(pb);
+    par->format                = avio_rl32(pb);
+    par->bit_rate              = avio_rl64(pb);
+    par->bits_per_coded_sample = avio_rl32(pb);
+    par->bits_per_raw_sample   = avio_rl32(pb);
+    par->profile               = avio_rl32(pb);
+    par->level                 = avio_rl32(pb);
+    par->width                 = avio_rl32(pb);
+    par->height                = avio_rl32(pb);
+    par->sample_aspect_ratio   = read_rational(pb);
+    par->field_order           = avio_rl32(pb);
+    par->color_range           = avio_rl32(pb);
+    par->color_primaries       = avio_rl32(pb);
+    par->color_trc             = avio_rl32(pb);
+    par->color_space           = avio_rl32(pb);
+    par->chroma_location       = avio_rl32(pb);
+    par->video_delay           = avio_rl32(pb);
+    par->channel_layout        = avio_rl64(pb);
+    par->channels              = avio_rl32(pb);
+    par->sample_rate           = avio_rl32(pb);
+    par->block_align           = avio_rl32(pb);
+    par->frame_size            = avio_rl32(pb);
+    par->initial_padding       = avio_rl32(pb);
+    par->trailing_padding      = avio_rl32(pb);
+    par->seek_preroll          = avio_rl32(pb);
+
+    par->extradata_size = avio_rl32(pb);
+    if ((unsigned)par->extradata_size >= FF_MAX_EXTRADATA_SIZE) {
+        par->extradata_size = 0;
+        return AVERROR_INVALIDDATA;
+    }
+    if (par->extradata_size) {
+        par->extradata = av_mallocz(par->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!par->extradata) {
+            par->extradata_size = 0;
+            return AVERROR(ENOMEM);
+        }
+        avio_read(pb, par->extradata, par->extradata_size);
+    }
+
+    return pb->eof_reached ? AVERROR_INVALIDDATA : 0;
+}
+
+/* returns 1 if the streams were restored, 0 if the record does not match */
+static int restore_streams(AVFormatContext *s, uint8_t *buf, int size)
+{
+    AVIOContext pb;
+    StreamRecord *recs = NULL;
+    int64_t start_time, duration, bit_rate;
+    int duration_estimation_method;
+    unsigned int i, nb_streams;
+    int ret = 0;
+
+    ffio_init_context(&pb, buf, size, 0, NULL, NULL, NULL, NULL);
+    start_time                 = avio_rl64(&pb);
+    duration                   = avio_rl64(&pb);
+    bit_rate                   = avio_rl64(&pb);
+    duration_estimation_method = avio_rl32(&pb);
+    nb_streams                 = avio_rl32(&pb);
+    if (pb.eof_reached || nb_streams != s->nb_streams)
+        return 0;
+
+    recs = av_calloc(nb_streams, sizeof(*recs));
+    if (!recs)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < nb_streams; i++) {
+        AVStream *st = s->streams[i];
+
+        recs[i].par = avcodec_parameters_alloc();
+        if (!recs[i].par) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        ret = read_stream(&pb, &recs[i]);
+        if (ret == AVERROR(ENOMEM))
+            goto end;
+        /* the codec may still be a guess of the demuxer, so it is not
+         * compared */
+        if (ret < 0 || recs[i].id != st->id ||
+            av_cmp_q(recs[i].time_base, st->time_base)) {
+            ret = 0;
+            goto end;
+        }
+    }
+
+    for (i = 0; i < nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        StreamRecord *rec = &recs[i];
+
+        ret = avcodec_parameters_copy(st->codecpar, rec->par);
+        if (ret < 0)
+            goto end;
+        st->start_time           = rec->start_time;
+        st->duration             = rec->duration;
+        st->nb_frames            = rec->nb_frames;
+        st->disposition          = rec->disposition;
+        st->sample_aspect_ratio  = rec->sample_aspect_ratio;
+        st->avg_frame_rate       = rec->avg_frame_rate;
+        st->r_frame_rate         = rec->r_frame_rate;
+        st->codec_info_nb_frames = rec->codec_info_nb_frames;
+        st->nb_decoded_frames    = rec->nb_decoded_frames;
+        st->internal->avctx->time_base       = rec->codec_time_base;
+        st->internal->avctx->ticks_per_frame = rec->ticks_per_frame;
+        st->internal->orig_codec_id          = st->codecpar->codec_id;
+        if (st->codecpar->codec_id != AV_CODEC_ID_NONE)
+            st->request_probe = 0;
+    }
+    s->start_time                 = start_time;
+    s->duration                   = duration;
+    s->bit_rate                   = bit_rate;
+    s->duration_estimation_method = duration_estimation_method;
+    ret = 1;
+
+end:
+    for (i = 0; i < nb_streams; i++)
+        avcodec_parameters_free(&recs[i].par);
+    av_free(recs);
+    return ret;
+}
+
+/* returns the number of index entries written */
+static int64_t write_index(AVFormatContext *s, AVIOContext *pb)
+{
+    int64_t total = 0;
+    int i, j;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+
+        ff_index_flush(st);
+        if (!index_cacheable(s)) {
+            avio_wl32(pb, 0);
+            continue;
+        }
+        avio_wl32(pb, st->nb_index_entries);
+        for (j = 0; j < st->nb_index_entries; j++) {
+            const AVIndexEntry *ie = &st->index_entries[j];
+            avio_wl64(pb, ie->pos);
+            avio_wl64(pb, ie->timestamp);
+            avio_wl32(pb, ie->size << 2 | ie->flags);
+            avio_wl32(pb, ie->min_distance);
+        }
+        total += st->nb_index_entries;
+    }
+
+    return total;
+}
+
+static int64_t read_index(AVFormatContext *s, AVIOContext *pb)
+{
+    int64_t total = 0;
+    int i;
+
+    for (i = 0; i < s->nb_streams && !pb->eof_reached; i++) {
+        AVStream *st = s->streams[i];
+        unsigned int j, nb_entries = avio_rl32(pb);
+        int restore = index_cacheable(s) && !st->nb_index_entries &&
+                      !st->internal->nb_index_pending;
+
+        for (j = 0; j < nb_entries && !pb->eof_reached; j++) {
+            int64_t pos       = avio_rl64(pb);
+            int64_t timestamp = avio_rl64(pb);
+            unsigned int size_flags = avio_rl32(pb);
+            int distance      = avio_rl32(pb);
+
+            if (restore && !pb->eof_reached &&
+                ff_add_index_entry(&st->index_entries, &st->nb_index_entries,
+                                   &st->index_entries_allocated_size, pos,
+                                   timestamp, size_flags >> 2, distance,
+                                   size_flags & 3) < 0)
+                restore = 0;
+        }
+        total += nb_entries;
+    }
+
+    return total;
+}
+
+static int set_entry(AVFormatContext *s, uint8_t *key, int key_size,
+                     const uint8_t *streams, int streams_size)
+{
+    AVFormatInternal *internal = s->internal;
+    uint8_t *entry = av_realloc(key, key_size + 4 + streams_size);
+
+    if (!entry) {
+        av_free(key);
+        return AVERROR(ENOMEM);
+    }
+    AV_WL32(entry + key_size, streams_size);
+    memcpy(entry + key_size + 4, streams, streams_size);
+
+    av_free(internal->probe_cache_entry);
+    internal->probe_cache_entry      = entry;
+    internal->probe_cache_entry_size = key_size + 4 + streams_size;
+    return 0;
+}
+
+static int write_entry(AVFormatContext *s)
+{
+    AVFormatInternal *internal = s->internal;
+    char path[1024], tmp[1024 + 16];
+    AVIOContext *pb;
+    int ret;
+
+    get_path(s, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%08x", path, av_get_random_seed());
+
+    ret = ffio_open_whitelist(&pb, tmp, AVIO_FLAG_WRITE, &s->interrupt_callback,
+                              NULL, "file", NULL);
+    if (ret < 0)
+        return ret;
+    avio_write(pb, internal->probe_cache_entry, internal->probe_cache_entry_size);
+    internal->probe_cache_nb_index = write_index(s, pb);
+    ret = avio_closep(&pb);
+    if (ret >= 0)
+        ret = ff_rename(tmp, path, s);
+    if (ret < 0)
+        avpriv_io_delete(tmp);
+    return ret;
+}
+
+int ff_probe_cache_load(AVFormatContext *s)
+{
+    char path[1024];
+    AVIOContext *pb = NULL;
+    uint8_t *key = NULL, *buf = NULL;
+    int key_size, size, ret;
+
+    ret = get_key(s, &key, &key_size);
+    if (ret <= 0)
+        return ret;
+
+    get_path(s, path, sizeof(path));
+    if (ffio_open_whitelist(&pb, path, AVIO_FLAG_READ, &s->interrupt_callback,
+                            NULL, "file", NULL) < 0) {
+        ret = 0;
+        goto end;
+    }
+
+    size = FFMAX(key_size, 4);
+    buf  = av_malloc(size);
+    if (!buf) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if (avio_read(pb, buf, key_size) != key_size || memcmp(buf, key, key_size)) {
+        av_log(s, AV_LOG_DEBUG, "Probe cache entry %s is stale\n", path);
+        ret = 0;
+        goto end;
+    }
+
+    size = avio_rl32(pb);
+    if (pb->eof_reached || size > MAX_STREAMS_SIZE) {
+        ret = 0;
+        goto end;
+    }
+    av_freep(&buf);
+    buf = av_malloc(size);
+    if (!buf) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if (avio_read(pb, buf, size) != size) {
+        ret = 0;
+        goto end;
+    }
+
+    ret = restore_streams(s, buf, size);
+    if (ret <= 0)
+        goto end;
+    s->internal->probe_cache_nb_index = read_index(s, pb);
+
+    ret = set_entry(s, key, key_size, buf, size);
+    key = NULL;
+    if (ret >= 0) {
+        av_log(s, AV_LOG_VERBOSE, "Stream parameters restored from %s\n", path);
+        ret = 1;
+    }
+
+end:
+    avio_closep(&pb);
+    av_free(buf);
+    av_free(key);
+    return ret;
+}
+
+int ff_probe_cache_store(AVFormatContext *s)
+{
+    AVIOContext *pb;
+    uint8_t *key, *streams;
+    int key_size, streams_size, ret;
+
+    ret = get_key(s, &key, &key_size);
+    if (ret <= 0)
+        return ret;
+
+    ret = avio_open_dyn_buf(&pb);
+    if (ret < 0) {
+        av_free(key);
+        return ret;
+    }
+    write_streams(s, pb);
+    streams_size = avio_close_dyn_buf(pb, &streams);
+    if (!streams) {
+        av_free(key);
+        return AVERROR(ENOMEM);
+    }
+
+    ret = set_entry(s, key, key_size, streams, streams_size);
+    av_free(streams);
+    if (ret < 0)
+        return ret;
+
+    return write_entry(s);
+}
+
+void ff_probe_cache_close(AVFormatContext *s)
+{
+    AVFormatInternal *internal = s->internal;
+    int64_t nb_index = 0;
+    int i;
+
+    if (!internal->probe_cache_entry)
+        return;
+
+    if (index_cacheable(s)) {
+        for (i = 0; i < s->nb_streams; i++) {
+            ff_index_flush(s->streams[i]);
+            nb_index += s->streams[i]->nb_index_entries;
+        }
+    }
+    if (nb_index > internal->probe_cache_nb_index) {
+        int ret = write_entry(s);
+        if (ret < 0)
+            av_log(s, AV_LOG_WARNING, "Could not update the probe cache: %s\n",
+                   av_err2str(ret));
+    }
+
+    av_freep(&internal->probe_cache_entry);
+    internal->probe_cache_entry_size = 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * Persistent cache of stream parameters and indexes
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_PROBECACHE_H
+#define AVFORMAT_PROBECACHE_H
+
+#include "avformat.h"
+
+/**
+ * Restore the results of an earlier avformat_find_stream_info() on the same
+ * file from the directory set in AVFormatContext.probe_cache.
+ *
+ * @return 1 if the stream parameters were restored, 0 if there is no usable
+ *         cache entry, a negative AVERROR code on error
+ */
+int ff_probe_cache_load(AVFormatContext *s);
+
+/**
+ * Write the stream parameters and the index of s to the cache, after
+ * avformat_find_stream_info() completed.
+ *
+ * @return 0 on success or if s cannot be cached, a negative AVERROR code on
+ *         error
+ */
+int ff_probe_cache_store(AVFormatContext *s);
+
+/**
+ * Rewrite the cache entry of s if its index grew since the entry was loaded
+ * or stored, and free the cache state of s.
+ */
+void ff_probe_cache_close(AVFormatContext *s);
+
+#endif /* AVFORMAT_PROBECACHE_H */
@@ -35,11 +35,18 @@ typedef enum {
 
 #define DEFAULT_SLAVE_FAILURE_POLICY ON_SLAVE_FAILURE_ABORT
 
+typedef enum {
+    ON_SLAVE_OVERFLOW_DEFAULT = 0,
+    ON_SLAVE_OVERFLOW_BLOCK   = 1,
+    ON_SLAVE_OVERFLOW_DROP    = 2
+} SlaveOverflowPolicy;
+
 typedef struct {
     AVFormatContext *avf;
     AVBSFContext **bsfs; ///< bitstream filters per stream
 
     SlaveFailurePolicy on_fail;
+    SlaveOverflowPolicy on_overflow;
     int use_fifo;
     AVDictionary *fifo_options;
 
@@ -96,6 +103,21 @@ static inline int parse_slave_failure_policy_option(const char *opt, TeeSlave *t
     return AVERROR(EINVAL);
 }
 
+static inline int parse_slave_overflow_policy_option(const char *opt, TeeSlave *tee_slave)
+{
+    if (!opt) {
+        tee_slave->on_overflow = ON_SLAVE_OVERFLOW_DEFAULT;
+        return 0;
+    } else if (!av_strcasecmp("block", opt)) {
+        tee_slave->on_overflow = ON_SLAVE_OVERFLOW_BLOCK;
+        return 0;
+    } else if (!av_strcasecmp("drop", opt)) {
+        tee_slave->on_overflow = ON_SLAVE_OVERFLOW_DROP;
+        return 0;
+    }
+    return AVERROR(EINVAL);
+}
+
 static int parse_slave_fifo_options(const char *use_fifo,
                                     const char *fifo_options, TeeSlave *tee_slave)
 {
@@ -162,7 +184,7 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
     AVDictionary *options = NULL;
     AVDictionaryEntry *entry;
     char *filename;
-    char *format = NULL, *select = NULL, *on_fail = NULL;
+    char *format = NULL, *select = NULL, *on_fail = NULL, *on_overflow = NULL;
     char *use_fifo = NULL, *fifo_options_str = NULL;
     AVFormatContext *avf2 = NULL;
     AVStream *st, *st2;
@@ -184,6 +206,7 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
     STEAL_OPTION("f", format);
     STEAL_OPTION("select", select);
     STEAL_OPTION("onfail", on_fail);
+    STEAL_OPTION("onoverflow", on_overflow);
     STEAL_OPTION("use_fifo", use_fifo);
     STEAL_OPTION("fifo_options", fifo_options_str);
 
@@ -200,6 +223,40 @@ static int open_slave(AVFormatContext *avf, char *slave, TeeSlave *tee_slave)
         goto end;
     }
 
+    ret = parse_slave_overflow_policy_option(on_overflow, tee_slave);
+    if (ret < 0) {
+        av_log(avf, AV_LOG_ERROR,
+               "Invalid onoverflow option value, valid options are 'block' and 'drop'\n");
+        goto end;
+    }
+
+    if (tee_slave->on_overflow != ON_SLAVE_OVERFLOW_DEFAULT) {
+        int drop = tee_slave->on_overflow == ON_SLAVE_OVERFLOW_DROP;
+
+        /* The queue which may overflow is the one of the fifo muxer, which
+         * also gives the slave its own writing thread. */
+        if (use_fifo && !tee_slave->use_fifo) {
+            av_log(avf, AV_LOG_ERROR, "onoverflow requires use_fifo, "
+                   "it cannot be combined with use_fifo=%s\n", use_fifo);
+            ret = AVERROR(EINVAL);
+            goto end;
+        }
+        entry = av_dict_get(tee_slave->fifo_options, "drop_pkts_on_overflow", NULL, 0);
+        if (entry && !av_match_name(entry->value, drop ? "true,y,yes,enable,enabled,on,1" :
+                                                         "false,n,no,disable,disabled,off,0")) {
+            av_log(avf, AV_LOG_ERROR, "onoverflow=%s conflicts with the "
+                   "drop_pkts_on_overflow=%s fifo option\n",
+                   on_overflow, entry->value);
+            ret = AVERROR(EINVAL);
+            goto end;
+        }
+        tee_slave->use_fifo = 1;
+        ret = av_dict_set(&tee_slave->fifo_options, "drop_pkts_on_overflow",
+                          drop ? "1" : "0", 0);
+        if (ret < 0)
+            goto end;
+    }
+
     if (tee_slave->use_fifo) {
 
         if (options) {
@@ -398,6 +455,7 @@ end:
     av_free(format);
     av_free(select);
     av_free(on_fail);
+    av_free(on_overflow);
     av_dict_free(&options);
     av_freep(&tmp_select);
     return ret;
@@ -0,0 +1,266 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Tests the segment prefetch of the hls demuxer against a local HTTP server.
+ */
+
+#include "libavutil/adler32.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+#include "libavformat/network.h"
+
+#define NB_SEGMENTS       6
+#define FRAMES_PER_SEGMENT 40
+#define FRAME_SIZE        417 /* MPEG-1 Layer II, 128 kbit/s, 44100 Hz */
+#define SEGMENT_SIZE      (FRAMES_PER_SEGMENT * FRAME_SIZE)
+#define STALLED_SEGMENT   2
+#define MAX_STALLED       16
+
+static int listen_fd;
+static int port;
+static int quit;
+static int stalled[MAX_STALLED];
+static int nb_stalled;
+static uint8_t segment[SEGMENT_SIZE];
+
+static void send_all(int fd, const void *buf, int size)
+{
+    const uint8_t *p = buf;
+
+    while (size > 0) {
+        int ret = send(fd, p, size, 0);
+        if (ret <= 0)
+            return;
+        p    += ret;
+        size -= ret;
+    }
+}
+
+static void send_response(int fd, const char *type, const void *body, int size,
+                          int body_size)
+{
+    char header[256];
+
+    snprintf(header, sizeof(header),
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: %s\r\n"
+             "Content-Length: %d\r\n"
+             "Connection: close\r\n"
+             "\r\n", type, size);
+    send_all(fd, header, strlen(header));
+    send_all(fd, body, body_size);
+}
+
+static void send_playlist(int fd, int stall)
+{
+    char playlist[1024];
+    int i, len;
+
+    len = snprintf(playlist, sizeof(playlist),
+                   "#EXTM3U\n"
+                   "#EXT-X-VERSION:3\n"
+                   "#EXT-X-TARGETDURATION:1\n"
+                   "#EXT-X-MEDIA-SEQUENCE:0\n");
+    for (i = 0; i < NB_SEGMENTS; i++)
+        len += snprintf(playlist + len, sizeof(playlist) - len,
+                        "#EXTINF:1.0,\n%s%d.mp2\n",
+                        stall && i == STALLED_SEGMENT ? "stall" : "seg", i);
+    len += snprintf(playlist + len, sizeof(playlist) - len, "#EXT-X-ENDLIST\n");
+    send_response(fd, "application/vnd.apple.mpegurl", playlist, len, len);
+}
+
+static void handle_request(int fd)
+{
+    char request[4096], path[256];
+    int len = 0, ret;
+
+    do {
+        ret = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (ret <= 0)
+            break;
+        len += ret;
+        request[len] = 0;
+    } while (!strstr(request, "\r\n\r\n") && len < sizeof(request) - 1);
+
+    if (ret <= 0 || sscanf(request, "GET %255s", path) != 1) {
+        closesocket(fd);
+        return;
+    }
+
+    if (!strcmp(path, "/index.m3u8")) {
+        send_playlist(fd, 0);
+    } else if (!strcmp(path, "/stall.m3u8")) {
+        send_playlist(fd, 1);
+    } else if (!strncmp(path, "/stall", 6) && nb_stalled < MAX_STALLED) {
+        /* announce the segment, but never deliver it */
+        send_response(fd, "audio/mpeg", segment, SEGMENT_SIZE, 0);
+        stalled[nb_stalled++] = fd;
+        return;
+    } else {
+        send_response(fd, "audio/mpeg", segment, SEGMENT_SIZE, SEGMENT_SIZE);
+    }
+    closesocket(fd);
+}
+
+static void *server_thread(void *arg)
+{
+    while (!quit) {
+        struct pollfd p = { listen_fd, POLLIN, 0 };
+        int fd;
+
+        if (poll(&p, 1, 100) <= 0)
+            continue;
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd >= 0)
+            handle_request(fd);
+    }
+    return NULL;
+}
+
+static int start_server(void)
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addrlen = sizeof(addr);
+
+    listen_fd = ff_socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        return AVERROR(errno);
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(listen_fd, 16) ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addrlen))
+        return AVERROR(errno);
+    port = ntohs(addr.sin_port);
+    return 0;
+}
+
+static int open_playlist(AVFormatContext **s, const char *name, int prefetch)
+{
+    AVDictionary *opts = NULL;
+    char url[256];
+    int ret;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", port, name);
+    av_dict_set_int(&opts, "prefetch", prefetch, 0);
+    av_dict_set(&opts, "http_persistent", "0", 0);
+    ret = avformat_open_input(s, url, NULL, &opts);
+    av_dict_free(&opts);
+    return ret;
+}
+
+static int read_all(int prefetch)
+{
+    AVFormatContext *s = NULL;
+    AVPacket pkt;
+    unsigned long checksum = 0;
+    int64_t size = 0;
+    int ret, nb_packets = 0;
+
+    if ((ret = open_playlist(&s, "index.m3u8", prefetch)) < 0) {
+        printf("prefetch %d: open error %d\n", prefetch, ret);
+        return ret;
+    }
+    while ((ret = av_read_frame(s, &pkt)) >= 0) {
+        checksum = av_adler32_update(checksum, pkt.data, pkt.size);
+        size    += pkt.size;
+        nb_packets++;
+        av_packet_unref(&pkt);
+    }
+    avformat_close_input(&s);
+
+    printf("prefetch %d: %d packets, %"PRId64" bytes, adler32 0x%08lx\n",
+           prefetch, nb_packets, size, checksum);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+static int closed;
+
+static void *watchdog_thread(void *arg)
+{
+    int i;
+
+    for (i = 0; i < 200 && !closed; i++)
+        av_usleep(50000);
+    if (!closed) {
+        printf("stall: closing the demuxer hangs\n");
+        exit(1);
+    }
+    return NULL;
+}
+
+/* Closing the demuxer must abort a prefetch waiting for a stalled server. */
+static int close_stalled(void)
+{
+    AVFormatContext *s = NULL;
+    AVPacket pkt;
+    pthread_t watchdog;
+    int i, ret;
+
+    if ((ret = open_playlist(&s, "stall.m3u8", 3)) < 0) {
+        printf("stall: open error %d\n", ret);
+        return ret;
+    }
+    for (i = 0; i < FRAMES_PER_SEGMENT / 2; i++) {
+        if ((ret = av_read_frame(s, &pkt)) < 0) {
+            printf("stall: read error %d\n", ret);
+            break;
+        }
+        av_packet_unref(&pkt);
+    }
+
+    pthread_create(&watchdog, NULL, watchdog_thread, NULL);
+    avformat_close_input(&s);
+    closed = 1;
+    pthread_join(watchdog, NULL);
+
+    printf("stall: closed\n");
+    return ret < 0 ? ret : 0;
+}
+
+int main(void)
+{
+    pthread_t server;
+    int i, ret = 0;
+
+    av_log_set_level(AV_LOG_QUIET);
+    avformat_network_init();
+
+    for (i = 0; i < FRAMES_PER_SEGMENT; i++)
+        AV_WB32(segment + i * FRAME_SIZE, 0xFFFD80C4);
+
+    if (start_server() < 0 ||
+        pthread_create(&server, NULL, server_thread, NULL)) {
+        printf("cannot start the HTTP server\n");
+        return 1;
+    }
+
+    if (read_all(0) < 0 || read_all(3) < 0 || close_stalled() < 0)
+        ret = 1;
+
+    quit = 1;
+    pthread_join(server, NULL);
+    for (i = 0; i < nb_stalled; i++)
+        closesocket(stalled[i]);
+    closesocket(listen_fd);
+    avformat_network_deinit();
+    return ret;
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Builds an index out of order, the way a demuxer does when it plays the
+ * second half of a file, seeks back to the start and plays the first half,
+ * once with av_add_index_entry() and once with ff_add_index_entry_deferred().
+ *
+ * Usage: index [number of entries]
+ * The times are printed on stderr.
+ */
+
+#include <stdlib.h>
+
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+#include "libavformat/internal.h"
+
+static AVStream *build_index(AVFormatContext **s, int nb_entries, int deferred,
+                             int64_t *time)
+{
+    AVStream *st;
+    int64_t t0;
+    int i, j;
+
+    if (!(*s = avformat_alloc_context()) || !(st = avformat_new_stream(*s, NULL)))
+        return NULL;
+
+    t0 = av_gettime_relative();
+    for (j = 0; j < nb_entries; j++) {
+        i = (j + nb_entries / 2) % nb_entries;
+        if (deferred)
+            ff_add_index_entry_deferred(st, i * 1000LL, i * 10LL, 0, 0, AVINDEX_KEYFRAME);
+        else
+            av_add_index_entry(st, i * 1000LL, i * 10LL, 0, 0, AVINDEX_KEYFRAME);
+    }
+    /* the first seek merges the deferred entries */
+    av_index_search_timestamp(st, 0, 0);
+    *time = av_gettime_relative() - t0;
+    return st;
+}
+
+int main(int argc, char **argv)
+{
+    AVFormatContext *s[2] = { NULL };
+    AVStream *st[2];
+    int64_t time[2];
+    int i, nb_entries = argc > 1 ? atoi(argv[1]) : 10000;
+    int identical, ret = 1;
+
+    if (nb_entries <= 0)
+        return 1;
+
+    for (i = 0; i < 2; i++)
+        if (!(st[i] = build_index(&s[i], nb_entries, i, &time[i])))
+            goto end;
+
+    identical = st[0]->nb_index_entries == nb_entries &&
+                st[1]->nb_index_entries == nb_entries &&
+                !memcmp(st[0]->index_entries, st[1]->index_entries,
+                        nb_entries * sizeof(*st[0]->index_entries));
+    for (i = 1; identical && i < nb_entries; i++)
+        identical = st[1]->index_entries[i - 1].timestamp < st[1]->index_entries[i].timestamp;
+
+    printf("entries: %d, identical: %s\n", nb_entries, identical ? "yes" : "no");
+    fprintf(stderr, "av_add_index_entry:          %8"PRId64" us\n"
+                    "ff_add_index_entry_deferred: %8"PRId64" us\n", time[0], time[1]);
+    ret = !identical;
+
+end:
+    for (i = 0; i < 2; i++)
+        avformat_free_context(s[i]);
+    return ret;
+}
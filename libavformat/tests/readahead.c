@@ -0,0 +1,206 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/time.h"
+#include "libavformat/avio_internal.h"
+#include "libavformat/url.h"
+
+#define TEST_STREAM_SIZE (4 << 20)
+
+/*
+ * A slow protocol that, like http, reconnects on seek and gives up
+ * whenever its interrupt callback fires. Like http, it reads through a
+ * nested context, whose interrupt callback was copied when connecting.
+ */
+typedef struct TestContext {
+    int64_t logical_pos;
+    int     reconnects;
+    AVIOInterruptCB child_interrupt_callback;
+    int64_t stall_pos;      ///< the server stops sending here until the next reconnect
+    int64_t next_stall_pos; ///< stall_pos after the next reconnect
+    int64_t fail_pos;       ///< a read fails once here
+    int64_t next_fail_pos;  ///< fail_pos after the next reconnect
+    int     timed_out;
+} TestContext;
+
+static int test_read(URLContext *h, unsigned char *buf, int size)
+{
+    TestContext *c = h->priv_data;
+    int i;
+
+    if (c->logical_pos >= TEST_STREAM_SIZE)
+        return AVERROR_EOF;
+    if (c->logical_pos == c->fail_pos) {
+        c->fail_pos = INT64_MAX;
+        return AVERROR(EIO);
+    }
+
+    for (i = 0; i < 10 || c->logical_pos >= c->stall_pos; i++) {
+        if (ff_check_interrupt(&c->child_interrupt_callback))
+            return AVERROR_EXIT;
+        if (i == 50000) {
+            c->timed_out = 1;
+            return AVERROR(ETIMEDOUT);
+        }
+        av_usleep(100);
+    }
+
+    size = FFMIN3(size, TEST_STREAM_SIZE - c->logical_pos, c->stall_pos - c->logical_pos);
+    size = FFMIN(size, c->fail_pos - c->logical_pos);
+    for (i = 0; i < size; i++)
+        buf[i] = c->logical_pos++ & 0xFF;
+    return size;
+}
+
+static int64_t test_seek(URLContext *h, int64_t pos, int whence)
+{
+    TestContext *c = h->priv_data;
+
+    if (whence == AVSEEK_SIZE)
+        return TEST_STREAM_SIZE;
+    if (whence == SEEK_CUR)
+        pos += c->logical_pos;
+    else if (whence != SEEK_SET)
+        return AVERROR(EINVAL);
+    if (pos < 0)
+        return AVERROR(EINVAL);
+
+    /* reconnect */
+    if (ff_check_interrupt(&c->child_interrupt_callback))
+        return AVERROR_EXIT;
+    c->stall_pos      = c->next_stall_pos;
+    c->next_stall_pos = INT64_MAX;
+    c->fail_pos       = c->next_fail_pos;
+    c->next_fail_pos  = INT64_MAX;
+    c->reconnects++;
+    c->logical_pos = pos;
+    return pos;
+}
+
+static int test_close(URLContext *h)
+{
+    return 0;
+}
+
+static const URLProtocol test_protocol = {
+    .name           = "readahead-test",
+    .url_read       = test_read,
+    .url_seek       = test_seek,
+    .url_close      = test_close,
+    .priv_data_size = sizeof(TestContext),
+};
+
+static int check_read(AVIOContext *pb, int64_t pos, int size)
+{
+    unsigned char buf[4096];
+    int i, ret;
+
+    while (size > 0) {
+        ret = avio_read(pb, buf, FFMIN(size, sizeof(buf)));
+        if (ret <= 0) {
+            printf("read-error: %d at %"PRId64"\n", ret, pos);
+            return -1;
+        }
+        for (i = 0; i < ret; i++, pos++) {
+            if (buf[i] != (pos & 0xFF)) {
+                printf("read-mismatch: actual %d, expecting %d, at %"PRId64"\n",
+                       buf[i], (int)(pos & 0xFF), pos);
+                return -1;
+            }
+        }
+        size -= ret;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const int64_t seeks[] = { 3 << 20, 4096, 1 << 20, 0, (4 << 20) - 100000 };
+    URLContext  *h;
+    TestContext *c;
+    AVIOContext *pb = NULL;
+    int64_t pos;
+    int i, ret = 1;
+
+    h = av_mallocz(sizeof(*h) + 1);
+    if (!h)
+        return 1;
+    h->av_class  = &ffurl_context_class;
+    h->filename  = (char *)&h[1];
+    h->prot      = &test_protocol;
+    h->flags     = AVIO_FLAG_READ;
+    h->priv_data = av_mallocz(sizeof(TestContext));
+    h->readahead = 1 << 20;
+    h->is_connected = 1;
+    if (!(c = h->priv_data))
+        goto fail;
+    /* connect, as ffurl_open_whitelist() does with read-ahead enabled */
+    ffurl_intercept_interrupt(h);
+    c->child_interrupt_callback = h->interrupt_callback;
+    c->stall_pos = c->next_stall_pos = INT64_MAX;
+    c->fail_pos  = c->next_fail_pos  = INT64_MAX;
+    if (ffio_fdopen(&pb, h) < 0)
+        goto fail;
+
+    if (check_read(pb, 0, 100000) < 0)
+        goto fail;
+    for (i = 0; i < FF_ARRAY_ELEMS(seeks); i++) {
+        /* let the worker go ahead so that it is busy at the seek */
+        av_usleep(10000);
+        pos = avio_seek(pb, seeks[i], SEEK_SET);
+        printf("seek: %"PRId64"\n", pos);
+        if (pos != seeks[i] || check_read(pb, pos, 100000) < 0)
+            goto fail;
+    }
+    printf("reconnects: %d\n", c->reconnects > 0);
+
+    /* a seek must interrupt the worker waiting for a stalled server */
+    c->next_stall_pos = (1 << 20) + 100000;
+    if (avio_seek(pb, 1 << 20, SEEK_SET) != 1 << 20 ||
+        check_read(pb, 1 << 20, 100000) < 0)
+        goto fail;
+    av_usleep(10000);
+    pos = avio_seek(pb, 0, SEEK_SET);
+    printf("stalled seek: %"PRId64"\n", pos);
+    if (pos || check_read(pb, 0, 100000) < 0)
+        goto fail;
+    printf("stall interrupted: %d\n", !c->timed_out);
+    if (c->timed_out)
+        goto fail;
+
+    /* a transient error is reported once, reading continues afterwards */
+    c->next_fail_pos = (2 << 20) + 50000;
+    if (avio_seek(pb, 2 << 20, SEEK_SET) != 2 << 20 ||
+        check_read(pb, 2 << 20, 50000) < 0)
+        goto fail;
+    printf("transient error: %d\n", avio_r8(pb) == 0 && pb->error == AVERROR(EIO));
+    pb->eof_reached = 0;
+    pb->error       = 0;
+    if (check_read(pb, (2 << 20) + 50000, 100000) < 0)
+        goto fail;
+    ret = 0;
+
+fail:
+    if (pb) {
+        avio_closep(&pb);
+    } else {
+        av_freep(&h->priv_data);
+        av_freep(&h);
+    }
+    return ret;
+}
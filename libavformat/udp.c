@@ -26,6 +26,9 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg() and sendmmsg() */
+
+#include <stdatomic.h>
 
 #include "avformat.h"
 #include "avio_internal.h"
@@ -74,6 +77,14 @@
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
 
+typedef struct UDPMessage {
+    struct sockaddr_storage addr;
+    int len;
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    struct iovec iov;
+#endif
+} UDPMessage;
+
 typedef struct UDPContext {
     const AVClass *class;
     int udp_fd;
@@ -103,7 +114,16 @@ typedef struct UDPContext {
     pthread_cond_t cond;
     int thread_started;
 #endif
-    uint8_t tmp[UDP_MAX_PKT_SIZE+4];
+    uint8_t *ring;         ///< received datagrams, each preceded by its size
+    unsigned ring_size;
+    atomic_uint ring_rpos;
+    atomic_uint ring_wpos;
+    int batch_size;        ///< datagrams per system call in the circular buffer thread
+    uint8_t *batch_buf;    ///< batch_size datagrams of UDP_MAX_PKT_SIZE bytes
+    UDPMessage *batch;
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    struct mmsghdr *mmsg;
+#endif
     int remaining_in_dg;
     char *localaddr;
     int timeout;
@@ -132,6 +152,7 @@ static const AVOption options[] = {
     { "connect",        "set if connect() should be called on socket",     OFFSET(is_connected),   AV_OPT_TYPE_BOOL,   { .i64 =  0 },     0, 1,       .flags = D|E },
     { "fifo_size",      "set the UDP receiving circular buffer size, expressed as a number of packets with size of 188 bytes", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = 7*4096}, 0, INT_MAX, D },
     { "overrun_nonfatal", "survive in case of UDP receiving circular buffer overrun", OFFSET(overrun_nonfatal), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1,    D },
+    { "batch_size",     "set the number of datagrams received or sent per system call by the circular buffer thread", OFFSET(batch_size), AV_OPT_TYPE_INT, {.i64 = 16}, 1, 1024, D|E },
     { "timeout",        "set raise error timeout (only in read mode)",     OFFSET(timeout),        AV_OPT_TYPE_INT,    { .i64 = 0 },      0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -454,6 +475,70 @@ static int udp_get_file_handle(URLContext *h)
 }
 
 #if HAVE_PTHREAD_CANCEL
+/* The receive ring holds the datagrams, each preceded by its 4 byte size.
+ * The receiving thread is its only writer and udp_read() its only reader,
+ * they synchronize through the two positions alone. The mutex is only taken
+ * once per batch of datagrams, to wake up a reader waiting for data. */
+
+static unsigned ring_used(UDPContext *s, unsigned wpos, unsigned rpos)
+{
+    return wpos >= rpos ? wpos - rpos : s->ring_size - rpos + wpos;
+}
+
+static unsigned ring_write(UDPContext *s, unsigned pos, const uint8_t *src, unsigned len)
+{
+    unsigned len1 = FFMIN(len, s->ring_size - pos);
+
+    memcpy(s->ring + pos, src, len1);
+    memcpy(s->ring, src + len1, len - len1);
+    return (pos + len) % s->ring_size;
+}
+
+static unsigned ring_read(UDPContext *s, unsigned pos, uint8_t *dst, unsigned len)
+{
+    unsigned len1 = FFMIN(len, s->ring_size - pos);
+
+    memcpy(dst, s->ring + pos, len1);
+    memcpy(dst + len1, s->ring, len - len1);
+    return (pos + len) % s->ring_size;
+}
+
+/* Receive up to batch_size datagrams, return their number */
+static int udp_recv_batch(UDPContext *s)
+{
+    socklen_t addr_len = sizeof(s->batch[0].addr);
+    int len;
+
+#if HAVE_RECVMMSG
+    if (s->batch_size > 1) {
+        int i, n;
+
+        for (i = 0; i < s->batch_size; i++) {
+            s->batch[i].iov.iov_base = s->batch_buf + i * UDP_MAX_PKT_SIZE;
+            s->batch[i].iov.iov_len  = UDP_MAX_PKT_SIZE;
+            memset(&s->mmsg[i], 0, sizeof(s->mmsg[i]));
+            s->mmsg[i].msg_hdr.msg_name    = &s->batch[i].addr;
+            s->mmsg[i].msg_hdr.msg_namelen = addr_len;
+            s->mmsg[i].msg_hdr.msg_iov     = &s->batch[i].iov;
+            s->mmsg[i].msg_hdr.msg_iovlen  = 1;
+        }
+        /* block for the first datagram only */
+        n = recvmmsg(s->udp_fd, s->mmsg, s->batch_size, MSG_WAITFORONE, NULL);
+        if (n < 0)
+            return ff_neterrno();
+        for (i = 0; i < n; i++)
+            s->batch[i].len = s->mmsg[i].msg_len;
+        return n;
+    }
+#endif
+    len = recvfrom(s->udp_fd, s->batch_buf, UDP_MAX_PKT_SIZE, 0,
+                   (struct sockaddr *)&s->batch[0].addr, &addr_len);
+    if (len < 0)
+        return ff_neterrno();
+    s->batch[0].len = len;
+    return 1;
+}
+
 static void *circular_buffer_task_rx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -467,46 +552,62 @@ static void *circular_buffer_task_rx( void *_URLContext)
         s->circular_buffer_error = AVERROR(EIO);
         goto end;
     }
+    pthread_mutex_unlock(&s->mutex);
     while(1) {
-        int len;
-        struct sockaddr_storage addr;
-        socklen_t addr_len = sizeof(addr);
+        int i, n;
+        unsigned wpos, space;
 
-        pthread_mutex_unlock(&s->mutex);
         /* Blocking operations are always cancellation points;
            see "General Information" / "Thread Cancelation Overview"
            in Single Unix. */
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
-        len = recvfrom(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0, (struct sockaddr *)&addr, &addr_len);
+        n = udp_recv_batch(s);
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
-        pthread_mutex_lock(&s->mutex);
-        if (len < 0) {
-            if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR)) {
-                s->circular_buffer_error = ff_neterrno();
+        if (n < 0) {
+            if (n != AVERROR(EAGAIN) && n != AVERROR(EINTR)) {
+                pthread_mutex_lock(&s->mutex);
+                s->circular_buffer_error = n;
                 goto end;
             }
             continue;
         }
-        if (ff_ip_check_source_lists(&addr, &s->filters))
-            continue;
-        AV_WL32(s->tmp, len);
 
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
+        wpos  = atomic_load_explicit(&s->ring_wpos, memory_order_relaxed);
+        space = s->ring_size - 1 -
+                ring_used(s, wpos, atomic_load_explicit(&s->ring_rpos, memory_order_acquire));
+        for (i = 0; i < n; i++) {
+            int len = s->batch[i].len;
+            uint8_t tmp[4];
+
+            if (ff_ip_check_source_lists(&s->batch[i].addr, &s->filters))
                 continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
-                goto end;
+
+            if (space < len + 4) {
+                /* No Space left */
+                if (s->overrun_nonfatal) {
+                    av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                            "Surviving due to overrun_nonfatal option\n");
+                    continue;
+                } else {
+                    av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                            "To avoid, increase fifo_size URL option. "
+                            "To survive in such case, use overrun_nonfatal option\n");
+                    atomic_store_explicit(&s->ring_wpos, wpos, memory_order_release);
+                    pthread_mutex_lock(&s->mutex);
+                    s->circular_buffer_error = AVERROR(EIO);
+                    goto end;
+                }
             }
+            AV_WL32(tmp, len);
+            wpos   = ring_write(s, wpos, tmp, 4);
+            wpos   = ring_write(s, wpos, s->batch_buf + i * UDP_MAX_PKT_SIZE, len);
+            space -= len + 4;
         }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
+        atomic_store_explicit(&s->ring_wpos, wpos, memory_order_release);
+
+        pthread_mutex_lock(&s->mutex);
         pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
     }
 
 end:
@@ -515,6 +616,82 @@ end:
     return NULL;
 }
 
+/* Take the next datagram of the transmit fifo into batch slot i, the fifo
+ * must hold one. Return its size. */
+static int udp_tx_pop(UDPContext *s, int i)
+{
+    uint8_t tmp[4];
+    int len;
+
+    av_fifo_generic_read(s->fifo, tmp, 4, NULL);
+    len=AV_RL32(tmp);
+
+    av_assert0(len >= 0);
+    av_assert0(len <= UDP_MAX_PKT_SIZE);
+
+    av_fifo_generic_read(s->fifo, s->batch_buf + i * UDP_MAX_PKT_SIZE, len, NULL);
+    s->batch[i].len = len;
+    return len;
+}
+
+/* Send the first n datagrams of the batch */
+static int udp_send_batch(UDPContext *s, int n)
+{
+    int i;
+
+#if HAVE_SENDMMSG
+    if (n > 1) {
+        for (i = 0; i < n; i++) {
+            s->batch[i].iov.iov_base = s->batch_buf + i * UDP_MAX_PKT_SIZE;
+            s->batch[i].iov.iov_len  = s->batch[i].len;
+            memset(&s->mmsg[i], 0, sizeof(s->mmsg[i]));
+            if (!s->is_connected) {
+                s->mmsg[i].msg_hdr.msg_name    = &s->dest_addr;
+                s->mmsg[i].msg_hdr.msg_namelen = s->dest_addr_len;
+            }
+            s->mmsg[i].msg_hdr.msg_iov    = &s->batch[i].iov;
+            s->mmsg[i].msg_hdr.msg_iovlen = 1;
+        }
+        i = 0;
+        while (i < n) {
+            int ret = sendmmsg(s->udp_fd, s->mmsg + i, n - i, 0);
+            if (ret >= 0) {
+                i += ret;
+            } else {
+                ret = ff_neterrno();
+                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+                    return ret;
+            }
+        }
+        return 0;
+    }
+#endif
+    for (i = 0; i < n; i++) {
+        const uint8_t *p = s->batch_buf + i * UDP_MAX_PKT_SIZE;
+        int len = s->batch[i].len;
+
+        while (len) {
+            int ret;
+            av_assert0(len > 0);
+            if (!s->is_connected) {
+                ret = sendto (s->udp_fd, p, len, 0,
+                            (struct sockaddr *) &s->dest_addr,
+                            s->dest_addr_len);
+            } else
+                ret = send(s->udp_fd, p, len, 0);
+            if (ret >= 0) {
+                len -= ret;
+                p   += ret;
+            } else {
+                ret = ff_neterrno();
+                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+                    return ret;
+            }
+        }
+    }
+    return 0;
+}
+
 static void *circular_buffer_task_tx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -536,9 +713,7 @@ static void *circular_buffer_task_tx( void *_URLContext)
     }
 
     for(;;) {
-        int len;
-        const uint8_t *p;
-        uint8_t tmp[4];
+        int len, n = 1, ret;
         int64_t timestamp;
 
         len=av_fifo_size(s->fifo);
@@ -552,13 +727,7 @@ static void *circular_buffer_task_tx( void *_URLContext)
             len=av_fifo_size(s->fifo);
         }
 
-        av_fifo_generic_read(s->fifo, tmp, 4, NULL);
-        len=AV_RL32(tmp);
-
-        av_assert0(len >= 0);
-        av_assert0(len <= sizeof(s->tmp));
-
-        av_fifo_generic_read(s->fifo, s->tmp, len, NULL);
+        len = udp_tx_pop(s, 0);
 
         pthread_mutex_unlock(&s->mutex);
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
@@ -583,30 +752,30 @@ static void *circular_buffer_task_tx( void *_URLContext)
             target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
         }
 
-        p = s->tmp;
-        while (len) {
-            int ret;
-            av_assert0(len > 0);
-            if (!s->is_connected) {
-                ret = sendto (s->udp_fd, p, len, 0,
-                            (struct sockaddr *) &s->dest_addr,
-                            s->dest_addr_len);
-            } else
-                ret = send(s->udp_fd, p, len, 0);
-            if (ret >= 0) {
-                len -= ret;
-                p   += ret;
-            } else {
-                ret = ff_neterrno();
-                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR)) {
-                    pthread_mutex_lock(&s->mutex);
-                    s->circular_buffer_error = ret;
-                    pthread_mutex_unlock(&s->mutex);
-                    return NULL;
-                }
+        /* send the following datagrams along as long as they are due */
+        while (n < s->batch_size &&
+               (!s->bitrate || av_gettime_relative() >= target_timestamp)) {
+            pthread_mutex_lock(&s->mutex);
+            if (av_fifo_size(s->fifo) < 4) {
+                pthread_mutex_unlock(&s->mutex);
+                break;
+            }
+            len = udp_tx_pop(s, n++);
+            pthread_mutex_unlock(&s->mutex);
+            if (s->bitrate) {
+                sent_bits += len * 8;
+                target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
             }
         }
 
+        ret = udp_send_batch(s, n);
+        if (ret < 0) {
+            pthread_mutex_lock(&s->mutex);
+            s->circular_buffer_error = ret;
+            pthread_mutex_unlock(&s->mutex);
+            return NULL;
+        }
+
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
         pthread_mutex_lock(&s->mutex);
     }
@@ -619,6 +788,16 @@ end:
 
 #endif
 
+static void udp_free_buffers(UDPContext *s)
+{
+    av_freep(&s->ring);
+    av_freep(&s->batch_buf);
+    av_freep(&s->batch);
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    av_freep(&s->mmsg);
+#endif
+}
+
 /* put it in UDP context */
 /* return non zero if error */
 static int udp_open(URLContext *h, const char *uri, int flags)
@@ -709,6 +888,9 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         if (av_find_info_tag(buf, sizeof(buf), "burst_bits", p)) {
             s->burst_bits = strtoll(buf, NULL, 10);
         }
+        if (av_find_info_tag(buf, sizeof(buf), "batch_size", p)) {
+            s->batch_size = av_clip(strtol(buf, NULL, 10), 1, 1024);
+        }
         if (av_find_info_tag(buf, sizeof(buf), "localaddr", p)) {
             av_strlcpy(localaddr, buf, sizeof(localaddr));
         }
@@ -892,7 +1074,27 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         int ret;
 
         /* start the task going */
-        s->fifo = av_fifo_alloc(s->circular_buffer_size);
+        if (is_output) {
+            s->fifo = av_fifo_alloc(s->circular_buffer_size);
+            if (!HAVE_SENDMMSG)
+                s->batch_size = 1;
+        } else {
+            s->ring_size = s->circular_buffer_size + 1;
+            s->ring = av_malloc(s->ring_size);
+            atomic_init(&s->ring_rpos, 0);
+            atomic_init(&s->ring_wpos, 0);
+            if (!HAVE_RECVMMSG)
+                s->batch_size = 1;
+        }
+        s->batch_buf = av_malloc_array(s->batch_size, UDP_MAX_PKT_SIZE);
+        s->batch     = av_mallocz_array(s->batch_size, sizeof(*s->batch));
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+        s->mmsg      = av_mallocz_array(s->batch_size, sizeof(*s->mmsg));
+        if (!s->mmsg)
+            goto fail;
+#endif
+        if ((!s->fifo && !s->ring) || !s->batch_buf || !s->batch)
+            goto fail;
         ret = pthread_mutex_init(&s->mutex, NULL);
         if (ret != 0) {
             av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
@@ -923,6 +1125,7 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     if (udp_fd >= 0)
         closesocket(udp_fd);
     av_fifo_freep(&s->fifo);
+    udp_free_buffers(s);
     ff_ip_reset_filters(&s->filters);
     return AVERROR(EIO);
 }
@@ -946,24 +1149,28 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
 #if HAVE_PTHREAD_CANCEL
     int avail, nonblock = h->flags & AVIO_FLAG_NONBLOCK;
 
-    if (s->fifo) {
-        pthread_mutex_lock(&s->mutex);
+    if (s->ring) {
         do {
-            avail = av_fifo_size(s->fifo);
-            if (avail) { // >=size) {
+            unsigned rpos = atomic_load_explicit(&s->ring_rpos, memory_order_relaxed);
+            if (atomic_load_explicit(&s->ring_wpos, memory_order_acquire) != rpos) {
                 uint8_t tmp[4];
 
-                av_fifo_generic_read(s->fifo, tmp, 4, NULL);
+                rpos = ring_read(s, rpos, tmp, 4);
                 avail= AV_RL32(tmp);
                 if(avail > size){
                     av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
                     avail= size;
                 }
 
-                av_fifo_generic_read(s->fifo, buf, avail, NULL);
-                av_fifo_drain(s->fifo, AV_RL32(tmp) - avail);
-                pthread_mutex_unlock(&s->mutex);
+                ring_read(s, rpos, buf, avail);
+                atomic_store_explicit(&s->ring_rpos, (rpos + AV_RL32(tmp)) % s->ring_size,
+                                      memory_order_release);
                 return avail;
+            }
+
+            pthread_mutex_lock(&s->mutex);
+            if (atomic_load_explicit(&s->ring_wpos, memory_order_acquire) != rpos) {
+                pthread_mutex_unlock(&s->mutex);
             } else if(s->circular_buffer_error){
                 int err = s->circular_buffer_error;
                 pthread_mutex_unlock(&s->mutex);
@@ -982,6 +1189,7 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
                     pthread_mutex_unlock(&s->mutex);
                     return AVERROR(errno == ETIMEDOUT ? EAGAIN : errno);
                 }
+                pthread_mutex_unlock(&s->mutex);
                 nonblock = 1;
             }
         } while( 1);
@@ -1082,6 +1290,7 @@ static int udp_close(URLContext *h)
 #endif
     closesocket(s->udp_fd);
     av_fifo_freep(&s->fifo);
+    udp_free_buffers(s);
     ff_ip_reset_filters(&s->filters);
     return 0;
 }
@@ -24,9 +24,12 @@
 #ifndef AVFORMAT_URL_H
 #define AVFORMAT_URL_H
 
+#include <stdatomic.h>
+
 #include "avio.h"
 #include "libavformat/version.h"
 
+#include "libavutil/buffer.h"
 #include "libavutil/dict.h"
 #include "libavutil/log.h"
 
@@ -49,6 +52,9 @@ typedef struct URLContext {
     const char *protocol_whitelist;
     const char *protocol_blacklist;
     int min_packet_size;        /**< if non zero, the stream is packetized with this min packet size */
+    int readahead;              /**< maximum size of the asynchronous read-ahead buffer, 0 to disable */
+    AVIOInterruptCB orig_interrupt_callback; /**< caller's callback, set by ffurl_intercept_interrupt() */
+    atomic_int cancel;          /**< interrupt h and its nested contexts, see ffurl_intercept_interrupt() */
 } URLContext;
 
 typedef struct URLProtocol {
@@ -97,6 +103,15 @@ typedef struct URLProtocol {
     int (*url_delete)(URLContext *h);
     int (*url_move)(URLContext *h_src, URLContext *h_dst);
     const char *default_whitelist;
+
+    /**
+     * Return a read-only reference to size bytes of the resource starting at
+     * absolute position pos, without copying them and without moving the
+     * read position. The AV_INPUT_BUFFER_PADDING_SIZE bytes following the
+     * data must be readable and zero, as for any packet.
+     * Return AVERROR(ENOSYS) if the data cannot be referenced this way.
+     */
+    int (*url_read_ref)(URLContext *h, int64_t pos, int size, AVBufferRef **buf);
 } URLProtocol;
 
 /**
@@ -125,6 +140,16 @@ int ffurl_alloc(URLContext **puc, const char *filename, int flags,
  */
 int ffurl_connect(URLContext *uc, AVDictionary **options);
 
+/**
+ * Route the interrupt callback of h through h itself, so that setting
+ * h->cancel interrupts h and the nested contexts it opens afterwards,
+ * which inherit the callback. The callback still checks the one of the
+ * caller. Does nothing if this was already done for h or for its parent.
+ *
+ * Must be called before connecting h to cover all nested contexts.
+ */
+void ffurl_intercept_interrupt(URLContext *h);
+
 /**
  * Create an URLContext for accessing to the resource indicated by
  * url, and open it.
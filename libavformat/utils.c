@@ -47,6 +47,7 @@
 #include "id3v2.h"
 #include "internal.h"
 #include "metadata.h"
+#include "probecache.h"
 #if CONFIG_NETWORK
 #include "network.h"
 #endif
@@ -317,6 +318,29 @@ int av_get_packet(AVIOContext *s, AVPacket *pkt, int size)
     return append_packet_chunked(s, pkt, size);
 }
 
+int ff_get_packet_ref(AVIOContext *s, AVPacket *pkt, int size)
+{
+    int ret;
+
+    av_init_packet(pkt);
+    pkt->data = NULL;
+    pkt->size = 0;
+    pkt->pos  = avio_tell(s);
+
+    if (size > 0) {
+        ret = ffio_read_ref(s, size, &pkt->buf);
+        if (ret != AVERROR(ENOSYS)) {
+            if (ret < 0)
+                return ret;
+            pkt->data = pkt->buf->data;
+            pkt->size = size;
+            return size;
+        }
+    }
+
+    return append_packet_chunked(s, pkt, size);
+}
+
 int av_append_packet(AVIOContext *s, AVPacket *pkt, int size)
 {
     if (!pkt->size)
@@ -1667,8 +1691,8 @@ FF_ENABLE_DEPRECATION_WARNINGS
             if ((s->iformat->flags & AVFMT_GENERIC_INDEX) &&
                 (pkt->flags & AV_PKT_FLAG_KEY) && pkt->dts != AV_NOPTS_VALUE) {
                 ff_reduce_index(s, st->index);
-                av_add_index_entry(st, pkt->pos, pkt->dts,
-                                   0, 0, AVINDEX_KEYFRAME);
+                ff_add_index_entry_deferred(st, pkt->pos, pkt->dts,
+                                            0, 0, AVINDEX_KEYFRAME);
             }
             got_packet = 1;
         } else if (st->discard < AVDISCARD_ALL) {
@@ -1851,7 +1875,7 @@ return_packet:
     st = s->streams[pkt->stream_index];
     if ((s->iformat->flags & AVFMT_GENERIC_INDEX) && pkt->flags & AV_PKT_FLAG_KEY) {
         ff_reduce_index(s, st->index);
-        av_add_index_entry(st, pkt->pos, pkt->dts, 0, 0, AVINDEX_KEYFRAME);
+        ff_add_index_entry_deferred(st, pkt->pos, pkt->dts, 0, 0, AVINDEX_KEYFRAME);
     }
 
     if (is_relative(pkt->dts))
@@ -1969,8 +1993,9 @@ void ff_reduce_index(AVFormatContext *s, int stream_index)
     AVStream *st             = s->streams[stream_index];
     unsigned int max_entries = s->max_index_size / sizeof(AVIndexEntry);
 
-    if ((unsigned) st->nb_index_entries >= max_entries) {
+    if ((unsigned) st->nb_index_entries + st->internal->nb_index_pending >= max_entries) {
         int i;
+        ff_index_flush(st);
         for (i = 0; 2 * i < st->nb_index_entries; i++)
             st->index_entries[i] = st->index_entries[2 * i];
         st->nb_index_entries = i;
@@ -2007,8 +2032,12 @@ int ff_add_index_entry(AVIndexEntry **index_entries,
 
     *index_entries = entries;
 
-    index = ff_index_search_timestamp(*index_entries, *nb_index_entries,
-                                      timestamp, AVSEEK_FLAG_ANY);
+    /* Indexes are mostly built in timestamp order, skip the search then. */
+    if (!*nb_index_entries || entries[*nb_index_entries - 1].timestamp < timestamp)
+        index = -1;
+    else
+        index = ff_index_search_timestamp(*index_entries, *nb_index_entries,
+                                          timestamp, AVSEEK_FLAG_ANY);
 
     if (index < 0) {
         index = (*nb_index_entries)++;
@@ -2039,12 +2068,107 @@ int ff_add_index_entry(AVIndexEntry **index_entries,
 int av_add_index_entry(AVStream *st, int64_t pos, int64_t timestamp,
                        int size, int distance, int flags)
 {
+    ff_index_flush(st);
     timestamp = wrap_timestamp(st, timestamp);
     return ff_add_index_entry(&st->index_entries, &st->nb_index_entries,
                               &st->index_entries_allocated_size, pos,
                               timestamp, size, distance, flags);
 }
 
+void ff_add_index_entry_deferred(AVStream *st, int64_t pos, int64_t timestamp,
+                                 int size, int distance, int flags)
+{
+    AVStreamInternal *sti = st->internal;
+    const AVIndexEntry *entries = st->index_entries;
+    int n = st->nb_index_entries;
+    int64_t ts;
+    AVIndexEntry *ie;
+    int index;
+
+    timestamp = wrap_timestamp(st, timestamp);
+    if (timestamp == AV_NOPTS_VALUE || size < 0 || size > 0x3FFFFFFF)
+        return;
+    ts = is_relative(timestamp) ? timestamp - RELATIVE_TS_BASE : timestamp;
+
+    /* Appending, or updating an existing entry, is cheap. */
+    if (!n || entries[n - 1].timestamp <= ts ||
+        ((index = ff_index_search_timestamp(entries, n, ts, AVSEEK_FLAG_ANY)) >= 0 &&
+         entries[index].timestamp == ts)) {
+        ff_add_index_entry(&st->index_entries, &st->nb_index_entries,
+                           &st->index_entries_allocated_size, pos,
+                           timestamp, size, distance, flags);
+        return;
+    }
+
+    /* The pending entries form a run, usually the playback after a seek
+     * into a part of the file which was not indexed yet. */
+    if (sti->nb_index_pending) {
+        ie = &sti->index_pending[sti->nb_index_pending - 1];
+        if (ie->timestamp > ts) {
+            ff_index_flush(st);
+            ff_add_index_entry(&st->index_entries, &st->nb_index_entries,
+                               &st->index_entries_allocated_size, pos,
+                               timestamp, size, distance, flags);
+            return;
+        }
+        if (ie->timestamp == ts) {
+            if (ie->pos == pos && distance < ie->min_distance)
+                distance = ie->min_distance;
+            goto set_entry;
+        }
+    }
+
+    ie = av_fast_realloc(sti->index_pending, &sti->index_pending_allocated_size,
+                         (sti->nb_index_pending + 1) * sizeof(*ie));
+    if (!ie)
+        return;
+    sti->index_pending = ie;
+    ie = &ie[sti->nb_index_pending++];
+
+set_entry:
+    ie->pos          = pos;
+    ie->timestamp    = ts;
+    ie->min_distance = distance;
+    ie->size         = size;
+    ie->flags        = flags;
+}
+
+void ff_index_flush(AVStream *st)
+{
+    AVStreamInternal *sti = st->internal;
+    AVIndexEntry *entries;
+    int i, j, k;
+
+    if (!sti->nb_index_pending)
+        return;
+
+    if ((unsigned) st->nb_index_entries + sti->nb_index_pending >= UINT_MAX / sizeof(AVIndexEntry)) {
+        sti->nb_index_pending = 0;
+        return;
+    }
+    entries = av_fast_realloc(st->index_entries, &st->index_entries_allocated_size,
+                              (st->nb_index_entries + sti->nb_index_pending) *
+                              sizeof(AVIndexEntry));
+    if (!entries) {
+        sti->nb_index_pending = 0;
+        return;
+    }
+    st->index_entries = entries;
+
+    /* merge from the end, the timestamps of both lists are distinct */
+    i = st->nb_index_entries - 1;
+    j = sti->nb_index_pending - 1;
+    k = st->nb_index_entries + sti->nb_index_pending - 1;
+    while (j >= 0) {
+        if (i >= 0 && entries[i].timestamp > sti->index_pending[j].timestamp)
+            entries[k--] = entries[i--];
+        else
+            entries[k--] = sti->index_pending[j--];
+    }
+    st->nb_index_entries += sti->nb_index_pending;
+    sti->nb_index_pending = 0;
+}
+
 int ff_index_search_timestamp(const AVIndexEntry *entries, int nb_entries,
                               int64_t wanted_timestamp, int flags)
 {
@@ -2115,6 +2239,8 @@ void ff_configure_buffers_for_index(AVFormatContext *s, int64_t time_tolerance)
             if (ist1 == ist2)
                 continue;
 
+            ff_index_flush(st1);
+            ff_index_flush(st2);
             for (i1 = i2 = 0; i1 < st1->nb_index_entries; i1++) {
                 AVIndexEntry *e1 = &st1->index_entries[i1];
                 int64_t e1_pts = av_rescale_q(e1->timestamp, st1->time_base, AV_TIME_BASE_Q);
@@ -2147,6 +2273,7 @@ void ff_configure_buffers_for_index(AVFormatContext *s, int64_t time_tolerance)
 
 int av_index_search_timestamp(AVStream *st, int64_t wanted_timestamp, int flags)
 {
+    ff_index_flush(st);
     return ff_index_search_timestamp(st->index_entries, st->nb_index_entries,
                                      wanted_timestamp, flags);
 }
@@ -2459,12 +2586,22 @@ static int seek_frame_generic(AVFormatContext *s, int stream_index,
     return 0;
 }
 
+static void flush_indexes(AVFormatContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_streams; i++)
+        ff_index_flush(s->streams[i]);
+}
+
 static int seek_frame_internal(AVFormatContext *s, int stream_index,
                                int64_t timestamp, int flags)
 {
     int ret;
     AVStream *st;
 
+    flush_indexes(s);
+
     if (flags & AVSEEK_FLAG_BYTE) {
         if (s->iformat->flags & AVFMT_NO_BYTE_SEEK)
             return -1;
@@ -2541,6 +2678,7 @@ int avformat_seek_file(AVFormatContext *s, int stream_index, int64_t min_ts,
     if (s->iformat->read_seek2) {
         int ret;
         ff_read_frame_flush(s);
+        flush_indexes(s);
 
         if (stream_index == -1 && s->nb_streams == 1) {
             AVRational time_base = s->streams[0]->time_base;
@@ -3561,6 +3699,262 @@ static int extract_extradata(AVStream *st, AVPacket *pkt)
     return 0;
 }
 
+#if HAVE_THREADS
+/* returns 1 if try_decode_frame() would still decode a packet of st */
+static int probe_needs_decode(AVStream *st)
+{
+    AVCodecContext *avctx = st->internal->avctx;
+
+    if (st->info->found_decoder < 0)
+        return 0;
+    return !has_codec_parameters(st, NULL) || !has_decode_delay_been_guessed(st) ||
+           (!st->codec_info_nb_frames && avctx->codec &&
+            (avctx->codec->capabilities & AV_CODEC_CAP_CHANNEL_CONF));
+}
+
+/* Probe frames of a stream decoded on a worker thread. The worker decodes
+ * through a shadow copy of the stream which owns the stream's codec context,
+ * while the parser and the timestamp code on the demuxing thread use a
+ * stand-in context. The decoding context is handed back by
+ * probe_thread_stop(), together with what the parser and the demuxer
+ * stored in the stand-in. */
+typedef struct ProbeThread {
+    AVFormatContext *s;
+    AVStream shadow;
+    AVStreamInternal shadow_internal;
+    /* the stand-in context as it was created, to find what changed in it */
+    AVCodecContext *orig;
+    AVDictionary *opts;
+    AVDictionary **opts_dst;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    AVPacketList *queue, *queue_end;
+    int eof;
+    int abort;
+    /* set once the worker needs no more packets */
+    int complete;
+    int has_b_frames;
+    int nb_decoded_frames;
+} ProbeThread;
+
+static void *probe_thread_main(void *arg)
+{
+    ProbeThread *p = arg;
+    AVStream *st = &p->shadow;
+    AVPacket pkt;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->complete) {
+        while (!p->queue && !p->eof && !p->abort)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (p->abort || !p->queue)
+            break;
+        ff_packet_list_get(&p->queue, &p->queue_end, &pkt);
+        pthread_mutex_unlock(&p->lock);
+
+        try_decode_frame(p->s, st, &pkt, p->opts_dst ? &p->opts : NULL);
+        av_packet_unref(&pkt);
+        st->codec_info_nb_frames++;
+
+        pthread_mutex_lock(&p->lock);
+        p->complete          = !probe_needs_decode(st);
+        p->has_b_frames      = st->internal->avctx->has_b_frames;
+        p->nb_decoded_frames = st->nb_decoded_frames;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+static int probe_thread_start(AVFormatContext *s, AVStream *st,
+                              AVDictionary **opts)
+{
+    AVStreamInternal *sti = st->internal;
+    AVCodecParameters *par = NULL;
+    AVCodecContext *avctx = NULL;
+    ProbeThread *p;
+    int ret;
+
+    p = av_mallocz(sizeof(*p));
+    if (!p)
+        return AVERROR(ENOMEM);
+
+    p->shadow          = *st;
+    p->shadow.internal = &p->shadow_internal;
+    p->shadow.info     = av_memdup(st->info, sizeof(*st->info));
+    p->shadow.codecpar = avcodec_parameters_alloc();
+    par                = avcodec_parameters_alloc();
+    avctx              = avcodec_alloc_context3(NULL);
+    p->orig            = avcodec_alloc_context3(NULL);
+    if (!p->shadow.info || !p->shadow.codecpar || !par || !avctx || !p->orig) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    p->shadow.info->duration_error = NULL;
+
+    /* the demuxing thread continues with a copy of the codec context */
+    if ((ret = avcodec_parameters_copy(p->shadow.codecpar, st->codecpar)) < 0 ||
+        (ret = avcodec_parameters_from_context(par, sti->avctx)) < 0 ||
+        (ret = avcodec_parameters_to_context(avctx, par)) < 0 ||
+        (ret = avcodec_parameters_to_context(p->orig, par)) < 0)
+        goto fail;
+    avctx->time_base       = p->orig->time_base       = sti->avctx->time_base;
+    avctx->pkt_timebase    = p->orig->pkt_timebase    = sti->avctx->pkt_timebase;
+    avctx->framerate       = p->orig->framerate       = sti->avctx->framerate;
+    avctx->ticks_per_frame = p->orig->ticks_per_frame = sti->avctx->ticks_per_frame;
+
+    p->s                 = s;
+    p->has_b_frames      = sti->avctx->has_b_frames;
+    p->nb_decoded_frames = st->nb_decoded_frames;
+    p->opts_dst          = opts;
+    if (opts)
+        FFSWAP(AVDictionary *, p->opts, *opts);
+    p->shadow_internal.avctx = sti->avctx;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    ret = AVERROR(pthread_create(&p->thread, NULL, probe_thread_main, p));
+    if (ret < 0) {
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->lock);
+        if (opts)
+            FFSWAP(AVDictionary *, p->opts, *opts);
+        goto fail;
+    }
+
+    av_log(s, AV_LOG_DEBUG, "Decoding probe frames of stream %d on a worker thread\n",
+           st->index);
+    sti->avctx        = avctx;
+    sti->probe_thread = p;
+    avcodec_parameters_free(&par);
+    return 0;
+fail:
+    avcodec_free_context(&avctx);
+    avcodec_free_context(&p->orig);
+    avcodec_parameters_free(&par);
+    avcodec_parameters_free(&p->shadow.codecpar);
+    av_freep(&p->shadow.info);
+    av_free(p);
+    return ret;
+}
+
+/**
+ * Copy the fields the parser and the demuxer changed in the stand-in context
+ * src to the decoding context dst, unless the decoder changed them as well.
+ * This gives the same result as if both had used the same context, with the
+ * decoder running after the parser.
+ */
+static void probe_thread_merge_context(AVCodecContext *dst, const AVCodecContext *src,
+                                       const AVCodecContext *orig)
+{
+#define MERGE(field)                                                        \
+    if ( memcmp(&src->field, &orig->field, sizeof(src->field)) &&           \
+        !memcmp(&dst->field, &orig->field, sizeof(dst->field)))             \
+        dst->field = src->field
+    MERGE(width);
+    MERGE(height);
+    MERGE(sample_aspect_ratio);
+    MERGE(pix_fmt);
+    MERGE(field_order);
+    MERGE(has_b_frames);
+    MERGE(framerate);
+    MERGE(time_base);
+    MERGE(ticks_per_frame);
+    MERGE(profile);
+    MERGE(level);
+    MERGE(bit_rate);
+    MERGE(rc_max_rate);
+    MERGE(bits_per_raw_sample);
+    MERGE(sample_rate);
+    MERGE(channels);
+    MERGE(channel_layout);
+    MERGE(sample_fmt);
+    MERGE(frame_size);
+    MERGE(audio_service_type);
+#undef MERGE
+}
+
+/**
+ * Join the worker of st and hand the decoding context back to the stream.
+ *
+ * @param abort    drop the packets the worker has not decoded yet
+ * @param discard  drop the decoding state, e.g. because the codec changed
+ */
+static void probe_thread_stop(AVStream *st, int abort, int discard)
+{
+    AVStreamInternal *sti = st->internal;
+    ProbeThread *p = sti->probe_thread;
+    AVCodecContext *avctx = p->shadow_internal.avctx;
+
+    pthread_mutex_lock(&p->lock);
+    p->eof   = 1;
+    p->abort = abort || discard;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+    ff_packet_list_free(&p->queue, &p->queue_end);
+
+    if (discard) {
+        avcodec_free_context(&avctx);
+        st->info->found_decoder = 0;
+    } else {
+        if (!avctx->extradata && sti->avctx->extradata) {
+            avctx->extradata      = sti->avctx->extradata;
+            avctx->extradata_size = sti->avctx->extradata_size;
+            sti->avctx->extradata      = NULL;
+            sti->avctx->extradata_size = 0;
+        }
+        probe_thread_merge_context(avctx, sti->avctx, p->orig);
+        avcodec_free_context(&sti->avctx);
+        sti->avctx = avctx;
+        st->info->found_decoder = p->shadow.info->found_decoder;
+        st->nb_decoded_frames   = p->shadow.nb_decoded_frames;
+    }
+    if (p->opts_dst) {
+        av_dict_free(p->opts_dst);
+        *p->opts_dst = p->opts;
+    }
+
+    avcodec_free_context(&p->orig);
+    avcodec_parameters_free(&p->shadow.codecpar);
+    av_freep(&p->shadow.info);
+    av_freep(&sti->probe_thread);
+}
+
+/* returns 1 if the worker of st needs no more packets */
+static int probe_thread_complete(AVStream *st)
+{
+    ProbeThread *p = st->internal->probe_thread;
+    int complete;
+
+    pthread_mutex_lock(&p->lock);
+    complete = p->complete;
+    pthread_mutex_unlock(&p->lock);
+    return complete;
+}
+
+static int probe_thread_send(AVStream *st, AVPacket *pkt)
+{
+    ProbeThread *p = st->internal->probe_thread;
+    int ret;
+
+    pthread_mutex_lock(&p->lock);
+    ret = ff_packet_list_put(&p->queue, &p->queue_end, pkt,
+                             FF_PACKETLIST_FLAG_REF_PACKET);
+    pthread_cond_signal(&p->cond);
+    /* let the timestamp code see what the decoder found so far */
+    st->internal->avctx->has_b_frames = FFMAX(st->internal->avctx->has_b_frames,
+                                              p->has_b_frames);
+    st->nb_decoded_frames             = p->nb_decoded_frames;
+    pthread_mutex_unlock(&p->lock);
+    return ret;
+}
+#endif
+
 int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
 {
     int i, count = 0, ret = 0, j;
@@ -3578,6 +3972,8 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
     int64_t probesize = ic->probesize;
     int eof_reached = 0;
     int *missing_streams = av_opt_ptr(ic->iformat->priv_class, ic->priv_data, "missing_streams");
+    int nb_probe_threads = 0;
+    int probe_cached = 0;
 
     flush_codecs = probesize > 0;
 
@@ -3599,6 +3995,17 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
         av_log(ic, AV_LOG_DEBUG, "Before avformat_find_stream_info() pos: %"PRId64" bytes read:%"PRId64" seeks:%d nb_streams:%d\n",
                avio_tell(ic->pb), ic->pb->bytes_read, ic->pb->seek_count, ic->nb_streams);
 
+    if (ic->probe_cache) {
+        ret = ff_probe_cache_load(ic);
+        if (ret < 0)
+            goto find_stream_info_err;
+        if (ret > 0) {
+            probe_cached = 1;
+            ret = 0;
+            goto probe_cache_done;
+        }
+    }
+
     for (i = 0; i < ic->nb_streams; i++) {
         const AVCodec *codec;
         AVDictionary *thread_opt = NULL;
@@ -3699,6 +4106,14 @@ FF_ENABLE_DEPRECATION_WARNINGS
             int count;
 
             st = ic->streams[i];
+#if HAVE_THREADS
+            if (st->internal->probe_thread) {
+                if (!probe_thread_complete(st))
+                    break;
+                probe_thread_stop(st, 0, 0);
+                nb_probe_threads--;
+            }
+#endif
             if (!has_codec_parameters(st, NULL))
                 break;
             /* If the timebase is coarse (like the usual millisecond precision
@@ -3897,6 +4312,30 @@ FF_ENABLE_DEPRECATION_WARNINGS
          * least one frame of codec data, this makes sure the codec initializes
          * the channel configuration and does not only trust the values from
          * the container. */
+#if HAVE_THREADS
+        if (st->internal->probe_thread &&
+            (st->codecpar->codec_id != st->internal->probe_thread->shadow.codecpar->codec_id ||
+             probe_thread_complete(st))) {
+            probe_thread_stop(st, 0, st->codecpar->codec_id !=
+                              st->internal->probe_thread->shadow.codecpar->codec_id);
+            nb_probe_threads--;
+        }
+        if (!st->internal->probe_thread && nb_probe_threads < ic->probe_threads &&
+            (avctx->codec_type == AVMEDIA_TYPE_VIDEO ||
+             avctx->codec_type == AVMEDIA_TYPE_AUDIO) &&
+            probe_needs_decode(st)) {
+            ret = probe_thread_start(ic, st, (options && st->index < orig_nb_streams) ?
+                                             &options[st->index] : NULL);
+            if (ret < 0)
+                goto find_stream_info_err;
+            nb_probe_threads++;
+        }
+        if (st->internal->probe_thread) {
+            ret = probe_thread_send(st, pkt);
+            if (ret < 0)
+                goto find_stream_info_err;
+        } else
+#endif
         try_decode_frame(ic, st, pkt,
                          (options && i < orig_nb_streams) ? &options[i] : NULL);
 
@@ -3907,6 +4346,12 @@ FF_ENABLE_DEPRECATION_WARNINGS
         count++;
     }
 
+#if HAVE_THREADS
+    for (i = 0; i < ic->nb_streams; i++)
+        if (ic->streams[i]->internal->probe_thread)
+            probe_thread_stop(ic->streams[i], 0, 0);
+#endif
+
     if (eof_reached) {
         int stream_index;
         for (stream_index = 0; stream_index < ic->nb_streams; stream_index++) {
@@ -4055,6 +4500,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
     if (probesize)
         estimate_timings(ic, old_offset);
 
+probe_cache_done:
     av_opt_set(ic, "skip_clear", "0", AV_OPT_SEARCH_CHILDREN);
 
     if (ret >= 0 && ic->nb_streams)
@@ -4147,9 +4593,20 @@ FF_ENABLE_DEPRECATION_WARNINGS
         st->internal->avctx_inited = 0;
     }
 
+    if (ic->probe_cache && !probe_cached) {
+        int err = ff_probe_cache_store(ic);
+        if (err < 0)
+            av_log(ic, AV_LOG_WARNING, "Could not write the probe cache: %s\n",
+                   av_err2str(err));
+    }
+
 find_stream_info_err:
     for (i = 0; i < ic->nb_streams; i++) {
         st = ic->streams[i];
+#if HAVE_THREADS
+        if (st->internal->probe_thread)
+            probe_thread_stop(st, 1, 0);
+#endif
         if (st->info)
             av_freep(&st->info->duration_error);
         avcodec_close(ic->streams[i]->internal->avctx);
@@ -4351,6 +4808,7 @@ static void free_stream(AVStream **pst)
             av_freep(&st->internal->bsfcs);
         }
         av_freep(&st->internal->priv_pts);
+        av_freep(&st->internal->index_pending);
         av_bsf_free(&st->internal->extract_extradata.bsf);
         av_packet_free(&st->internal->extract_extradata.pkt);
     }
@@ -4399,6 +4857,10 @@ void avformat_free_context(AVFormatContext *s)
     if (s->oformat && s->oformat->priv_class && s->priv_data)
         av_opt_free(s->priv_data);
 
+    if (s->internal) {
+        ff_interleave_free(s);
+        av_freep(&s->internal->interleave_heap);
+    }
     for (i = s->nb_streams - 1; i >= 0; i--)
         ff_free_stream(s, s->streams[i]);
 
@@ -4417,6 +4879,7 @@ void avformat_free_context(AVFormatContext *s)
     av_freep(&s->chapters);
     av_dict_free(&s->metadata);
     av_dict_free(&s->internal->id3v2_meta);
+    av_freep(&s->internal->probe_cache_entry);
     av_freep(&s->streams);
     flush_packet_queue(s);
     av_freep(&s->internal);
@@ -4441,6 +4904,9 @@ void avformat_close_input(AVFormatContext **ps)
 
     flush_packet_queue(s);
 
+    if (s->iformat)
+        ff_probe_cache_close(s);
+
     if (s->iformat)
         if (s->iformat->read_close)
             s->iformat->read_close(s);
@@ -25,32 +25,25 @@
 #include "mem.h"
 #include "thread.h"
 
-AVBufferRef *av_buffer_create(uint8_t *data, int size,
-                              void (*free)(void *opaque, uint8_t *data),
-                              void *opaque, int flags)
+/* initialize buf and return a new reference to it, buf itself is not freed
+ * on failure */
+static AVBufferRef *buffer_create(AVBuffer *buf, uint8_t *data, int size,
+                                  void (*free)(void *opaque, uint8_t *data),
+                                  void *opaque, int flags)
 {
     AVBufferRef *ref = NULL;
-    AVBuffer    *buf = NULL;
-
-    buf = av_mallocz(sizeof(*buf));
-    if (!buf)
-        return NULL;
 
     buf->data     = data;
     buf->size     = size;
     buf->free     = free ? free : av_buffer_default_free;
     buf->opaque   = opaque;
+    buf->flags    = flags;
 
     atomic_init(&buf->refcount, 1);
 
-    if (flags & AV_BUFFER_FLAG_READONLY)
-        buf->flags |= BUFFER_FLAG_READONLY;
-
     ref = av_mallocz(sizeof(*ref));
-    if (!ref) {
-        av_freep(&buf);
+    if (!ref)
         return NULL;
-    }
 
     ref->buffer = buf;
     ref->data   = data;
@@ -59,6 +52,27 @@ AVBufferRef *av_buffer_create(uint8_t *data, int size,
     return ref;
 }
 
+AVBufferRef *av_buffer_create(uint8_t *data, int size,
+                              void (*free)(void *opaque, uint8_t *data),
+                              void *opaque, int flags)
+{
+    AVBufferRef *ref = NULL;
+    AVBuffer    *buf = NULL;
+
+    buf = av_mallocz(sizeof(*buf));
+    if (!buf)
+        return NULL;
+
+    ref = buffer_create(buf, data, size, free, opaque,
+                        flags & AV_BUFFER_FLAG_READONLY ? BUFFER_FLAG_READONLY : 0);
+    if (!ref) {
+        av_freep(&buf);
+        return NULL;
+    }
+
+    return ref;
+}
+
 void av_buffer_default_free(void *opaque, uint8_t *data)
 {
     av_free(data);
@@ -117,8 +131,13 @@ static void buffer_replace(AVBufferRef **dst, AVBufferRef **src)
         av_freep(dst);
 
     if (atomic_fetch_add_explicit(&b->refcount, -1, memory_order_acq_rel) == 1) {
+        /* b->free() may hand the structure containing b back to a pool,
+         * so the flag has to be read before calling it */
+        int free_avbuffer = !(b->flags & BUFFER_FLAG_NO_FREE);
+
         b->free(b->opaque, b->data);
-        av_freep(&b);
+        if (free_avbuffer)
+            av_freep(&b);
     }
 }
 
@@ -231,6 +250,7 @@ AVBufferPool *av_buffer_pool_init2(int size, void *opaque,
     pool->pool_free = pool_free;
 
     atomic_init(&pool->refcount, 1);
+    atomic_init(&pool->free_list, 0);
 
     return pool;
 }
@@ -247,23 +267,33 @@ AVBufferPool *av_buffer_pool_init(int size, AVBufferRef* (*alloc)(int size))
     pool->alloc    = alloc ? alloc : av_buffer_alloc;
 
     atomic_init(&pool->refcount, 1);
+    atomic_init(&pool->free_list, 0);
 
     return pool;
 }
 
+static BufferPoolEntry *pool_entry(AVBufferPool *pool, unsigned index)
+{
+    int k = av_log2(index);
+    return pool->entries[k][index - (1U << k)];
+}
+
 /*
  * This function gets called when the pool has been uninited and
  * all the buffers returned to it.
  */
 static void buffer_pool_free(AVBufferPool *pool)
 {
-    while (pool->pool) {
-        BufferPoolEntry *buf = pool->pool;
-        pool->pool = buf->next;
+    unsigned i;
+
+    for (i = 1; i <= pool->nb_entries; i++) {
+        BufferPoolEntry *buf = pool_entry(pool, i);
 
         buf->free(buf->opaque, buf->data);
-        av_freep(&buf);
+        av_free(buf);
     }
+    for (i = 0; i < FF_ARRAY_ELEMS(pool->entries); i++)
+        av_freep(&pool->entries[i]);
     ff_mutex_destroy(&pool->mutex);
 
     if (pool->pool_free)
@@ -285,18 +315,56 @@ void av_buffer_pool_uninit(AVBufferPool **ppool)
         buffer_pool_free(pool);
 }
 
+static void pool_push(AVBufferPool *pool, BufferPoolEntry *buf)
+{
+    uintptr_t head = atomic_load_explicit(&pool->free_list, memory_order_relaxed);
+    uintptr_t tag;
+
+    do {
+        atomic_store_explicit(&buf->next, head & POOL_INDEX_MASK, memory_order_relaxed);
+        tag = (head >> POOL_INDEX_BITS) + 1;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_list, &head,
+                                                    tag << POOL_INDEX_BITS | buf->index,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+static BufferPoolEntry *pool_pop(AVBufferPool *pool)
+{
+    uintptr_t head = atomic_load_explicit(&pool->free_list, memory_order_acquire);
+    BufferPoolEntry *buf;
+    uintptr_t tag, next;
+
+    do {
+        if (!(head & POOL_INDEX_MASK))
+            return NULL;
+        /* pooled entries are only freed with the pool, so this is safe even
+         * if another thread pops buf first; the tag then makes the exchange
+         * below fail */
+        buf  = pool_entry(pool, head & POOL_INDEX_MASK);
+        next = atomic_load_explicit(&buf->next, memory_order_relaxed);
+        tag  = (head >> POOL_INDEX_BITS) + 1;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_list, &head,
+                                                    tag << POOL_INDEX_BITS | next,
+                                                    memory_order_acquire,
+                                                    memory_order_acquire));
+
+    return buf;
+}
+
 static void pool_release_buffer(void *opaque, uint8_t *data)
 {
     BufferPoolEntry *buf = opaque;
     AVBufferPool *pool = buf->pool;
 
-    if(CONFIG_MEMORY_POISONING)
-        memset(buf->data, FF_MEMORY_POISON, pool->size);
-
-    ff_mutex_lock(&pool->mutex);
-    buf->next = pool->pool;
-    pool->pool = buf;
-    ff_mutex_unlock(&pool->mutex);
+    if (!buf->index) {
+        buf->free(buf->opaque, buf->data);
+        av_free(buf);
+    } else {
+        if(CONFIG_MEMORY_POISONING)
+            memset(buf->data, FF_MEMORY_POISON, pool->size);
+        pool_push(pool, buf);
+    }
 
     if (atomic_fetch_add_explicit(&pool->refcount, -1, memory_order_acq_rel) == 1)
         buffer_pool_free(pool);
@@ -320,6 +388,24 @@ static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
         return NULL;
     }
 
+    /* give the entry an index if there is still room for it */
+    if (pool->nb_entries < POOL_INDEX_MASK) {
+        unsigned index = pool->nb_entries + 1;
+        int k = av_log2(index);
+
+        if (index == 1U << k) {
+            pool->entries[k] = av_malloc_array(1U << k, sizeof(*pool->entries[k]));
+            if (!pool->entries[k]) {
+                av_free(buf);
+                av_buffer_unref(&ret);
+                return NULL;
+            }
+        }
+        pool->entries[k][index - (1U << k)] = buf;
+        pool->nb_entries = index;
+        buf->index       = index;
+    }
+
     buf->data   = ret->buffer->data;
     buf->opaque = ret->buffer->opaque;
     buf->free   = ret->buffer->free;
@@ -333,22 +419,22 @@ static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
 
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
 {
-    AVBufferRef *ret;
+    AVBufferRef *ret = NULL;
     BufferPoolEntry *buf;
 
-    ff_mutex_lock(&pool->mutex);
-    buf = pool->pool;
+    /* Only the (rare) allocation of new buffers takes the lock, the alloc
+     * callbacks may rely on being serialized. */
+    buf = pool_pop(pool);
     if (buf) {
-        ret = av_buffer_create(buf->data, pool->size, pool_release_buffer,
-                               buf, 0);
-        if (ret) {
-            pool->pool = buf->next;
-            buf->next = NULL;
-        }
+        ret = buffer_create(&buf->buffer, buf->data, pool->size,
+                            pool_release_buffer, buf, BUFFER_FLAG_NO_FREE);
+        if (!ret)
+            pool_push(pool, buf);
     } else {
+        ff_mutex_lock(&pool->mutex);
         ret = pool_alloc_buffer(pool);
+        ff_mutex_unlock(&pool->mutex);
     }
-    ff_mutex_unlock(&pool->mutex);
 
     if (ret)
         atomic_fetch_add_explicit(&pool->refcount, 1, memory_order_relaxed);
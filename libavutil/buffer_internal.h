@@ -33,6 +33,11 @@
  * The buffer was av_realloc()ed, so it is reallocatable.
  */
 #define BUFFER_FLAG_REALLOCATABLE (1 << 1)
+/**
+ * The AVBuffer structure is part of a larger structure
+ * and must not be freed on its own.
+ */
+#define BUFFER_FLAG_NO_FREE       (1 << 2)
 
 struct AVBuffer {
     uint8_t *data; /**< data described by this buffer */
@@ -70,12 +75,49 @@ typedef struct BufferPoolEntry {
     void (*free)(void *opaque, uint8_t *data);
 
     AVBufferPool *pool;
-    struct BufferPoolEntry *next;
+
+    /*
+     * Position of this entry in AVBufferPool.entries, starting from 1, or 0
+     * if the entry does not fit in the free list and is freed on release.
+     */
+    unsigned index;
+
+    /*
+     * Index of the entry below this one in the free list, 0 for the last one.
+     */
+    atomic_uint next;
+
+    /*
+     * An AVBuffer structure to (re)use as AVBuffer for subsequent uses
+     * of this BufferPoolEntry, saving one allocation per get.
+     */
+    AVBuffer buffer;
 } BufferPoolEntry;
 
+/*
+ * The free list head packs the index of the first entry in the low half of
+ * the word and a tag in the high half. The tag changes on every push and
+ * pop, so that a pop which read a stale next index fails its
+ * compare-and-swap instead of corrupting the list (ABA problem).
+ */
+#define POOL_INDEX_BITS (sizeof(uintptr_t) * 4)
+#define POOL_INDEX_MASK (((uintptr_t)1 << POOL_INDEX_BITS) - 1)
+
 struct AVBufferPool {
+    /*
+     * Serializes the allocation of new entries, the alloc callbacks may
+     * rely on it. Getting and releasing pooled entries does not lock.
+     */
     AVMutex mutex;
-    BufferPoolEntry *pool;
+    atomic_uintptr_t free_list;
+
+    /*
+     * All the pooled entries, by index: entries[k] holds the 2^k entries
+     * with an index from 2^k to 2^(k+1) - 1, so that entries never move
+     * once allocated and can be looked up without locking.
+     */
+    BufferPoolEntry **entries[sizeof(uintptr_t) * 4];
+    unsigned nb_entries;
 
     /*
      * This is used to track when the pool is to be freed.
@@ -24,6 +24,28 @@
 
 #if HAVE_PTHREADS || HAVE_W32THREADS || HAVE_OS2THREADS
 
+/**
+ * Worker threads shared by all the contexts created with
+ * avpriv_slicethread_create_shared().
+ */
+typedef struct SharedPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    pthread_t       *threads;
+    int             nb_workers;
+    int             nb_idle;
+    int             max_workers;
+    int             finished;
+
+    /* contexts waiting for workers, served round-robin */
+    AVSliceThread   *first;
+    AVSliceThread   *last;
+} SharedPool;
+
+static AVMutex shared_pool_lock = AV_MUTEX_INITIALIZER;
+static SharedPool *shared_pool;
+static int shared_pool_users;
+
 typedef struct WorkerContext {
     AVSliceThread   *ctx;
     pthread_mutex_t mutex;
@@ -48,6 +70,13 @@ struct AVSliceThread {
     void            *priv;
     void            (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads);
     void            (*main_func)(void *priv);
+
+    /* shared pool state, protected by pool->mutex */
+    SharedPool      *pool;
+    AVSliceThread   *next;
+    int             queued;
+    int             nb_joined;
+    int             nb_running;
 };
 
 static int run_jobs(AVSliceThread *ctx)
@@ -91,6 +120,216 @@ static void *attribute_align_arg thread_worker(void *v)
     }
 }
 
+static void shared_pool_push(SharedPool *pool, AVSliceThread *ctx)
+{
+    ctx->next   = NULL;
+    ctx->queued = 1;
+    if (pool->last)
+        pool->last->next = ctx;
+    else
+        pool->first = ctx;
+    pool->last = ctx;
+}
+
+static void shared_pool_remove(SharedPool *pool, AVSliceThread *ctx)
+{
+    AVSliceThread **p = &pool->first, *prev = NULL;
+
+    while (*p != ctx) {
+        prev = *p;
+        p    = &(*p)->next;
+    }
+    *p = ctx->next;
+    if (pool->last == ctx)
+        pool->last = prev;
+    ctx->next   = NULL;
+    ctx->queued = 0;
+}
+
+static void run_shared_jobs(AVSliceThread *ctx, int threadnr)
+{
+    unsigned nb_jobs = ctx->nb_jobs;
+    unsigned jobnr;
+
+    /* as with private threads, thread 0 always starts with job 0 */
+    if (!threadnr)
+        ctx->worker_func(ctx->priv, 0, 0, nb_jobs, ctx->nb_active_threads);
+
+    while ((jobnr = atomic_fetch_add_explicit(&ctx->current_job, 1, memory_order_acq_rel)) < nb_jobs)
+        ctx->worker_func(ctx->priv, jobnr, threadnr, nb_jobs, ctx->nb_active_threads);
+}
+
+static void *attribute_align_arg shared_worker(void *v)
+{
+    SharedPool *pool = v;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->finished) {
+        AVSliceThread *ctx = pool->first;
+        int threadnr;
+
+        if (!ctx) {
+            pool->nb_idle++;
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+            pool->nb_idle--;
+            continue;
+        }
+
+        /* take one slot of the first context and requeue it at the end, so
+         * that the workers are spread evenly over the busy contexts */
+        shared_pool_remove(pool, ctx);
+        if (atomic_load_explicit(&ctx->current_job, memory_order_relaxed) >= ctx->nb_jobs)
+            continue;
+        threadnr = ctx->nb_joined++;
+        ctx->nb_running++;
+        if (ctx->nb_joined < ctx->nb_active_threads)
+            shared_pool_push(pool, ctx);
+        pthread_mutex_unlock(&pool->mutex);
+
+        run_shared_jobs(ctx, threadnr);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (!--ctx->nb_running)
+            pthread_cond_signal(&ctx->done_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+static SharedPool *shared_pool_ref(int max_workers)
+{
+    SharedPool *pool;
+
+    ff_mutex_lock(&shared_pool_lock);
+    if (!shared_pool && (shared_pool = av_mallocz(sizeof(*shared_pool)))) {
+        pthread_mutex_init(&shared_pool->mutex, NULL);
+        pthread_cond_init(&shared_pool->cond, NULL);
+    }
+    pool = shared_pool;
+    if (pool) {
+        shared_pool_users++;
+        pthread_mutex_lock(&pool->mutex);
+        pool->max_workers = FFMAX(pool->max_workers, max_workers);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    ff_mutex_unlock(&shared_pool_lock);
+
+    return pool;
+}
+
+static void shared_pool_unref(SharedPool *pool)
+{
+    int i;
+
+    ff_mutex_lock(&shared_pool_lock);
+    if (--shared_pool_users) {
+        ff_mutex_unlock(&shared_pool_lock);
+        return;
+    }
+    shared_pool = NULL;
+    ff_mutex_unlock(&shared_pool_lock);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->finished = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->nb_workers; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    av_freep(&pool->threads);
+    av_free(pool);
+}
+
+/* start enough workers for nb_wanted more participants, pool->mutex held */
+static void shared_pool_spawn(SharedPool *pool, int nb_wanted)
+{
+    int nb_new = FFMIN(nb_wanted - pool->nb_idle, pool->max_workers - pool->nb_workers);
+    pthread_t *threads;
+
+    if (nb_new <= 0)
+        return;
+    threads = av_realloc_array(pool->threads, pool->nb_workers + nb_new, sizeof(*threads));
+    if (!threads)
+        return;
+    pool->threads = threads;
+
+    while (nb_new--) {
+        if (pthread_create(&pool->threads[pool->nb_workers], NULL, shared_worker, pool))
+            return;
+        pool->nb_workers++;
+    }
+}
+
+static void shared_execute(AVSliceThread *ctx, int nb_jobs)
+{
+    SharedPool *pool = ctx->pool;
+
+    ctx->nb_jobs           = nb_jobs;
+    ctx->nb_active_threads = FFMIN(nb_jobs, ctx->nb_threads);
+    atomic_store_explicit(&ctx->current_job, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&pool->mutex);
+    /* the calling thread always takes part, so jobs never wait for the pool */
+    ctx->nb_joined  = 1;
+    ctx->nb_running = 1;
+    if (ctx->nb_active_threads > 1) {
+        shared_pool_push(pool, ctx);
+        shared_pool_spawn(pool, ctx->nb_active_threads - 1);
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    run_shared_jobs(ctx, 0);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (ctx->queued)
+        shared_pool_remove(pool, ctx);
+    ctx->nb_running--;
+    while (ctx->nb_running)
+        pthread_cond_wait(&ctx->done_cond, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+int avpriv_slicethread_create_shared(AVSliceThread **pctx, void *priv,
+                                     void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                     int nb_threads, int max_workers)
+{
+    AVSliceThread *ctx;
+
+    av_assert0(nb_threads >= 0 && max_workers > 0);
+    if (!nb_threads) {
+        int nb_cpus = av_cpu_count();
+        if (nb_cpus > 1)
+            nb_threads = nb_cpus + 1;
+        else
+            nb_threads = 1;
+    }
+
+    *pctx = ctx = av_mallocz(sizeof(*ctx));
+    if (!ctx)
+        return AVERROR(ENOMEM);
+
+    ctx->pool = shared_pool_ref(max_workers);
+    if (!ctx->pool) {
+        av_freep(pctx);
+        return AVERROR(ENOMEM);
+    }
+
+    ctx->priv        = priv;
+    ctx->worker_func = worker_func;
+    ctx->nb_threads  = FFMIN(nb_threads, max_workers + 1);
+    atomic_init(&ctx->first_job, 0);
+    atomic_init(&ctx->current_job, 0);
+    pthread_mutex_init(&ctx->done_mutex, NULL);
+    pthread_cond_init(&ctx->done_cond, NULL);
+
+    return ctx->nb_threads;
+}
+
 int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
                               void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
                               void (*main_func)(void *priv),
@@ -166,6 +405,11 @@ void avpriv_slicethread_execute(AVSliceThread *ctx, int nb_jobs, int execute_mai
     int nb_workers, i, is_last = 0;
 
     av_assert0(nb_jobs > 0);
+    if (ctx->pool) {
+        shared_execute(ctx, nb_jobs);
+        return;
+    }
+
     ctx->nb_jobs           = nb_jobs;
     ctx->nb_active_threads = FFMIN(nb_jobs, ctx->nb_threads);
     atomic_store_explicit(&ctx->first_job, 0, memory_order_relaxed);
@@ -205,6 +449,14 @@ void avpriv_slicethread_free(AVSliceThread **pctx)
         return;
 
     ctx = *pctx;
+    if (ctx->pool) {
+        shared_pool_unref(ctx->pool);
+        pthread_cond_destroy(&ctx->done_cond);
+        pthread_mutex_destroy(&ctx->done_mutex);
+        av_freep(pctx);
+        return;
+    }
+
     nb_workers = ctx->nb_threads;
     if (!ctx->main_func)
         nb_workers--;
@@ -242,6 +494,14 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
     return AVERROR(EINVAL);
 }
 
+int avpriv_slicethread_create_shared(AVSliceThread **pctx, void *priv,
+                                     void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                     int nb_threads, int max_workers)
+{
+    *pctx = NULL;
+    return AVERROR(EINVAL);
+}
+
 void avpriv_slicethread_execute(AVSliceThread *ctx, int nb_jobs, int execute_main)
 {
     av_assert0(0);
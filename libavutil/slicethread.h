@@ -35,6 +35,25 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
                               void (*main_func)(void *priv),
                               int nb_threads);
 
+/**
+ * Create slice threading context running on worker threads shared by all
+ * such contexts of the process, instead of threads of its own.
+ * The thread calling avpriv_slicethread_execute() always runs jobs itself,
+ * and up to nb_threads - 1 idle pool workers join it. Contexts waiting for
+ * workers are served round-robin.
+ * @param pctx slice threading context returned here
+ * @param priv private pointer to be passed to callback function
+ * @param worker_func callback function to be executed
+ * @param nb_threads maximum number of threads running jobs of this context
+ *                   at once, 0 for automatic, must be >= 0
+ * @param max_workers maximum number of worker threads in the shared pool,
+ *                    the pool uses the largest value requested by its users
+ * @return return number of threads or negative AVERROR on failure
+ */
+int avpriv_slicethread_create_shared(AVSliceThread **pctx, void *priv,
+                                     void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                     int nb_threads, int max_workers);
+
 /**
  * Execute slice threading.
  * @param ctx slice threading context
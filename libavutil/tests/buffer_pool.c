@@ -0,0 +1,124 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This test program hammers a single AVBufferPool from several threads,
+ * checking that no buffer is ever handed out twice, and reports the
+ * get/unref throughput under contention.
+ *
+ * Usage: buffer_pool [threads [iterations]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/buffer.h"
+#include "libavutil/common.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#define MAX_THREADS 64
+#define BUF_SIZE    4096
+#define MAX_HELD    4
+
+typedef struct ThreadArg {
+    AVBufferPool *pool;
+    int id;
+    int iterations;
+    int64_t pairs;
+    int errors;
+} ThreadArg;
+
+static void *thread_main(void *opaque)
+{
+    ThreadArg *arg = opaque;
+    AVBufferRef *held[MAX_HELD] = { NULL };
+    int i, j;
+
+    for (i = 0; i < arg->iterations; i++) {
+        int n = 1 + i % MAX_HELD;
+
+        for (j = 0; j < n; j++) {
+            held[j] = av_buffer_pool_get(arg->pool);
+            if (!held[j]) {
+                arg->errors++;
+                break;
+            }
+            memset(held[j]->data, arg->id, 16);
+            arg->pairs++;
+        }
+        for (j = 0; j < n && held[j]; j++) {
+            int k;
+            for (k = 0; k < 16; k++)
+                if (held[j]->data[k] != (uint8_t)arg->id)
+                    arg->errors++;
+            av_buffer_unref(&held[j]);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    ThreadArg args[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    AVBufferPool *pool;
+    int nb_threads = argc > 1 ? atoi(argv[1]) : 4;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20000;
+    int64_t start, elapsed;
+    int64_t pairs = 0;
+    int i, ret, errors = 0;
+
+    if (nb_threads < 1 || nb_threads > MAX_THREADS || iterations < 1) {
+        fprintf(stderr, "Usage: %s [threads (1-%d) [iterations]]\n",
+                argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    pool = av_buffer_pool_init(BUF_SIZE, NULL);
+    if (!pool)
+        return 1;
+
+    start = av_gettime_relative();
+    for (i = 0; i < nb_threads; i++) {
+        args[i].pool       = pool;
+        args[i].id         = i + 1;
+        args[i].iterations = iterations;
+        args[i].pairs      = 0;
+        args[i].errors     = 0;
+        if ((ret = pthread_create(&threads[i], NULL, thread_main, &args[i]))) {
+            fprintf(stderr, "pthread_create failed: %s.\n", strerror(ret));
+            return 1;
+        }
+    }
+    for (i = 0; i < nb_threads; i++) {
+        pthread_join(threads[i], NULL);
+        pairs  += args[i].pairs;
+        errors += args[i].errors;
+    }
+    elapsed = av_gettime_relative() - start;
+
+    av_buffer_pool_uninit(&pool);
+
+    printf("%d threads, %"PRId64" get/unref pairs: %"PRId64" us, %.0f pairs/s\n",
+           nb_threads, pairs, elapsed, pairs * 1e6 / FFMAX(elapsed, 1));
+
+    return errors ? 2 : 0;
+}
@@ -234,14 +234,22 @@ static void lumRangeFromJpeg16_c(int16_t *_dst, int width)
     if (DEBUG_SWSCALE_BUFFERS)                  \
         av_log(c, AV_LOG_DEBUG, __VA_ARGS__)
 
-static int swscale(SwsContext *c, const uint8_t *src[],
-                   int srcStride[], int srcSliceY,
-                   int srcSliceH, uint8_t *dst[], int dstStride[])
+/**
+ * Scale the given source slice. If dstSliceY/dstSliceH select only a part of
+ * the output, the source must contain all the lines needed for that part, and
+ * the output lines are produced independently from any previous call.
+ */
+static int swscale_slice(SwsContext *c, const uint8_t *src[],
+                         int srcStride[], int srcSliceY, int srcSliceH,
+                         uint8_t *dst[], int dstStride[],
+                         int dstSliceY, int dstSliceH)
 {
     /* load a few things into local vars to make the code more readable?
      * and faster */
     const int dstW                   = c->dstW;
     const int dstH                   = c->dstH;
+    const int scale_dst              = dstSliceY > 0 || dstSliceH < dstH;
+    const int dstEnd                 = dstSliceY + dstSliceH;
 
     const enum AVPixelFormat dstFormat = c->dstFormat;
     const int flags                  = c->flags;
@@ -337,10 +345,16 @@ static int swscale(SwsContext *c, const uint8_t *src[],
         }
     }
 
-    /* Note the user might start scaling the picture in the middle so this
-     * will not get executed. This is not really intended but works
-     * currently, so people might do it. */
-    if (srcSliceY == 0) {
+    if (scale_dst) {
+        lumBufIndex  = -1;
+        chrBufIndex  = -1;
+        dstY         = dstSliceY;
+        lastInLumBuf = -1;
+        lastInChrBuf = -1;
+    } else if (srcSliceY == 0) {
+        /* Note the user might start scaling the picture in the middle so this
+         * will not get executed. This is not really intended but works
+         * currently, so people might do it. */
         lumBufIndex  = -1;
         chrBufIndex  = -1;
         dstY         = 0;
@@ -362,7 +376,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
     ff_init_slice_from_src(vout_slice, (uint8_t**)dst, dstStride, c->dstW,
             dstY, dstH, dstY >> c->chrDstVSubSample,
             AV_CEIL_RSHIFT(dstH, c->chrDstVSubSample), 0);
-    if (srcSliceY == 0) {
+    if (srcSliceY == 0 || scale_dst) {
         hout_slice->plane[0].sliceY = lastInLumBuf + 1;
         hout_slice->plane[1].sliceY = lastInChrBuf + 1;
         hout_slice->plane[2].sliceY = lastInChrBuf + 1;
@@ -375,7 +389,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
         hout_slice->width = dstW;
     }
 
-    for (; dstY < dstH; dstY++) {
+    for (; dstY < dstEnd; dstY++) {
         const int chrDstY = dstY >> c->chrDstVSubSample;
         int use_mmx_vfilter= c->use_mmx_vfilter;
 
@@ -527,6 +541,9 @@ static int swscale(SwsContext *c, const uint8_t *src[],
 #endif
     emms_c();
 
+    if (scale_dst)
+        return dstY - lastDstY;
+
     /* store changed local vars back in the context */
     c->dstY         = dstY;
     c->lumBufIndex  = lumBufIndex;
@@ -537,6 +554,14 @@ static int swscale(SwsContext *c, const uint8_t *src[],
     return dstY - lastDstY;
 }
 
+static int swscale(SwsContext *c, const uint8_t *src[],
+                   int srcStride[], int srcSliceY,
+                   int srcSliceH, uint8_t *dst[], int dstStride[])
+{
+    return swscale_slice(c, src, srcStride, srcSliceY, srcSliceH,
+                         dst, dstStride, 0, c->dstH);
+}
+
 av_cold void ff_sws_init_range_convert(SwsContext *c)
 {
     c->lumConvertRange = NULL;
@@ -752,16 +777,13 @@ static void rgb48Toxyz12(struct SwsContext *c, uint16_t *dst,
     }
 }
 
-/**
- * swscale wrapper, so we don't need to export the SwsContext.
- * Assumes planar YUV to be in YUV order instead of YVU.
- */
-int attribute_align_arg sws_scale(struct SwsContext *c,
-                                  const uint8_t * const srcSlice[],
-                                  const int srcStride[], int srcSliceY,
-                                  int srcSliceH, uint8_t *const dst[],
-                                  const int dstStride[])
+static int scale_internal(SwsContext *c,
+                          const uint8_t * const srcSlice[],
+                          const int srcStride[], int srcSliceY,
+                          int srcSliceH, uint8_t *const dst[],
+                          const int dstStride[], int dstSliceY, int dstSliceH)
 {
+    const int scale_dst = dstSliceY > 0 || dstSliceH < c->dstH;
     int i, ret;
     const uint8_t *src2[4];
     uint8_t *dst2[4];
@@ -983,11 +1005,16 @@ int attribute_align_arg sws_scale(struct SwsContext *c,
     /* reset slice direction at end of frame */
     if (srcSliceY_internal + srcSliceH == c->srcH)
         c->sliceDir = 0;
-    ret = c->swscale(c, src2, srcStride2, srcSliceY_internal, srcSliceH, dst2, dstStride2);
+    if (scale_dst)
+        ret = swscale_slice(c, src2, srcStride2, srcSliceY_internal, srcSliceH,
+                            dst2, dstStride2, dstSliceY, dstSliceH);
+    else
+        ret = c->swscale(c, src2, srcStride2, srcSliceY_internal, srcSliceH, dst2, dstStride2);
 
 
     if (c->dstXYZ && !(c->srcXYZ && c->srcW==c->dstW && c->srcH==c->dstH)) {
-        int dstY = c->dstY ? c->dstY : srcSliceY + srcSliceH;
+        int dstY = scale_dst ? dstSliceY + ret :
+                   c->dstY ? c->dstY : srcSliceY + srcSliceH;
         uint16_t *dst16 = (uint16_t*)(dst2[0] + (dstY - ret) * dstStride2[0]);
         av_assert0(dstY >= ret);
         av_assert0(ret >= 0);
@@ -1000,3 +1027,49 @@ int attribute_align_arg sws_scale(struct SwsContext *c,
     av_free(rgb0_tmp);
     return ret;
 }
+
+/**
+ * swscale wrapper, so we don't need to export the SwsContext.
+ * Assumes planar YUV to be in YUV order instead of YVU.
+ */
+int attribute_align_arg sws_scale(struct SwsContext *c,
+                                  const uint8_t * const srcSlice[],
+                                  const int srcStride[], int srcSliceY,
+                                  int srcSliceH, uint8_t *const dst[],
+                                  const int dstStride[])
+{
+    return scale_internal(c, srcSlice, srcStride, srcSliceY, srcSliceH,
+                          dst, dstStride, 0, c->dstH);
+}
+
+int attribute_align_arg sws_scale_dst_slice(struct SwsContext *c,
+                                            const uint8_t * const src[],
+                                            const int srcStride[],
+                                            uint8_t *const dst[],
+                                            const int dstStride[],
+                                            int dstSliceY, int dstSliceH)
+{
+    int align = 1 << c->chrDstVSubSample;
+
+    if (!src || !srcStride || !dst || !dstStride) {
+        av_log(c, AV_LOG_ERROR, "One of the input parameters to sws_scale_dst_slice() is NULL, please check the calling code\n");
+        return AVERROR(EINVAL);
+    }
+
+    if (dstSliceY < 0 || dstSliceH <= 0 || dstSliceY + dstSliceH > c->dstH ||
+        (dstSliceY & (align - 1)) ||
+        ((dstSliceH & (align - 1)) && dstSliceY + dstSliceH != c->dstH)) {
+        av_log(c, AV_LOG_ERROR, "Destination slice parameters %d, %d are invalid\n",
+               dstSliceY, dstSliceH);
+        return AVERROR(EINVAL);
+    }
+
+    /* unscaled converters and cascaded contexts work on source slices and
+     * error diffusion dithering carries state from one line to the next */
+    if (c->swscale != swscale || c->cascaded_context[0] ||
+        c->dither == SWS_DITHER_ED)
+        return AVERROR(ENOSYS);
+
+    return scale_internal(c, src, srcStride, 0, c->srcH,
+                          dst, dstStride, dstSliceY, dstSliceH);
+}
@@ -218,6 +218,39 @@ int sws_scale(struct SwsContext *c, const uint8_t *const srcSlice[],
               const int srcStride[], int srcSliceY, int srcSliceH,
               uint8_t *const dst[], const int dstStride[]);
 
+/**
+ * Scale the complete source image, but only output the rows
+ * dstSliceY to dstSliceY + dstSliceH - 1 of the destination image.
+ *
+ * The output does not depend on previous calls, so several contexts
+ * initialized with the same parameters can be used from different threads
+ * to produce different slices of the same destination image. The result is
+ * identical to what sws_scale() produces for these rows.
+ *
+ * @param c          the scaling context previously created with
+ *                   sws_getContext()
+ * @param src        the array containing the pointers to the planes of
+ *                   the whole source image
+ * @param srcStride  the array containing the strides for each plane of
+ *                   the source image
+ * @param dst        the array containing the pointers to the planes of
+ *                   the whole destination image
+ * @param dstStride  the array containing the strides for each plane of
+ *                   the destination image
+ * @param dstSliceY  the first row of the destination image to output; must
+ *                   be a multiple of the vertical chroma subsampling factor
+ *                   of the destination format
+ * @param dstSliceH  the number of rows to output; must be a multiple of the
+ *                   vertical chroma subsampling factor unless the slice ends
+ *                   at the bottom of the image
+ * @return           the number of rows written, AVERROR(ENOSYS) if the
+ *                   conversion performed by c cannot output independent
+ *                   slices, another negative error code on failure
+ */
+int sws_scale_dst_slice(struct SwsContext *c, const uint8_t *const src[],
+                        const int srcStride[], uint8_t *const dst[],
+                        const int dstStride[], int dstSliceY, int dstSliceH);
+
 /**
  * @param dstRange flag indicating the while-black range of the output (1=jpeg / 0=mpeg)
  * @param srcRange flag indicating the while-black range of the input (1=jpeg / 0=mpeg)
@@ -93,6 +93,15 @@ probetags(){
     run ffprobe${PROGSUF} -show_entries format_tags -v 0 "$@"
 }
 
+probethreads(){
+    serialfile="${outdir}/${test}.serial"
+    threadsfile="${outdir}/${test}.threads"
+    cleanfiles="$cleanfiles $serialfile $threadsfile"
+    run ffprobe${PROGSUF} -bitexact -show_streams -show_format -v 0 "$@" > "$serialfile" || return
+    run ffprobe${PROGSUF} -bitexact -show_streams -show_format -v 0 -probe_threads 2 "$@" > "$threadsfile" || return
+    diff -u "$serialfile" "$threadsfile" && cat "$serialfile"
+}
+
 runlocal(){
     test "${V:-0}" -gt 0 && echo ${base}/"$@" ${base} >&3
     ${base}/"$@" ${base}
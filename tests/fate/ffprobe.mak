@@ -29,6 +29,21 @@ FATE_FFPROBE-$(CONFIG_AVDEVICE) += fate-ffprobe_xml
 fate-ffprobe_xml: $(FFPROBE_TEST_FILE)
 fate-ffprobe_xml: CMD = run $(FFPROBE_COMMAND) -of xml
 
+tests/data/probe-threads.ts: TAG = GEN
+tests/data/probe-threads.ts: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< \
+        -f lavfi -i "testsrc=s=352x288:d=2[out0]; sine=d=2[out1]" \
+        -flags +bitexact+ildct+ilme -fflags +bitexact -top 1 \
+        -vcodec mpeg2video -b:v 1M -minrate 1M -maxrate 1M -bufsize 500k -acodec mp2 \
+        -y $(TARGET_PATH)/$@ 2>/dev/null
+
+FATE_FFPROBE-$(call ALLYES, AVDEVICE LAVFI_INDEV TESTSRC_FILTER SINE_FILTER  \
+                            MPEG2VIDEO_ENCODER MP2_ENCODER MPEGTS_MUXER      \
+                            MPEGTS_DEMUXER MPEGVIDEO_PARSER MPEGAUDIO_PARSER \
+                            MPEG2VIDEO_DECODER MP2_DECODER) += fate-ffprobe_probe_threads
+fate-ffprobe_probe_threads: tests/data/probe-threads.ts
+fate-ffprobe_probe_threads: CMD = probethreads tests/data/probe-threads.ts
+
 FATE_FFPROBE += $(FATE_FFPROBE-yes)
 
 fate-ffprobe: $(FATE_FFPROBE)
@@ -2,10 +2,23 @@
 #fate-async: libavformat/tests/async$(EXESUF)
 #fate-async: CMD = run libavformat/tests/async
 
+FATE_LIBAVFORMAT += fate-index
+fate-index: libavformat/tests/index$(EXESUF)
+fate-index: CMD = run libavformat/tests/index
+
 FATE_LIBAVFORMAT-$(CONFIG_NETWORK) += fate-noproxy
 fate-noproxy: libavformat/tests/noproxy$(EXESUF)
 fate-noproxy: CMD = run libavformat/tests/noproxy
 
+FATE_HLS_PREFETCH-$(call ALLYES, NETWORK HLS_DEMUXER HTTP_PROTOCOL MP3_DEMUXER) += fate-hls-prefetch
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += $(FATE_HLS_PREFETCH-yes)
+fate-hls-prefetch: libavformat/tests/hls$(EXESUF)
+fate-hls-prefetch: CMD = run libavformat/tests/hls
+
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += fate-readahead
+fate-readahead: libavformat/tests/readahead$(EXESUF)
+fate-readahead: CMD = run libavformat/tests/readahead
+
 FATE_LIBAVFORMAT-$(CONFIG_FFRTMPCRYPT_PROTOCOL) += fate-rtmpdh
 fate-rtmpdh: libavformat/tests/rtmpdh$(EXESUF)
 fate-rtmpdh: CMD = run libavformat/tests/rtmpdh
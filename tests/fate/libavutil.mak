@@ -48,6 +48,11 @@ fate-cpu: libavutil/tests/cpu$(EXESUF)
 fate-cpu: CMD = runecho libavutil/tests/cpu $(CPUFLAGS:%=-c%) $(THREADS:%=-t%)
 fate-cpu: CMP = null
 
+FATE_LIBAVUTIL-$(HAVE_THREADS) += fate-buffer_pool
+fate-buffer_pool: libavutil/tests/buffer_pool$(EXESUF)
+fate-buffer_pool: CMD = run libavutil/tests/buffer_pool
+fate-buffer_pool: CMP = null
+
 FATE_LIBAVUTIL-$(HAVE_THREADS) += fate-cpu_init
 fate-cpu_init: libavutil/tests/cpu_init$(EXESUF)
 fate-cpu_init: CMD = run libavutil/tests/cpu_init